@@ -0,0 +1,227 @@
+#include "Corpus.h"
+#include <format>
+#include <random>
+
+namespace rheo::bench {
+
+namespace {
+
+constexpr llvm::StringRef NameParts[] = {
+    "value", "tmp", "accumulator", "index", "result", "lhs", "rhs",
+    "count", "buffer", "offset"};
+
+// Terms for expressions inside functions generated with params (a, b, c).
+std::string operand(std::mt19937 &Rng) {
+  static constexpr llvm::StringRef Params[] = {"a", "b", "c"};
+  if (Rng() % 3 == 0)
+    return std::to_string(Rng() % 1000);
+  return Params[Rng() % std::size(Params)].str();
+}
+
+} // namespace
+
+std::string generateCorpus(std::size_t TargetBytes) {
+  std::mt19937 Rng(0x5eed);
+  std::string Out;
+  Out.reserve(TargetBytes + 256);
+  auto Ident = [&] {
+    std::string Name(NameParts[Rng() % std::size(NameParts)]);
+    Name += '_';
+    Name += NameParts[Rng() % std::size(NameParts)];
+    return Name;
+  };
+  unsigned Fn = 0;
+  while (Out.size() < TargetBytes) {
+    Out += std::format("def generated_fn_{}(a, b, c) -> Int\n", Fn++);
+    for (unsigned Line = 0; Line < 24; ++Line) {
+      Out.append(4 + (Rng() % 4) * 4, ' ');
+      Out += std::format("{} := {} + {} * {}\n", Ident(), Ident(),
+                         Rng() % 1000000, Ident());
+    }
+    Out += "    return a\nend\n\n";
+  }
+  return Out;
+}
+
+std::string generateRealistic(std::size_t TargetBytes) {
+  std::mt19937 Rng(0x7ea1);
+  std::string Out;
+  Out.reserve(TargetBytes + 1024);
+  for (unsigned Fn = 0; Out.size() < TargetBytes; ++Fn) {
+    Out += std::format("def fn_{}(a: Int, b: Int, c: Int) -> Int\n", Fn);
+    Out += "    mut acc := a\n";
+    unsigned Locals = 0;
+    auto Local = [&] {
+      return Locals == 0 ? std::string("b")
+                         : std::format("t_{}", Rng() % Locals);
+    };
+    for (unsigned Line = 0, E = 4 + static_cast<unsigned>(Rng() % 12);
+         Line < E; ++Line) {
+      switch (Rng() % 4) {
+      case 0:
+        Out += std::format("    t_{} := {} * {} + {}\n", Locals++,
+                           operand(Rng), Rng() % 100, operand(Rng));
+        break;
+      case 1:
+        Out += std::format("    if acc > {}\n"
+                           "        acc = acc - {}\n"
+                           "    else\n"
+                           "        acc = acc + {}\n"
+                           "    end\n",
+                           Rng() % 1000, Local(), operand(Rng));
+        break;
+      case 2:
+        Out += std::format("    while acc < {}\n"
+                           "        acc = acc + {} % 7 + 1\n"
+                           "    end\n",
+                           Rng() % 1000, Local());
+        break;
+      case 3:
+        if (Fn == 0)
+          break;
+        Out += std::format("    t_{} := fn_{}(acc, {}, {})\n", Locals++,
+                           Rng() % Fn, Local(), Rng() % 100);
+        break;
+      }
+    }
+    Out += "    return acc\nend\n\n";
+  }
+  return Out;
+}
+
+std::string generateManyDefs(std::size_t TargetBytes) {
+  std::string Out;
+  Out.reserve(TargetBytes + 128);
+  for (unsigned Fn = 0; Out.size() < TargetBytes; ++Fn) {
+    Out += std::format("def f_{}(x) x + {} end\n", Fn, Fn);
+    Out += std::format("def g_{}(x, y)\n    return f_{}(x) * y\nend\n", Fn,
+                       Fn);
+  }
+  return Out;
+}
+
+std::string generateDeepNesting(std::size_t TargetBytes) {
+  constexpr unsigned MaxDepth = 200;
+  std::mt19937 Rng(0xdee9);
+  std::string Out;
+  Out.reserve(TargetBytes + MaxDepth * MaxDepth * 4);
+  for (unsigned Fn = 0; Out.size() < TargetBytes; ++Fn) {
+    unsigned Depth = 1 + Fn % MaxDepth;
+    Out += std::format("def nest_{}(a)\n    mut v := a\n", Fn);
+    for (unsigned Level = 1; Level <= Depth; ++Level) {
+      Out.append(Level * 2 + 2, ' ');
+      Out += Rng() % 2 ? "if v > " : "while v < ";
+      Out += std::to_string(Rng() % 1000);
+      Out += '\n';
+    }
+    Out.append(Depth * 2 + 4, ' ');
+    Out += "v = v + 1\n";
+    for (unsigned Level = Depth; Level >= 1; --Level) {
+      Out.append(Level * 2 + 2, ' ');
+      Out += "end\n";
+    }
+    Out += "    v\nend\n\n";
+  }
+  return Out;
+}
+
+std::string generateLongChains(std::size_t TargetBytes) {
+  static constexpr llvm::StringRef Arith[] = {"+", "-", "*", "/", "%"};
+  static constexpr llvm::StringRef Compare[] = {"<", "<=", ">", ">=", "==",
+                                                "!="};
+  std::mt19937 Rng(0xc4a1);
+  std::string Out;
+  Out.reserve(TargetBytes + 16384);
+  for (unsigned Fn = 0; Out.size() < TargetBytes; ++Fn) {
+    Out += std::format("def chain_{}(a, b, c)\n    return ", Fn);
+    // Comparisons joined by and/or, each side an arithmetic run, so every
+    // precedence level of the binary parser gets exercised.
+    for (unsigned Term = 0, E = 256 + static_cast<unsigned>(Rng() % 768);
+         Term < E; ++Term) {
+      if (Term != 0) {
+        unsigned Pick = Rng() % 16;
+        if (Pick == 0)
+          Out += Rng() % 2 ? " and " : " or ";
+        else if (Pick == 1)
+          Out += std::format(" {} ", Compare[Rng() % std::size(Compare)]);
+        else
+          Out += std::format(" {} ", Arith[Rng() % std::size(Arith)]);
+      }
+      if (Rng() % 8 == 0)
+        Out += std::format("({} + {})", operand(Rng), operand(Rng));
+      else
+        Out += operand(Rng);
+    }
+    Out += "\nend\n\n";
+  }
+  return Out;
+}
+
+std::string generateIdentHeavy(std::size_t TargetBytes) {
+  std::mt19937 Rng(0x1de7);
+  std::string Out;
+  Out.reserve(TargetBytes + 1024);
+  std::vector<std::string> Names;
+  for (unsigned Fn = 0; Out.size() < TargetBytes; ++Fn) {
+    Names.assign({"first_argument_value", "second_argument_value"});
+    Out += std::format("def identifier_heavy_function_number_{}("
+                       "first_argument_value, second_argument_value)\n",
+                       Fn);
+    for (unsigned Line = 0; Line < 48; ++Line) {
+      auto Name = std::format("{}_{}_{}_{}", NameParts[Rng() % 10],
+                              NameParts[Rng() % 10], Fn, Line);
+      Out += std::format("    {} := {} + {} * {}\n", Name,
+                         Names[Rng() % Names.size()],
+                         Names[Rng() % Names.size()],
+                         Names[Rng() % Names.size()]);
+      Names.push_back(std::move(Name));
+    }
+    Out += std::format("    return {}\nend\n\n", Names.back());
+  }
+  return Out;
+}
+
+std::string generateLetChains(std::size_t TargetBytes) {
+  std::mt19937 Rng(0x1e7c);
+  std::string Out;
+  Out.reserve(TargetBytes + 16384);
+  for (unsigned Fn = 0; Out.size() < TargetBytes; ++Fn) {
+    Out += std::format("def let_{}(a, b)\n    v_0 := a\n", Fn);
+    unsigned Length = 64 + static_cast<unsigned>(Rng() % 192);
+    for (unsigned I = 1; I < Length; ++I) {
+      if (Fn != 0 && Rng() % 32 == 0)
+        Out += std::format("    v_{} := let_{}(v_{}, b)\n", I, Fn - 1, I - 1);
+      else
+        Out += std::format("    v_{} := v_{} * {} + b\n", I, I - 1,
+                           Rng() % 100);
+    }
+    Out += std::format("    v_{}\nend\n\n", Length - 1);
+  }
+  return Out;
+}
+
+std::string generateWideCalls(std::size_t TargetBytes) {
+  std::mt19937 Rng(0x111de);
+  std::string Out = "def wide_0(x, y) x end\n";
+  Out.reserve(TargetBytes + 1024);
+  for (unsigned Fn = 1; Out.size() < TargetBytes; ++Fn) {
+    Out += std::format("def wide_{}(x, y)\n    r := x", Fn);
+    for (unsigned Call = 0; Call < 12; ++Call)
+      Out += std::format(" + wide_{}({}, {})", Rng() % Fn,
+                         Rng() % 2 ? "x" : "y", Rng() % 2 ? "x" : "y");
+    Out += "\n    r\nend\n";
+  }
+  return Out;
+}
+
+std::vector<Corpus> generateAll(std::size_t TargetBytes) {
+  std::vector<Corpus> All;
+  All.push_back({"realistic", generateRealistic(TargetBytes)});
+  All.push_back({"many-defs", generateManyDefs(TargetBytes)});
+  All.push_back({"deep-nesting", generateDeepNesting(TargetBytes)});
+  All.push_back({"long-chains", generateLongChains(TargetBytes)});
+  All.push_back({"ident-heavy", generateIdentHeavy(TargetBytes)});
+  return All;
+}
+
+} // namespace rheo::bench
@@ -0,0 +1,55 @@
+#ifndef RHEO_BENCH_CORPUS_H
+#define RHEO_BENCH_CORPUS_H
+
+#include <cstddef>
+#include <llvm/ADT/StringRef.h>
+#include <string>
+#include <vector>
+
+namespace rheo::bench {
+
+// Generators for benchmark input. Every generator is deterministic (fixed
+// seed) and stops at the first top-level definition that reaches
+// TargetBytes. All but generateCorpus emit programs that parse and resolve
+// without diagnostics, so the phase numbers measure the happy path rather
+// than error recovery.
+
+// Generated-code shaped input: long identifiers, wide indentation, numeric
+// literals and operator soup. Lexes cleanly but does not resolve.
+std::string generateCorpus(std::size_t TargetBytes);
+
+// Hand-written looking functions: typed params, locals, if/else, while loops
+// and calls to earlier functions.
+std::string generateRealistic(std::size_t TargetBytes);
+
+// Thousands of tiny definitions, half of them inline one-liners.
+std::string generateManyDefs(std::size_t TargetBytes);
+
+// Functions whose bodies nest if/while up to a few hundred levels deep.
+std::string generateDeepNesting(std::size_t TargetBytes);
+
+// Return statements made of binary operator chains hundreds of terms long.
+std::string generateLongChains(std::size_t TargetBytes);
+
+// Long, mostly distinct identifiers declared and referenced in bulk.
+std::string generateIdentHeavy(std::size_t TargetBytes);
+
+// Defs with unannotated parameters whose locals each build on the one
+// before, hundreds deep, and which call the def before them.
+std::string generateLetChains(std::size_t TargetBytes);
+
+// Small polymorphic defs, each calling a dozen earlier ones at random.
+std::string generateWideCalls(std::size_t TargetBytes);
+
+struct Corpus {
+  llvm::StringRef Name;
+  std::string Text;
+};
+
+// One corpus per generator above except generateCorpus and the two for type
+// inference.
+std::vector<Corpus> generateAll(std::size_t TargetBytes);
+
+} // namespace rheo::bench
+
+#endif // RHEO_BENCH_CORPUS_H
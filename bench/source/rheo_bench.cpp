@@ -0,0 +1,1057 @@
+#include "Corpus.h"
+#include "rheo/AST/AST.h"
+#include "rheo/AST/FlatAST.h"
+#include "rheo/AST/ModuleFile.h"
+#include "rheo/AST/Print.h"
+#include "rheo/AST/RecursiveASTVisitor.h"
+#include "rheo/Common.h"
+#include "rheo/Diagnostics/DiagnosticEngine.h"
+#include "rheo/Diagnostics/SourceManager.h"
+#include "rheo/Frontend/CharScan.h"
+#include "rheo/Frontend/Lexer.h"
+#include "rheo/Frontend/Parser.h"
+#include "rheo/Frontend/Token.h"
+#include "rheo/Frontend/TokenBuffer.h"
+#include "rheo/Sema/NameResolver.h"
+#include "rheo/Sema/QueryEngine.h"
+#include "rheo/Sema/TypeChecker.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace cl = llvm::cl;
+
+static cl::opt<std::string>
+    JSONPath("json", cl::desc("Also write results as JSON to <file>"),
+             cl::value_desc("file"));
+
+static cl::opt<std::string>
+    Filter("filter",
+           cl::desc("Only run benchmark groups whose name contains <text>"),
+           cl::value_desc("text"));
+
+static cl::opt<unsigned>
+    CorpusMiB("corpus-mib",
+              cl::desc("Size of each generated phase corpus in MiB"),
+              cl::init(4));
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using rheo::bench::generateCorpus;
+
+// Runs Body until at least MinTime has elapsed (and at least three times) and
+// returns the fastest run in seconds. Setup runs before every Body and is not
+// timed.
+template <typename SetupFn, typename Fn>
+double bestOf(SetupFn &&Setup, Fn &&Body) {
+  constexpr auto MinTime = std::chrono::milliseconds(500);
+  double Best = 1e300;
+  auto Deadline = Clock::now() + MinTime;
+  for (int Run = 0; Run < 3 || Clock::now() < Deadline; ++Run) {
+    Setup();
+    auto Start = Clock::now();
+    Body();
+    std::chrono::duration<double> Elapsed = Clock::now() - Start;
+    Best = std::min(Best, Elapsed.count());
+  }
+  return Best;
+}
+
+template <typename Fn> double bestOf(Fn &&Body) {
+  return bestOf([] {}, std::forward<Fn>(Body));
+}
+
+// One measurement. Bytes and Items (tokens, nodes, ...) are per run and may
+// be zero when the rate would mean nothing, e.g. for a single relex.
+struct Result {
+  std::string Group;
+  std::string Name;
+  std::string Corpus;
+  double Seconds;
+  std::uint64_t Bytes;
+  std::uint64_t Items;
+  llvm::StringRef ItemUnit;
+};
+
+// Collects results for the JSON report; each group still prints its own
+// human-readable table as it goes.
+class Report {
+  std::vector<Result> Results;
+
+public:
+  llvm::raw_ostream &OS;
+
+  explicit Report(llvm::raw_ostream &OS) : OS(OS) {}
+
+  void record(Result R) { Results.push_back(std::move(R)); }
+
+  // Schema version 1: {"schema": 1, "isa": ..., "results": [...]} with one
+  // object per Result plus the derived rates.
+  void writeJSON(llvm::raw_ostream &Out) const {
+    llvm::json::OStream J(Out, /*IndentSize=*/2);
+    J.object([&] {
+      J.attribute("schema", 1);
+      J.attribute("isa", rheo::scan::isaName(rheo::scan::activeISA()));
+      J.attributeArray("results", [&] {
+        for (const auto &R : Results)
+          J.object([&] {
+            J.attribute("group", R.Group);
+            J.attribute("name", R.Name);
+            J.attribute("corpus", R.Corpus);
+            J.attribute("seconds", R.Seconds);
+            J.attribute("bytes", static_cast<int64_t>(R.Bytes));
+            J.attribute("items", static_cast<int64_t>(R.Items));
+            J.attribute("item_unit", R.ItemUnit);
+            J.attribute("bytes_per_second",
+                        static_cast<double>(R.Bytes) / R.Seconds);
+            J.attribute("items_per_second",
+                        static_cast<double>(R.Items) / R.Seconds);
+          });
+      });
+    });
+    Out << "\n";
+  }
+};
+
+double megabytesPerSecond(std::size_t Bytes, double Seconds) {
+  return static_cast<double>(Bytes) / Seconds / 1e6;
+}
+
+std::size_t lexAll(llvm::StringRef Src) {
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0, Src, Diags);
+  std::size_t Count = 0;
+  while (Lex.nextToken().Kind != rheo::TokenKind::Eof)
+    ++Count;
+  return Count;
+}
+
+void benchLexer(Report &R) {
+  using rheo::scan::ISA;
+  auto Src = generateCorpus(std::size_t(8) << 20);
+  double Megabytes = static_cast<double>(Src.size()) / (1024.0 * 1024.0);
+  auto Default = rheo::scan::activeISA();
+  auto Tokens = lexAll(Src);
+
+  R.OS << std::format("lexer: {:.1f} MiB corpus, {} tokens\n", Megabytes,
+                      Tokens);
+  for (auto Target : {ISA::Scalar, ISA::SSE42, ISA::AVX2}) {
+    if (!rheo::scan::forceISA(Target))
+      continue;
+    double Seconds = bestOf([&] { lexAll(Src); });
+    auto Name = rheo::scan::isaName(Target).str();
+    R.OS << std::format("  {:<8} {:>9.1f} MB/s\n", Name,
+                        megabytesPerSecond(Src.size(), Seconds));
+    R.record({"lexer", Name, "generated", Seconds, Src.size(), Tokens,
+              "tokens"});
+  }
+  rheo::scan::forceISA(Default);
+}
+
+// Identifier-heavy input: keywords, near-miss spellings and plain names.
+void benchKeywords(Report &R) {
+  std::mt19937 Rng(0x6b77);
+  std::vector<std::string> Words;
+  for (const auto &K : rheo::Keywords) {
+    Words.emplace_back(K.Spelling);
+    Words.push_back(std::string(K.Spelling) + "_");
+    Words.push_back(std::string(K.Spelling.substr(1)));
+  }
+  for (llvm::StringRef Name : {"x", "value", "accumulator", "Integer",
+                               "elif", "Float", "done", "defined"})
+    Words.push_back(Name.str());
+
+  std::vector<std::string> Stream;
+  std::string Src;
+  while (Src.size() < (std::size_t(4) << 20)) {
+    const auto &Word = Words[Rng() % Words.size()];
+    Stream.push_back(Word);
+    Src += Word;
+    Src += Rng() % 8 == 0 ? '\n' : ' ';
+  }
+
+  std::size_t Keywords = 0;
+  double Classify = bestOf([&] {
+    Keywords = 0;
+    for (const auto &Word : Stream)
+      Keywords += rheo::classifyIdent(Word) != rheo::TokenKind::Identifier;
+  });
+  double Lex = bestOf([&] { lexAll(Src); });
+  auto Idents = static_cast<double>(Stream.size());
+  R.OS << std::format("keywords: {} identifiers, {} keywords\n", Stream.size(),
+                      Keywords);
+  R.OS << std::format("  classifyIdent {:>9.2f} ns/ident\n",
+                      Classify / Idents * 1e9);
+  R.OS << std::format("  lexer         {:>9.1f} MB/s\n",
+                      megabytesPerSecond(Src.size(), Lex));
+  R.record({"keywords", "classifyIdent", "keywords", Classify, 0,
+            Stream.size(), "identifiers"});
+  R.record({"keywords", "lexer", "keywords", Lex, Src.size(), Stream.size(),
+            "identifiers"});
+}
+
+void benchLineTable(Report &R) {
+  using rheo::scan::ISA;
+  auto Src = generateCorpus(std::size_t(8) << 20);
+  auto Default = rheo::scan::activeISA();
+
+  R.OS << "line table:\n";
+  for (auto Target : {ISA::Scalar, ISA::SSE42, ISA::AVX2}) {
+    if (!rheo::scan::forceISA(Target))
+      continue;
+    std::uint32_t Lines = 0;
+    double Seconds = bestOf([&] {
+      rheo::SourceManager SM;
+      auto File = SM.addBuffer(llvm::MemoryBuffer::getMemBuffer(
+          Src, "corpus.rheo", /*RequiresNullTerminator=*/false));
+      const auto *F = SM.getFile(File);
+      Lines = F->getLineCol(F->size()).Line;
+    });
+    auto Name = rheo::scan::isaName(Target).str();
+    R.OS << std::format("  {:<8} {:>9.1f} MB/s {:>9} lines\n", Name,
+                        megabytesPerSecond(Src.size(), Seconds), Lines);
+    R.record({"line-table", Name, "generated", Seconds, Src.size(), Lines,
+              "lines"});
+  }
+  rheo::scan::forceISA(Default);
+}
+
+void benchParallelLexer(Report &R) {
+  rheo::SourceManager SM;
+  auto File = SM.addFile("corpus.rheo", generateCorpus(std::size_t(32) << 20));
+  auto Src = SM.getFile(File)->getSource();
+
+  double Serial = bestOf([&] {
+    rheo::DiagnosticEngine Diags;
+    rheo::IdentifierTable Idents;
+    rheo::Lexer Lex(*SM.getFile(File), Diags);
+    rheo::TokenBuffer::lex(Lex, Idents);
+  });
+  R.OS << std::format("parallel lexer: {:.1f} MiB corpus\n",
+                      static_cast<double>(Src.size()) / (1024.0 * 1024.0));
+  R.OS << std::format("  {:<8} {:>9.1f} MB/s\n", "serial",
+                      megabytesPerSecond(Src.size(), Serial));
+  R.record({"parallel-lexer", "serial", "generated", Serial, Src.size(), 0,
+            ""});
+  unsigned MaxThreads =
+      std::max(llvm::hardware_concurrency().compute_thread_count(), 2u);
+  for (unsigned Threads = 2; Threads <= MaxThreads; Threads *= 2) {
+    llvm::DefaultThreadPool Pool(llvm::hardware_concurrency(Threads));
+    double Seconds = bestOf([&] {
+      rheo::DiagnosticEngine Diags;
+      rheo::IdentifierTable Idents;
+      rheo::TokenBuffer::lexParallel(SM, File, Idents, Diags, Pool);
+    });
+    auto Name = std::to_string(Threads) + "T";
+    R.OS << std::format("  {:<8} {:>9.1f} MB/s\n", Name,
+                        megabytesPerSecond(Src.size(), Seconds));
+    R.record({"parallel-lexer", Name, "generated", Seconds, Src.size(), 0,
+              ""});
+  }
+}
+
+// One keystroke in the middle of a large file: relex vs lexing from scratch.
+void benchRelex(Report &R) {
+  rheo::SourceManager SM;
+  auto File = SM.addFile("corpus.rheo", generateCorpus(std::size_t(8) << 20));
+  auto Src = SM.getFile(File)->getSource();
+  rheo::DiagnosticEngine Diags;
+  rheo::IdentifierTable Idents;
+  rheo::Lexer Lex(*SM.getFile(File), Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Idents);
+
+  auto Offset = static_cast<rheo::BytePos>(Src.find(":=", Src.size() / 2));
+  rheo::TextEdit Type{.Offset = Offset, .RemovedLen = 0, .Inserted = "x"};
+  rheo::TextEdit Undo{.Offset = Offset, .RemovedLen = 1, .Inserted = ""};
+  bool Typed = false;
+  double Relex = bestOf([&] {
+    const auto &Edit = Typed ? Undo : Type;
+    Typed = !Typed;
+    Tokens.relex(Edit, SM.applyEdit(File, Edit), Idents, Diags);
+  });
+  double Full = bestOf([&] {
+    rheo::Lexer Fresh(*SM.getFile(File), Diags);
+    rheo::TokenBuffer::lex(Fresh, Idents);
+  });
+  R.OS << std::format("relex: {} tokens, one-byte edit\n", Tokens.size());
+  R.OS << std::format("  relex    {:>9.1f} us\n", Relex * 1e6);
+  R.OS << std::format("  full     {:>9.1f} us\n", Full * 1e6);
+  R.record({"relex", "relex", "generated", Relex, 0, 0, ""});
+  R.record({"relex", "full", "generated", Full, Src.size(), Tokens.size(),
+            "tokens"});
+}
+
+struct TreeCounts {
+  std::uint64_t Nodes = 0;
+  std::uint64_t Links = 0;
+};
+
+// Counts every Stmt, Expr, Type, Param and function body, so that nodes/s
+// stays comparable between phases that visit the same tree, and the resolved
+// VarRef and CallExpr links among them.
+class NodeCounter : public rheo::RecursiveASTVisitor<NodeCounter> {
+  std::uint64_t Count = 0;
+  std::uint64_t Links = 0;
+
+public:
+  bool visitStmt(rheo::Stmt &) {
+    ++Count;
+    return true;
+  }
+  bool visitExpr(rheo::Expr &E) {
+    Count += 1 + (E.Ty != nullptr);
+    if (auto *Call = std::get_if<rheo::CallExpr>(&E.Kind))
+      Links += Call->Resolved != nullptr;
+    else if (auto *Ref = std::get_if<rheo::VarRef>(&E.Kind))
+      Links += Ref->Resolved != nullptr;
+    return true;
+  }
+  bool visitParam(rheo::Param &) {
+    ++Count;
+    return true;
+  }
+  bool visitTypeLoc(rheo::TypeLoc &) {
+    ++Count;
+    return true;
+  }
+  bool visitFunction(rheo::FunctionDecl &F) {
+    Count += F.getBody() != nullptr;
+    return true;
+  }
+
+  [[nodiscard]] TreeCounts counts() const { return {Count, Links}; }
+
+  static TreeCounts count(const rheo::Module &M) {
+    NodeCounter Counter;
+    Counter.traverseModule(M);
+    return Counter.counts();
+  }
+};
+
+// A fresh context whose identifier table hands out the same atoms as Idents,
+// so that it can parse a buffer lexed against Idents.
+std::unique_ptr<rheo::ASTContext>
+contextFor(const rheo::IdentifierTable &Idents) {
+  auto Ctx = std::make_unique<rheo::ASTContext>();
+  for (rheo::Atom Id = 1; Id < Idents.size(); ++Id)
+    Ctx->intern(Idents.spelling(Id));
+  return Ctx;
+}
+
+// Times each front-end phase on its own over one corpus: lexing into a
+// TokenBuffer, Parser::parseModule over that buffer, NameResolver::analyze
+// over the parsed module and ASTPrinter into a null stream.
+void benchPhases(Report &R, const rheo::bench::Corpus &C) {
+  rheo::SourceManager SM;
+  auto File = SM.addFile(std::format("{}.rheo", C.Name.str()), C.Text);
+  const auto &Source = *SM.getFile(File);
+  auto Bytes = Source.size();
+
+  rheo::DiagnosticEngine Diags;
+  rheo::IdentifierTable Idents;
+  rheo::Lexer Lex(Source, Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Idents);
+  auto Ctx = contextFor(Idents);
+  rheo::Parser P(*Ctx, Tokens, Diags);
+  auto M = P.parseModule(C.Name);
+  rheo::NameResolver(Diags, *Ctx).analyze(M);
+  auto Nodes = NodeCounter::count(M).Nodes;
+
+  R.OS << std::format("phases/{}: {:.1f} MiB, {} tokens, {} nodes\n",
+                      C.Name.str(),
+                      static_cast<double>(Bytes) / (1024.0 * 1024.0),
+                      Tokens.size(), Nodes);
+  if (Diags.hasError())
+    R.OS << std::format("  warning: {} diagnostics, generator is off\n",
+                        Diags.diagnostics().size());
+
+  auto Row = [&](llvm::StringRef Phase, double Seconds, std::uint64_t Items,
+                 llvm::StringRef Unit) {
+    R.OS << std::format("  {:<8} {:>9.1f} MB/s {:>9.2f} M{}/s\n", Phase.str(),
+                        megabytesPerSecond(Bytes, Seconds),
+                        static_cast<double>(Items) / Seconds / 1e6,
+                        Unit.str());
+    R.record({"phases", Phase.str(), C.Name.str(), Seconds, Bytes, Items,
+              Unit});
+  };
+
+  Row("lex", bestOf([&] {
+        rheo::DiagnosticEngine Scratch;
+        rheo::IdentifierTable Table;
+        rheo::Lexer Fresh(Source, Scratch);
+        rheo::TokenBuffer::lex(Fresh, Table);
+      }),
+      Tokens.size(), "tokens");
+
+  std::unique_ptr<rheo::ASTContext> ParseCtx;
+  Row("parse", bestOf([&] { ParseCtx = contextFor(Idents); },
+                      [&] {
+                        rheo::DiagnosticEngine Scratch;
+                        rheo::Parser Fresh(*ParseCtx, Tokens, Scratch);
+                        Fresh.parseModule(C.Name);
+                      }),
+      Nodes, "nodes");
+  ParseCtx.reset();
+
+  Row("resolve", bestOf([&] {
+        rheo::DiagnosticEngine Scratch;
+        rheo::NameResolver(Scratch, *Ctx).analyze(M);
+      }),
+      Nodes, "nodes");
+
+  Row("print", bestOf([&] {
+        llvm::raw_null_ostream Null;
+        rheo::ASTPrinter(*Ctx, Null).print(M);
+      }),
+      Nodes, "nodes");
+}
+
+void benchAllPhases(Report &R) {
+  for (const auto &C :
+       rheo::bench::generateAll(std::size_t(CorpusMiB) << 20))
+    benchPhases(R, C);
+}
+
+// The same resolved module as Expr*/Stmt* nodes and as a FlatAST: building
+// the flat copy, printing each, and a whole-tree walk that counts resolved
+// links, recursive over pointers and a front-to-back scan over the arrays.
+void benchFlatAST(Report &R, const rheo::bench::Corpus &C) {
+  rheo::DiagnosticEngine Diags;
+  rheo::ASTContext Ctx;
+  rheo::Lexer Lex(0, C.Text, Diags);
+  rheo::Parser P(Ctx, Lex, Diags);
+  auto M = P.parseModule(C.Name);
+  rheo::NameResolver(Diags, Ctx).analyze(M);
+  auto Counts = NodeCounter::count(M);
+  auto Flat = rheo::FlatAST::build(M);
+
+  R.OS << std::format("flat-ast/{}: {} nodes, pointer AST {} KiB, flat {} "
+                      "KiB\n",
+                      C.Name.str(), Counts.Nodes,
+                      Ctx.getBytesAllocated() >> 10, Flat.bytes() >> 10);
+  auto Row = [&](llvm::StringRef Name, double Seconds) {
+    R.OS << std::format("  {:<14} {:>9.2f} Mnodes/s\n", Name.str(),
+                        static_cast<double>(Counts.Nodes) / Seconds / 1e6);
+    R.record({"flat-ast", Name.str(), C.Name.str(), Seconds, C.Text.size(),
+              Counts.Nodes, "nodes"});
+  };
+
+  Row("build", bestOf([&] { rheo::FlatAST::build(M); }));
+  Row("print/pointer", bestOf([&] {
+        llvm::raw_null_ostream Null;
+        rheo::ASTPrinter(Ctx, Null).print(M);
+      }));
+  Row("print/flat", bestOf([&] {
+        llvm::raw_null_ostream Null;
+        rheo::printFlatAST(Flat, Ctx.identifiers(), Null);
+      }));
+
+  std::uint64_t Links = 0;
+  Row("walk/pointer", bestOf([&] { Links = NodeCounter::count(M).Links; }));
+  Row("walk/flat", bestOf([&] {
+        Links = 0;
+        auto Kinds = Flat.kinds();
+        auto Data = Flat.data();
+        for (std::size_t N = 1; N < Kinds.size(); ++N)
+          if (Kinds[N] == rheo::NodeKind::VarRef)
+            Links += Data[N].B != rheo::NoNode;
+          else if (Kinds[N] == rheo::NodeKind::Call)
+            Links += Flat.extra(Data[N].B) != rheo::NoNode;
+      }));
+  if (Links != Counts.Links)
+    R.OS << std::format("  warning: flat walk found {} links, expected {}\n",
+                        Links, Counts.Links);
+}
+
+// Code-generator sized module: serial parseModule against
+// parseModuleParallel with 2, 4, ... threads.
+void benchParallelParser(Report &R) {
+  auto Src = rheo::bench::generateRealistic(std::size_t(CorpusMiB) << 22);
+  rheo::DiagnosticEngine Diags;
+  rheo::IdentifierTable Idents;
+  rheo::Lexer Lex(0, Src, Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Idents);
+
+  std::unique_ptr<rheo::ASTContext> Ctx;
+  auto Fresh = [&] { Ctx = contextFor(Idents); };
+  std::size_t Stmts = 0;
+  double Serial = bestOf(Fresh, [&] {
+    rheo::Parser P(*Ctx, Tokens, Diags);
+    Stmts = P.parseModule("corpus").Stmts.size();
+  });
+  R.OS << std::format("parallel parser: {:.1f} MiB corpus, {} definitions\n",
+                      static_cast<double>(Src.size()) / (1024.0 * 1024.0),
+                      Stmts);
+  R.OS << std::format("  {:<8} {:>9.1f} MB/s\n", "serial",
+                      megabytesPerSecond(Src.size(), Serial));
+  R.record({"parallel-parser", "serial", "realistic", Serial, Src.size(),
+            Stmts, "definitions"});
+  unsigned MaxThreads =
+      std::max(llvm::hardware_concurrency().compute_thread_count(), 2u);
+  for (unsigned Threads = 2; Threads <= MaxThreads; Threads *= 2) {
+    llvm::DefaultThreadPool Pool(llvm::hardware_concurrency(Threads));
+    double Seconds = bestOf(Fresh, [&] {
+      rheo::Parser P(*Ctx, Tokens, Diags);
+      P.parseModuleParallel("corpus", Pool);
+    });
+    auto Name = std::to_string(Threads) + "T";
+    R.OS << std::format("  {:<8} {:>9.1f} MB/s\n", Name,
+                        megabytesPerSecond(Src.size(), Seconds));
+    R.record({"parallel-parser", Name, "realistic", Seconds, Src.size(),
+              Stmts, "definitions"});
+  }
+  Ctx.reset();
+}
+
+// NameResolver::analyze against analyzeParallel with 2, 4, ... threads, on
+// one parsed module.
+void benchParallelResolver(Report &R) {
+  auto Src = rheo::bench::generateRealistic(std::size_t(CorpusMiB) << 22);
+  rheo::DiagnosticEngine Diags;
+  rheo::IdentifierTable Idents;
+  rheo::Lexer Lex(0, Src, Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Idents);
+  auto Ctx = contextFor(Idents);
+  rheo::Parser P(*Ctx, Tokens, Diags);
+  auto M = P.parseModule("corpus");
+
+  double Serial = bestOf([&] {
+    rheo::DiagnosticEngine Scratch;
+    rheo::NameResolver(Scratch, *Ctx).analyze(M);
+  });
+  R.OS << std::format("parallel resolver: {:.1f} MiB corpus, {} definitions\n",
+                      static_cast<double>(Src.size()) / (1024.0 * 1024.0),
+                      M.Stmts.size());
+  R.OS << std::format("  {:<8} {:>9.1f} MB/s\n", "serial",
+                      megabytesPerSecond(Src.size(), Serial));
+  R.record({"parallel-resolver", "serial", "realistic", Serial, Src.size(),
+            M.Stmts.size(), "definitions"});
+  unsigned MaxThreads =
+      std::max(llvm::hardware_concurrency().compute_thread_count(), 2u);
+  for (unsigned Threads = 2; Threads <= MaxThreads; Threads *= 2) {
+    llvm::DefaultThreadPool Pool(llvm::hardware_concurrency(Threads));
+    double Seconds = bestOf([&] {
+      rheo::DiagnosticEngine Scratch;
+      rheo::NameResolver(Scratch, *Ctx).analyzeParallel(M, Pool);
+    });
+    auto Name = std::to_string(Threads) + "T";
+    R.OS << std::format("  {:<8} {:>9.1f} MB/s\n", Name,
+                        megabytesPerSecond(Src.size(), Seconds));
+    R.record({"parallel-resolver", Name, "realistic", Seconds, Src.size(),
+              M.Stmts.size(), "definitions"});
+  }
+}
+
+// TypeChecker::analyze over resolved modules of growing size: realistic code,
+// long chains of unannotated locals, and many small polymorphic defs each
+// instantiated at a dozen call sites. The checker holds one group at a time
+// (see TypeChecker); what grows with the module is the tree it walks, which
+// costs more per node once it outgrows the cache.
+void benchTypeInference(Report &R) {
+  using Generator = std::string (*)(std::size_t);
+  for (auto [Name, Generate] :
+       {std::pair<llvm::StringRef, Generator>{"realistic",
+                                              rheo::bench::generateRealistic},
+        {"let-chains", rheo::bench::generateLetChains},
+        {"wide-calls", rheo::bench::generateWideCalls}}) {
+    R.OS << std::format("type inference/{}:\n", Name.str());
+    for (unsigned Scale = 1; Scale <= 4; Scale *= 2) {
+      auto Src = Generate((std::size_t(CorpusMiB) << 18) * Scale);
+      rheo::DiagnosticEngine Diags;
+      rheo::IdentifierTable Idents;
+      rheo::Lexer Lex(0, Src, Diags);
+      auto Tokens = rheo::TokenBuffer::lex(Lex, Idents);
+      auto Ctx = contextFor(Idents);
+      rheo::Parser P(*Ctx, Tokens, Diags);
+      auto M = P.parseModule(Name);
+      rheo::NameResolver(Diags, *Ctx).analyze(M);
+      auto Nodes = NodeCounter::count(M).Nodes;
+      rheo::TypeChecker(Diags, *Ctx).analyze(M);
+      if (Diags.hasError())
+        R.OS << std::format("  warning: {} diagnostics, generator is off\n",
+                            Diags.diagnostics().size());
+
+      double Seconds = bestOf([&] {
+        rheo::DiagnosticEngine Scratch;
+        rheo::TypeChecker(Scratch, *Ctx).analyze(M);
+      });
+      auto Size = std::format("{:.2f}MiB", static_cast<double>(Src.size()) /
+                                               (1024.0 * 1024.0));
+      R.OS << std::format("  {:<8} {:>9} nodes {:>9.2f} Mnodes/s\n", Size,
+                          Nodes, static_cast<double>(Nodes) / Seconds / 1e6);
+      R.record({"type-inference", Size, Name.str(), Seconds, Src.size(), Nodes,
+                "nodes"});
+    }
+  }
+}
+
+// Loading a module for its signatures: parseModule as usual, with
+// deferFunctionBodies, and with deferred bodies then all parsed on demand.
+void benchDeferredBodies(Report &R) {
+  auto Src = rheo::bench::generateRealistic(std::size_t(CorpusMiB) << 20);
+  rheo::DiagnosticEngine Diags;
+  rheo::IdentifierTable Idents;
+  rheo::Lexer Lex(0, Src, Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Idents);
+
+  std::unique_ptr<rheo::ASTContext> Ctx;
+  auto Fresh = [&] { Ctx = contextFor(Idents); };
+  auto Parse = [&](bool Defer) {
+    rheo::Parser P(*Ctx, Tokens, Diags);
+    if (Defer)
+      P.deferFunctionBodies();
+    return P.parseModule("corpus");
+  };
+  std::size_t Stmts = 0;
+  double Eager =
+      bestOf(Fresh, [&] { Stmts = Parse(/*Defer=*/false).Stmts.size(); });
+  double Signatures = bestOf(Fresh, [&] { Parse(/*Defer=*/true); });
+  double Forced = bestOf(Fresh, [&] {
+    for (auto *S : Parse(/*Defer=*/true).Stmts)
+      if (auto **F = std::get_if<rheo::FunctionDecl *>(&S->Kind))
+        (*F)->getBody();
+  });
+
+  R.OS << std::format("deferred bodies: {:.1f} MiB corpus, {} definitions\n",
+                      static_cast<double>(Src.size()) / (1024.0 * 1024.0),
+                      Stmts);
+  for (auto [Name, Seconds] : {std::pair{"eager", Eager},
+                               std::pair{"signatures", Signatures},
+                               std::pair{"on-demand", Forced}}) {
+    R.OS << std::format("  {:<10} {:>9.1f} MB/s\n", Name,
+                        megabytesPerSecond(Src.size(), Seconds));
+    R.record({"deferred-bodies", Name, "realistic", Seconds, Src.size(),
+              Stmts, "definitions"});
+  }
+  Ctx.reset();
+}
+
+// Parse and resolve the whole module in one context, against streaming:
+// signatures in one context and each def body in a reused arena. Reports
+// time and the memory each way holds at its peak.
+void benchStreaming(Report &R, const rheo::bench::Corpus &C) {
+  rheo::DiagnosticEngine Diags;
+  rheo::IdentifierTable Idents;
+  rheo::Lexer Lex(0, C.Text, Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Idents);
+
+  std::unique_ptr<rheo::ASTContext> Ctx;
+  auto Fresh = [&] { Ctx = contextFor(Idents); };
+  std::uint64_t WholePeak = 0, StreamPeak = 0;
+  double Whole = bestOf(Fresh, [&] {
+    rheo::DiagnosticEngine Scratch;
+    rheo::Parser P(*Ctx, Tokens, Scratch);
+    auto M = P.parseModule(C.Name);
+    rheo::NameResolver(Scratch, *Ctx).analyze(M);
+    WholePeak = Ctx->getStats().BytesReserved;
+  });
+  double Streamed = bestOf(Fresh, [&] {
+    rheo::DiagnosticEngine Scratch;
+    rheo::Parser P(*Ctx, Tokens, Scratch);
+    P.deferFunctionBodies();
+    auto M = P.parseModule(C.Name);
+    rheo::ASTContext Arena(*Ctx);
+    std::uint64_t Largest = 0;
+    rheo::NameResolver(Scratch, *Ctx)
+        .analyzeStreaming(M, Arena, [&](rheo::Stmt &) {
+          Largest = std::max(Largest, Arena.getStats().BytesReserved);
+        });
+    StreamPeak = Ctx->getStats().BytesReserved + Largest;
+  });
+  Ctx.reset();
+
+  R.OS << std::format("streaming/{}: {:.1f} MiB\n", C.Name.str(),
+                      static_cast<double>(C.Text.size()) / (1024.0 * 1024.0));
+  for (auto [Name, Seconds, Peak] :
+       {std::tuple{"whole", Whole, WholePeak},
+        std::tuple{"streamed", Streamed, StreamPeak}}) {
+    R.OS << std::format("  {:<9} {:>9.1f} MB/s {:>9} KiB peak\n", Name,
+                        megabytesPerSecond(C.Text.size(), Seconds),
+                        Peak >> 10);
+    R.record({"streaming", Name, C.Name.str(), Seconds, C.Text.size(), Peak,
+              "peak bytes"});
+  }
+}
+
+void benchAllStreaming(Report &R) {
+  for (const auto &C :
+       rheo::bench::generateAll(std::size_t(CorpusMiB) << 20))
+    benchStreaming(R, C);
+}
+
+// A one-line edit in the middle of a 50k-line module, typed and undone:
+// relex plus reparseModule against a full parse of the edited buffer.
+void benchReparse(Report &R) {
+  std::string Src;
+  for (std::size_t Bytes = 1 << 20; llvm::count(Src, '\n') < 50000;
+       Bytes *= 2)
+    Src = rheo::bench::generateRealistic(Bytes);
+  rheo::SourceManager SM;
+  auto File = SM.addFile("corpus.rheo", Src);
+  rheo::DiagnosticEngine Diags;
+  rheo::ASTContext Ctx;
+  rheo::Lexer Lex(*SM.getFile(File), Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Ctx.identifiers());
+  auto M = rheo::Parser(Ctx, Tokens, Diags).parseModule("corpus");
+
+  // "acc = acc + x" -> "acc = acc + 1 + x".
+  auto Offset = static_cast<rheo::BytePos>(
+      Src.find("acc = acc + ", Src.size() / 2) + 12);
+  rheo::TextEdit Type{.Offset = Offset, .RemovedLen = 0, .Inserted = "1 + "};
+  rheo::TextEdit Undo{.Offset = Offset, .RemovedLen = 4, .Inserted = ""};
+  bool Typed = false;
+  double Reparse = bestOf([&] {
+    const auto &Edit = Typed ? Undo : Type;
+    Typed = !Typed;
+    auto Changed = Tokens.relex(Edit, SM.applyEdit(File, Edit),
+                                Ctx.identifiers(), Diags);
+    M = rheo::Parser(Ctx, Tokens, Diags).reparseModule(M, Edit, Changed);
+  });
+  std::unique_ptr<rheo::ASTContext> FullCtx;
+  double Full = bestOf([&] { FullCtx = contextFor(Ctx.identifiers()); },
+                       [&] {
+                         rheo::Parser(*FullCtx, Tokens, Diags)
+                             .parseModule("corpus");
+                       });
+  FullCtx.reset();
+  if (Diags.hasError())
+    R.OS << "  warning: edited module has errors\n";
+
+  auto Lines = llvm::count(Src, '\n');
+  R.OS << std::format("reparse: {} lines, {} statements, one-line edit\n",
+                      Lines, M.Stmts.size());
+  R.OS << std::format("  reparse  {:>9.1f} us\n", Reparse * 1e6);
+  R.OS << std::format("  full     {:>9.1f} us\n", Full * 1e6);
+  R.record({"reparse", "relex+reparse", "realistic", Reparse, 0,
+            M.Stmts.size(), "statements"});
+  R.record({"reparse", "full", "realistic", Full, Src.size(),
+            M.Stmts.size(), "statements"});
+}
+
+// The QueryEngine on the reparse corpus: a cold run against parse plus
+// NameResolver::analyze, then the one-line edit of "reparse" with all
+// diagnostics asked for again, with and without types.
+void benchQueryEngine(Report &R) {
+  std::string Src;
+  for (std::size_t Bytes = 1 << 20; llvm::count(Src, '\n') < 50000;
+       Bytes *= 2)
+    Src = rheo::bench::generateRealistic(Bytes);
+  auto Offset = static_cast<rheo::BytePos>(
+      Src.find("acc = acc + ", Src.size() / 2) + 12);
+  rheo::TextEdit Type{.Offset = Offset, .RemovedLen = 0, .Inserted = "1 + "};
+  rheo::TextEdit Undo{.Offset = Offset, .RemovedLen = 4, .Inserted = ""};
+
+  std::size_t Stmts = 0;
+  double Full = bestOf([&] {
+    rheo::ASTContext Ctx;
+    rheo::DiagnosticEngine Diags;
+    rheo::Lexer Lex(0, Src, Diags);
+    rheo::Parser P(Ctx, Lex, Diags);
+    auto M = P.parseModule("corpus");
+    rheo::NameResolver(Diags, Ctx).analyze(M);
+    Stmts = M.Stmts.size();
+  });
+  std::unique_ptr<rheo::QueryEngine> Engine;
+  rheo::FileId File = 0;
+  auto Fresh = [&] {
+    Engine = std::make_unique<rheo::QueryEngine>();
+    File = Engine->addFile("corpus.rheo", Src);
+  };
+  std::size_t Reported = 0;
+  double Cold =
+      bestOf(Fresh, [&] { Reported = Engine->diagnostics(File).size(); });
+
+  bool Typed = false;
+  auto Edit = [&] {
+    Engine->applyEdit(File, Typed ? Undo : Type);
+    Typed = !Typed;
+  };
+  auto Before = Engine->runs(rheo::QueryKind::Resolve);
+  unsigned Edits = 0;
+  double Resolve = bestOf([&] {
+    Edit();
+    ++Edits;
+    if (!Engine->diagnostics(File).empty())
+      R.OS << "  warning: edited module has errors\n";
+  });
+  double Resolved =
+      double(Engine->runs(rheo::QueryKind::Resolve) - Before) / Edits;
+  Reported += Engine->typeDiagnostics(File).size();
+  Before = Engine->runs(rheo::QueryKind::Infer);
+  Edits = 0;
+  double Types = bestOf([&] {
+    Edit();
+    ++Edits;
+    Reported = Engine->diagnostics(File).size() +
+               Engine->typeDiagnostics(File).size();
+  });
+  double Inferred =
+      double(Engine->runs(rheo::QueryKind::Infer) - Before) / Edits;
+
+  R.OS << std::format("query engine: {} lines, {} statements, one-line edit\n",
+                      llvm::count(Src, '\n'), Stmts);
+  if (Reported != 0)
+    R.OS << std::format("  warning: {} diagnostics\n", Reported);
+  R.OS << std::format("  full     {:>9.1f} us\n", Full * 1e6);
+  R.OS << std::format("  cold     {:>9.1f} us\n", Cold * 1e6);
+  R.OS << std::format("  edit     {:>9.1f} us ({:.1f} defs resolved)\n",
+                      Resolve * 1e6, Resolved);
+  R.OS << std::format("  +types   {:>9.1f} us ({:.1f} groups inferred)\n",
+                      Types * 1e6, Inferred);
+  R.record({"query-engine", "full", "realistic", Full, Src.size(), Stmts,
+            "statements"});
+  R.record({"query-engine", "cold", "realistic", Cold, Src.size(), Stmts,
+            "statements"});
+  R.record({"query-engine", "edit", "realistic", Resolve, 0, Stmts,
+            "statements"});
+  R.record({"query-engine", "edit+types", "realistic", Types, 0, Stmts,
+            "statements"});
+}
+
+// Machine-generated expressions: a chain of 1M operands cycling through every
+// binary precedence level, one of 1M operands at a single level, and 1M
+// prefix operators on one literal. Chains parse about as fast as they did by
+// precedence climbing, which only recursed into tighter levels: per operand
+// the time goes to the node and the operand, not to the operator.
+void benchLongExpressions(Report &R) {
+  constexpr unsigned Terms = 1'000'000;
+  static constexpr llvm::StringRef Ops[] = {" or ", " + ", " * ", " and ",
+                                            " - ", " == ", " / ", " < "};
+  std::string Chain = "x := a";
+  for (unsigned I = 1; I < Terms; ++I) {
+    Chain += Ops[I % std::size(Ops)];
+    Chain += I % 3 ? "a" : "1";
+  }
+  Chain += '\n';
+  std::string Flat = "z := a";
+  for (unsigned I = 1; I < Terms; ++I)
+    Flat += " + a";
+  Flat += '\n';
+  std::string Prefix = "y := ";
+  for (unsigned I = 0; I < Terms; ++I)
+    Prefix += I % 2 ? "- " : "not ";
+  Prefix += "1\n";
+
+  R.OS << std::format("long expressions: {} terms\n", Terms);
+  for (auto [Name, Src] : {std::pair{"chain", llvm::StringRef(Chain)},
+                           std::pair{"flat", llvm::StringRef(Flat)},
+                           std::pair{"prefix", llvm::StringRef(Prefix)}}) {
+    rheo::DiagnosticEngine Diags;
+    rheo::IdentifierTable Idents;
+    rheo::Lexer Lex(0, Src, Diags);
+    auto Tokens = rheo::TokenBuffer::lex(Lex, Idents);
+    std::unique_ptr<rheo::ASTContext> Ctx;
+    double Seconds = bestOf([&] { Ctx = contextFor(Idents); },
+                            [&] {
+                              rheo::Parser P(*Ctx, Tokens, Diags);
+                              P.parseModule("long");
+                            });
+    if (Diags.hasError())
+      R.OS << std::format("  warning: {} diagnostics\n",
+                          Diags.diagnostics().size());
+    R.OS << std::format("  {:<8} {:>9.1f} ms {:>9.2f} Mterms/s\n", Name,
+                        Seconds * 1e3, Terms / Seconds / 1e6);
+    R.record({"long-expressions", Name, "generated", Seconds, Src.size(),
+              Terms, "terms"});
+  }
+}
+
+// Loading a dependency from source (lex, parse, resolve) against loading its
+// module file, as a flat tree and expanded back into Stmt/Expr nodes.
+void benchModuleFile(Report &R) {
+  auto Src = rheo::bench::generateRealistic(std::size_t(CorpusMiB) << 20);
+  auto FromSource = [&](rheo::ASTContext &Ctx) {
+    rheo::DiagnosticEngine Diags;
+    rheo::Lexer Lex(0, Src, Diags);
+    auto Tokens = rheo::TokenBuffer::lex(Lex, Ctx.identifiers());
+    auto M = rheo::Parser(Ctx, Tokens, Diags).parseModule("corpus");
+    rheo::NameResolver(Diags, Ctx).analyze(M);
+    return M;
+  };
+  rheo::ASTContext Ctx;
+  auto Flat = rheo::FlatAST::build(FromSource(Ctx));
+  std::string Bytes;
+  llvm::raw_string_ostream OS(Bytes);
+  rheo::writeModuleFile(Flat, Ctx.identifiers(), 0, OS);
+  OS.flush();
+
+  std::unique_ptr<rheo::ASTContext> Fresh;
+  auto NewContext = [&] { Fresh = std::make_unique<rheo::ASTContext>(); };
+  auto Load = [&] {
+    return *rheo::readModuleFile(
+        llvm::MemoryBuffer::getMemBuffer(Bytes, "corpus", false),
+        Fresh->identifiers(), 0);
+  };
+  double Source = bestOf(NewContext, [&] { FromSource(*Fresh); });
+  double Write = bestOf([&] {
+    std::string Out;
+    llvm::raw_string_ostream Scratch(Out);
+    rheo::writeModuleFile(Flat, Ctx.identifiers(), 0, Scratch);
+  });
+  double Read = bestOf(NewContext, [&] { Load(); });
+  double Expand = bestOf(NewContext, [&] { Load().toModule(*Fresh); });
+  Fresh.reset();
+
+  R.OS << std::format("module file: {:.1f} MiB source, {:.1f} MiB file, "
+                      "{} nodes\n",
+                      static_cast<double>(Src.size()) / (1024.0 * 1024.0),
+                      static_cast<double>(Bytes.size()) / (1024.0 * 1024.0),
+                      Flat.size());
+  for (auto [Name, Seconds] :
+       {std::pair{"source", Source}, std::pair{"write", Write},
+        std::pair{"read", Read}, std::pair{"read+expand", Expand}}) {
+    R.OS << std::format("  {:<12} {:>9.1f} us\n", Name, Seconds * 1e6);
+    R.record({"module-file", Name, "realistic", Seconds, Src.size(),
+              Flat.size(), "nodes"});
+  }
+}
+
+void benchAllFlatAST(Report &R) {
+  for (const auto &C :
+       rheo::bench::generateAll(std::size_t(CorpusMiB) << 20))
+    benchFlatAST(R, C);
+}
+
+// Two more lightweight analyses to fuse with NodeCounter: the deepest block
+// nesting, and the number of distinct names read.
+class NestingMeter : public rheo::RecursiveASTVisitor<NestingMeter> {
+  unsigned Depth = 0;
+
+public:
+  unsigned MaxDepth = 0;
+
+  bool visitBlock(rheo::BlockExpr &) {
+    MaxDepth = std::max(MaxDepth, ++Depth);
+    return true;
+  }
+  bool postVisitBlock(rheo::BlockExpr &) {
+    --Depth;
+    return true;
+  }
+};
+
+class NamesRead : public rheo::RecursiveASTVisitor<NamesRead> {
+public:
+  std::vector<bool> Seen;
+  std::size_t Count = 0;
+
+  bool visitExpr(rheo::Expr &E) {
+    if (auto *Ref = std::get_if<rheo::VarRef>(&E.Kind)) {
+      if (Ref->Name >= Seen.size())
+        Seen.resize(Ref->Name + 1);
+      if (!Seen[Ref->Name]) {
+        Seen[Ref->Name] = true;
+        ++Count;
+      }
+    }
+    return true;
+  }
+};
+
+// Three analyses as a walk each against one FusedVisitor walk.
+void benchFusedPasses(Report &R, const rheo::bench::Corpus &C) {
+  rheo::DiagnosticEngine Diags;
+  rheo::ASTContext Ctx;
+  rheo::Lexer Lex(0, C.Text, Diags);
+  rheo::Parser P(Ctx, Lex, Diags);
+  auto M = P.parseModule(C.Name);
+  rheo::NameResolver(Diags, Ctx).analyze(M);
+  auto Nodes = NodeCounter::count(M).Nodes;
+
+  R.OS << std::format("fused-passes/{}: {} nodes, 3 passes\n", C.Name.str(),
+                      Nodes);
+  auto Row = [&](llvm::StringRef Name, double Seconds) {
+    R.OS << std::format("  {:<9} {:>9.2f} Mnodes/s\n", Name.str(),
+                        static_cast<double>(Nodes) / Seconds / 1e6);
+    R.record({"fused-passes", Name.str(), C.Name.str(), Seconds,
+              C.Text.size(), Nodes, "nodes"});
+  };
+
+  // Summed results, to check that both ways agree.
+  std::uint64_t Separate = 0, Fused = 0;
+  Row("separate", bestOf([&] {
+        NodeCounter Counter;
+        NestingMeter Nesting;
+        NamesRead Names;
+        Counter.traverseModule(M);
+        Nesting.traverseModule(M);
+        Names.traverseModule(M);
+        Separate = Counter.counts().Nodes + Nesting.MaxDepth + Names.Count;
+      }));
+  Row("fused", bestOf([&] {
+        NodeCounter Counter;
+        NestingMeter Nesting;
+        NamesRead Names;
+        rheo::FusedVisitor(Counter, Nesting, Names).traverseModule(M);
+        Fused = Counter.counts().Nodes + Nesting.MaxDepth + Names.Count;
+      }));
+  if (Separate != Fused)
+    R.OS << "  warning: fused passes disagree with separate ones\n";
+}
+
+void benchAllFusedPasses(Report &R) {
+  for (const auto &C :
+       rheo::bench::generateAll(std::size_t(CorpusMiB) << 20))
+    benchFusedPasses(R, C);
+}
+
+} // namespace
+
+int main(int Argc, char **Argv) {
+  cl::ParseCommandLineOptions(Argc, Argv, "rheo benchmarks\n");
+
+  Report R(llvm::outs());
+  struct Group {
+    llvm::StringRef Name;
+    void (*Run)(Report &);
+  };
+  for (auto [Name, Run] : {Group{"lexer", benchLexer},
+                           Group{"keywords", benchKeywords},
+                           Group{"line-table", benchLineTable},
+                           Group{"parallel-lexer", benchParallelLexer},
+                           Group{"relex", benchRelex},
+                           Group{"phases", benchAllPhases},
+                           Group{"parallel-parser", benchParallelParser},
+                           Group{"parallel-resolver", benchParallelResolver},
+                           Group{"type-inference", benchTypeInference},
+                           Group{"deferred-bodies", benchDeferredBodies},
+                           Group{"streaming", benchAllStreaming},
+                           Group{"reparse", benchReparse},
+                           Group{"query-engine", benchQueryEngine},
+                           Group{"long-expressions", benchLongExpressions},
+                           Group{"module-file", benchModuleFile},
+                           Group{"flat-ast", benchAllFlatAST},
+                           Group{"fused-passes", benchAllFusedPasses}})
+    if (Name.contains(Filter))
+      Run(R);
+
+  if (JSONPath.empty())
+    return 0;
+  std::error_code EC;
+  llvm::raw_fd_ostream Out(JSONPath, EC, llvm::sys::fs::OF_Text);
+  if (EC) {
+    llvm::errs() << std::format("rheo_bench: cannot write {}: {}\n",
+                                JSONPath.getValue(), EC.message());
+    return 1;
+  }
+  R.writeJSON(Out);
+  return 0;
+}
@@ -1,13 +1,22 @@
 #ifndef RHEO_AST_H
 #define RHEO_AST_H
 
+#include "rheo/AST/IdentifierTable.h"
 #include "rheo/Diagnostics/SourceLocation.h"
+#include <array>
+#include <cassert>
 #include <cstdint>
 #include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/StringRef.h>
 #include <llvm/Support/Allocator.h>
 #include <llvm/Support/StringSaver.h>
+#include <llvm/Support/raw_ostream.h>
+#include <memory>
+#include <mutex>
+#include <type_traits>
 #include <variant>
+#include <vector>
 
 namespace rheo {
 
@@ -18,25 +27,9 @@ struct BlockExpr;
 struct FunctionDecl;
 struct Module;
 struct VarDecl;
-
-class ASTContext {
-  llvm::BumpPtrAllocator Alloc;
-  llvm::StringSaver Strings{Alloc};
-
-public:
-  template <typename T, typename... Args> T *create(Args &&...A) {
-    void *Mem = Alloc.Allocate(sizeof(T), alignof(T));
-    return new (Mem) T(std::forward<Args>(A)...);
-  }
-
-  llvm::StringRef save(llvm::StringRef S) { return Strings.save(S); }
-
-  template <typename T> llvm::ArrayRef<T> copyArray(llvm::ArrayRef<T> Arr) {
-    T *Mem = Alloc.Allocate<T>(Arr.size());
-    std::uninitialized_copy(Arr.begin(), Arr.end(), Mem);
-    return llvm::ArrayRef<T>(Mem, Arr.size());
-  }
-};
+struct Param;
+struct LazyBody;
+class DiagnosticEngine;
 
 enum class BuiltinKind : std::uint8_t {
   Int,
@@ -61,7 +54,7 @@ struct BuiltinType {
 };
 
 struct NamedType {
-  llvm::StringRef Name;
+  Atom Name;
 };
 
 // Filled by HM inference for type variables during unification
@@ -71,10 +64,217 @@ struct TypeVar {
 
 using TypeKind = std::variant<BuiltinType, NamedType, TypeVar>;
 
+// Types are uniqued (see TypeTable): two types are equal exactly when they
+// are the same object. Where a type was written is kept beside it, in a
+// TypeLoc.
 struct Type {
-  Span Location;
   TypeKind Kind;
-  Type(Span Location, TypeKind Kind) : Location(Location), Kind(Kind) {}
+};
+
+inline constexpr std::size_t NumBuiltinKinds =
+    static_cast<std::size_t>(BuiltinKind::Never) + 1;
+
+// The builtin types, shared by every context.
+inline constexpr auto BuiltinTypes = [] {
+  std::array<Type, NumBuiltinKinds> Types{};
+  for (std::size_t I = 0; I < NumBuiltinKinds; ++I)
+    Types[I].Kind = BuiltinType{static_cast<BuiltinKind>(I)};
+  return Types;
+}();
+
+// A type as written in the source. Null when the annotation was left out.
+struct TypeLoc {
+  const Type *Ty = nullptr;
+  Span Location{0, 0};
+
+  explicit operator bool() const { return Ty != nullptr; }
+  const Type &operator*() const { return *Ty; }
+  const Type *operator->() const { return Ty; }
+};
+
+// Hands out the non-builtin types, one object per distinct kind. Safe to use
+// from several threads, so that child contexts parsing on a pool can share
+// their parent's table.
+class TypeTable {
+  llvm::BumpPtrAllocator Alloc;
+  llvm::DenseMap<std::uint64_t, const Type *> Uniqued;
+  mutable std::mutex Lock;
+
+public:
+  const Type *get(TypeKind Kind) {
+    if (auto *B = std::get_if<BuiltinType>(&Kind))
+      return &BuiltinTypes[static_cast<std::size_t>(B->Kind)];
+    std::uint32_t Payload = std::holds_alternative<NamedType>(Kind)
+                                ? std::get<NamedType>(Kind).Name
+                                : std::get<TypeVar>(Kind).Id;
+    std::uint64_t Key = std::uint64_t(Kind.index()) << 32 | Payload;
+    std::lock_guard<std::mutex> Guard(Lock);
+    auto [It, Inserted] = Uniqued.try_emplace(Key, nullptr);
+    if (Inserted)
+      It->second = new (Alloc.Allocate<Type>()) Type{Kind};
+    return It->second;
+  }
+
+  [[nodiscard]] std::size_t size() const {
+    std::lock_guard<std::mutex> Guard(Lock);
+    return Uniqued.size();
+  }
+};
+
+// What an ASTContext allocation is counted as.
+enum class AllocKind : std::uint8_t {
+  Expr,
+  Stmt,
+  Block,
+  Function,
+  Var,
+  LazyBody,
+  StmtList,
+  ExprList,
+  ParamList,
+  String,
+  Other,
+};
+inline constexpr std::size_t NumAllocKinds =
+    static_cast<std::size_t>(AllocKind::Other) + 1;
+// Alternatives of ExprKind and StmtKind, checked where those are defined.
+inline constexpr std::size_t NumExprKinds = 13;
+inline constexpr std::size_t NumStmtKinds = 5;
+
+// Memory use of one or more ASTContexts (see ASTContext::getStats).
+struct ASTStats {
+  struct Counter {
+    std::uint64_t Count = 0;
+    std::uint64_t Bytes = 0;
+  };
+  std::array<Counter, NumAllocKinds> Allocs{};
+  std::array<std::uint64_t, NumExprKinds> ExprKinds{};
+  std::array<std::uint64_t, NumStmtKinds> StmtKinds{};
+  // Of the arenas: slabs taken from malloc, their total size, and how much
+  // of it was handed out. The rest is slab tails and alignment padding.
+  std::uint64_t Slabs = 0;
+  std::uint64_t BytesReserved = 0;
+  std::uint64_t BytesAllocated = 0;
+  // Distinct non-builtin types in the (shared) type table.
+  std::uint64_t Types = 0;
+
+  void count(AllocKind Kind, std::uint64_t Bytes) {
+    auto &C = Allocs[static_cast<std::size_t>(Kind)];
+    ++C.Count;
+    C.Bytes += Bytes;
+  }
+  ASTStats &operator+=(const ASTStats &Other);
+  void print(llvm::raw_ostream &OS) const;
+};
+
+class ASTContext {
+  llvm::BumpPtrAllocator Alloc;
+  llvm::StringSaver Strings{Alloc};
+  IdentifierTable OwnIdents;
+  IdentifierTable *Idents = &OwnIdents;
+  TypeTable OwnTypes;
+  TypeTable *Types = &OwnTypes;
+  // Child contexts whose nodes have been linked into this one's trees.
+  std::vector<std::unique_ptr<ASTContext>> Adopted;
+  ASTStats Stats;
+
+  template <typename T> static constexpr AllocKind allocKindOf() {
+    if constexpr (std::is_same_v<T, Expr>)
+      return AllocKind::Expr;
+    else if constexpr (std::is_same_v<T, Stmt>)
+      return AllocKind::Stmt;
+    else if constexpr (std::is_same_v<T, BlockExpr>)
+      return AllocKind::Block;
+    else if constexpr (std::is_same_v<T, FunctionDecl>)
+      return AllocKind::Function;
+    else if constexpr (std::is_same_v<T, VarDecl>)
+      return AllocKind::Var;
+    else if constexpr (std::is_same_v<T, LazyBody>)
+      return AllocKind::LazyBody;
+    else if constexpr (std::is_same_v<T, Stmt *>)
+      return AllocKind::StmtList;
+    else if constexpr (std::is_same_v<T, Expr *>)
+      return AllocKind::ExprList;
+    else if constexpr (std::is_same_v<T, Param>)
+      return AllocKind::ParamList;
+    else
+      return AllocKind::Other;
+  }
+
+public:
+  ASTContext() = default;
+  // A context for building nodes on another thread: it has an arena of its
+  // own but names atoms from Parent's table, which the child must only read,
+  // and shares Parent's types.
+  explicit ASTContext(ASTContext &Parent)
+      : Idents(Parent.Idents), Types(Parent.Types) {}
+  ASTContext(const ASTContext &) = delete;
+  ASTContext &operator=(const ASTContext &) = delete;
+
+  // Frees every node at once, keeping the first slab for the next ones. No
+  // tree may point into this context any more, and it must have adopted
+  // nothing.
+  void reset() {
+    assert(Adopted.empty() && "adopted contexts would outlive the reset");
+    Alloc.Reset();
+    Stats = {};
+  }
+
+  // Keeps a child's nodes alive for as long as this context.
+  void adopt(std::unique_ptr<ASTContext> Child) {
+    assert(Child->Idents == Idents && "not a child of this context");
+    Adopted.push_back(std::move(Child));
+  }
+
+  template <typename T, typename... Args> T *create(Args &&...A) {
+    void *Mem = Alloc.Allocate(sizeof(T), alignof(T));
+    T *Node = new (Mem) T(std::forward<Args>(A)...);
+    Stats.count(allocKindOf<T>(), sizeof(T));
+    if constexpr (std::is_same_v<T, Expr>)
+      ++Stats.ExprKinds[Node->Kind.index()];
+    else if constexpr (std::is_same_v<T, Stmt>)
+      ++Stats.StmtKinds[Node->Kind.index()];
+    return Node;
+  }
+
+  llvm::StringRef save(llvm::StringRef S) {
+    Stats.count(AllocKind::String, S.size() + 1);
+    return Strings.save(S);
+  }
+
+  // Allocations by this context and the ones it adopted.
+  [[nodiscard]] ASTStats getStats() const;
+
+  // Bytes handed out by the node arenas so far, adopted ones included.
+  [[nodiscard]] std::size_t getBytesAllocated() const {
+    std::size_t Bytes = Alloc.getBytesAllocated();
+    for (const auto &Child : Adopted)
+      Bytes += Child->getBytesAllocated();
+    return Bytes;
+  }
+
+  // Names in the AST are atoms of this table.
+  IdentifierTable &identifiers() { return *Idents; }
+  const IdentifierTable &identifiers() const { return *Idents; }
+  Atom intern(llvm::StringRef Name) { return Idents->intern(Name); }
+  [[nodiscard]] llvm::StringRef spelling(Atom Name) const {
+    return Idents->spelling(Name);
+  }
+
+  // The uniqued type of the given kind; equal for this context, its parent
+  // and its children.
+  const Type *getType(TypeKind Kind) { return Types->get(Kind); }
+  const Type *getBuiltinType(BuiltinKind Kind) const {
+    return &BuiltinTypes[static_cast<std::size_t>(Kind)];
+  }
+
+  template <typename T>
+  llvm::MutableArrayRef<T> copyArray(llvm::ArrayRef<T> Arr) {
+    Stats.count(allocKindOf<T>(), sizeof(T) * Arr.size());
+    T *Mem = Alloc.Allocate<T>(Arr.size());
+    std::uninitialized_copy(Arr.begin(), Arr.end(), Mem);
+    return llvm::MutableArrayRef<T>(Mem, Arr.size());
+  }
 };
 
 // ─────────────────────────────────────────────
@@ -130,9 +330,14 @@ struct CallExpr {
   FunctionDecl *Resolved = nullptr;
 };
 
+// Depth and Slot are set with Resolved: the variable lives in slot Slot of
+// the frame Depth functions out from the reference, 0 being the enclosing
+// function's own frame and the outermost the module's.
 struct VarRef {
-  llvm::StringRef Name;
+  Atom Name;
   VarDecl *Resolved = nullptr;
+  std::uint32_t Depth = 0;
+  std::uint32_t Slot = 0;
 };
 
 // BlockExpr is part of ExprKind via pointer; defined fully below.
@@ -160,10 +365,12 @@ using ExprKind =
                  BinaryExpr, CallExpr, VarRef, BlockExpr *, IfExpr, WhileExpr,
                  BreakExpr, ContinueExpr>;
 
+static_assert(std::variant_size_v<ExprKind> == NumExprKinds);
+
 struct Expr {
   Span Location;
   ExprKind Kind;
-  Type *Ty = nullptr;
+  const Type *Ty = nullptr;
   Expr(Span Location, ExprKind Kind) : Location(Location), Kind(Kind) {}
 };
 
@@ -179,13 +386,29 @@ struct ReturnStmt {
   Expr *Value; // nullable
 };
 
+// IsMut and Slot share the word after Name, which keeps VarDecl, the largest
+// StmtKind, at 32 bytes.
 struct VarDecl {
-  llvm::StringRef Name;
-  Type *Ty;   // nullable if inferred
+  Atom Name;
+  bool IsMut : 1;
+  // Index in its function's (or the module's) frame; set by NameResolver.
+  std::uint32_t Slot : 31 = 0;
+  TypeLoc Ty; // null if inferred
   Expr *Init; // nullable
-  bool IsMut;
+
+  static constexpr std::uint32_t MaxSlot = (std::uint32_t(1) << 31) - 1;
+
+  VarDecl(Atom Name, bool IsMut, TypeLoc Ty, Expr *Init)
+      : Name(Name), IsMut(IsMut), Ty(Ty), Init(Init) {}
+
+  void setSlot(std::uint32_t Index) {
+    assert(Index <= MaxSlot && "frame slot does not fit in VarDecl::Slot");
+    Slot = Index & MaxSlot;
+  }
 };
 
+static_assert(sizeof(VarDecl) == 32);
+
 struct AssignStmt {
   Expr *Target;
   Expr *Value;
@@ -196,6 +419,8 @@ struct AssignStmt {
 using StmtKind =
     std::variant<ExprStmt, ReturnStmt, VarDecl, AssignStmt, FunctionDecl *>;
 
+static_assert(std::variant_size_v<StmtKind> == NumStmtKinds);
+
 struct Stmt {
   Span Location;
   StmtKind Kind;
@@ -210,24 +435,103 @@ struct BlockExpr {
 };
 
 struct Param {
-  llvm::StringRef Name;
-  Type *Ty;
+  Atom Name;
+  TypeLoc Ty;
   Span Location;
 };
 
+struct LazyBody;
+
+// Parses function bodies that were skipped at parse time (see
+// Parser::deferFunctionBodies). Allocated in an ASTContext arena, so it is
+// never destroyed.
+class LazyBodySource {
+public:
+  virtual BlockExpr *parseBody(const LazyBody &Body) = 0;
+  // Parses into Arena, a child of the source's context, with any defs nested
+  // in the body parsed in place rather than deferred. Errors go to Diags, or
+  // to the source's engine if null. With an arena and engine of its own,
+  // each thread may parse a different body at the same time.
+  virtual BlockExpr *parseBodyInto(const LazyBody &Body, ASTContext &Arena,
+                                   DiagnosticEngine *Diags = nullptr) = 0;
+
+protected:
+  ~LazyBodySource() = default;
+};
+
+// A body not parsed yet: tokens [Begin, End) of the source's buffer, End
+// being the function's 'end'.
+struct LazyBody {
+  LazyBodySource *Source;
+  std::uint32_t Begin;
+  std::uint32_t End;
+};
+
 struct FunctionDecl {
-  llvm::StringRef Name;
-  llvm::ArrayRef<Param> Params;
-  Type *ReturnType; // nullable
-  BlockExpr *Body;
-  FunctionDecl(llvm::StringRef Name, llvm::ArrayRef<Param> Params,
-               Type *ReturnType, BlockExpr *Body)
+  Atom Name;
+  // Arena-owned, so passes can annotate parameters in place.
+  llvm::MutableArrayRef<Param> Params;
+  TypeLoc ReturnType; // null if not written
+  // Frame slots the body needs, parameters first; set by NameResolver.
+  // Slots of sibling blocks overlap.
+  std::uint32_t NumLocals = 0;
+
+  FunctionDecl(Atom Name, llvm::MutableArrayRef<Param> Params,
+               TypeLoc ReturnType, BlockExpr *Body)
       : Name(Name), Params(Params), ReturnType(ReturnType), Body(Body) {}
+  FunctionDecl(Atom Name, llvm::MutableArrayRef<Param> Params,
+               TypeLoc ReturnType, LazyBody *Deferred)
+      : Name(Name), Params(Params), ReturnType(ReturnType), Body(nullptr),
+        Deferred(Deferred) {}
+
+  // Nullable. A deferred body is parsed here on first use, which allocates
+  // in the context the source parses into and is not thread-safe.
+  BlockExpr *getBody() const {
+    if (!Body && Deferred) {
+      Body = Deferred->Source->parseBody(*Deferred);
+      Deferred = nullptr;
+    }
+    return Body;
+  }
+  [[nodiscard]] bool hasDeferredBody() const { return Deferred && !Body; }
+
+  // Parses a deferred body into Arena and lends it to this decl until
+  // releaseBody(), which defers it again so that Arena can be reset. Returns
+  // the body, null if it did not parse.
+  BlockExpr *borrowBody(ASTContext &Arena) {
+    assert(hasDeferredBody() && "no deferred body to borrow");
+    Body = Deferred->Source->parseBodyInto(*Deferred, Arena);
+    return Body;
+  }
+  void releaseBody() {
+    assert(Deferred && "body was not borrowed");
+    Body = nullptr;
+  }
+
+  // Parses a deferred body into Arena for good, reporting to Diags; see
+  // LazyBodySource::parseBodyInto. Returns the body, null if it did not
+  // parse.
+  BlockExpr *loadBody(ASTContext &Arena, DiagnosticEngine &Diags) {
+    assert(hasDeferredBody() && "no deferred body to load");
+    Body = Deferred->Source->parseBodyInto(*Deferred, Arena, &Diags);
+    Deferred = nullptr;
+    return Body;
+  }
+
+  // The token range of a body not parsed yet or borrowed, or null.
+  [[nodiscard]] const LazyBody *getDeferredBody() const { return Deferred; }
+  [[nodiscard]] LazyBody *getDeferredBody() { return Deferred; }
+
+private:
+  mutable BlockExpr *Body;
+  mutable LazyBody *Deferred = nullptr;
 };
 
 struct Module {
   llvm::StringRef Name;
   llvm::ArrayRef<Stmt *> Stmts;
+  // Frame slots of the top-level variables; set by NameResolver.
+  std::uint32_t NumGlobals = 0;
 };
 
 } // namespace rheo
@@ -0,0 +1,169 @@
+#ifndef RHEO_FLAT_AST_H
+#define RHEO_FLAT_AST_H
+
+#include "rheo/AST/AST.h"
+#include "rheo/AST/IdentifierTable.h"
+#include "rheo/Diagnostics/SourceLocation.h"
+#include <cassert>
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+#include <memory>
+
+namespace rheo {
+
+// Index of a node in a FlatAST. Node 0 is a placeholder, so NoNode can stand
+// for every absent child.
+using NodeId = std::uint32_t;
+inline constexpr NodeId NoNode = 0;
+
+// What each node's Flags byte and Data operands hold. "extra" is an index
+// into the Extra array, where lists are stored as a count followed by that
+// many node ids.
+enum class NodeKind : std::uint8_t {
+  Invalid,
+  BuiltinType,  // Flags: BuiltinKind
+  NamedType,    // A: atom
+  TypeVar,      // A: id
+  IntLiteral,   // A: low 32 bits, B: high 32 bits
+  FloatLiteral, // A: low 32 bits, B: high 32 bits of the double
+  BoolLiteral,  // Flags: value
+  UnitLiteral,  //
+  Unary,        // Flags: UnaryOp, A: operand
+  Binary,       // Flags: BinaryOp, A: lhs, B: rhs
+  Call,         // A: callee, B: extra -> resolved Function, argument list
+  VarRef,       // A: atom, B: resolved VarDecl or Param
+  Block,        // A: extra -> statement list, B: tail
+  If,           // A: condition, B: extra -> then Block, else Block
+  While,        // A: condition, B: body Block
+  Break,        // A: value
+  Continue,     //
+  ExprStmt,     // A: expression
+  Return,       // A: value
+  VarDecl,      // Flags: IsMut, A: atom, B: extra -> type, initializer, slot
+  Assign,       // A: target, B: value
+  Function,     // A: atom, B: extra -> return type, body Block, NumLocals,
+                //   param list
+  Param,        // A: atom, B: type
+};
+
+// Kinds whose A operand is an atom.
+inline bool holdsAtom(NodeKind Kind) {
+  switch (Kind) {
+  case NodeKind::NamedType:
+  case NodeKind::VarRef:
+  case NodeKind::VarDecl:
+  case NodeKind::Function:
+  case NodeKind::Param:
+    return true;
+  default:
+    return false;
+  }
+}
+
+struct NodeData {
+  std::uint32_t A = 0;
+  std::uint32_t B = 0;
+};
+
+// The same tree as a Module, stored as parallel arrays indexed by NodeId
+// instead of arena nodes linked by pointers. Nodes are laid out in pre-order,
+// so a whole-tree pass walks each array front to back, and a node costs 18
+// bytes plus its list entries, against 56 for an Expr; 22 once the tree is
+// typed. Expression types are the one exception to the order: each distinct
+// Expr::Ty gets a single type node, wherever its first use put it, which
+// every expression of that type points at.
+//
+// Everything is plain integers (names are atoms of the table the Module was
+// built with, resolved links are node ids), so the arrays can be written out
+// and read back as they are; see ModuleFile.h. A FlatAST is a set of views
+// over arrays it shares ownership of, so copies are cheap.
+class FlatAST {
+  friend class FlatASTBuilder;
+  friend class ModuleFileReader;
+
+  // Keeps the arrays alive: the builder's vectors or a module file's buffer.
+  std::shared_ptr<const void> Storage;
+  llvm::StringRef Name;
+  llvm::ArrayRef<NodeKind> Kinds;
+  llvm::ArrayRef<std::uint8_t> Flags;
+  llvm::ArrayRef<Span> Spans;
+  llvm::ArrayRef<NodeData> Data;
+  llvm::ArrayRef<std::uint32_t> Extra;
+  // The Expr::Ty annotation of every node, NoNode for the rest; empty if no
+  // expression has one.
+  llvm::ArrayRef<NodeId> Types;
+  std::uint32_t TopLevel = 0;
+  std::uint32_t NumGlobals = 0;
+
+  FlatAST() = default;
+
+public:
+  // Flattens M, which may or may not have been through name resolution.
+  static FlatAST build(const Module &M);
+
+  // Rebuilds the tree as Stmt/Expr nodes in Ctx, resolved links, frame
+  // slots and depths included, so the module can be type-checked as it is;
+  // a reference to a parameter gets a VarDecl of its own, as from the
+  // resolver. Ctx must use the table the atoms come from.
+  Module toModule(ASTContext &Ctx) const;
+
+  [[nodiscard]] llvm::StringRef getName() const { return Name; }
+  // Number of nodes, including the NoNode placeholder.
+  [[nodiscard]] std::size_t size() const { return Kinds.size(); }
+
+  [[nodiscard]] NodeKind kind(NodeId N) const { return Kinds[N]; }
+  [[nodiscard]] std::uint8_t flags(NodeId N) const { return Flags[N]; }
+  [[nodiscard]] Span span(NodeId N) const { return Spans[N]; }
+  [[nodiscard]] NodeData data(NodeId N) const { return Data[N]; }
+  [[nodiscard]] std::uint32_t extra(std::uint32_t At) const {
+    return Extra[At];
+  }
+
+  // The count-prefixed list stored at Extra[At].
+  [[nodiscard]] llvm::ArrayRef<NodeId> list(std::uint32_t At) const {
+    return Extra.slice(At + 1, Extra[At]);
+  }
+  [[nodiscard]] llvm::ArrayRef<NodeId> topLevel() const {
+    return list(TopLevel);
+  }
+
+  // The Expr::Ty annotation of expression N, or NoNode.
+  [[nodiscard]] NodeId exprType(NodeId N) const {
+    return Types.empty() ? NoNode : Types[N];
+  }
+
+  // Whether every kind, operator, builtin and variable slot is in range,
+  // every extra index and list lies inside Extra, and every child is a node
+  // of the kind its slot takes, with a higher id unless it is a type. Every
+  // node but a type is the child of exactly one node, or of the top-level
+  // list, so the tree is a tree and all of it is reached. A resolved link
+  // must reach a declaration in scope: one whose frame is the reference's or
+  // encloses it. Atoms are not checked. A tree that passes can be walked by toModule()
+  // and printFlatAST() without reading out of bounds or looping. Two passes
+  // over the arrays, plus a walk out through the enclosing defs per link.
+  [[nodiscard]] bool verify() const;
+
+  // Bytes held by the arrays, for comparison with the pointer AST.
+  [[nodiscard]] std::size_t bytes() const;
+
+  [[nodiscard]] llvm::ArrayRef<NodeKind> kinds() const { return Kinds; }
+  [[nodiscard]] llvm::ArrayRef<std::uint8_t> flags() const { return Flags; }
+  [[nodiscard]] llvm::ArrayRef<Span> spans() const { return Spans; }
+  [[nodiscard]] llvm::ArrayRef<NodeData> data() const { return Data; }
+  [[nodiscard]] llvm::ArrayRef<std::uint32_t> extra() const { return Extra; }
+  [[nodiscard]] llvm::ArrayRef<NodeId> exprTypes() const { return Types; }
+  // Where the topLevel() list starts in Extra.
+  [[nodiscard]] std::uint32_t topLevelIndex() const { return TopLevel; }
+  // Module::NumGlobals of the module it was built from.
+  [[nodiscard]] std::uint32_t numGlobals() const { return NumGlobals; }
+};
+
+// Prints Tree exactly as ASTPrinter prints the Module it was built from.
+void printFlatAST(const FlatAST &Tree, const IdentifierTable &Idents,
+                  llvm::raw_ostream &OS = llvm::outs());
+
+} // namespace rheo
+
+#endif // RHEO_FLAT_AST_H
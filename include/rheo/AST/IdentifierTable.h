@@ -0,0 +1,49 @@
+#ifndef RHEO_IDENTIFIER_TABLE_H
+#define RHEO_IDENTIFIER_TABLE_H
+
+#include <cassert>
+#include <cstdint>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <vector>
+
+namespace rheo {
+
+// An interned identifier. Two atoms from the same table are equal exactly
+// when their spellings are.
+using Atom = std::uint32_t;
+
+// Atom 0 is the empty spelling and doubles as "not an identifier".
+inline constexpr Atom NoAtom = 0;
+
+// Hands out dense atoms in first-seen order. Spellings are copied into the
+// table, so atoms outlive the source buffer they were lexed from. Not
+// thread-safe: intern from one thread and share only the atoms.
+class IdentifierTable {
+  llvm::StringMap<Atom, llvm::BumpPtrAllocator> Map;
+  std::vector<llvm::StringRef> Spellings;
+
+public:
+  IdentifierTable() { intern(""); }
+
+  Atom intern(llvm::StringRef Spelling) {
+    auto [It, Inserted] =
+        Map.try_emplace(Spelling, static_cast<Atom>(Spellings.size()));
+    if (Inserted)
+      Spellings.push_back(It->getKey());
+    return It->second;
+  }
+
+  [[nodiscard]] llvm::StringRef spelling(Atom Id) const {
+    assert(Id < Spellings.size() && "atom from another table");
+    return Spellings[Id];
+  }
+
+  // Number of atoms handed out, including NoAtom.
+  [[nodiscard]] std::size_t size() const { return Spellings.size(); }
+};
+
+} // namespace rheo
+
+#endif // RHEO_IDENTIFIER_TABLE_H
@@ -0,0 +1,58 @@
+#ifndef RHEO_MODULE_FILE_H
+#define RHEO_MODULE_FILE_H
+
+#include "rheo/AST/FlatAST.h"
+#include "rheo/AST/IdentifierTable.h"
+#include <cstdint>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <memory>
+
+namespace rheo {
+
+// A precompiled module: the arrays of a FlatAST written out as they are, so
+// that loading one is one checking pass and views into the (mapped) file.
+//
+//   header     magic "RHEOAST", version, byte order, top-level list index,
+//              number of global slots, then offset and size of each section
+//   sections   each 8-byte aligned: module name, kinds, flags, spans, data,
+//              extra, expression types, identifier offsets, identifier
+//              characters
+//
+// Nodes refer to each other by node id, which is an index, not an address,
+// so resolved links need no patching. Atoms are renumbered into the file's
+// own identifier list in order of first use, NoAtom first; loading into a
+// table that hands out the same numbers (a fresh one, say) needs no patching
+// either. Spans are offsets into the module's source file, not positions in
+// the writer's SourceManager, and are moved to wherever the loader has put
+// that file; at base 0, as the first file of a fresh SourceManager is, they
+// need no patching. The empty span at 0 of a node with no location stays
+// as it is. Numbers are in the writer's byte order. Files from
+// another byte order or version are rejected rather than converted.
+inline constexpr std::uint32_t ModuleFileVersion = 4;
+
+// Idents is the table Tree's atoms come from, and Base the position of the
+// source file Tree was parsed from.
+void writeModuleFile(const FlatAST &Tree, const IdentifierTable &Idents,
+                     BytePos Base, llvm::raw_ostream &OS);
+
+// Loads a module file whose source file sits at Base, interning its
+// identifiers into Idents. The tree's arrays are views into Buffer, except
+// that the data column is copied with its atoms renumbered when Idents
+// numbers them differently, and the spans are copied when Base is not 0.
+// Besides the framing, the arrays must pass FlatAST::verify() and every atom
+// must be one of the file's, or the file is rejected as malformed before
+// anything is interned.
+llvm::ErrorOr<FlatAST>
+readModuleFile(std::unique_ptr<llvm::MemoryBuffer> Buffer,
+               IdentifierTable &Idents, BytePos Base);
+
+// Maps Path and reads it as above.
+llvm::ErrorOr<FlatAST> readModuleFile(llvm::StringRef Path,
+                                      IdentifierTable &Idents, BytePos Base);
+
+} // namespace rheo
+
+#endif // RHEO_MODULE_FILE_H
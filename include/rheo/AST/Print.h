@@ -7,6 +7,7 @@
 namespace rheo {
 
 class ASTPrinter {
+  const ASTContext &Context;
   llvm::raw_ostream &OS;
   int Indent = 0;
   const Span *CurrentLoc = nullptr;
@@ -19,7 +20,9 @@ class ASTPrinter {
     OS << " [" << S.getStart() << ":" << S.getEnd() << "]";
   }
 
-  llvm::StringRef unaryOpStr(UnaryOp Op) {
+public:
+  // Operator and builtin spellings, shared with printFlatAST.
+  static llvm::StringRef unaryOpStr(UnaryOp Op) {
     switch (Op) {
     case Neg:
       return "-";
@@ -31,7 +34,7 @@ class ASTPrinter {
     llvm_unreachable("unknown UnaryOp");
   }
 
-  llvm::StringRef binaryOpStr(BinaryOp Op) {
+  static llvm::StringRef binaryOpStr(BinaryOp Op) {
     switch (Op) {
     case Add:
       return "+";
@@ -63,7 +66,7 @@ class ASTPrinter {
     llvm_unreachable("unknown BinaryOp");
   }
 
-  llvm::StringRef builtinKindStr(BuiltinKind K) {
+  static llvm::StringRef builtinKindStr(BuiltinKind K) {
     switch (K) {
     case BuiltinKind::Int:
       return "Int";
@@ -99,27 +102,38 @@ class ASTPrinter {
     llvm_unreachable("unknown BuiltinKind");
   }
 
-public:
-  explicit ASTPrinter(llvm::raw_ostream &OS = llvm::outs()) : OS(OS) {}
+  // Context spells the atoms the nodes refer to.
+  explicit ASTPrinter(const ASTContext &Context,
+                      llvm::raw_ostream &OS = llvm::outs())
+      : Context(Context), OS(OS) {}
 
   // ── Top-level ────────────────────────────────────────────────────────────
 
   void print(const Module &M) {
+    printModuleHeader(M);
+    for (auto *S : M.Stmts)
+      printTopLevel(*S);
+  }
+
+  // The same output a statement at a time, for trees that do not stay in
+  // memory as a whole.
+  void printModuleHeader(const Module &M) {
     OS << "Module(" << M.Name << ")\n";
+  }
+  void printTopLevel(const Stmt &S) {
     push();
-    for (auto *S : M.Stmts)
-      printStmt(*S);
+    printStmt(S);
     pop();
   }
 
   // FIX 1: FunctionDecl has no Location field — drop the printLoc call.
   void print(const FunctionDecl &F) {
     indent();
-    OS << "FunctionDecl(" << F.Name << ")\n";
+    OS << "FunctionDecl(" << Context.spelling(F.Name) << ")\n";
     push();
     for (auto &P : F.Params) {
       indent();
-      OS << "Param(" << P.Name;
+      OS << "Param(" << Context.spelling(P.Name);
       if (P.Ty) {
         OS << ": ";
         printType(*P.Ty);
@@ -134,8 +148,8 @@ public:
       printType(*F.ReturnType);
       OS << "\n";
     }
-    if (F.Body)
-      printBlockExpr(*F.Body);
+    if (auto *Body = F.getBody())
+      printBlockExpr(*Body);
     pop();
   }
 
@@ -147,7 +161,7 @@ public:
 
   void printTypeKind(const BuiltinType &T) { OS << builtinKindStr(T.Kind); }
 
-  void printTypeKind(const NamedType &T) { OS << T.Name; }
+  void printTypeKind(const NamedType &T) { OS << Context.spelling(T.Name); }
 
   void printTypeKind(const TypeVar &T) { OS << "?T" << T.Id; }
 
@@ -201,9 +215,9 @@ public:
 
   void printExprKind(const VarRef &E) {
     indent();
-    OS << "VarRef(" << E.Name;
+    OS << "VarRef(" << Context.spelling(E.Name);
     if (E.Resolved)
-      OS << " -> " << E.Resolved->Name;
+      OS << " -> " << Context.spelling(E.Resolved->Name);
     OS << ")";
     if (CurrentLoc)
       printLoc(*CurrentLoc);
@@ -246,7 +260,7 @@ public:
     indent();
     OS << "CallExpr";
     if (E.Resolved)
-      OS << " -> " << E.Resolved->Name;
+      OS << " -> " << Context.spelling(E.Resolved->Name);
     if (CurrentLoc)
       printLoc(*CurrentLoc);
     OS << "\n";
@@ -377,7 +391,7 @@ public:
 
   void printStmtKind(const VarDecl &S) {
     indent();
-    OS << "VarDecl(" << (S.IsMut ? "mut " : "") << S.Name;
+    OS << "VarDecl(" << (S.IsMut ? "mut " : "") << Context.spelling(S.Name);
     if (S.Ty) {
       OS << ": ";
       printType(*S.Ty);
@@ -418,21 +432,24 @@ public:
 
 // ── Free helpers ─────────────────────────────────────────────────────────────
 
-inline void printAST(const Module &M, llvm::raw_ostream &OS = llvm::outs()) {
-  ASTPrinter(OS).print(M);
+inline void printAST(const ASTContext &Ctx, const Module &M,
+                     llvm::raw_ostream &OS = llvm::outs()) {
+  ASTPrinter(Ctx, OS).print(M);
 }
 
-inline void printAST(const FunctionDecl &F,
+inline void printAST(const ASTContext &Ctx, const FunctionDecl &F,
                      llvm::raw_ostream &OS = llvm::outs()) {
-  ASTPrinter(OS).print(F);
+  ASTPrinter(Ctx, OS).print(F);
 }
 
-inline void printAST(const Expr &E, llvm::raw_ostream &OS = llvm::outs()) {
-  ASTPrinter(OS).printExpr(E);
+inline void printAST(const ASTContext &Ctx, const Expr &E,
+                     llvm::raw_ostream &OS = llvm::outs()) {
+  ASTPrinter(Ctx, OS).printExpr(E);
 }
 
-inline void printAST(const Stmt &S, llvm::raw_ostream &OS = llvm::outs()) {
-  ASTPrinter(OS).printStmt(S);
+inline void printAST(const ASTContext &Ctx, const Stmt &S,
+                     llvm::raw_ostream &OS = llvm::outs()) {
+  ASTPrinter(Ctx, OS).printStmt(S);
 }
 
 } // namespace rheo
@@ -0,0 +1,197 @@
+#ifndef RHEO_RECURSIVE_AST_VISITOR_H
+#define RHEO_RECURSIVE_AST_VISITOR_H
+
+#include "rheo/AST/AST.h"
+#include "rheo/Common.h"
+#include <tuple>
+#include <variant>
+
+namespace rheo {
+
+// Walks a pointer AST depth-first, calling Derived's hooks with no virtual
+// dispatch. Derived hides the hooks it needs:
+//
+//   visitX(X &)       before X's children (pre-order)
+//   postVisitX(X &)   after them (post-order)
+//
+// for X in Stmt, Expr, Block, Function, plus visitParam and visitTypeLoc for
+// written types (only called when one was written). A hook returning false
+// stops the whole walk, and the traverse functions then return false.
+// Derived may also hide a traverseX to change how X's children are walked.
+//
+// Deferred function bodies are parsed and walked unless Derived's
+// shouldTraverseDeferredBodies() says otherwise.
+template <typename Derived> class RecursiveASTVisitor {
+  Derived &derived() { return *static_cast<Derived *>(this); }
+
+public:
+  bool traverseModule(const Module &M) {
+    for (Stmt *S : M.Stmts)
+      if (!derived().traverseStmt(*S))
+        return false;
+    return true;
+  }
+
+  bool traverseStmt(Stmt &S) {
+    if (!derived().visitStmt(S))
+      return false;
+    bool Walked = std::visit(
+        Overloaded{[&](ExprStmt &E) { return derived().traverseExpr(*E.Expr); },
+                   [&](ReturnStmt &R) {
+                     return !R.Value || derived().traverseExpr(*R.Value);
+                   },
+                   [&](VarDecl &V) {
+                     return derived().traverseTypeLoc(V.Ty) &&
+                            (!V.Init || derived().traverseExpr(*V.Init));
+                   },
+                   [&](AssignStmt &A) {
+                     return derived().traverseExpr(*A.Target) &&
+                            derived().traverseExpr(*A.Value);
+                   },
+                   [&](FunctionDecl *F) {
+                     return derived().traverseFunction(*F);
+                   }},
+        S.Kind);
+    return Walked && derived().postVisitStmt(S);
+  }
+
+  bool traverseExpr(Expr &E) {
+    if (!derived().visitExpr(E))
+      return false;
+    bool Walked = std::visit(
+        Overloaded{[&](UnaryExpr &U) {
+                     return derived().traverseExpr(*U.Operand);
+                   },
+                   [&](BinaryExpr &B) {
+                     return derived().traverseExpr(*B.Lhs) &&
+                            derived().traverseExpr(*B.Rhs);
+                   },
+                   [&](CallExpr &C) {
+                     if (!derived().traverseExpr(*C.Callee))
+                       return false;
+                     for (Expr *Arg : C.Args)
+                       if (!derived().traverseExpr(*Arg))
+                         return false;
+                     return true;
+                   },
+                   [&](BlockExpr *B) { return derived().traverseBlock(*B); },
+                   [&](IfExpr &I) {
+                     return derived().traverseExpr(*I.Condition) &&
+                            derived().traverseBlock(*I.ThenBlock) &&
+                            (!I.ElseBranch ||
+                             derived().traverseBlock(*I.ElseBranch));
+                   },
+                   [&](WhileExpr &W) {
+                     return derived().traverseExpr(*W.Condition) &&
+                            derived().traverseBlock(*W.Body);
+                   },
+                   [&](BreakExpr &B) {
+                     return !B.Value || derived().traverseExpr(*B.Value);
+                   },
+                   [](auto &) { return true; }},
+        E.Kind);
+    return Walked && derived().postVisitExpr(E);
+  }
+
+  bool traverseBlock(BlockExpr &B) {
+    if (!derived().visitBlock(B))
+      return false;
+    for (Stmt *S : B.Stmts)
+      if (!derived().traverseStmt(*S))
+        return false;
+    if (B.Tail && !derived().traverseExpr(*B.Tail))
+      return false;
+    return derived().postVisitBlock(B);
+  }
+
+  bool traverseFunction(FunctionDecl &F) {
+    if (!derived().visitFunction(F))
+      return false;
+    for (Param &P : F.Params) {
+      if (!derived().visitParam(P) || !derived().traverseTypeLoc(P.Ty))
+        return false;
+    }
+    if (!derived().traverseTypeLoc(F.ReturnType))
+      return false;
+    if (!F.hasDeferredBody() || derived().shouldTraverseDeferredBodies())
+      if (BlockExpr *Body = F.getBody())
+        if (!derived().traverseBlock(*Body))
+          return false;
+    return derived().postVisitFunction(F);
+  }
+
+  bool traverseTypeLoc(TypeLoc &T) { return !T || derived().visitTypeLoc(T); }
+
+  // The hooks. Derived hides the ones it needs.
+  bool visitStmt(Stmt &) { return true; }
+  bool postVisitStmt(Stmt &) { return true; }
+  bool visitExpr(Expr &) { return true; }
+  bool postVisitExpr(Expr &) { return true; }
+  bool visitBlock(BlockExpr &) { return true; }
+  bool postVisitBlock(BlockExpr &) { return true; }
+  bool visitFunction(FunctionDecl &) { return true; }
+  bool postVisitFunction(FunctionDecl &) { return true; }
+  bool visitParam(Param &) { return true; }
+  bool visitTypeLoc(TypeLoc &) { return true; }
+  bool shouldTraverseDeferredBodies() const { return true; }
+};
+
+// Runs several visitors in one walk over the tree instead of one walk each.
+// Every hook calls that hook of each pass in order, pre- and post-order
+// alike; only the passes' hooks are used, not their traverse functions.
+// Deferred bodies are walked only if every pass wants them.
+//
+//   FusedVisitor(Counter, Checker).traverseModule(M);
+template <typename... Passes>
+class FusedVisitor : public RecursiveASTVisitor<FusedVisitor<Passes...>> {
+  std::tuple<Passes &...> Fused;
+
+  template <typename Hook> bool each(Hook &&H) {
+    return std::apply([&](auto &...Pass) { return (H(Pass) && ...); }, Fused);
+  }
+
+public:
+  explicit FusedVisitor(Passes &...P) : Fused(P...) {}
+
+  bool visitStmt(Stmt &S) {
+    return each([&](auto &P) { return P.visitStmt(S); });
+  }
+  bool postVisitStmt(Stmt &S) {
+    return each([&](auto &P) { return P.postVisitStmt(S); });
+  }
+  bool visitExpr(Expr &E) {
+    return each([&](auto &P) { return P.visitExpr(E); });
+  }
+  bool postVisitExpr(Expr &E) {
+    return each([&](auto &P) { return P.postVisitExpr(E); });
+  }
+  bool visitBlock(BlockExpr &B) {
+    return each([&](auto &P) { return P.visitBlock(B); });
+  }
+  bool postVisitBlock(BlockExpr &B) {
+    return each([&](auto &P) { return P.postVisitBlock(B); });
+  }
+  bool visitFunction(FunctionDecl &F) {
+    return each([&](auto &P) { return P.visitFunction(F); });
+  }
+  bool postVisitFunction(FunctionDecl &F) {
+    return each([&](auto &P) { return P.postVisitFunction(F); });
+  }
+  bool visitParam(Param &Prm) {
+    return each([&](auto &P) { return P.visitParam(Prm); });
+  }
+  bool visitTypeLoc(TypeLoc &T) {
+    return each([&](auto &P) { return P.visitTypeLoc(T); });
+  }
+  bool shouldTraverseDeferredBodies() const {
+    return std::apply(
+        [](const auto &...Pass) {
+          return (Pass.shouldTraverseDeferredBodies() && ...);
+        },
+        Fused);
+  }
+};
+
+} // namespace rheo
+
+#endif // RHEO_RECURSIVE_AST_VISITOR_H
@@ -15,27 +15,26 @@ namespace rheo {
 
 enum class Severity : uint8_t { Error, Warning, Note, Help };
 
+// Label locations are global, so a diagnostic can point into several files
+// without naming them.
 struct Label {
   Span Location;
-  FileId File;
   std::optional<std::string> Message;
   bool IsPrimary;
 
-  static Label primary(Span Location, FileId File,
+  static Label primary(Span Location,
                        std::optional<std::string> Message = std::nullopt) {
-    return {Location, File, std::move(Message), true};
+    return {Location, std::move(Message), true};
   }
 
-  static Label secondary(Span Location, FileId File,
+  static Label secondary(Span Location,
                          std::optional<std::string> Message = std::nullopt) {
-    return {Location, File, std::move(Message), false};
+    return {Location, std::move(Message), false};
   }
 
 private:
-  Label(Span Location, FileId File, std::optional<std::string> Message,
-        bool IsPrimary)
-      : Location(Location), File(File), Message(std::move(Message)),
-        IsPrimary(IsPrimary) {}
+  Label(Span Location, std::optional<std::string> Message, bool IsPrimary)
+      : Location(Location), Message(std::move(Message)), IsPrimary(IsPrimary) {}
 };
 
 struct Diagnostic {
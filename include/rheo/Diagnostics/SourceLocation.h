@@ -4,25 +4,45 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <llvm/ADT/StringRef.h>
 
 namespace rheo {
 
 using FileId = std::uint32_t;
+
+// A position in the SourceManager's global offset space: every file owns a
+// contiguous range of it, so a BytePos alone identifies file, line and
+// column. Offsets within one file are plain std::uint32_t.
 using BytePos = std::uint32_t;
 
+// A start plus a length. The length stays 32 bits wide: every AST node that
+// holds a Span also holds a pointer, so a 16-bit length would only turn into
+// padding, and block spans in generated modules easily exceed 64 KiB.
 class Span {
   BytePos Start;
-  BytePos End;
+  std::uint32_t Len;
 
 public:
-  Span(BytePos Start, BytePos End) : Start(Start), End(End) {
+  Span(BytePos Start, BytePos End) : Start(Start), Len(End - Start) {
     assert(Start <= End && "Span start must be before end");
   }
-  [[nodiscard]] const BytePos &getStart() const { return Start; }
-  [[nodiscard]] const BytePos &getEnd() const { return End; }
-  [[nodiscard]] std::uint32_t len() const { return End - Start; }
+  [[nodiscard]] BytePos getStart() const { return Start; }
+  [[nodiscard]] BytePos getEnd() const { return Start + Len; }
+  [[nodiscard]] std::uint32_t len() const { return Len; }
   [[nodiscard]] Span merge(const Span &Other) const {
-    return {std::min(Start, Other.Start), std::max(End, Other.End)};
+    return {std::min(Start, Other.Start), std::max(getEnd(), Other.getEnd())};
+  }
+};
+
+// Replace the RemovedLen bytes at Offset with Inserted. Offset is relative to
+// the start of the file, in the text before the edit.
+struct TextEdit {
+  std::uint32_t Offset;
+  std::uint32_t RemovedLen;
+  llvm::StringRef Inserted;
+
+  [[nodiscard]] std::int64_t delta() const {
+    return std::int64_t(Inserted.size()) - std::int64_t(RemovedLen);
   }
 };
 
@@ -3,32 +3,90 @@
 
 #include "SourceLocation.h"
 #include "llvm/ADT/StringRef.h"
-#include <diagnostics.h>
-#include <string>
+#include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <memory>
+#include <optional>
+#include <utility>
 #include <vector>
 
 namespace rheo {
 
+// A source file owns the only copy of its text. Buffers opened from disk are
+// memory-mapped where the platform allows it; the lexer and every token refer
+// back into this buffer instead of copying it.
+//
+// The line table is built on the first getLineCol() call, so files that never
+// produce a diagnostic are never scanned for newlines. getLineCol() is
+// therefore not safe to call concurrently on the same file.
+//
+// The file occupies [getBase(), getBase() + size()] of the global offset
+// space; the position one past the last byte belongs to it too, so Eof and
+// spans ending at the end of the file stay inside it.
 class SourceFile {
-  std::string Name;
-  std::string Source;
-  std::vector<BytePos> LineStarts;
+  friend class SourceManager;
+
+  std::unique_ptr<llvm::MemoryBuffer> Buffer;
+  BytePos Base;
+  mutable std::vector<std::uint32_t> LineStarts;
+  mutable std::uint32_t LastLine = 0;
+
+  void computeLineStarts() const;
+  void applyEdit(const TextEdit &Edit);
 
 public:
-  SourceFile(llvm::StringRef Name, llvm::StringRef Source,
-             std::vector<BytePos> LineStarts)
-      : Name(Name), Source(Source), LineStarts(std::move(LineStarts)) {}
-  [[nodiscard]] llvm::StringRef getName() const { return Name; }
-  [[nodiscard]] llvm::StringRef getSource() const { return Source; }
-  [[nodiscard]] LineColumn getLineCol(BytePos Pos) const;
+  SourceFile(std::unique_ptr<llvm::MemoryBuffer> Buffer, BytePos Base)
+      : Buffer(std::move(Buffer)), Base(Base) {}
+  [[nodiscard]] llvm::StringRef getName() const {
+    return Buffer->getBufferIdentifier();
+  }
+  [[nodiscard]] llvm::StringRef getSource() const {
+    return Buffer->getBuffer();
+  }
+  [[nodiscard]] BytePos getBase() const { return Base; }
+  [[nodiscard]] std::uint32_t size() const {
+    return static_cast<std::uint32_t>(Buffer->getBufferSize());
+  }
+  [[nodiscard]] bool contains(BytePos Pos) const {
+    return Pos >= Base && Pos - Base <= size();
+  }
+  // Offset is relative to the start of this file.
+  [[nodiscard]] LineColumn getLineCol(std::uint32_t Offset) const;
+};
+
+// A global position split into its file and the offset within that file.
+struct FileLoc {
+  FileId File;
+  std::uint32_t Offset;
 };
 
 class SourceManager {
   std::vector<SourceFile> Files;
+  // File bases in increasing order, for mapping a BytePos back to its file.
+  std::vector<std::pair<BytePos, FileId>> Ranges;
+  BytePos NextBase = 0;
+
+  BytePos allocate(std::size_t Size);
 
 public:
+  // Copies Source into a buffer owned by the manager.
   FileId addFile(llvm::StringRef Name, llvm::StringRef Source);
+  FileId addBuffer(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+  llvm::ErrorOr<FileId> openFile(llvm::StringRef Path);
   [[nodiscard]] const SourceFile *getFile(FileId FileId) const;
+
+  // Maps a global position back to its file, or std::nullopt if no file
+  // covers it (for example a position from before an edit moved the file).
+  [[nodiscard]] std::optional<FileLoc> decompose(BytePos Pos) const;
+  [[nodiscard]] const SourceFile *getFileContaining(BytePos Pos) const;
+  [[nodiscard]] LineColumn getLineCol(BytePos Pos) const;
+
+  // Replaces the file's text with the edited one and returns the file. Views
+  // of the old text, including any TokenBuffer over it, are invalidated, and
+  // so are old positions past the edit. A file that has grown past its range
+  // moves to the end of the offset space. A line table that was already built
+  // is patched rather than rebuilt.
+  const SourceFile &applyEdit(FileId FileId, const TextEdit &Edit);
 };
 
 } // namespace rheo
@@ -0,0 +1,81 @@
+#ifndef RHEO_CHAR_SCAN_H
+#define RHEO_CHAR_SCAN_H
+
+#include <array>
+#include <cstdint>
+#include <llvm/ADT/StringRef.h>
+#include <vector>
+
+namespace rheo::scan {
+
+enum CharClass : std::uint8_t {
+  CC_None = 0,
+  CC_Blank = 1 << 0, // whitespace other than '\n'
+  CC_Digit = 1 << 1,
+  CC_Ident = 1 << 2,  // may start an identifier
+  CC_IdentBody = CC_Ident | CC_Digit,
+};
+
+// Locale-independent replacement for std::isspace/isdigit/isalpha as the
+// lexer used them ("C" locale). Bytes >= 0x80 never classify.
+inline constexpr std::array<std::uint8_t, 256> CharTable = [] {
+  std::array<std::uint8_t, 256> Table{};
+  for (char Chr : {' ', '\t', '\v', '\f', '\r'})
+    Table[static_cast<unsigned char>(Chr)] |= CC_Blank;
+  for (unsigned Chr = '0'; Chr <= '9'; ++Chr)
+    Table[Chr] |= CC_Digit;
+  for (unsigned Chr = 'a'; Chr <= 'z'; ++Chr)
+    Table[Chr] |= CC_Ident;
+  for (unsigned Chr = 'A'; Chr <= 'Z'; ++Chr)
+    Table[Chr] |= CC_Ident;
+  Table['_'] |= CC_Ident;
+  return Table;
+}();
+
+constexpr bool is(char Chr, CharClass Class) {
+  return (CharTable[static_cast<unsigned char>(Chr)] & Class) != 0;
+}
+
+enum class ISA : std::uint8_t { Scalar, SSE42, AVX2 };
+
+// Each scanner returns the first position in [Cur, End) whose byte is not in
+// the scanned class, or End. SkipIdent scans CC_IdentBody.
+struct Kernels {
+  const char *(*SkipBlanks)(const char *Cur, const char *End);
+  const char *(*SkipIdent)(const char *Cur, const char *End);
+  const char *(*SkipDigits)(const char *Cur, const char *End);
+  // Appends Base + offset + 1 for every '\n' in Text.
+  void (*AppendLineStarts)(llvm::StringRef Text, std::uint32_t Base,
+                           std::vector<std::uint32_t> &Out);
+};
+
+// The kernels picked for this CPU on first use.
+const Kernels &kernels();
+ISA activeISA();
+
+// Overrides the runtime choice; returns false if the CPU lacks the ISA.
+// Meant for benchmarks and tests comparing implementations.
+bool forceISA(ISA Target);
+bool isSupported(ISA Target);
+llvm::StringRef isaName(ISA Target);
+
+inline const char *skipBlanks(const char *Cur, const char *End) {
+  return kernels().SkipBlanks(Cur, End);
+}
+
+inline const char *skipIdent(const char *Cur, const char *End) {
+  return kernels().SkipIdent(Cur, End);
+}
+
+inline const char *skipDigits(const char *Cur, const char *End) {
+  return kernels().SkipDigits(Cur, End);
+}
+
+inline void appendLineStarts(llvm::StringRef Text, std::uint32_t Base,
+                             std::vector<std::uint32_t> &Out) {
+  kernels().AppendLineStarts(Text, Base, Out);
+}
+
+} // namespace rheo::scan
+
+#endif // RHEO_CHAR_SCAN_H
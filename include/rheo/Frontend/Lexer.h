@@ -4,14 +4,17 @@
 #include "Token.h"
 #include "rheo/Diagnostics/DiagnosticEngine.h"
 #include "rheo/Diagnostics/SourceLocation.h"
+#include "rheo/Diagnostics/SourceManager.h"
 #include <llvm/ADT/StringRef.h>
-#include <string>
 
 namespace rheo {
 
+// Lexes a view of a buffer owned elsewhere (normally a SourceFile); the
+// buffer must outlive the lexer and every token it returns. Token spans are
+// global positions: Base plus the offset into Input.
 class Lexer {
-  FileId File;
-  std::string Input;
+  BytePos Base;
+  llvm::StringRef Input;
   std::size_t Pos = 0;
   DiagnosticEngine *Diags;
 
@@ -34,14 +37,43 @@ class Lexer {
                                           llvm::StringRef SecondPart,
                                           Span Span);
 
+  // Advances Pos past the run accepted by one of the scan:: kernels.
+  void scanWhile(const char *(*Skip)(const char *, const char *));
+
+  // Global span of the text between Start and the current position.
+  [[nodiscard]] Span spanFrom(std::size_t Start) const {
+    return {static_cast<BytePos>(Base + Start),
+            static_cast<BytePos>(Base + Pos)};
+  }
+
+  // Token for the text between Start and the current position.
+  Token makeToken(TokenKind Kind, std::size_t Start) const {
+    return {.Span = spanFrom(Start),
+            .Kind = Kind,
+            .Value = Input.slice(Start, Pos)};
+  }
+
   Token lexNum();
   Token lexKeywordOrIdent();
 
   void skipWhitespace();
 
 public:
-  Lexer(FileId File, llvm::StringRef Input, DiagnosticEngine &Diags)
-      : File(File), Input(Input), Diags(&Diags) {}
+  Lexer(BytePos Base, llvm::StringRef Input, DiagnosticEngine &Diags)
+      : Base(Base), Input(Input), Diags(&Diags) {}
+
+  Lexer(const SourceFile &File, DiagnosticEngine &Diags)
+      : Lexer(File.getBase(), File.getSource(), Diags) {}
+
+  // Lexes only Input[Begin, End). Spans stay relative to Base, so a file can
+  // be lexed in pieces. Begin must be at the start of a line.
+  Lexer(BytePos Base, llvm::StringRef Input, DiagnosticEngine &Diags,
+        std::size_t Begin, std::size_t End)
+      : Base(Base), Input(Input.take_front(End)), Pos(Begin), Diags(&Diags) {}
+
+  [[nodiscard]] BytePos getBase() const { return Base; }
+  [[nodiscard]] llvm::StringRef getInput() const { return Input; }
+  [[nodiscard]] std::size_t getOffset() const { return Pos; }
 
   Token nextToken();
 };
@@ -6,28 +6,65 @@
 #include "rheo/Diagnostics/SourceLocation.h"
 #include "rheo/Frontend/Lexer.h"
 #include "rheo/Frontend/Token.h"
+#include "rheo/Frontend/TokenBuffer.h"
 #include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringRef.h>
+#include <algorithm>
+#include <cassert>
 #include <optional>
 
+namespace llvm {
+class ThreadPoolInterface;
+} // namespace llvm
+
 namespace rheo {
 
+// Walks a pre-lexed TokenBuffer by index. Index is the token the parser is
+// looking at; it never moves past the trailing Eof.
 class Parser {
+  friend class DeferredBodies;
+
   ASTContext &Context;
-  Lexer &Lex;
-  Token NextToken;
+  TokenBuffer OwnedTokens;
+  const TokenBuffer *Tokens;
+  std::size_t Index = 0;
   DiagnosticEngine &Diags;
-  FileId File;
+  // Set by deferFunctionBodies().
+  LazyBodySource *BodySource = nullptr;
+  // Index of Tokens[0] in the buffer BodySource reads, when Tokens is a
+  // slice of it.
+  std::size_t TokenBase = 0;
 
-  void eatNextToken() { NextToken = Lex.nextToken(); }
+  [[nodiscard]] TokenKind nextKind() const { return Tokens->kind(Index); }
+  [[nodiscard]] Span nextSpan() const { return Tokens->span(Index); }
+  [[nodiscard]] llvm::StringRef nextText() const {
+    return Tokens->text(Index);
+  }
+  [[nodiscard]] Atom nextAtom() const { return Tokens->atom(Index); }
+  [[nodiscard]] Token nextToken() const { return Tokens->token(Index); }
+  // Kind of the token Ahead positions after the current one (Eof past the
+  // end).
+  [[nodiscard]] TokenKind peekKind(std::size_t Ahead) const {
+    return Tokens->kind(std::min(Index + Ahead, Tokens->size() - 1));
+  }
+
+  void eatNextToken() {
+    if (Index + 1 < Tokens->size())
+      ++Index;
+  }
   void skipNewLines();
 
-  Type *parseType();
+  // Backtracking: a saved position can be restored without relexing.
+  [[nodiscard]] std::size_t mark() const { return Index; }
+  void rewind(std::size_t Mark) { Index = Mark; }
+
+  TypeLoc parseType();
 
   Expr *parsePrimaryExpr();
   Expr *parseUnaryExpr();
   Expr *parseCallExpr();
-  Expr *parseBinaryExpr(int MinOp = 0);
+  Expr *parseBinaryExpr();
   Expr *parseExpr();
   Expr *parseIf();
   Expr *parseWhile();
@@ -40,11 +77,16 @@ class Parser {
   Stmt *parseFunc();
 
   std::optional<Param> parseParam();
-  llvm::ArrayRef<Param> parseParamList();
+  llvm::MutableArrayRef<Param> parseParamList();
   BlockExpr *parseBlock(llvm::ArrayRef<TokenKind> Terminator);
+  // Skips a def body up to and including its 'end', or returns null without
+  // moving if the nesting does not close.
+  LazyBody *deferBody();
+  // Top-level statements from Index up to Eof, with error recovery.
+  void parseTopLevel(llvm::SmallVectorImpl<Stmt *> &Stmts);
 
-  Type *errorUnexpectedType();
-  Type *errorExpectedRParenInType(Span OpenParenSpan);
+  TypeLoc errorUnexpectedType();
+  TypeLoc errorExpectedRParenInType(Span OpenParenSpan);
   Stmt *errorUnexpectedColonEqualAfterType(Span TypeSpan);
   Stmt *errorExpectedStmtTerminator(Span StmtSpan);
   Stmt *errorExpectedStmt();
@@ -63,11 +105,50 @@ class Parser {
   void errorExpectedFunctionBody(Span FnSpan);
 
 public:
-  Parser(ASTContext &Context, Lexer &Lex, DiagnosticEngine &Diags, FileId File)
-      : Context(Context), Lex(Lex), NextToken(Lex.nextToken()), Diags(Diags),
-        File(File) {}
+  // Lexes the rest of Lex's input up front.
+  Parser(ASTContext &Context, Lexer &Lex, DiagnosticEngine &Diags)
+      : Context(Context),
+        OwnedTokens(TokenBuffer::lex(Lex, Context.identifiers())),
+        Tokens(&OwnedTokens), Diags(Diags) {}
+
+  // Parses an existing buffer, which must outlive the parser and end in Eof.
+  // Its atoms must come from Context's identifier table.
+  Parser(ASTContext &Context, const TokenBuffer &Tokens,
+         DiagnosticEngine &Diags)
+      : Context(Context), Tokens(&Tokens), Diags(Diags) {
+    assert(!Tokens.empty() && Tokens.kind(Tokens.size() - 1) == TokenKind::Eof &&
+           "token buffer must end in Eof");
+  }
+
+  // From now on, only scan each multi-line def body for its 'end' and leave
+  // it to FunctionDecl::getBody() to parse it on first use; one-line bodies
+  // are still parsed in place. The token buffer, Context and Diags must
+  // outlive the module, and a body's diagnostics are emitted when it is
+  // parsed. Needs the TokenBuffer constructor.
+  void deferFunctionBodies();
 
   Module parseModule(llvm::StringRef Name);
+
+  // Same result and diagnostics as parseModule(), but runs of top-level
+  // statements of about ChunkTokens tokens are parsed on Pool, each into a
+  // child of Context that Context then adopts. Chunks are cut after a
+  // newline or ';' outside any def/if/while ... end and any parentheses.
+  // From the first chunk that reports an error on, parsing continues
+  // serially, so recovery never depends on where the cuts fell.
+  static constexpr std::size_t DefaultChunkTokens = std::size_t(1) << 16;
+  Module parseModuleParallel(llvm::StringRef Name,
+                             llvm::ThreadPoolInterface &Pool,
+                             std::size_t ChunkTokens = DefaultChunkTokens);
+
+  // Parses the buffer again after relex() applied Edit to it, given the
+  // Module the buffer parsed into without errors before. Only top-level
+  // statements whose tokens overlap Changed are parsed again; the others are
+  // Old's own nodes, and the ones after the edit are moved to their new
+  // positions in place. Resolved links are stale until names are resolved
+  // again. Falls back to parseModule() if Old does not line up with the
+  // buffer, and parses serially to the end if a new statement has an error.
+  Module reparseModule(const Module &Old, const TextEdit &Edit,
+                       const TokenBuffer::RelexResult &Changed);
 };
 
 }; // namespace rheo
@@ -2,7 +2,11 @@
 #define RHEO_TOKEN_H
 
 #include "rheo/Diagnostics/SourceLocation.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <llvm/ADT/StringRef.h>
+#include <string_view>
 
 namespace rheo {
 
@@ -74,6 +78,148 @@ struct Token {
   llvm::StringRef Value;
 };
 
+// ─────────────────────────────────────────────
+//  Keywords
+// ─────────────────────────────────────────────
+
+struct Keyword {
+  std::string_view Spelling;
+  TokenKind Kind;
+};
+
+inline constexpr std::array Keywords = {
+    Keyword{"if", TokenKind::If},
+    Keyword{"or", TokenKind::Or},
+    Keyword{"mut", TokenKind::Mut},
+    Keyword{"def", TokenKind::Def},
+    Keyword{"Int", TokenKind::Int},
+    Keyword{"not", TokenKind::Not},
+    Keyword{"and", TokenKind::And},
+    Keyword{"end", TokenKind::End},
+    Keyword{"true", TokenKind::True},
+    Keyword{"Bool", TokenKind::Bool},
+    Keyword{"else", TokenKind::Else},
+    Keyword{"UInt", TokenKind::UInt},
+    Keyword{"Int8", TokenKind::Int8},
+    Keyword{"false", TokenKind::False},
+    Keyword{"while", TokenKind::While},
+    Keyword{"break", TokenKind::Break},
+    Keyword{"Int16", TokenKind::Int16},
+    Keyword{"Int32", TokenKind::Int32},
+    Keyword{"Int64", TokenKind::Int64},
+    Keyword{"UInt8", TokenKind::UInt8},
+    Keyword{"return", TokenKind::Return},
+    Keyword{"elseif", TokenKind::ElseIf},
+    Keyword{"UInt16", TokenKind::UInt16},
+    Keyword{"UInt32", TokenKind::UInt32},
+    Keyword{"UInt64", TokenKind::UInt64},
+    Keyword{"Float32", TokenKind::Float32},
+    Keyword{"Float64", TokenKind::Float64},
+    Keyword{"continue", TokenKind::Continue},
+};
+
+namespace detail {
+
+// Perfect hash over (first byte, last byte, length), which already separates
+// every keyword; the multiplier spreads those keys over KeywordSlots without
+// collisions and is found at compile time.
+inline constexpr unsigned KeywordHashBits = 7;
+inline constexpr std::size_t KeywordSlots = std::size_t(1) << KeywordHashBits;
+inline constexpr std::uint8_t NoKeyword = 0xFF;
+
+constexpr std::size_t minKeywordLength() {
+  std::size_t Min = Keywords[0].Spelling.size();
+  for (const auto &K : Keywords)
+    Min = std::min(Min, K.Spelling.size());
+  return Min;
+}
+
+constexpr std::size_t maxKeywordLength() {
+  std::size_t Max = 0;
+  for (const auto &K : Keywords)
+    Max = std::max(Max, K.Spelling.size());
+  return Max;
+}
+
+constexpr std::uint32_t keywordHash(std::string_view Spelling,
+                                    std::uint32_t Multiplier) {
+  auto Key = (static_cast<std::uint32_t>(
+                  static_cast<unsigned char>(Spelling.front()))
+              << 16) |
+             (static_cast<std::uint32_t>(
+                  static_cast<unsigned char>(Spelling.back()))
+              << 8) |
+             static_cast<std::uint32_t>(Spelling.size());
+  return (Key * Multiplier) >> (32 - KeywordHashBits);
+}
+
+struct KeywordHashTable {
+  std::uint32_t Multiplier = 0;
+  std::array<std::uint8_t, KeywordSlots> Slots{};
+};
+
+constexpr KeywordHashTable buildKeywordHashTable() {
+  static_assert(Keywords.size() < NoKeyword);
+  for (std::uint32_t Multiplier = 0x9E3779B1U;; Multiplier += 2) {
+    KeywordHashTable Table{Multiplier, {}};
+    Table.Slots.fill(NoKeyword);
+    bool Collides = false;
+    for (std::size_t I = 0; I < Keywords.size() && !Collides; ++I) {
+      auto &Slot = Table.Slots[keywordHash(Keywords[I].Spelling, Multiplier)];
+      Collides = Slot != NoKeyword;
+      Slot = static_cast<std::uint8_t>(I);
+    }
+    if (!Collides)
+      return Table;
+  }
+}
+
+inline constexpr KeywordHashTable KeywordTable = buildKeywordHashTable();
+
+} // namespace detail
+
+// Keyword kind for an identifier-shaped spelling, or TokenKind::Identifier.
+// One hash and at most one string comparison.
+constexpr TokenKind classifyIdent(std::string_view Spelling) {
+  if (Spelling.size() < detail::minKeywordLength() ||
+      Spelling.size() > detail::maxKeywordLength())
+    return TokenKind::Identifier;
+  auto Index = detail::KeywordTable.Slots[detail::keywordHash(
+      Spelling, detail::KeywordTable.Multiplier)];
+  if (Index == detail::NoKeyword || Keywords[Index].Spelling != Spelling)
+    return TokenKind::Identifier;
+  return Keywords[Index].Kind;
+}
+
+namespace detail {
+
+constexpr bool keywordsAreDistinct() {
+  for (std::size_t I = 0; I < Keywords.size(); ++I)
+    for (std::size_t J = I + 1; J < Keywords.size(); ++J)
+      if (Keywords[I].Spelling == Keywords[J].Spelling ||
+          Keywords[I].Kind == Keywords[J].Kind)
+        return false;
+  return true;
+}
+
+constexpr bool keywordsRoundTrip() {
+  for (const auto &K : Keywords)
+    if (classifyIdent(K.Spelling) != K.Kind)
+      return false;
+  return true;
+}
+
+} // namespace detail
+
+static_assert(detail::keywordsAreDistinct(),
+              "keyword spellings and kinds must be unique");
+static_assert(detail::keywordsRoundTrip(),
+              "every keyword must classify as its own kind");
+static_assert(classifyIdent("elif") == TokenKind::Identifier &&
+                  classifyIdent("Int128") == TokenKind::Identifier &&
+                  classifyIdent("x") == TokenKind::Identifier,
+              "near misses must stay identifiers");
+
 } // namespace rheo
 
 #endif // RHEO_TOKEN_H
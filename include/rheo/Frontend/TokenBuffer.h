@@ -0,0 +1,136 @@
+#ifndef RHEO_TOKEN_BUFFER_H
+#define RHEO_TOKEN_BUFFER_H
+
+#include "rheo/AST/IdentifierTable.h"
+#include "rheo/Diagnostics/DiagnosticEngine.h"
+#include "rheo/Diagnostics/SourceLocation.h"
+#include "rheo/Frontend/Token.h"
+#include <cassert>
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <vector>
+
+namespace llvm {
+class ThreadPoolInterface;
+} // namespace llvm
+
+namespace rheo {
+
+class Lexer;
+class SourceFile;
+class SourceManager;
+
+// A whole file's tokens, stored as parallel arrays of kinds, start offsets and
+// lengths over the source buffer. The last token is always Eof. Token values
+// are not stored; text() slices them out of the source on demand.
+//
+// Starts are offsets into Source; start() and span() add the file's Base to
+// give global positions, so moving the file only changes Base.
+//
+// Identifiers are interned as they are lexed and their atoms kept in a fourth
+// column (NoAtom for every other kind), so the parser never touches the
+// identifier table.
+class TokenBuffer {
+  llvm::StringRef Source;
+  BytePos Base = 0;
+  std::vector<TokenKind> Kinds;
+  std::vector<std::uint32_t> Starts;
+  std::vector<std::uint32_t> Lengths;
+  std::vector<Atom> Atoms;
+
+public:
+  TokenBuffer() = default;
+  explicit TokenBuffer(llvm::StringRef Source, BytePos Base = 0)
+      : Source(Source), Base(Base) {}
+
+  // Lexes everything Lex has left, up to and including Eof.
+  static TokenBuffer lex(Lexer &Lex, IdentifierTable &Idents);
+
+  // Lexes File on Pool in chunks of about ChunkBytes, each cut just after a
+  // '\n' (the lexer keeps no state across lines). The result is identical to
+  // lex() over the whole file, and diagnostics reach Diags in source order.
+  // Identifiers are interned while the chunks are merged, on this thread.
+  static constexpr std::size_t DefaultChunkBytes = std::size_t(512) << 10;
+  static TokenBuffer lexParallel(const SourceManager &SM, FileId File,
+                                 IdentifierTable &Idents,
+                                 DiagnosticEngine &Diags,
+                                 llvm::ThreadPoolInterface &Pool,
+                                 std::size_t ChunkBytes = DefaultChunkBytes);
+
+  // What relex() changed: tokens [First, First + Removed) of the old buffer
+  // were replaced by [First, First + Inserted) of the new one. Tokens before
+  // First are untouched; the ones after only moved.
+  struct RelexResult {
+    std::size_t First;
+    std::size_t Removed;
+    std::size_t Inserted;
+  };
+
+  // Updates the buffer for Edit, given the edited file. Lexing restarts at
+  // the beginning of the edited line and stops at the first token that lines
+  // up with an old token past the edit; since the lexer only looks forward,
+  // everything from there on is the old stream shifted by Edit.delta().
+  // Diags only receives diagnostics for the relexed tokens.
+  RelexResult relex(const TextEdit &Edit, const SourceFile &File,
+                    IdentifierTable &Idents, DiagnosticEngine &Diags);
+
+  // Tokens [Begin, End) followed by an Eof where token End starts, over the
+  // same Source and Base.
+  [[nodiscard]] TokenBuffer slice(std::size_t Begin, std::size_t End) const;
+
+  void reserve(std::size_t Count);
+  // Start is an offset into Source.
+  void append(TokenKind Kind, std::uint32_t Start, std::uint32_t Length,
+              Atom Name = NoAtom) {
+    Kinds.push_back(Kind);
+    Starts.push_back(Start);
+    Lengths.push_back(Length);
+    Atoms.push_back(Name);
+  }
+  void append(const Token &Tok, IdentifierTable &Idents) {
+    append(Tok.Kind, Tok.Span.getStart() - Base, Tok.Span.len(),
+           Tok.Kind == TokenKind::Identifier ? Idents.intern(Tok.Value)
+                                             : NoAtom);
+  }
+
+  [[nodiscard]] llvm::StringRef getSource() const { return Source; }
+  [[nodiscard]] BytePos getBase() const { return Base; }
+  [[nodiscard]] std::size_t size() const { return Kinds.size(); }
+  [[nodiscard]] bool empty() const { return Kinds.empty(); }
+
+  [[nodiscard]] TokenKind kind(std::size_t I) const {
+    assert(I < size() && "token index out of range");
+    return Kinds[I];
+  }
+  [[nodiscard]] BytePos start(std::size_t I) const {
+    return Base + Starts[I];
+  }
+  [[nodiscard]] std::uint32_t length(std::size_t I) const {
+    return Lengths[I];
+  }
+  [[nodiscard]] Span span(std::size_t I) const {
+    return {start(I), start(I) + Lengths[I]};
+  }
+  [[nodiscard]] Atom atom(std::size_t I) const { return Atoms[I]; }
+  [[nodiscard]] llvm::StringRef text(std::size_t I) const {
+    return Source.substr(Starts[I], Lengths[I]);
+  }
+  [[nodiscard]] Token token(std::size_t I) const {
+    return {.Span = span(I), .Kind = kind(I), .Value = text(I)};
+  }
+
+  [[nodiscard]] llvm::ArrayRef<TokenKind> kinds() const { return Kinds; }
+  // File-relative, unlike start().
+  [[nodiscard]] llvm::ArrayRef<std::uint32_t> starts() const {
+    return Starts;
+  }
+  [[nodiscard]] llvm::ArrayRef<std::uint32_t> lengths() const {
+    return Lengths;
+  }
+  [[nodiscard]] llvm::ArrayRef<Atom> atoms() const { return Atoms; }
+};
+
+} // namespace rheo
+
+#endif // RHEO_TOKEN_BUFFER_H
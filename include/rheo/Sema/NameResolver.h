@@ -4,8 +4,16 @@
 #include "rheo/AST/AST.h"
 #include "rheo/Diagnostics/DiagnosticEngine.h"
 #include "rheo/Diagnostics/SourceLocation.h"
-#include <llvm/ADT/StringMap.h>
+#include <algorithm>
+#include <cstdint>
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringRef.h>
+#include <vector>
+namespace llvm {
+class ThreadPoolInterface;
+} // namespace llvm
+
 namespace rheo {
 
 using SymbolKind = std::variant<FunctionDecl *, VarDecl *>;
@@ -23,48 +31,189 @@ struct Symbol {
   template <typename T> T *getIf() const { return std::get_if<T>(&Kind); }
 };
 
-using Scope = llvm::StringMap<Symbol>;
+// Every binding in scope, in one table indexed by atom. Each name points at
+// its innermost binding, which points at the one it shadows. Bindings are
+// kept in declaration order and double as the undo log: closing a scope pops
+// back to where it opened, pointing each name at what it had shadowed.
+//
+// Scopes nest inside frames, one per function plus the module's. Variables
+// get slots in the innermost frame, and a closed scope's slots are handed out
+// again to the next one.
+class SymbolTable {
+  static constexpr std::uint32_t None = ~std::uint32_t(0);
+
+  struct Binding {
+    Symbol Sym;
+    Atom Name;
+    std::uint32_t Shadowed;
+    std::uint32_t Frame;
+  };
+
+  struct ScopeStart {
+    std::uint32_t Bindings;
+    std::uint32_t NextSlot;
+  };
+
+  struct Frame {
+    std::uint32_t NextSlot = 0;
+    std::uint32_t NumSlots = 0;
+  };
 
+  std::vector<std::uint32_t> Innermost;
+  std::vector<Binding> Bindings;
+  llvm::SmallVector<ScopeStart, 16> Scopes;
+  llvm::SmallVector<Frame, 8> Frames;
+  // Looked at for names this table does not bind; see setOuter().
+  const SymbolTable *Outer = nullptr;
+  std::uint32_t OuterMark = 0;
+
+  // Name's innermost binding among the first Mark.
+  const Binding *findBefore(Atom Name, std::uint32_t Mark) const {
+    if (Name >= Innermost.size())
+      return nullptr;
+    auto Top = Innermost[Name];
+    while (Top != None && Top >= Mark)
+      Top = Bindings[Top].Shadowed;
+    return Top == None ? nullptr : &Bindings[Top];
+  }
+
+  const Binding *find(Atom Name) const {
+    if (Name < Innermost.size() && Innermost[Name] != None)
+      return &Bindings[Innermost[Name]];
+    return Outer ? Outer->findBefore(Name, OuterMark) : nullptr;
+  }
+
+public:
+  void pushFrame() { Frames.emplace_back(); }
+  void popFrame() { Frames.pop_back(); }
+  // Slots the innermost frame has needed so far.
+  [[nodiscard]] std::uint32_t frameSize() const {
+    return Frames.back().NumSlots;
+  }
+
+  void pushScope() {
+    Scopes.push_back({static_cast<std::uint32_t>(Bindings.size()),
+                      Frames.back().NextSlot});
+  }
+  void popScope();
+
+  // The next free slot of the innermost frame.
+  std::uint32_t allocateSlot() {
+    auto &F = Frames.back();
+    F.NumSlots = std::max(F.NumSlots, F.NextSlot + 1);
+    return F.NextSlot++;
+  }
+
+  // Redeclaring a name in the same scope shadows the earlier binding, so
+  // that the bindings only ever grow while a scope is open.
+  void declare(Atom Name, Symbol S);
+  const Symbol *lookup(Atom Name) const {
+    const auto *B = find(Name);
+    return B ? &B->Sym : nullptr;
+  }
+  // How many frames out Name's innermost binding is; Name must be bound.
+  [[nodiscard]] std::uint32_t depthOf(Atom Name) const {
+    return static_cast<std::uint32_t>(Frames.size()) - 1 - find(Name)->Frame;
+  }
+
+  // The number of bindings so far, for setOuter().
+  [[nodiscard]] std::uint32_t mark() const {
+    return static_cast<std::uint32_t>(Bindings.size());
+  }
+  // Names this table does not bind are looked up in Outer as it was at
+  // Mark, with Outer's frames numbered as this table's outermost ones. Outer
+  // must not change while it is shared; any number of tables may share it.
+  void setOuter(const SymbolTable &Outer, std::uint32_t Mark) {
+    this->Outer = &Outer;
+    OuterMark = Mark;
+  }
+};
+
+// Opens a scope, in a frame of its own if OpensFrame.
 struct ScopeGuard {
-  llvm::SmallVector<Scope, 8> *Scopes;
-  explicit ScopeGuard(llvm::SmallVector<Scope, 8> *Scopes) : Scopes(Scopes) {
-    Scopes->emplace_back();
+  SymbolTable *Symbols;
+  bool OpensFrame;
+  explicit ScopeGuard(SymbolTable *Symbols, bool OpensFrame = false)
+      : Symbols(Symbols), OpensFrame(OpensFrame) {
+    if (OpensFrame)
+      Symbols->pushFrame();
+    Symbols->pushScope();
+  }
+  ~ScopeGuard() {
+    Symbols->popScope();
+    if (OpensFrame)
+      Symbols->popFrame();
   }
-  ~ScopeGuard() { Scopes->pop_back(); }
   ScopeGuard(const ScopeGuard &) = delete;
   ScopeGuard &operator=(const ScopeGuard &) = delete;
 };
 
 class NameResolver {
-  llvm::SmallVector<Scope, 8> Scopes;
+  SymbolTable Symbols;
   DiagnosticEngine &Diags;
-  FileId File;
   ASTContext &Ctx;
+  // Where new nodes go: Ctx, or the arena of the body being streamed.
+  ASTContext *Nodes = &Ctx;
+  // Where diagnostics go: Diags, or a buffer of analyzeParallel().
+  DiagnosticEngine *Sink = &Diags;
+  // Resolving on a pool thread: deferred bodies are loaded into Nodes and
+  // report to Sink instead of going through getBody().
+  bool OnWorker = false;
 
-  void declare(llvm::StringRef Name, Symbol S);
-  const Symbol *lookup(llvm::StringRef Name) const;
-
-  void errorSymbolRedeclared(llvm::StringRef Name, Span NewSpan, Span OldSpan);
-  void errorCalleeUndefined(llvm::StringRef Name, Span CallSpan);
-  void errorCalleeNotCallable(llvm::StringRef Name, Span CallSpan,
-                              Span DeclSpan);
-  void errorCalleeArityMismatch(llvm::StringRef Name, Span CallSpan,
-                                Span DeclSpan, size_t Expected, size_t Got);
+  void errorSymbolRedeclared(Atom Id, Span NewSpan, Span OldSpan);
+  void errorCalleeUndefined(Atom Id, Span CallSpan);
+  void errorCalleeNotCallable(Atom Id, Span CallSpan, Span DeclSpan);
+  void errorCalleeArityMismatch(Atom Id, Span CallSpan, Span DeclSpan,
+                                size_t Expected, size_t Got);
   void errorCalleeExprNotCallable(Span CallSpan);
-  void errorUndefinedDecl(llvm::StringRef Name, Span UseSpan);
-  void errorVarRefNotAVariable(llvm::StringRef Name, Span UseSpan,
-                               Span DeclSpan);
-  void errorAssignToImmutable(llvm::StringRef Name, Span AssignSpan,
-                              Span DeclSpan);
+  void errorUndefinedDecl(Atom Id, Span UseSpan);
+  void errorVarRefNotAVariable(Atom Id, Span UseSpan, Span DeclSpan);
+  void errorAssignToImmutable(Atom Id, Span AssignSpan, Span DeclSpan);
 
   void analyzeStmt(Stmt &S);
   void analyzeExpr(Expr &E);
   void analyzeBlock(BlockExpr &B);
+  void analyzeFunction(FunctionDecl &Fn);
+  void declareFunctions(Module &M);
 
 public:
-  NameResolver(DiagnosticEngine &Diags, FileId File, ASTContext &Ctx)
-      : Diags(Diags), File(File), Ctx(Ctx) {}
+  NameResolver(DiagnosticEngine &Diags, ASTContext &Ctx)
+      : Diags(Diags), Ctx(Ctx) {}
   void analyze(Module &M);
+
+  // For a module parsed with deferred bodies: resolves the top-level
+  // statements in order and passes each to Consume. A def with a deferred
+  // body has it parsed into Arena, a child of Ctx, for the resolution and the
+  // Consume call; then the body is deferred again and Arena reset. Only one
+  // such body is in memory at a time, and links into it do not outlive
+  // Consume.
+  void analyzeStreaming(Module &M, ASTContext &Arena,
+                        llvm::function_ref<void(Stmt &)> Consume);
+
+  // Same links and diagnostics as analyze(), but top-level defs are resolved
+  // on Pool, about ChunkFunctions to a task, each against the global scope
+  // as it stood at that def. A task has a scope stack and a diagnostic
+  // buffer per def of its own, and builds nodes in a child of Ctx that Ctx
+  // then adopts; the buffers are emitted in source order once all are done.
+  // A deferred body of such a def is parsed by its task, with errors
+  // reported here among the resolver's rather than to the parser's engine.
+  static constexpr std::size_t DefaultChunkFunctions = 64;
+  void analyzeParallel(Module &M, llvm::ThreadPoolInterface &Pool,
+                       std::size_t ChunkFunctions = DefaultChunkFunctions);
+
+  // For resolving defs one at a time, as the QueryEngine does: declares M's
+  // defs and resolves every other top-level statement, calling OnDef with
+  // each def and the mark() of the global scope when it came up. The global
+  // scope stays open for analyzeFunctionAt().
+  void analyzeTopLevel(
+      Module &M,
+      llvm::function_ref<void(FunctionDecl &, std::uint32_t)> OnDef);
+
+  // Resolves Fn against the global scope Globals was left with by
+  // analyzeTopLevel(), as it stood at Mark. Globals is only read, so any
+  // number of resolvers may share it.
+  void analyzeFunctionAt(FunctionDecl &Fn, const NameResolver &Globals,
+                         std::uint32_t Mark);
 };
 
 } // namespace rheo
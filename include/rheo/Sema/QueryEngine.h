@@ -0,0 +1,297 @@
+#ifndef RHEO_QUERY_ENGINE_H
+#define RHEO_QUERY_ENGINE_H
+
+#include "rheo/AST/AST.h"
+#include "rheo/Diagnostics/DiagnosticEngine.h"
+#include "rheo/Diagnostics/Diagnostics.h"
+#include "rheo/Diagnostics/SourceLocation.h"
+#include "rheo/Diagnostics/SourceManager.h"
+#include "rheo/Frontend/TokenBuffer.h"
+#include "rheo/Sema/NameResolver.h"
+#include "rheo/Sema/TypeChecker.h"
+#include <cstdint>
+#include <deque>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace rheo {
+
+enum class QueryKind : std::uint8_t {
+  Text,       // input: a file's text
+  Parse,      // file: its module
+  Definition, // top-level def: its node and when that was last parsed
+  Signature,  // top-level def: the types written on it
+  Globals,    // file: the global scope, other top-level statements resolved
+  Resolve,    // top-level def: its body resolved
+  Uses,       // top-level def: the defs it calls and globals it reads
+  Groups,     // file: its items grouped for inference
+  Group,      // group, by its first item: its items and what they use
+  Infer,      // group, by its first item: its types and schemes
+  Types       // file: every expression typed
+};
+
+inline constexpr std::size_t NumQueryKinds =
+    static_cast<std::size_t>(QueryKind::Types) + 1;
+
+// Demand-driven analysis of files that keep being edited, after Rust's
+// salsa. Each query result is memoized with the queries it read, the
+// revision it was last verified at and the revision its value last changed
+// at; every edit starts a new revision. A query asked for again first
+// brings what it read up to date, in the order it read it, and only runs
+// again if one of those changed since. A query that runs again and comes to
+// the same value keeps its old changed-at revision, so what read it does not
+// run again either.
+//
+// Top-level defs and variables keep their nodes across edits: a reparsed
+// item is copied into the node of the item it replaces, matched by name and
+// by which of the items of that name it is, so links into it stay valid.
+// Editing a def's body thus parses and resolves that def alone; the global
+// scope is rebuilt but compares equal. Changing what the global scope binds,
+// or a def's arity, resolves every def again.
+//
+// Types are inferred a group at a time (see TypeChecker), against the
+// schemes of the groups it uses. Editing a def infers its group again, and
+// the groups that use it only if its scheme changed. Regrouping the file
+// and checking its loose top-level statements, those that are neither a def
+// nor a variable, is redone after every edit.
+//
+// Diagnostics hold positions, which any edit may move: a query that reports
+// one also reads the parse of its file, so a def with errors is resolved
+// again after every edit of its file.
+//
+// Memory grows with the edits: every parse copies the list of top-level
+// statements, and a reparsed item leaves the nodes it was parsed into behind
+// in the context. An item with a new name gets memos of its own that stay.
+// Type variables are numbered per group, so inference adds no types past the
+// ones the biggest group needs.
+class QueryEngine {
+public:
+  using Revision = std::uint64_t;
+  // A top-level def or variable; the id stays while edits keep its node.
+  using ItemId = std::uint32_t;
+  using DefId = ItemId;
+
+  // The types written on a def, null where there are none.
+  struct Signature {
+    Atom Name;
+    llvm::SmallVector<const Type *, 4> Params;
+    const Type *Ret;
+    bool operator==(const Signature &) const = default;
+  };
+
+private:
+  using QueryKey = std::uint64_t;
+  static QueryKey key(QueryKind Kind, std::uint32_t Id) {
+    return std::uint64_t(Kind) << 32 | Id;
+  }
+
+  struct ParsedDef {
+    DefId Id;
+    FunctionDecl *Fn;
+    Revision ParsedAt;
+  };
+
+  static constexpr ItemId NoItem = ~ItemId(0);
+
+  // A top-level statement, and the revision it was last parsed at.
+  struct ParsedStmt {
+    ItemId Id; // NoItem unless a def or a variable
+    Revision ParsedAt;
+  };
+
+  struct ParsedFile {
+    Module M;
+    std::vector<Diagnostic> Diags;
+    // Top-level defs in order, and where each one is in it.
+    std::vector<ParsedDef> Defs;
+    llvm::DenseMap<DefId, std::uint32_t> DefIndex;
+    // One per statement of M.
+    std::vector<ParsedStmt> Stmts;
+  };
+
+  struct Definition {
+    FunctionDecl *Fn; // null once the def is gone
+    Revision ParsedAt;
+    bool operator==(const Definition &) const = default;
+  };
+
+  // A global binding, as much of it as a def body depends on: for a def its
+  // arity and the mark() it is resolved at, for a variable its slot and
+  // mutability.
+  struct GlobalEntry {
+    const void *Decl;
+    Atom Name;
+    std::uint32_t Info;
+    std::uint32_t Mark;
+    bool operator==(const GlobalEntry &) const = default;
+  };
+
+  struct DefScope {
+    std::uint32_t Mark;
+    std::size_t DiagsBefore;
+  };
+
+  struct GlobalScope {
+    std::unique_ptr<DiagnosticEngine> Diags;
+    // Left by analyzeTopLevel() with the global scope open.
+    std::unique_ptr<NameResolver> Resolver;
+    std::vector<GlobalEntry> Bindings;
+    llvm::DenseMap<DefId, DefScope> Scopes;
+    bool operator==(const GlobalScope &Other) const {
+      return Bindings == Other.Bindings;
+    }
+  };
+
+  struct Reported {
+    std::vector<Diagnostic> Diags;
+    // Only when neither has any: diagnostics do not compare.
+    bool operator==(const Reported &Other) const {
+      return Diags.empty() && Other.Diags.empty();
+    }
+  };
+
+  // What a def uses, as TypeChecker::uses() lists it.
+  struct Used {
+    llvm::SmallVector<const void *, 4> Decls;
+    bool operator==(const Used &) const = default;
+  };
+
+  // The file's groups in the order they are checked. A group of items is
+  // known by its first item, its leader.
+  struct Grouping {
+    std::vector<TypeChecker::Group> Groups;
+    llvm::DenseMap<ItemId, std::uint32_t> ByLeader;
+    // Per statement; NoItem for a loose one.
+    std::vector<ItemId> LeaderOf;
+  };
+
+  // One group, in the terms that stay put across edits.
+  struct GroupItems {
+    // Its items, and when each was last parsed.
+    llvm::SmallVector<std::pair<Stmt *, Revision>, 1> Items;
+    // The items of other groups it uses, and their leaders.
+    llvm::SmallVector<std::pair<Stmt *, ItemId>, 4> Uses;
+    bool operator==(const GroupItems &) const = default;
+  };
+
+  struct Inferred {
+    std::vector<Diagnostic> Diags;
+    llvm::SmallVector<std::pair<const Stmt *, TypeChecker::Scheme>, 1>
+        Schemes;
+    // As with Reported, only when neither has diagnostics.
+    bool operator==(const Inferred &Other) const {
+      return Diags.empty() && Other.Diags.empty() && Schemes == Other.Schemes;
+    }
+  };
+
+  using Value =
+      std::variant<std::monostate, ParsedFile, Definition, Signature,
+                   GlobalScope, Reported, Used, Grouping, GroupItems,
+                   Inferred>;
+
+  struct Memo {
+    Value Val;
+    Revision VerifiedAt = 0;
+    Revision ChangedAt = 0;
+    std::vector<QueryKey> Deps;
+    bool Running = false;
+  };
+
+  // An edit since the last parse, relexed into the file's tokens. Set only
+  // for the first edit after a parse without errors; otherwise the next
+  // parse starts from scratch.
+  struct PendingEdit {
+    std::uint32_t Offset;
+    std::uint32_t RemovedLen;
+    std::string Inserted;
+    TokenBuffer::RelexResult Changed;
+    std::vector<Diagnostic> Diags;
+  };
+
+  struct FileState {
+    llvm::StringRef ModuleName;
+    TokenBuffer Tokens;
+    bool CanReparse = false;
+    std::optional<PendingEdit> Edit;
+    // The top-level items of the last parse by name, kind and ordinal.
+    llvm::DenseMap<std::uint64_t, Stmt *> Items;
+  };
+
+  SourceManager SM;
+  ASTContext Ctx;
+  std::vector<FileState> Files;
+  llvm::DenseMap<const FunctionDecl *, DefId> DefIds;
+  llvm::DenseMap<const VarDecl *, ItemId> VarIds;
+  std::vector<FileId> ItemFiles;
+
+  Revision Current = 1;
+  // A deque, so that memos stay put while the queries they run add more.
+  std::deque<Memo> Memos;
+  llvm::DenseMap<QueryKey, Memo *> MemoOf;
+  // The queries running, innermost last; each records what it reads.
+  llvm::SmallVector<Memo *, 8> Active;
+  unsigned Runs[NumQueryKinds] = {};
+
+  Memo &memo(QueryKey Key);
+  // Brings Key up to date and returns the revision it last changed at.
+  Revision update(QueryKey Key);
+  void run(QueryKey Key, Memo &M);
+  template <typename T> T &fetch(QueryKind Kind, std::uint32_t Id);
+  // Whether the query has a value from an earlier run.
+  bool ranBefore(QueryKind Kind, std::uint32_t Id);
+
+  void keepIdentities(FileId File, const ParsedFile *Old, ParsedFile &New);
+  DefId defIdOf(const FunctionDecl &Fn) const;
+
+  Value compute(QueryKind Kind, std::uint32_t Id);
+  ParsedFile computeParse(FileId File);
+  Definition computeDefinition(DefId Def);
+  Signature computeSignature(DefId Def);
+  GlobalScope computeGlobals(FileId File);
+  Reported computeResolve(DefId Def);
+  Used computeUses(DefId Def);
+  Grouping computeGroups(FileId File);
+  GroupItems computeGroup(ItemId Leader);
+  Inferred computeInfer(ItemId Leader);
+  Reported computeTypes(FileId File);
+  // The schemes of the items used, read from the groups they are in.
+  void assumptions(llvm::ArrayRef<std::pair<Stmt *, ItemId>> Uses,
+                   std::vector<TypeChecker::Assumption> &Out);
+
+public:
+  FileId addFile(llvm::StringRef Name, llvm::StringRef Text);
+  // Starts a new revision. Views of the file's old text are invalidated,
+  // as with SourceManager::applyEdit().
+  void applyEdit(FileId File, const TextEdit &Edit);
+
+  [[nodiscard]] const SourceManager &sources() const { return SM; }
+  [[nodiscard]] ASTContext &context() { return Ctx; }
+  [[nodiscard]] Revision revision() const { return Current; }
+  // How many times queries of Kind have run, memo hits aside.
+  [[nodiscard]] unsigned runs(QueryKind Kind) const {
+    return Runs[static_cast<std::size_t>(Kind)];
+  }
+
+  // Results stay valid until the next edit.
+  const Module &parse(FileId File);
+  const Signature &signature(const FunctionDecl &Fn);
+  // Resolves a top-level def's body and returns what that reported.
+  llvm::ArrayRef<Diagnostic> resolve(const FunctionDecl &Fn);
+  // Null for a callee, as with TypeChecker.
+  const Type *typeOf(const Expr &E);
+
+  // What parsing and resolving the file reported, in source order.
+  std::vector<Diagnostic> diagnostics(FileId File);
+  llvm::ArrayRef<Diagnostic> typeDiagnostics(FileId File);
+};
+
+} // namespace rheo
+
+#endif // RHEO_QUERY_ENGINE_H
@@ -0,0 +1,211 @@
+#ifndef RHEO_TYPE_CHECKER_H
+#define RHEO_TYPE_CHECKER_H
+
+#include "rheo/AST/AST.h"
+#include "rheo/Diagnostics/DiagnosticEngine.h"
+#include "rheo/Diagnostics/SourceLocation.h"
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rheo {
+
+// Hindley-Milner inference over a module the NameResolver has been through.
+// Sets Expr::Ty on every expression but callees, which name a def, and
+// checks the types written on variables, parameters and return types.
+//
+// Types are flat: a builtin or named type, or a variable. Variables live in
+// a union-find forest (path halving, union by rank); a root may carry the
+// type it was unified with, or the requirement to be numeric. Functions are
+// not values, so only defs get polymorphic signatures: a def's parameters
+// and return type start one level deeper than the def, and whatever is still
+// deeper once its body is done is generalized, with no scan of the
+// environment. Each call instantiates the signature afresh.
+//
+// The top-level defs and variables are checked in groups, each after the
+// groups whose defs it calls and whose variables it reads; a group is one
+// item, or items that use each other in a cycle. Within a group, items go in
+// source order, and a call to a def before its body has been inferred uses
+// the signature as it is, which leaves that def monomorphic. Once the group
+// is done, every variable left in its signatures and its variables' types is
+// generalized: later groups see only those schemes, so a group can be
+// checked on its own given the schemes of what it uses (analyzeGroup()).
+// A global whose type is still a variable can only hold the value of a call
+// that never returns, so generalizing it is sound. Every other top-level
+// statement is a group of its own.
+//
+// A def's signature is found through a map kept by the checker, a local
+// through its frame slot, and a global through its slot in a table of the
+// ones the group uses. A group's types are written to the tree when it is
+// done, so the union-find and the list of typed expressions only ever hold
+// one group. Type variables are numbered per group, in the order
+// they come up: ?T0 in one def is unrelated to ?T0 in another.
+//
+// A block has the type of its tail, Unit without one, or Never if it ends in
+// a return or another Never statement. A while has the type of its break
+// values, Unit if it has no break. break, continue and return are Never, and
+// Never unifies with anything.
+class TypeChecker {
+public:
+  // What a top-level def or variable leaves for the groups after its own:
+  // the signature of a def, or in Ret the type of a variable. Every variable
+  // in it is generalized; they are numbered from 0 in order of appearance.
+  struct Scheme {
+    llvm::SmallVector<const Type *, 4> Params;
+    const Type *Ret = nullptr;
+    // The variables that must be numeric.
+    llvm::SmallVector<std::uint32_t, 2> Numeric;
+    bool operator==(const Scheme &) const = default;
+  };
+
+  // Top-level statements checked together, as indices into the module's.
+  struct Group {
+    // In source order.
+    llvm::SmallVector<std::uint32_t, 1> Stmts;
+    // The defs and variables of other groups that these call or read.
+    llvm::SmallVector<std::uint32_t, 4> Uses;
+  };
+
+  // A def or variable of an earlier group, and its scheme.
+  using Assumption = std::pair<Stmt *, const Scheme *>;
+
+
+private:
+  using TyId = std::uint32_t;
+  static constexpr std::uint32_t Generic = ~std::uint32_t(0);
+  static constexpr TyId NoTy = ~TyId(0);
+  static constexpr std::uint32_t NoName = ~std::uint32_t(0);
+
+  struct Node {
+    TyId Parent;
+    std::uint32_t Level;
+    std::uint8_t Rank = 0;
+    bool Numeric = false;
+    // The variable's TypeVar id, given when it is first spelled or written.
+    std::uint32_t Name = NoName;
+    const Type *Con = nullptr; // set once the variable is a known type
+  };
+
+  // Indexed through SigOf. The types are made when first needed, by a call
+  // or by the def's own body.
+  struct Signature {
+    std::uint32_t DeclLevel = 0; // of the scope the def is declared in
+    llvm::SmallVector<TyId, 4> Params;
+    TyId Ret = NoTy;
+    bool Generalized = false;
+  };
+
+  // A def whose body is being inferred, or the module, and for a def where
+  // its frame slots are in Locals.
+  struct Frame {
+    const FunctionDecl *Fn;
+    std::uint32_t Sig;
+    std::uint32_t Base;
+    std::uint32_t Size;
+  };
+
+  // The variable a frame slot holds, and its type.
+  struct Local {
+    const VarDecl *Decl = nullptr;
+    TyId Ty = NoTy;
+  };
+
+  struct Loop {
+    TyId Ty;
+    bool HasBreak = false;
+  };
+
+  DiagnosticEngine &Diags;
+  // Where diagnostics go; analyze() holds them back to report in source
+  // order.
+  DiagnosticEngine *Sink = &Diags;
+  ASTContext &Ctx;
+  std::vector<Node> Nodes;
+  TyId Builtins[NumBuiltinKinds];
+  std::uint32_t Level = 0;
+  std::uint32_t NumNames = 0;
+
+  std::vector<Signature> Sigs;
+  llvm::DenseMap<const FunctionDecl *, std::uint32_t> SigOf;
+  llvm::SmallVector<Frame, 8> Frames;
+  // The slots of every frame in Frames but the module's, outermost first.
+  std::vector<Local> Locals;
+  // The module's slots, by slot. A group reads a few of the globals, and
+  // there may be many, so only those are kept.
+  llvm::DenseMap<std::uint32_t, Local> Globals;
+  llvm::SmallVector<Loop, 8> Loops;
+  // Each expression and its type, written to Expr::Ty once the group is
+  // unified.
+  std::vector<std::pair<Expr *, TyId>> Typed;
+
+  void reset();
+  TyId fresh();
+  TyId builtin(BuiltinKind K) { return Builtins[static_cast<unsigned>(K)]; }
+  TyId typeOf(TypeLoc Written);
+  TyId find(TyId T);
+  [[nodiscard]] bool is(TyId T, BuiltinKind K);
+  bool unify(TyId A, TyId B);
+  bool requireNumeric(TyId T);
+
+  void declare(FunctionDecl &Fn);
+  std::uint32_t signature(FunctionDecl &Fn,
+                          std::optional<std::uint32_t> AtLevel = {});
+  void instantiate(const Signature &Sig, llvm::SmallVectorImpl<TyId> &Out);
+  void generalize(Signature &Sig);
+  void pushFrame(const FunctionDecl *Fn, std::uint32_t Sig,
+                 std::uint32_t Size);
+  void popFrame();
+  Local *slot(Frame &F, std::uint32_t Slot);
+  TyId variable(const VarRef &Ref);
+  TyId copyIfGeneric(TyId T);
+
+  void assume(Stmt &Item, const Scheme &S);
+  Scheme close(const Stmt &Item);
+
+  std::uint32_t name(TyId Root);
+  std::string spell(TyId T);
+  void errorMismatch(Span Use, TyId Expected, TyId Found,
+                     TypeLoc Annotation = {});
+  void errorNotNumeric(Span Use, llvm::StringRef Op, TyId Found);
+
+  void declareFunctions(llvm::ArrayRef<Stmt *> Stmts);
+  void inferFunction(FunctionDecl &Fn, Span Location);
+  TyId inferBlock(BlockExpr &B);
+  TyId inferExpr(Expr &E);
+  TyId inferExprKind(Expr &E);
+  // Whether S never finishes.
+  bool inferStmt(Stmt &S);
+
+public:
+  TypeChecker(DiagnosticEngine &Diags, ASTContext &Ctx);
+  // Checks every group of M, reporting in source order.
+  void analyze(Module &M);
+
+  // What S calls, and the top-level variables it reads, in order: each a
+  // FunctionDecl or a VarDecl.
+  static void uses(Stmt &S, llvm::SmallVectorImpl<const void *> &Decls);
+  static void uses(FunctionDecl &Fn, llvm::SmallVectorImpl<const void *> &Decls);
+  // The groups of a module's top-level statements, each after the groups it
+  // uses. UsesOf(I) is uses() of Stmts[I]; only the defs and variables among
+  // Stmts count.
+  static std::vector<Group>
+  groups(llvm::ArrayRef<Stmt *> Stmts,
+         llvm::function_ref<llvm::ArrayRef<const void *>(std::uint32_t)>
+             UsesOf);
+  // Checks one group against the schemes of what it uses and returns the
+  // schemes its statements leave, in order; empty for those that are neither
+  // a def nor a variable.
+  std::vector<Scheme> analyzeGroup(llvm::ArrayRef<Stmt *> Stmts,
+                                   llvm::ArrayRef<Assumption> Uses);
+};
+
+} // namespace rheo
+
+#endif // RHEO_TYPE_CHECKER_H
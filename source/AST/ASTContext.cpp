@@ -0,0 +1,81 @@
+#include "rheo/AST/AST.h"
+#include <format>
+#include <llvm/ADT/StringRef.h>
+
+namespace rheo {
+
+namespace {
+
+constexpr llvm::StringRef AllocKindNames[NumAllocKinds] = {
+    "Expr",     "Stmt",     "BlockExpr", "FunctionDecl", "VarDecl", "LazyBody",
+    "Stmt *[]", "Expr *[]", "Param[]",   "string",       "other",
+};
+
+constexpr llvm::StringRef ExprKindNames[NumExprKinds] = {
+    "IntLiteral", "FloatLiteral", "BoolLiteral", "UnitLiteral", "UnaryExpr",
+    "BinaryExpr", "CallExpr",     "VarRef",      "BlockExpr",   "IfExpr",
+    "WhileExpr",  "BreakExpr",    "ContinueExpr",
+};
+
+constexpr llvm::StringRef StmtKindNames[NumStmtKinds] = {
+    "ExprStmt", "ReturnStmt", "VarDecl", "AssignStmt", "FunctionDecl",
+};
+
+} // namespace
+
+ASTStats &ASTStats::operator+=(const ASTStats &Other) {
+  for (std::size_t I = 0; I < NumAllocKinds; ++I) {
+    Allocs[I].Count += Other.Allocs[I].Count;
+    Allocs[I].Bytes += Other.Allocs[I].Bytes;
+  }
+  for (std::size_t I = 0; I < NumExprKinds; ++I)
+    ExprKinds[I] += Other.ExprKinds[I];
+  for (std::size_t I = 0; I < NumStmtKinds; ++I)
+    StmtKinds[I] += Other.StmtKinds[I];
+  Slabs += Other.Slabs;
+  BytesReserved += Other.BytesReserved;
+  BytesAllocated += Other.BytesAllocated;
+  return *this;
+}
+
+void ASTStats::print(llvm::raw_ostream &OS) const {
+  std::uint64_t Unused = BytesReserved - BytesAllocated;
+  OS << "*** AST Stats:\n";
+  OS << std::format("  {} slabs, {} bytes reserved, {} allocated, {} unused "
+                    "({:.1f}%)\n",
+                    Slabs, BytesReserved, BytesAllocated, Unused,
+                    BytesReserved ? 100.0 * Unused / BytesReserved : 0.0);
+  OS << std::format("  {:<14} {:>10} {:>12} {:>8}\n", "allocation", "count",
+                    "bytes", "avg");
+  for (std::size_t I = 0; I < NumAllocKinds; ++I)
+    if (Allocs[I].Count)
+      OS << std::format("  {:<14} {:>10} {:>12} {:>8.1f}\n",
+                        AllocKindNames[I].str(), Allocs[I].Count,
+                        Allocs[I].Bytes,
+                        double(Allocs[I].Bytes) / Allocs[I].Count);
+  OS << std::format("  {:<14} {:>10}\n", "Expr kind", "count");
+  for (std::size_t I = 0; I < NumExprKinds; ++I)
+    if (ExprKinds[I])
+      OS << std::format("  {:<14} {:>10}\n", ExprKindNames[I].str(),
+                        ExprKinds[I]);
+  OS << std::format("  {:<14} {:>10}\n", "Stmt kind", "count");
+  for (std::size_t I = 0; I < NumStmtKinds; ++I)
+    if (StmtKinds[I])
+      OS << std::format("  {:<14} {:>10}\n", StmtKindNames[I].str(),
+                        StmtKinds[I]);
+  OS << std::format("  {} uniqued non-builtin types\n", Types);
+}
+
+ASTStats ASTContext::getStats() const {
+  ASTStats Total = Stats;
+  Total.Slabs = Alloc.GetNumSlabs();
+  Total.BytesReserved = Alloc.getTotalMemory();
+  Total.BytesAllocated = Alloc.getBytesAllocated();
+  for (const auto &Child : Adopted)
+    Total += Child->getStats();
+  // Children share this context's type table.
+  Total.Types = Types->size();
+  return Total;
+}
+
+} // namespace rheo
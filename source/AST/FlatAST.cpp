@@ -0,0 +1,954 @@
+#include "rheo/AST/FlatAST.h"
+#include "rheo/AST/Print.h"
+#include "rheo/Common.h"
+#include <algorithm>
+#include <bit>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace rheo {
+
+// Appends nodes parent first. A node's own slots (and its lists in Extra) are
+// reserved before its children are built, so children always get higher ids
+// and every list stays contiguous. The type node of an expression is the
+// exception: it is added where the first expression of that type finishes.
+class FlatASTBuilder {
+  // The arrays under construction; the tree only gets views of them.
+  struct Arrays {
+    std::string Name;
+    std::vector<NodeKind> Kinds;
+    std::vector<std::uint8_t> Flags;
+    std::vector<Span> Spans;
+    std::vector<NodeData> Data;
+    std::vector<std::uint32_t> Extra;
+    std::vector<NodeId> Types;
+  };
+
+  FlatAST &Tree;
+  std::shared_ptr<Arrays> Owned = std::make_shared<Arrays>();
+  Arrays &Out = *Owned;
+
+  // Resolved links are patched once every declaration has an id, since calls
+  // may refer to functions defined further down.
+  llvm::DenseMap<const void *, NodeId> DeclIds;
+  std::vector<std::pair<std::uint32_t, const void *>> Links;
+
+  // Parameters of the functions being built, innermost last. The resolver
+  // gives every parameter a VarDecl of its own outside the tree, so a
+  // reference to one is matched by name against the enclosing functions.
+  llvm::SmallVector<std::pair<Atom, NodeId>, 16> Params;
+
+  // The node standing for each type an expression has. Types are uniqued, so
+  // one node serves every expression of that type.
+  llvm::DenseMap<const Type *, NodeId> ExprTypeIds;
+  bool AnyTyped = false;
+
+  NodeId add(NodeKind Kind, Span Location, std::uint8_t Flags = 0) {
+    auto N = static_cast<NodeId>(Out.Kinds.size());
+    Out.Kinds.push_back(Kind);
+    Out.Flags.push_back(Flags);
+    Out.Spans.push_back(Location);
+    Out.Data.emplace_back();
+    Out.Types.push_back(NoNode);
+    return N;
+  }
+
+  // Reserves Fixed slots in Extra, optionally followed by a list of Count
+  // entries.
+  std::uint32_t reserve(std::uint32_t Fixed) {
+    auto At = static_cast<std::uint32_t>(Out.Extra.size());
+    Out.Extra.resize(At + Fixed, NoNode);
+    return At;
+  }
+
+  std::uint32_t reserve(std::uint32_t Fixed, std::size_t Count) {
+    auto N = static_cast<std::uint32_t>(Count);
+    std::uint32_t At = reserve(Fixed + 1 + N);
+    Out.Extra[At + Fixed] = N;
+    return At;
+  }
+
+  static Span noSpan() { return {0, 0}; }
+
+  NodeId type(const Type *T, Span Location) {
+    if (!T)
+      return NoNode;
+    return std::visit(
+        Overloaded{[&](const BuiltinType &B) {
+                     return add(NodeKind::BuiltinType, Location,
+                                static_cast<std::uint8_t>(B.Kind));
+                   },
+                   [&](const NamedType &Named) {
+                     NodeId N = add(NodeKind::NamedType, Location);
+                     Out.Data[N].A = Named.Name;
+                     return N;
+                   },
+                   [&](const TypeVar &Var) {
+                     NodeId N = add(NodeKind::TypeVar, Location);
+                     Out.Data[N].A = Var.Id;
+                     return N;
+                   }},
+        T->Kind);
+  }
+  NodeId type(TypeLoc T) { return type(T.Ty, T.Location); }
+
+  NodeId block(const BlockExpr &B, Span Location) {
+    NodeId N = add(NodeKind::Block, Location);
+    std::uint32_t List = reserve(0, B.Stmts.size());
+    Out.Data[N].A = List;
+    for (std::size_t I = 0; I < B.Stmts.size(); ++I)
+      Out.Extra[List + 1 + I] = stmt(*B.Stmts[I]);
+    Out.Data[N].B = B.Tail ? expr(*B.Tail) : NoNode;
+    return N;
+  }
+
+  NodeId varRef(const VarRef &Ref, Span Location) {
+    NodeId N = add(NodeKind::VarRef, Location);
+    Out.Data[N].A = Ref.Name;
+    if (!Ref.Resolved)
+      return N;
+    if (auto It = DeclIds.find(Ref.Resolved); It != DeclIds.end()) {
+      Out.Data[N].B = It->second;
+      return N;
+    }
+    auto Param = std::find_if(Params.rbegin(), Params.rend(), [&](auto &P) {
+      return P.first == Ref.Name;
+    });
+    if (Param != Params.rend())
+      Out.Data[N].B = Param->second;
+    return N;
+  }
+
+  NodeId expr(const Expr &E) {
+    NodeId Id = std::visit(
+        Overloaded{
+            [&](const IntLiteral &L) {
+              NodeId N = add(NodeKind::IntLiteral, E.Location);
+              Out.Data[N] = {static_cast<std::uint32_t>(L.Value),
+                              static_cast<std::uint32_t>(L.Value >> 32)};
+              return N;
+            },
+            [&](const FloatLiteral &L) {
+              NodeId N = add(NodeKind::FloatLiteral, E.Location);
+              auto Bits = std::bit_cast<std::uint64_t>(L.Value);
+              Out.Data[N] = {static_cast<std::uint32_t>(Bits),
+                              static_cast<std::uint32_t>(Bits >> 32)};
+              return N;
+            },
+            [&](const BoolLiteral &L) {
+              return add(NodeKind::BoolLiteral, E.Location, L.Value);
+            },
+            [&](const UnitLiteral &) {
+              return add(NodeKind::UnitLiteral, E.Location);
+            },
+            [&](const UnaryExpr &U) {
+              NodeId N = add(NodeKind::Unary, E.Location, U.Op);
+              Out.Data[N].A = expr(*U.Operand);
+              return N;
+            },
+            [&](const BinaryExpr &B) {
+              NodeId N = add(NodeKind::Binary, E.Location, B.Op);
+              Out.Data[N].A = expr(*B.Lhs);
+              Out.Data[N].B = expr(*B.Rhs);
+              return N;
+            },
+            [&](const CallExpr &C) {
+              NodeId N = add(NodeKind::Call, E.Location);
+              std::uint32_t At = reserve(1, C.Args.size());
+              Out.Data[N].B = At;
+              if (C.Resolved)
+                Links.emplace_back(At, C.Resolved);
+              Out.Data[N].A = expr(*C.Callee);
+              for (std::size_t I = 0; I < C.Args.size(); ++I)
+                Out.Extra[At + 2 + I] = expr(*C.Args[I]);
+              return N;
+            },
+            [&](const VarRef &Ref) { return varRef(Ref, E.Location); },
+            [&](const BlockExpr *B) { return block(*B, E.Location); },
+            [&](const IfExpr &I) {
+              NodeId N = add(NodeKind::If, E.Location);
+              std::uint32_t At = reserve(2);
+              Out.Data[N].B = At;
+              Out.Data[N].A = expr(*I.Condition);
+              Out.Extra[At] = block(*I.ThenBlock, noSpan());
+              if (I.ElseBranch)
+                Out.Extra[At + 1] = block(*I.ElseBranch, noSpan());
+              return N;
+            },
+            [&](const WhileExpr &W) {
+              NodeId N = add(NodeKind::While, E.Location);
+              Out.Data[N].A = expr(*W.Condition);
+              Out.Data[N].B = block(*W.Body, noSpan());
+              return N;
+            },
+            [&](const BreakExpr &B) {
+              NodeId N = add(NodeKind::Break, E.Location);
+              if (B.Value)
+                Out.Data[N].A = expr(*B.Value);
+              return N;
+            },
+            [&](const ContinueExpr &) {
+              return add(NodeKind::Continue, E.Location);
+            }},
+        E.Kind);
+    if (E.Ty) {
+      auto [It, Inserted] = ExprTypeIds.try_emplace(E.Ty, NoNode);
+      if (Inserted)
+        It->second = type(E.Ty, noSpan());
+      Out.Types[Id] = It->second;
+      AnyTyped = true;
+    }
+    return Id;
+  }
+
+  NodeId function(const FunctionDecl &F, Span Location) {
+    NodeId N = add(NodeKind::Function, Location);
+    DeclIds[&F] = N;
+    std::uint32_t At = reserve(3, F.Params.size());
+    Out.Data[N] = {F.Name, At};
+    Out.Extra[At + 2] = F.NumLocals;
+    auto Outer = Params.size();
+    for (std::size_t I = 0; I < F.Params.size(); ++I) {
+      const auto &P = F.Params[I];
+      NodeId PN = add(NodeKind::Param, P.Location);
+      // type() may grow Data, so it runs before the element is named.
+      NodeId Ty = type(P.Ty);
+      Out.Data[PN] = {P.Name, Ty};
+      Out.Extra[At + 4 + I] = PN;
+      Params.emplace_back(P.Name, PN);
+    }
+    Out.Extra[At] = type(F.ReturnType);
+    if (auto *Body = F.getBody())
+      Out.Extra[At + 1] = block(*Body, noSpan());
+    Params.resize(Outer);
+    return N;
+  }
+
+  NodeId stmt(const Stmt &S) {
+    return std::visit(
+        Overloaded{[&](const ExprStmt &E) {
+                     NodeId N = add(NodeKind::ExprStmt, S.Location);
+                     Out.Data[N].A = expr(*E.Expr);
+                     return N;
+                   },
+                   [&](const ReturnStmt &R) {
+                     NodeId N = add(NodeKind::Return, S.Location);
+                     if (R.Value)
+                       Out.Data[N].A = expr(*R.Value);
+                     return N;
+                   },
+                   [&](const VarDecl &V) {
+                     NodeId N = add(NodeKind::VarDecl, S.Location, V.IsMut);
+                     DeclIds[&V] = N;
+                     std::uint32_t At = reserve(3);
+                     Out.Data[N] = {V.Name, At};
+                     Out.Extra[At] = type(V.Ty);
+                     Out.Extra[At + 2] = V.Slot;
+                     if (V.Init)
+                       Out.Extra[At + 1] = expr(*V.Init);
+                     return N;
+                   },
+                   [&](const AssignStmt &A) {
+                     NodeId N = add(NodeKind::Assign, S.Location);
+                     Out.Data[N].A = expr(*A.Target);
+                     Out.Data[N].B = expr(*A.Value);
+                     return N;
+                   },
+                   [&](const FunctionDecl *F) {
+                     return function(*F, S.Location);
+                   }},
+        S.Kind);
+  }
+
+public:
+  explicit FlatASTBuilder(FlatAST &Tree) : Tree(Tree) {}
+
+  void build(const Module &M) {
+    Out.Name = M.Name.str();
+    add(NodeKind::Invalid, noSpan());
+    Tree.TopLevel = reserve(0, M.Stmts.size());
+    Tree.NumGlobals = M.NumGlobals;
+    for (std::size_t I = 0; I < M.Stmts.size(); ++I)
+      Out.Extra[Tree.TopLevel + 1 + I] = stmt(*M.Stmts[I]);
+    for (auto [At, Decl] : Links)
+      Out.Extra[At] = DeclIds.lookup(Decl);
+    if (!AnyTyped)
+      Out.Types.clear();
+
+    Tree.Name = Out.Name;
+    Tree.Kinds = Out.Kinds;
+    Tree.Flags = Out.Flags;
+    Tree.Spans = Out.Spans;
+    Tree.Data = Out.Data;
+    Tree.Extra = Out.Extra;
+    Tree.Types = Out.Types;
+    Tree.Storage = std::move(Owned);
+  }
+};
+
+FlatAST FlatAST::build(const Module &M) {
+  FlatAST Tree;
+  FlatASTBuilder(Tree).build(M);
+  return Tree;
+}
+
+namespace {
+
+// The inverse of FlatASTBuilder. Resolved links are patched at the end, as
+// calls may refer to functions defined further down.
+class FlatASTExpander {
+  const FlatAST &Tree;
+  ASTContext &Ctx;
+  // The FunctionDecl or VarDecl built for each declaring node, and for a
+  // variable how many defs enclose its frame.
+  std::vector<void *> Decls;
+  std::vector<std::uint32_t> DeclFrames;
+  std::vector<std::pair<CallExpr *, NodeId>> Calls;
+  // Each reference, its declaration and how many defs enclose it. A VarRef's
+  // slot is its declaration's, and its depth is the difference in frames,
+  // so neither is stored.
+  struct PendingRef {
+    VarRef *Ref;
+    NodeId Decl;
+    std::uint32_t Frame;
+  };
+  std::vector<PendingRef> Refs;
+  std::uint32_t Frame = 0;
+
+  TypeLoc type(NodeId N) {
+    if (N == NoNode)
+      return {};
+    auto D = Tree.data(N);
+    switch (Tree.kind(N)) {
+    case NodeKind::BuiltinType:
+      return {Ctx.getBuiltinType(static_cast<BuiltinKind>(Tree.flags(N))),
+              Tree.span(N)};
+    case NodeKind::NamedType:
+      return {Ctx.getType(NamedType{D.A}), Tree.span(N)};
+    case NodeKind::TypeVar:
+      return {Ctx.getType(TypeVar{D.A}), Tree.span(N)};
+    default:
+      llvm_unreachable("not a type node");
+    }
+  }
+
+  llvm::ArrayRef<Stmt *> stmts(llvm::ArrayRef<NodeId> Ids) {
+    llvm::SmallVector<Stmt *, 8> Out;
+    Out.reserve(Ids.size());
+    for (NodeId S : Ids)
+      Out.push_back(stmt(S));
+    return Ctx.copyArray(llvm::ArrayRef<Stmt *>(Out));
+  }
+
+  BlockExpr *block(NodeId N) {
+    auto D = Tree.data(N);
+    auto Stmts = stmts(Tree.list(D.A));
+    return Ctx.create<BlockExpr>(Stmts, D.B ? expr(D.B) : nullptr);
+  }
+
+  Expr *expr(NodeId N) {
+    Span Loc = Tree.span(N);
+    auto D = Tree.data(N);
+    Expr *E = nullptr;
+    switch (Tree.kind(N)) {
+    case NodeKind::IntLiteral:
+      E = Ctx.create<Expr>(Loc, IntLiteral{std::uint64_t(D.B) << 32 | D.A});
+      break;
+    case NodeKind::FloatLiteral:
+      E = Ctx.create<Expr>(Loc, FloatLiteral{std::bit_cast<double>(
+                                    std::uint64_t(D.B) << 32 | D.A)});
+      break;
+    case NodeKind::BoolLiteral:
+      E = Ctx.create<Expr>(Loc, BoolLiteral{Tree.flags(N) != 0});
+      break;
+    case NodeKind::UnitLiteral:
+      E = Ctx.create<Expr>(Loc, UnitLiteral{});
+      break;
+    case NodeKind::Unary:
+      E = Ctx.create<Expr>(
+          Loc, UnaryExpr{static_cast<UnaryOp>(Tree.flags(N)), expr(D.A)});
+      break;
+    case NodeKind::Binary: {
+      auto *Lhs = expr(D.A);
+      E = Ctx.create<Expr>(Loc, BinaryExpr{static_cast<BinaryOp>(Tree.flags(N)),
+                                           Lhs, expr(D.B)});
+      break;
+    }
+    case NodeKind::Call: {
+      auto *Callee = expr(D.A);
+      llvm::SmallVector<Expr *, 4> Args;
+      for (NodeId Arg : Tree.list(D.B + 1))
+        Args.push_back(expr(Arg));
+      E = Ctx.create<Expr>(
+          Loc, CallExpr{Callee, Ctx.copyArray(llvm::ArrayRef<Expr *>(Args))});
+      if (NodeId Fn = Tree.extra(D.B))
+        Calls.emplace_back(&std::get<CallExpr>(E->Kind), Fn);
+      break;
+    }
+    case NodeKind::VarRef:
+      E = Ctx.create<Expr>(Loc, VarRef{D.A});
+      if (D.B)
+        Refs.push_back({&std::get<VarRef>(E->Kind), D.B, Frame});
+      break;
+    case NodeKind::Block:
+      E = Ctx.create<Expr>(Loc, block(N));
+      break;
+    case NodeKind::If: {
+      auto *Cond = expr(D.A);
+      auto *Then = block(Tree.extra(D.B));
+      NodeId Else = Tree.extra(D.B + 1);
+      E = Ctx.create<Expr>(Loc,
+                           IfExpr{Cond, Then, Else ? block(Else) : nullptr});
+      break;
+    }
+    case NodeKind::While: {
+      auto *Cond = expr(D.A);
+      E = Ctx.create<Expr>(Loc, WhileExpr{Cond, block(D.B)});
+      break;
+    }
+    case NodeKind::Break:
+      E = Ctx.create<Expr>(Loc, BreakExpr{D.A ? expr(D.A) : nullptr});
+      break;
+    case NodeKind::Continue:
+      E = Ctx.create<Expr>(Loc, ContinueExpr{});
+      break;
+    default:
+      llvm_unreachable("not an expression node");
+    }
+    E->Ty = type(Tree.exprType(N)).Ty;
+    return E;
+  }
+
+  FunctionDecl *function(NodeId N) {
+    auto D = Tree.data(N);
+    llvm::SmallVector<Param, 4> Params;
+    for (NodeId P : Tree.list(D.B + 3)) {
+      auto PD = Tree.data(P);
+      Params.push_back({PD.A, type(PD.B), Tree.span(P)});
+      auto *Decl = Ctx.create<VarDecl>(
+          VarDecl{PD.A, false, Params.back().Ty, nullptr});
+      Decl->setSlot(static_cast<std::uint32_t>(Params.size() - 1));
+      Decls[P] = Decl;
+      DeclFrames[P] = Frame + 1;
+    }
+    TypeLoc Ret = type(Tree.extra(D.B));
+    NodeId Body = Tree.extra(D.B + 1);
+    ++Frame;
+    auto *F = Ctx.create<FunctionDecl>(
+        D.A, Ctx.copyArray(llvm::ArrayRef<Param>(Params)), Ret,
+        Body ? block(Body) : nullptr);
+    --Frame;
+    F->NumLocals = Tree.extra(D.B + 2);
+    Decls[N] = F;
+    return F;
+  }
+
+  Stmt *stmt(NodeId N) {
+    Span Loc = Tree.span(N);
+    auto D = Tree.data(N);
+    switch (Tree.kind(N)) {
+    case NodeKind::ExprStmt:
+      return Ctx.create<Stmt>(Loc, ExprStmt{expr(D.A)});
+    case NodeKind::Return:
+      return Ctx.create<Stmt>(Loc, ReturnStmt{D.A ? expr(D.A) : nullptr});
+    case NodeKind::VarDecl: {
+      TypeLoc Ty = type(Tree.extra(D.B));
+      NodeId Init = Tree.extra(D.B + 1);
+      auto *S = Ctx.create<Stmt>(
+          Loc, VarDecl{D.A, Tree.flags(N) != 0, Ty,
+                       Init ? expr(Init) : nullptr});
+      auto &Decl = std::get<VarDecl>(S->Kind);
+      Decl.setSlot(Tree.extra(D.B + 2));
+      Decls[N] = &Decl;
+      DeclFrames[N] = Frame;
+      return S;
+    }
+    case NodeKind::Assign: {
+      auto *Target = expr(D.A);
+      return Ctx.create<Stmt>(Loc, AssignStmt{Target, expr(D.B)});
+    }
+    case NodeKind::Function:
+      return Ctx.create<Stmt>(Loc, function(N));
+    default:
+      llvm_unreachable("not a statement node");
+    }
+  }
+
+public:
+  FlatASTExpander(const FlatAST &Tree, ASTContext &Ctx)
+      : Tree(Tree), Ctx(Ctx), Decls(Tree.size()), DeclFrames(Tree.size()) {}
+
+  Module expand() {
+    auto Stmts = stmts(Tree.topLevel());
+    for (auto [Call, Fn] : Calls)
+      Call->Resolved = static_cast<FunctionDecl *>(Decls[Fn]);
+    for (auto [Ref, Decl, RefFrame] : Refs) {
+      Ref->Resolved = static_cast<VarDecl *>(Decls[Decl]);
+      Ref->Depth = RefFrame - DeclFrames[Decl];
+      Ref->Slot = Ref->Resolved->Slot;
+    }
+    return Module{Ctx.save(Tree.getName()), Stmts, Tree.numGlobals()};
+  }
+};
+
+} // namespace
+
+Module FlatAST::toModule(ASTContext &Ctx) const {
+  return FlatASTExpander(*this, Ctx).expand();
+}
+
+
+namespace {
+
+bool isType(NodeKind K) {
+  return K == NodeKind::BuiltinType || K == NodeKind::NamedType ||
+         K == NodeKind::TypeVar;
+}
+
+bool isExpr(NodeKind K) {
+  return K >= NodeKind::IntLiteral && K <= NodeKind::Continue;
+}
+
+bool isStmt(NodeKind K) {
+  return K >= NodeKind::ExprStmt && K <= NodeKind::Function;
+}
+
+bool isBlock(NodeKind K) { return K == NodeKind::Block; }
+
+} // namespace
+
+bool FlatAST::verify() const {
+  if (Kinds.empty() || Kinds[NoNode] != NodeKind::Invalid)
+    return false;
+  // Fixed slots Extra[At, At + Count).
+  auto Fixed = [&](std::uint32_t At, std::size_t Count) {
+    return std::size_t(At) + Count <= Extra.size();
+  };
+  auto List = [&](std::uint32_t At) {
+    return At < Extra.size() && Extra[At] <= Extra.size() - At - 1;
+  };
+  // A child of Parent; children come after their parent, which also rules
+  // out cycles, and have no other parent.
+  constexpr NodeId NoParent = ~NodeId(0);
+  std::vector<NodeId> Parents(size(), NoParent);
+  auto Child = [&](NodeId Parent, NodeId C, bool (*Is)(NodeKind),
+                   bool Optional = false) {
+    if (C == NoNode)
+      return Optional;
+    if (C <= Parent || C >= size() || !Is(Kinds[C]) || Parents[C] != NoParent)
+      return false;
+    Parents[C] = Parent;
+    return true;
+  };
+  auto Children = [&](NodeId Parent, std::uint32_t At, bool (*Is)(NodeKind)) {
+    return llvm::all_of(list(At),
+                        [&](NodeId C) { return Child(Parent, C, Is); });
+  };
+  // Types are leaves and may be shared, so they can come before their user.
+  auto TypeOf = [&](NodeId T) {
+    return T == NoNode || (T < size() && isType(Kinds[T]));
+  };
+  auto Link = [&](NodeId To, auto... Ks) {
+    return To == NoNode || (To < size() && ((Kinds[To] == Ks) || ...));
+  };
+
+  for (NodeId N = 1; N < size(); ++N) {
+    auto D = Data[N];
+    bool Ok = true;
+    switch (Kinds[N]) {
+    case NodeKind::BuiltinType:
+      Ok = Flags[N] < NumBuiltinKinds;
+      break;
+    case NodeKind::NamedType:
+    case NodeKind::TypeVar:
+    case NodeKind::IntLiteral:
+    case NodeKind::FloatLiteral:
+    case NodeKind::BoolLiteral:
+    case NodeKind::UnitLiteral:
+    case NodeKind::Continue:
+      break;
+    case NodeKind::Unary:
+      Ok = Flags[N] <= Plus && Child(N, D.A, isExpr);
+      break;
+    case NodeKind::Binary:
+    case NodeKind::Assign:
+      Ok = (Kinds[N] == NodeKind::Assign || Flags[N] <= Or) &&
+           Child(N, D.A, isExpr) && Child(N, D.B, isExpr);
+      break;
+    case NodeKind::Call:
+      Ok = Fixed(D.B, 1) && List(D.B + 1) && Child(N, D.A, isExpr) &&
+           Link(Extra[D.B], NodeKind::Function) &&
+           Children(N, D.B + 1, isExpr);
+      break;
+    case NodeKind::VarRef:
+      Ok = Link(D.B, NodeKind::VarDecl, NodeKind::Param);
+      break;
+    case NodeKind::Block:
+      Ok = List(D.A) && Children(N, D.A, isStmt) &&
+           Child(N, D.B, isExpr, /*Optional=*/true);
+      break;
+    case NodeKind::If:
+      Ok = Fixed(D.B, 2) && Child(N, D.A, isExpr) &&
+           Child(N, Extra[D.B], isBlock) &&
+           Child(N, Extra[D.B + 1], isBlock, /*Optional=*/true);
+      break;
+    case NodeKind::While:
+      Ok = Child(N, D.A, isExpr) && Child(N, D.B, isBlock);
+      break;
+    case NodeKind::Break:
+    case NodeKind::ExprStmt:
+    case NodeKind::Return:
+      Ok = Child(N, D.A, isExpr,
+                 /*Optional=*/Kinds[N] != NodeKind::ExprStmt);
+      break;
+    case NodeKind::VarDecl:
+      Ok = Fixed(D.B, 3) && TypeOf(Extra[D.B]) &&
+           Child(N, Extra[D.B + 1], isExpr, /*Optional=*/true) &&
+           Extra[D.B + 2] <= VarDecl::MaxSlot;
+      break;
+    case NodeKind::Function:
+      Ok = Fixed(D.B, 3) && List(D.B + 3) && TypeOf(Extra[D.B]) &&
+           Child(N, Extra[D.B + 1], isBlock, /*Optional=*/true) &&
+           Children(N, D.B + 3, [](NodeKind K) {
+             return K == NodeKind::Param;
+           });
+      break;
+    case NodeKind::Param:
+      Ok = TypeOf(D.B);
+      break;
+    default:
+      Ok = false;
+    }
+    if (!Ok)
+      return false;
+  }
+
+  if (!Types.empty()) {
+    if (Types.size() != size())
+      return false;
+    for (NodeId N = 0; N < size(); ++N)
+      if (Types[N] != NoNode && (!isExpr(Kinds[N]) || !TypeOf(Types[N])))
+        return false;
+  }
+  if (!List(TopLevel) || !Children(NoNode, TopLevel, isStmt))
+    return false;
+
+  // The def whose frame each node is in, NoNode for the module's, and how
+  // many defs enclose each def. Parents come first, so one pass does.
+  std::vector<NodeId> FrameOf(size(), NoNode);
+  std::vector<std::uint32_t> Nesting(size(), 0);
+  for (NodeId N = 1; N < size(); ++N) {
+    if (isType(Kinds[N]))
+      continue;
+    NodeId P = Parents[N];
+    if (P == NoParent)
+      return false;
+    FrameOf[N] = Kinds[P] == NodeKind::Function ? P : FrameOf[P];
+    if (Kinds[N] == NodeKind::Function)
+      Nesting[N] = Nesting[FrameOf[N]] + 1;
+  }
+  // A parameter is in its def's frame, any other declaration in the frame
+  // of the def or block it is in.
+  auto InScope = [&](NodeId Ref, NodeId Decl) {
+    NodeId Frame = FrameOf[Ref];
+    NodeId DeclFrame = FrameOf[Decl];
+    while (Nesting[Frame] > Nesting[DeclFrame])
+      Frame = FrameOf[Frame];
+    return Frame == DeclFrame;
+  };
+  for (NodeId N = 1; N < size(); ++N) {
+    NodeId Decl = NoNode;
+    if (Kinds[N] == NodeKind::VarRef)
+      Decl = Data[N].B;
+    else if (Kinds[N] == NodeKind::Call)
+      Decl = Extra[Data[N].B];
+    if (Decl != NoNode && !InScope(N, Decl))
+      return false;
+  }
+  return true;
+}
+
+std::size_t FlatAST::bytes() const {
+  return Kinds.size() * (sizeof(NodeKind) + sizeof(std::uint8_t) +
+                         sizeof(Span) + sizeof(NodeData)) +
+         Extra.size() * sizeof(std::uint32_t) + Types.size() * sizeof(NodeId);
+}
+
+namespace {
+
+// Mirrors ASTPrinter line for line; see that class for the layout.
+class FlatASTPrinter {
+  const FlatAST &Tree;
+  const IdentifierTable &Idents;
+  llvm::raw_ostream &OS;
+  int Indent = 0;
+
+  void indent() { OS.indent(Indent * 2); }
+  void push() { ++Indent; }
+  void pop() { --Indent; }
+
+  void printLoc(NodeId N) {
+    Span S = Tree.span(N);
+    OS << " [" << S.getStart() << ":" << S.getEnd() << "]";
+  }
+
+  // Resolved links point at a VarDecl, Param or Function, all named by A.
+  llvm::StringRef nameOf(NodeId N) { return Idents.spelling(Tree.data(N).A); }
+
+  void header(llvm::StringRef Text, NodeId N) {
+    indent();
+    OS << Text;
+    printLoc(N);
+    OS << "\n";
+  }
+
+  void labelled(llvm::StringRef Label, NodeId N) {
+    indent();
+    OS << Label << ":\n";
+    push();
+    print(N);
+    pop();
+  }
+
+  void printType(NodeId T) {
+    auto D = Tree.data(T);
+    switch (Tree.kind(T)) {
+    case NodeKind::BuiltinType:
+      OS << ASTPrinter::builtinKindStr(
+          static_cast<BuiltinKind>(Tree.flags(T)));
+      break;
+    case NodeKind::NamedType:
+      OS << Idents.spelling(D.A);
+      break;
+    case NodeKind::TypeVar:
+      OS << "?T" << D.A;
+      break;
+    default:
+      llvm_unreachable("not a type node");
+    }
+  }
+
+  void printBlock(NodeId N) {
+    indent();
+    OS << "BlockExpr\n";
+    push();
+    for (NodeId S : Tree.list(Tree.data(N).A))
+      print(S);
+    if (NodeId Tail = Tree.data(N).B)
+      labelled("Tail", Tail);
+    pop();
+  }
+
+  void printFunction(NodeId N) {
+    auto D = Tree.data(N);
+    indent();
+    OS << "FunctionDecl(" << Idents.spelling(D.A) << ")\n";
+    push();
+    for (NodeId P : Tree.list(D.B + 3)) {
+      indent();
+      OS << "Param(" << nameOf(P);
+      if (NodeId Ty = Tree.data(P).B) {
+        OS << ": ";
+        printType(Ty);
+      }
+      OS << ")";
+      printLoc(P);
+      OS << "\n";
+    }
+    if (NodeId Ret = Tree.extra(D.B)) {
+      indent();
+      OS << "ReturnType: ";
+      printType(Ret);
+      OS << "\n";
+    }
+    if (NodeId Body = Tree.extra(D.B + 1))
+      printBlock(Body);
+    pop();
+  }
+
+  void printNode(NodeId N) {
+    auto D = Tree.data(N);
+    switch (Tree.kind(N)) {
+    case NodeKind::IntLiteral:
+      indent();
+      OS << "IntLiteral(" << (std::uint64_t(D.B) << 32 | D.A) << ")";
+      printLoc(N);
+      OS << "\n";
+      return;
+    case NodeKind::FloatLiteral:
+      indent();
+      OS << "FloatLiteral("
+         << std::bit_cast<double>(std::uint64_t(D.B) << 32 | D.A) << ")";
+      printLoc(N);
+      OS << "\n";
+      return;
+    case NodeKind::BoolLiteral:
+      header(Tree.flags(N) ? "BoolLiteral(true)" : "BoolLiteral(false)", N);
+      return;
+    case NodeKind::UnitLiteral:
+      header("UnitLiteral", N);
+      return;
+    case NodeKind::VarRef:
+      indent();
+      OS << "VarRef(" << Idents.spelling(D.A);
+      if (D.B)
+        OS << " -> " << nameOf(D.B);
+      OS << ")";
+      printLoc(N);
+      OS << "\n";
+      return;
+    case NodeKind::Continue:
+      header("ContinueExpr", N);
+      return;
+    case NodeKind::Unary:
+      indent();
+      OS << "UnaryExpr("
+         << ASTPrinter::unaryOpStr(static_cast<UnaryOp>(Tree.flags(N)))
+         << ")";
+      printLoc(N);
+      OS << "\n";
+      push();
+      print(D.A);
+      pop();
+      return;
+    case NodeKind::Binary:
+      indent();
+      OS << "BinaryExpr("
+         << ASTPrinter::binaryOpStr(static_cast<BinaryOp>(Tree.flags(N)))
+         << ")";
+      printLoc(N);
+      OS << "\n";
+      push();
+      print(D.A);
+      print(D.B);
+      pop();
+      return;
+    case NodeKind::Call:
+      indent();
+      OS << "CallExpr";
+      if (NodeId Fn = Tree.extra(D.B))
+        OS << " -> " << nameOf(Fn);
+      printLoc(N);
+      OS << "\n";
+      push();
+      labelled("Callee", D.A);
+      indent();
+      OS << "Args:\n";
+      push();
+      for (NodeId Arg : Tree.list(D.B + 1))
+        print(Arg);
+      pop();
+      pop();
+      return;
+    case NodeKind::Block:
+      printBlock(N);
+      return;
+    case NodeKind::If:
+      header("IfExpr", N);
+      push();
+      labelled("Condition", D.A);
+      labelled("Then", Tree.extra(D.B));
+      if (NodeId Else = Tree.extra(D.B + 1))
+        labelled("Else", Else);
+      pop();
+      return;
+    case NodeKind::While:
+      header("WhileExpr", N);
+      push();
+      labelled("Condition", D.A);
+      labelled("Body", D.B);
+      pop();
+      return;
+    case NodeKind::Break:
+      header("BreakExpr", N);
+      if (D.A) {
+        push();
+        print(D.A);
+        pop();
+      }
+      return;
+    case NodeKind::ExprStmt:
+      header("ExprStmt", N);
+      push();
+      print(D.A);
+      pop();
+      return;
+    case NodeKind::Return:
+      header("ReturnStmt", N);
+      if (D.A) {
+        push();
+        print(D.A);
+        pop();
+      }
+      return;
+    case NodeKind::VarDecl:
+      indent();
+      OS << "VarDecl(" << (Tree.flags(N) ? "mut " : "")
+         << Idents.spelling(D.A);
+      if (NodeId Ty = Tree.extra(D.B)) {
+        OS << ": ";
+        printType(Ty);
+      }
+      OS << ")";
+      printLoc(N);
+      OS << "\n";
+      if (NodeId Init = Tree.extra(D.B + 1)) {
+        push();
+        print(Init);
+        pop();
+      }
+      return;
+    case NodeKind::Assign:
+      header("AssignStmt", N);
+      push();
+      labelled("Target", D.A);
+      labelled("Value", D.B);
+      pop();
+      return;
+    case NodeKind::Function:
+      printFunction(N);
+      return;
+    default:
+      llvm_unreachable("node cannot be printed on its own");
+    }
+  }
+
+public:
+  FlatASTPrinter(const FlatAST &Tree, const IdentifierTable &Idents,
+                 llvm::raw_ostream &OS)
+      : Tree(Tree), Idents(Idents), OS(OS) {}
+
+  void print(NodeId N) {
+    printNode(N);
+    if (NodeId Ty = Tree.exprType(N)) {
+      push();
+      indent();
+      OS << ":: ";
+      printType(Ty);
+      OS << "\n";
+      pop();
+    }
+  }
+
+  void printModule() {
+    OS << "Module(" << Tree.getName() << ")\n";
+    push();
+    for (NodeId S : Tree.topLevel())
+      print(S);
+    pop();
+  }
+};
+
+} // namespace
+
+void printFlatAST(const FlatAST &Tree, const IdentifierTable &Idents,
+                  llvm::raw_ostream &OS) {
+  FlatASTPrinter(Tree, Idents, OS).printModule();
+}
+
+} // namespace rheo
@@ -0,0 +1,254 @@
+#include "rheo/AST/ModuleFile.h"
+#include <cstring>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/MathExtras.h>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace rheo {
+
+namespace {
+
+constexpr char Magic[8] = {'R', 'H', 'E', 'O', 'A', 'S', 'T', '\0'};
+constexpr std::uint32_t ByteOrderMark = 0x01020304;
+
+enum class Section : std::uint8_t {
+  Name,
+  Kinds,
+  Flags,
+  Spans,
+  Data,
+  Extra,
+  ExprTypes,
+  IdentOffsets,
+  IdentChars,
+};
+constexpr unsigned NumSections = 9;
+
+struct SectionRange {
+  std::uint64_t Offset;
+  std::uint64_t Size;
+};
+
+struct Header {
+  char Magic[8];
+  std::uint32_t Version;
+  std::uint32_t ByteOrder;
+  std::uint32_t TopLevel;
+  std::uint32_t NumGlobals;
+  SectionRange Sections[NumSections];
+};
+
+template <typename T> llvm::StringRef bytesOf(llvm::ArrayRef<T> Array) {
+  return {reinterpret_cast<const char *>(Array.data()),
+          Array.size() * sizeof(T)};
+}
+
+} // namespace
+
+void writeModuleFile(const FlatAST &Tree, const IdentifierTable &Idents,
+                     BytePos Base, llvm::raw_ostream &OS) {
+  llvm::DenseMap<Atom, Atom> Local;
+  std::vector<std::uint32_t> IdentOffsets{0};
+  std::string IdentChars;
+  auto localAtom = [&](Atom Name) {
+    auto [It, Inserted] =
+        Local.try_emplace(Name, static_cast<Atom>(Local.size()));
+    if (Inserted) {
+      IdentChars += Idents.spelling(Name);
+      IdentOffsets.push_back(static_cast<std::uint32_t>(IdentChars.size()));
+    }
+    return It->second;
+  };
+  localAtom(NoAtom);
+  std::vector<NodeData> Data(Tree.data().begin(), Tree.data().end());
+  for (NodeId N = 0; N < Data.size(); ++N)
+    if (holdsAtom(Tree.kind(N)))
+      Data[N].A = localAtom(Data[N].A);
+  std::vector<Span> Spans(Tree.spans().begin(), Tree.spans().end());
+  if (Base != 0)
+    for (auto &S : Spans)
+      if (S.getEnd() != 0)
+        S = Span(S.getStart() - Base, S.getEnd() - Base);
+
+  llvm::StringRef Contents[NumSections] = {
+      Tree.getName(),
+      bytesOf(Tree.kinds()),
+      bytesOf(Tree.flags()),
+      bytesOf(llvm::ArrayRef(Spans)),
+      bytesOf(llvm::ArrayRef(Data)),
+      bytesOf(Tree.extra()),
+      bytesOf(Tree.exprTypes()),
+      bytesOf(llvm::ArrayRef(IdentOffsets)),
+      IdentChars,
+  };
+  Header H{};
+  std::memcpy(H.Magic, Magic, sizeof(Magic));
+  H.Version = ModuleFileVersion;
+  H.ByteOrder = ByteOrderMark;
+  H.TopLevel = Tree.topLevelIndex();
+  H.NumGlobals = Tree.numGlobals();
+  std::uint64_t At = sizeof(Header);
+  for (unsigned I = 0; I < NumSections; ++I) {
+    At = llvm::alignTo(At, 8);
+    H.Sections[I] = {At, Contents[I].size()};
+    At += Contents[I].size();
+  }
+
+  OS.write(reinterpret_cast<const char *>(&H), sizeof(H));
+  std::uint64_t Written = sizeof(Header);
+  for (unsigned I = 0; I < NumSections; ++I) {
+    OS.write_zeros(static_cast<unsigned>(H.Sections[I].Offset - Written));
+    OS << Contents[I];
+    Written = H.Sections[I].Offset + H.Sections[I].Size;
+  }
+}
+
+class ModuleFileReader {
+  // The mapped file, plus the renumbered data column and the rebased spans
+  // if they were needed.
+  struct Storage {
+    std::unique_ptr<llvm::MemoryBuffer> Buffer;
+    std::vector<NodeData> Data;
+    std::vector<Span> Spans;
+  };
+
+  llvm::StringRef Bytes;
+  Header H;
+
+  template <typename T> llvm::ArrayRef<T> section(Section S) const {
+    const auto &Range = H.Sections[static_cast<unsigned>(S)];
+    return {reinterpret_cast<const T *>(Bytes.data() + Range.Offset),
+            Range.Size / sizeof(T)};
+  }
+
+  // Every section in bounds, aligned and a whole number of elements.
+  bool checkSections() const {
+    static constexpr std::size_t ElementSize[NumSections] = {
+        1,
+        sizeof(NodeKind),
+        1,
+        sizeof(Span),
+        sizeof(NodeData),
+        sizeof(std::uint32_t),
+        sizeof(NodeId),
+        sizeof(std::uint32_t),
+        1};
+    for (unsigned I = 0; I < NumSections; ++I) {
+      const auto &Range = H.Sections[I];
+      if (Range.Offset % 8 != 0 || Range.Offset > Bytes.size() ||
+          Range.Size > Bytes.size() - Range.Offset ||
+          Range.Size % ElementSize[I] != 0)
+        return false;
+    }
+    auto Nodes = section<NodeKind>(Section::Kinds).size();
+    auto Extra = section<std::uint32_t>(Section::Extra);
+    return Nodes != 0 &&
+           section<std::uint8_t>(Section::Flags).size() == Nodes &&
+           section<Span>(Section::Spans).size() == Nodes &&
+           section<NodeData>(Section::Data).size() == Nodes &&
+           H.TopLevel < Extra.size() &&
+           Extra[H.TopLevel] < Extra.size() - H.TopLevel &&
+           !section<std::uint32_t>(Section::IdentOffsets).empty();
+  }
+
+public:
+  static llvm::ErrorOr<FlatAST>
+  read(std::unique_ptr<llvm::MemoryBuffer> Buffer, IdentifierTable &Idents,
+       BytePos Base);
+};
+
+llvm::ErrorOr<FlatAST>
+ModuleFileReader::read(std::unique_ptr<llvm::MemoryBuffer> Buffer,
+                       IdentifierTable &Idents, BytePos Base) {
+  auto Malformed = std::make_error_code(std::errc::illegal_byte_sequence);
+  // Mapped files are page aligned; anything else is copied to where the
+  // sections can be read in place.
+  if (reinterpret_cast<std::uintptr_t>(Buffer->getBufferStart()) % 8 != 0)
+    Buffer = llvm::MemoryBuffer::getMemBufferCopy(
+        Buffer->getBuffer(), Buffer->getBufferIdentifier());
+
+  ModuleFileReader R;
+  R.Bytes = Buffer->getBuffer();
+  if (R.Bytes.size() < sizeof(Header))
+    return Malformed;
+  std::memcpy(&R.H, R.Bytes.data(), sizeof(Header));
+  if (std::memcmp(R.H.Magic, Magic, sizeof(Magic)) != 0)
+    return Malformed;
+  if (R.H.Version != ModuleFileVersion || R.H.ByteOrder != ByteOrderMark)
+    return std::make_error_code(std::errc::not_supported);
+  if (!R.checkSections())
+    return Malformed;
+
+  auto Offsets = R.section<std::uint32_t>(Section::IdentOffsets);
+  auto Chars = R.section<char>(Section::IdentChars);
+  for (std::size_t I = 0; I + 1 < Offsets.size(); ++I)
+    if (Offsets[I] > Offsets[I + 1] || Offsets[I + 1] > Chars.size())
+      return Malformed;
+
+  FlatAST Tree;
+  auto Name = R.section<char>(Section::Name);
+  Tree.Name = llvm::StringRef(Name.data(), Name.size());
+  Tree.Kinds = R.section<NodeKind>(Section::Kinds);
+  Tree.Flags = R.section<std::uint8_t>(Section::Flags);
+  Tree.Spans = R.section<Span>(Section::Spans);
+  Tree.Data = R.section<NodeData>(Section::Data);
+  Tree.Extra = R.section<std::uint32_t>(Section::Extra);
+  Tree.Types = R.section<NodeId>(Section::ExprTypes);
+  Tree.TopLevel = R.H.TopLevel;
+  Tree.NumGlobals = R.H.NumGlobals;
+
+  // A stale or corrupt cache must not be walked, so everything the tree
+  // indexes with is checked here, once, and before Idents is touched.
+  if (!Tree.verify())
+    return Malformed;
+  std::vector<Atom> Remap(Offsets.size() - 1);
+  for (std::size_t N = 0; N < Tree.size(); ++N)
+    if (holdsAtom(Tree.Kinds[N]) && Tree.Data[N].A >= Remap.size())
+      return Malformed;
+
+  bool Renumber = false;
+  for (std::size_t I = 0; I < Remap.size(); ++I) {
+    Remap[I] = Idents.intern(llvm::StringRef(Chars.data() + Offsets[I],
+                                             Offsets[I + 1] - Offsets[I]));
+    Renumber |= Remap[I] != I;
+  }
+
+  auto Owned = std::make_shared<Storage>();
+  if (Renumber) {
+    Owned->Data.assign(Tree.Data.begin(), Tree.Data.end());
+    for (std::size_t N = 0; N < Owned->Data.size(); ++N)
+      if (holdsAtom(Tree.Kinds[N]))
+        Owned->Data[N].A = Remap[Owned->Data[N].A];
+    Tree.Data = Owned->Data;
+  }
+  if (Base != 0) {
+    Owned->Spans.reserve(Tree.Spans.size());
+    for (Span S : Tree.Spans)
+      Owned->Spans.push_back(S.getEnd() == 0 ? S
+                                             : Span(S.getStart() + Base,
+                                                    S.getEnd() + Base));
+    Tree.Spans = Owned->Spans;
+  }
+  Owned->Buffer = std::move(Buffer);
+  Tree.Storage = std::move(Owned);
+  return Tree;
+}
+
+llvm::ErrorOr<FlatAST>
+readModuleFile(std::unique_ptr<llvm::MemoryBuffer> Buffer,
+               IdentifierTable &Idents, BytePos Base) {
+  return ModuleFileReader::read(std::move(Buffer), Idents, Base);
+}
+
+llvm::ErrorOr<FlatAST> readModuleFile(llvm::StringRef Path,
+                                      IdentifierTable &Idents, BytePos Base) {
+  auto Buffer = llvm::MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                            /*RequiresNullTerminator=*/false);
+  if (!Buffer)
+    return Buffer.getError();
+  return readModuleFile(std::move(*Buffer), Idents, Base);
+}
+
+} // namespace rheo
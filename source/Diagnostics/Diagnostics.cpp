@@ -53,15 +53,14 @@ void Diagnostic::print(llvm::raw_ostream &Out,
   Out << ": " << Message << "\n";
 
   for (const auto &Label : Labels) {
-    const SourceFile *File = SrcMgr.getFile(Label.File);
-    if (!File)
+    auto Loc = SrcMgr.decompose(Label.Location.getStart());
+    if (!Loc)
       continue;
-
-    LineColumn Start = File->getLineCol(Label.Location.getStart());
+    const SourceFile *File = SrcMgr.getFile(Loc->File);
+    LineColumn Start = File->getLineCol(Loc->Offset);
     llvm::StringRef Src = File->getSource();
 
-    size_t LineBegin =
-        Label.Location.getStart() - (static_cast<size_t>(Start.Col) - 1);
+    size_t LineBegin = Loc->Offset - (static_cast<size_t>(Start.Col) - 1);
     size_t LineEnd = Src.find('\n', LineBegin);
     if (LineEnd == llvm::StringRef::npos)
       LineEnd = Src.size();
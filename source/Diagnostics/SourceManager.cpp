@@ -1,37 +1,108 @@
 #include <llvm/ADT/StringRef.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <rheo/Diagnostics/Diagnostics.h>
 #include <rheo/Diagnostics/SourceManager.h>
+#include <rheo/Frontend/CharScan.h>
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <limits>
+#include <system_error>
 #include <vector>
 
 namespace rheo {
 
-LineColumn SourceFile::getLineCol(BytePos Pos) const {
-  auto LowerBound = std::ranges::lower_bound(LineStarts, Pos);
-  std::uint32_t Line = 0;
-  if (LowerBound != LineStarts.end() && *LowerBound == Pos) {
-    Line = LowerBound - LineStarts.begin();
-  } else if (LowerBound != LineStarts.begin()) {
-    Line = (LowerBound - LineStarts.begin()) - 1;
+void SourceFile::computeLineStarts() const {
+  LineStarts.push_back(0);
+  scan::appendLineStarts(getSource(), 0, LineStarts);
+}
+
+LineColumn SourceFile::getLineCol(std::uint32_t Pos) const {
+  if (LineStarts.empty())
+    computeLineStarts();
+
+  // Diagnostics for one file tend to cluster, so try the line of the previous
+  // lookup and the one after it before falling back to a binary search.
+  auto Contains = [&](std::uint32_t Line) {
+    return Line < LineStarts.size() && LineStarts[Line] <= Pos &&
+           (Line + 1 == LineStarts.size() || Pos < LineStarts[Line + 1]);
+  };
+  std::uint32_t Line = LastLine;
+  if (!Contains(Line)) {
+    if (Contains(Line + 1)) {
+      ++Line;
+    } else {
+      auto UpperBound = std::ranges::upper_bound(LineStarts, Pos);
+      Line = static_cast<std::uint32_t>(UpperBound - LineStarts.begin()) - 1;
+    }
   }
+  LastLine = Line;
   std::uint32_t Col = Pos - LineStarts[Line];
   return {.Line = Line + 1, .Col = Col + 1};
 }
 
-static std::vector<BytePos> computeLineStarts(llvm::StringRef Source) {
-  std::vector<BytePos> LineStarts = {BytePos(0)};
-  for (size_t I = 0; I < Source.size(); ++I)
-    if (Source[I] == '\n')
-      LineStarts.emplace_back(I + 1);
-  return LineStarts;
+void SourceFile::applyEdit(const TextEdit &Edit) {
+  llvm::StringRef Old = getSource();
+  assert(Edit.Offset + Edit.RemovedLen <= Old.size() && "edit out of range");
+  auto NewSize = static_cast<std::size_t>(std::int64_t(Old.size()) +
+                                          Edit.delta());
+  auto NewBuffer =
+      llvm::WritableMemoryBuffer::getNewUninitMemBuffer(NewSize, getName());
+  char *Out = NewBuffer->getBufferStart();
+  Out = std::copy_n(Old.data(), Edit.Offset, Out);
+  Out = std::copy(Edit.Inserted.begin(), Edit.Inserted.end(), Out);
+  std::copy(Old.begin() + Edit.Offset + Edit.RemovedLen, Old.end(), Out);
+  Buffer = std::move(NewBuffer);
+
+  LastLine = 0;
+  if (LineStarts.empty())
+    return;
+  // Lines starting inside the removed text go away, later ones move by the
+  // edit's delta, and every '\n' in the inserted text starts a new line.
+  std::uint32_t RemovedEnd = Edit.Offset + Edit.RemovedLen;
+  auto First = std::ranges::upper_bound(LineStarts, Edit.Offset);
+  auto Last = std::ranges::upper_bound(LineStarts, RemovedEnd);
+  for (auto It = Last; It != LineStarts.end(); ++It)
+    *It = static_cast<std::uint32_t>(*It + Edit.delta());
+  std::vector<std::uint32_t> Inserted;
+  scan::appendLineStarts(Edit.Inserted, Edit.Offset, Inserted);
+  auto At = LineStarts.erase(First, Last);
+  LineStarts.insert(At, Inserted.begin(), Inserted.end());
+}
+
+// Hands out Size + 1 positions: one per byte plus the end of the file.
+BytePos SourceManager::allocate(std::size_t Size) {
+  if (Size >= std::numeric_limits<BytePos>::max() - NextBase)
+    llvm::report_fatal_error("rheo: 4 GiB source offset space exhausted");
+  BytePos Base = NextBase;
+  NextBase = static_cast<BytePos>(Base + Size + 1);
+  return Base;
 }
 
 FileId SourceManager::addFile(llvm::StringRef Name, llvm::StringRef Source) {
-  auto LineStarts = computeLineStarts(Source);
+  return addBuffer(llvm::MemoryBuffer::getMemBufferCopy(Source, Name));
+}
+
+FileId SourceManager::addBuffer(std::unique_ptr<llvm::MemoryBuffer> Buffer) {
   auto Id = FileId(Files.size());
-  Files.emplace_back(Name, Source, LineStarts);
+  BytePos Base = allocate(Buffer->getBufferSize());
+  Files.emplace_back(std::move(Buffer), Base);
+  Ranges.emplace_back(Base, Id);
   return Id;
 }
 
+llvm::ErrorOr<FileId> SourceManager::openFile(llvm::StringRef Path) {
+  auto Buffer = llvm::MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                            /*RequiresNullTerminator=*/false);
+  if (!Buffer)
+    return Buffer.getError();
+  if ((*Buffer)->getBufferSize() >=
+      std::numeric_limits<BytePos>::max() - NextBase)
+    return std::make_error_code(std::errc::file_too_large);
+  return addBuffer(std::move(*Buffer));
+}
+
 const SourceFile *SourceManager::getFile(FileId ID) const {
   if (ID >= Files.size()) {
     return nullptr;
@@ -39,4 +110,43 @@ const SourceFile *SourceManager::getFile(FileId ID) const {
   return &Files[ID];
 }
 
+std::optional<FileLoc> SourceManager::decompose(BytePos Pos) const {
+  auto It = std::ranges::upper_bound(
+      Ranges, Pos, {}, [](const auto &Range) { return Range.first; });
+  if (It == Ranges.begin())
+    return std::nullopt;
+  FileId ID = std::prev(It)->second;
+  if (!Files[ID].contains(Pos))
+    return std::nullopt;
+  return FileLoc{.File = ID, .Offset = Pos - Files[ID].getBase()};
+}
+
+const SourceFile *SourceManager::getFileContaining(BytePos Pos) const {
+  auto Loc = decompose(Pos);
+  return Loc ? &Files[Loc->File] : nullptr;
+}
+
+LineColumn SourceManager::getLineCol(BytePos Pos) const {
+  auto Loc = decompose(Pos);
+  assert(Loc && "position outside every file");
+  return Files[Loc->File].getLineCol(Loc->Offset);
+}
+
+const SourceFile &SourceManager::applyEdit(FileId ID, const TextEdit &Edit) {
+  assert(ID < Files.size() && "invalid file id");
+  SourceFile &File = Files[ID];
+  bool IsLast = File.getBase() + File.size() + 1 == NextBase;
+  File.applyEdit(Edit);
+  if (IsLast) {
+    NextBase = File.getBase();
+    allocate(File.size());
+  } else if (Edit.delta() > 0) {
+    // The range after this file is taken; move to the end of the space.
+    std::erase(Ranges, std::pair(File.getBase(), ID));
+    File.Base = allocate(File.size());
+    Ranges.emplace_back(File.Base, ID);
+  }
+  return File;
+}
+
 } // namespace rheo
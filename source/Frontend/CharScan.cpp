@@ -0,0 +1,273 @@
+#include "rheo/Frontend/CharScan.h"
+#include <cstring>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/ErrorHandling.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define RHEO_SCAN_X86 1
+#include <immintrin.h>
+#else
+#define RHEO_SCAN_X86 0
+#endif
+
+namespace rheo::scan {
+
+// ── Portable fallback ───────────────────────────────────────────────────────
+
+template <CharClass Class>
+static const char *skipScalar(const char *Cur, const char *End) {
+  while (Cur != End && is(*Cur, Class))
+    ++Cur;
+  return Cur;
+}
+
+static void appendLineStartsScalar(llvm::StringRef Text, std::uint32_t Base,
+                                   std::vector<std::uint32_t> &Out) {
+  const char *Begin = Text.data();
+  const char *End = Begin + Text.size();
+  for (const char *Cur = Begin; Cur != End; ++Cur) {
+    Cur = static_cast<const char *>(
+        std::memchr(Cur, '\n', static_cast<std::size_t>(End - Cur)));
+    if (!Cur)
+      return;
+    Out.push_back(Base + static_cast<std::uint32_t>(Cur - Begin) + 1);
+  }
+}
+
+// Newline positions come out of a compare mask one set bit at a time. The
+// mask's popcount sizes the output up front, so the vector grows once per
+// block instead of once per line.
+template <typename MaskT>
+static inline void appendMaskedLineStarts(MaskT Mask, std::uint32_t Offset,
+                                          std::vector<std::uint32_t> &Out) {
+  if (Mask == 0)
+    return;
+  auto Size = Out.size();
+  Out.resize(Size + static_cast<std::size_t>(__builtin_popcount(Mask)));
+  for (; Mask != 0; Mask &= Mask - 1)
+    Out[Size++] = Offset + static_cast<std::uint32_t>(__builtin_ctz(Mask)) + 1;
+}
+
+#if RHEO_SCAN_X86
+
+// ── SSE4.2 ──────────────────────────────────────────────────────────────────
+//
+// PCMPISTRI with range aggregation finds the first byte outside a set of up to
+// eight [lo, hi] ranges. A NUL byte in the input terminates the implicit
+// string and is reported as "outside", which matches the scalar tables.
+
+__attribute__((target("sse4.2"))) static const char *
+skipRangesSSE42(const char *Cur, const char *End, __m128i Set) {
+  constexpr int Mode = _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                       _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT;
+  while (End - Cur >= 16) {
+    __m128i Chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Cur));
+    int Index = _mm_cmpistri(Set, Chunk, Mode);
+    if (Index != 16)
+      return Cur + Index;
+    Cur += 16;
+  }
+  return Cur;
+}
+
+__attribute__((target("sse4.2"))) static const char *
+skipBlanksSSE42(const char *Cur, const char *End) {
+  const __m128i Set = _mm_setr_epi8('\t', '\t', '\v', '\r', ' ', ' ', 0, 0, 0,
+                                    0, 0, 0, 0, 0, 0, 0);
+  return skipScalar<CC_Blank>(skipRangesSSE42(Cur, End, Set), End);
+}
+
+__attribute__((target("sse4.2"))) static const char *
+skipIdentSSE42(const char *Cur, const char *End) {
+  const __m128i Set = _mm_setr_epi8('a', 'z', 'A', 'Z', '_', '_', '0', '9', 0,
+                                    0, 0, 0, 0, 0, 0, 0);
+  return skipScalar<CC_IdentBody>(skipRangesSSE42(Cur, End, Set), End);
+}
+
+__attribute__((target("sse4.2"))) static const char *
+skipDigitsSSE42(const char *Cur, const char *End) {
+  const __m128i Set =
+      _mm_setr_epi8('0', '9', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  return skipScalar<CC_Digit>(skipRangesSSE42(Cur, End, Set), End);
+}
+
+__attribute__((target("sse4.2"))) static void
+appendLineStartsSSE42(llvm::StringRef Text, std::uint32_t Base,
+                      std::vector<std::uint32_t> &Out) {
+  const char *Begin = Text.data();
+  const char *Cur = Begin;
+  const char *End = Begin + Text.size();
+  const __m128i NewLine = _mm_set1_epi8('\n');
+  for (; End - Cur >= 16; Cur += 16) {
+    __m128i Chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Cur));
+    auto Mask = static_cast<std::uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(Chunk, NewLine)));
+    appendMaskedLineStarts(Mask, Base + static_cast<std::uint32_t>(Cur - Begin),
+                           Out);
+  }
+  appendLineStartsScalar(Text.drop_front(static_cast<std::size_t>(Cur - Begin)),
+                         Base + static_cast<std::uint32_t>(Cur - Begin), Out);
+}
+
+// ── AVX2 ────────────────────────────────────────────────────────────────────
+//
+// Classifies 32 bytes per step with compares; unsigned range checks use
+// min(X - Lo, Hi - Lo) == X - Lo.
+
+__attribute__((target("avx2"))) static inline __m256i
+inRangeAVX2(__m256i Chunk, char Lo, char Hi) {
+  __m256i Off = _mm256_sub_epi8(Chunk, _mm256_set1_epi8(Lo));
+  __m256i Width = _mm256_set1_epi8(static_cast<char>(Hi - Lo));
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(Off, Width), Off);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+classifyBlankAVX2(__m256i Chunk) {
+  // '\t' and '\v'..'\r' are 9 and 11..13; exclude '\n' from 9..13.
+  __m256i Ctrl =
+      _mm256_andnot_si256(_mm256_cmpeq_epi8(Chunk, _mm256_set1_epi8('\n')),
+                          inRangeAVX2(Chunk, '\t', '\r'));
+  return _mm256_or_si256(Ctrl, _mm256_cmpeq_epi8(Chunk, _mm256_set1_epi8(' ')));
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+classifyIdentBodyAVX2(__m256i Chunk) {
+  // Folding case with | 0x20 maps exactly 'A'..'Z' and 'a'..'z' onto 'a'..'z'.
+  __m256i Lower = _mm256_or_si256(Chunk, _mm256_set1_epi8(0x20));
+  __m256i Letter = inRangeAVX2(Lower, 'a', 'z');
+  __m256i Other = _mm256_or_si256(
+      inRangeAVX2(Chunk, '0', '9'),
+      _mm256_cmpeq_epi8(Chunk, _mm256_set1_epi8('_')));
+  return _mm256_or_si256(Letter, Other);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+classifyDigitAVX2(__m256i Chunk) {
+  return inRangeAVX2(Chunk, '0', '9');
+}
+
+template <__m256i (*Classify)(__m256i), CharClass Class>
+__attribute__((target("avx2"))) static const char *skipAVX2(const char *Cur,
+                                                             const char *End) {
+  while (End - Cur >= 32) {
+    __m256i Chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(Cur));
+    auto Mask =
+        static_cast<std::uint32_t>(_mm256_movemask_epi8(Classify(Chunk)));
+    if (Mask != 0xFFFFFFFFU)
+      return Cur + __builtin_ctz(~Mask);
+    Cur += 32;
+  }
+  return skipScalar<Class>(Cur, End);
+}
+
+__attribute__((target("avx2"))) static void
+appendLineStartsAVX2(llvm::StringRef Text, std::uint32_t Base,
+                     std::vector<std::uint32_t> &Out) {
+  const char *Begin = Text.data();
+  const char *Cur = Begin;
+  const char *End = Begin + Text.size();
+  const __m256i NewLine = _mm256_set1_epi8('\n');
+  for (; End - Cur >= 32; Cur += 32) {
+    __m256i Chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(Cur));
+    auto Mask = static_cast<std::uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(Chunk, NewLine)));
+    appendMaskedLineStarts(Mask, Base + static_cast<std::uint32_t>(Cur - Begin),
+                           Out);
+  }
+  appendLineStartsScalar(Text.drop_front(static_cast<std::size_t>(Cur - Begin)),
+                         Base + static_cast<std::uint32_t>(Cur - Begin), Out);
+}
+
+#endif // RHEO_SCAN_X86
+
+// ── Dispatch ────────────────────────────────────────────────────────────────
+
+static constexpr Kernels ScalarKernels = {
+    skipScalar<CC_Blank>, skipScalar<CC_IdentBody>, skipScalar<CC_Digit>,
+    appendLineStartsScalar};
+
+static Kernels kernelsFor(ISA Target) {
+  switch (Target) {
+  case ISA::Scalar:
+    return ScalarKernels;
+#if RHEO_SCAN_X86
+  case ISA::SSE42:
+    return {skipBlanksSSE42, skipIdentSSE42, skipDigitsSSE42,
+            appendLineStartsSSE42};
+  case ISA::AVX2:
+    return {skipAVX2<classifyBlankAVX2, CC_Blank>,
+            skipAVX2<classifyIdentBodyAVX2, CC_IdentBody>,
+            skipAVX2<classifyDigitAVX2, CC_Digit>, appendLineStartsAVX2};
+#else
+  case ISA::SSE42:
+  case ISA::AVX2:
+    return ScalarKernels;
+#endif
+  }
+  llvm_unreachable("unknown scan ISA");
+}
+
+bool isSupported(ISA Target) {
+  switch (Target) {
+  case ISA::Scalar:
+    return true;
+#if RHEO_SCAN_X86
+  case ISA::SSE42:
+    return __builtin_cpu_supports("sse4.2") != 0;
+  case ISA::AVX2:
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+  case ISA::SSE42:
+  case ISA::AVX2:
+    return false;
+#endif
+  }
+  llvm_unreachable("unknown scan ISA");
+}
+
+static ISA bestISA() {
+  if (isSupported(ISA::AVX2))
+    return ISA::AVX2;
+  if (isSupported(ISA::SSE42))
+    return ISA::SSE42;
+  return ISA::Scalar;
+}
+
+namespace {
+struct ActiveKernels {
+  ISA Target = bestISA();
+  Kernels Fns = kernelsFor(Target);
+};
+} // namespace
+
+static ActiveKernels &active() {
+  static ActiveKernels Active;
+  return Active;
+}
+
+const Kernels &kernels() { return active().Fns; }
+
+ISA activeISA() { return active().Target; }
+
+bool forceISA(ISA Target) {
+  if (!isSupported(Target))
+    return false;
+  active().Target = Target;
+  active().Fns = kernelsFor(Target);
+  return true;
+}
+
+llvm::StringRef isaName(ISA Target) {
+  switch (Target) {
+  case ISA::Scalar:
+    return "scalar";
+  case ISA::SSE42:
+    return "sse4.2";
+  case ISA::AVX2:
+    return "avx2";
+  }
+  llvm_unreachable("unknown scan ISA");
+}
+
+} // namespace rheo::scan
@@ -1,5 +1,6 @@
 #include "rheo/Frontend/Lexer.h"
 #include "rheo/Diagnostics/SourceLocation.h"
+#include "rheo/Frontend/CharScan.h"
 #include "rheo/Frontend/Token.h"
 #include <format>
 #include <llvm/ADT/StringRef.h>
@@ -7,24 +8,19 @@
 
 namespace rheo {
 
-void Lexer::skipWhitespace() {
-  while (true) {
-    char CH = peek();
-    if (CH == '\n' || CH == '\0') {
-      return;
-    }
-    if (std::isspace(static_cast<unsigned char>(CH)) == 0) {
-      return;
-    }
-    advance();
-  }
+void Lexer::scanWhile(const char *(*Skip)(const char *, const char *)) {
+  const char *Begin = Input.data();
+  Pos = static_cast<std::size_t>(Skip(Begin + Pos, Begin + Input.size()) -
+                                 Begin);
 }
 
+void Lexer::skipWhitespace() { scanWhile(scan::skipBlanks); }
+
 void Lexer::makeUnexpectedCharDiag(char Chr, Span Span) {
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("unexpected character '" + std::string(1, Chr) + "'");
   Diag.setCode("E0001");
-  Diag.addLabel(Label::primary(Span, File, "unexpected character"));
+  Diag.addLabel(Label::primary(Span, "unexpected character"));
   switch (Chr) {
   case '@':
     Diag.setHelp("remove '@' or replace it with a valid identifier character");
@@ -44,7 +40,7 @@ void Lexer::makeUnexpectedDoubleDotInFloatDiag(llvm::StringRef FirstPart,
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("unexpected '.' in floating point literal");
   Diag.setCode("E0002");
-  Diag.addLabel(Label::primary(Span, File, "second '.' here"));
+  Diag.addLabel(Label::primary(Span, "second '.' here"));
   llvm::StringRef SecondDigits = SecondPart.drop_front(1);
   Diag.setHelp(std::format(
       "floating point literals can only have one decimal point — "
@@ -55,13 +51,11 @@ void Lexer::makeUnexpectedDoubleDotInFloatDiag(llvm::StringRef FirstPart,
 
 Token Lexer::lexNum() {
   auto Start = Pos;
-  while (Pos < Input.size() && std::isdigit(peek()) != 0)
-    advance();
+  scanWhile(scan::skipDigits);
 
   if (Pos < Input.size() && peek() == '.') {
     advance();
-    while (Pos < Input.size() && std::isdigit(peek()) != 0)
-      advance();
+    scanWhile(scan::skipDigits);
 
     llvm::StringRef FirstPart(Input.data() + Start, Pos - Start);
 
@@ -69,89 +63,40 @@ Token Lexer::lexNum() {
       auto SecondDotPos = Pos;
       advance();
       auto SecondPartStart = Pos - 1;
-      while (Pos < Input.size() && std::isdigit(peek()) != 0)
-        advance();
+      scanWhile(scan::skipDigits);
 
       llvm::StringRef SecondPart(Input.data() + SecondPartStart,
                                  Pos - SecondPartStart);
       makeUnexpectedDoubleDotInFloatDiag(FirstPart, SecondPart,
-                                         Span(SecondDotPos, Pos));
+                                         spanFrom(SecondDotPos));
     }
 
-    return {.Span = Span(Start, Pos),
-            .Kind = TokenKind::FloatLiteral,
-            .Value = llvm::StringRef(Input.data() + Start, Pos - Start)};
+    return makeToken(TokenKind::FloatLiteral, Start);
   }
 
-  return {.Span = Span(Start, Pos),
-          .Kind = TokenKind::IntLiteral,
-          .Value = llvm::StringRef(Input.data() + Start, Pos - Start)};
+  return makeToken(TokenKind::IntLiteral, Start);
 }
 
-#define KW(str, kind)                                                          \
-  if (Keyword == str)                                                          \
-    return kind;
-
-static TokenKind classifyIdent(llvm::StringRef Keyword) {
-  switch (Keyword.size()) {
-  case 2:
-    KW("if", TokenKind::If)
-    KW("or", TokenKind::Or)
-    break;
-
-  case 3:
-    KW("mut", TokenKind::Mut)
-    KW("def", TokenKind::Def)
-    KW("Int", TokenKind::Int)
-    KW("not", TokenKind::Not)
-    KW("and", TokenKind::And)
-    KW("end", TokenKind::End)
-    break;
-
-  case 4:
-    KW("true", TokenKind::True)
-    KW("Bool", TokenKind::Bool)
-    KW("else", TokenKind::Else)
-    KW("elseif", TokenKind::ElseIf)
-    break;
-
-  case 5:
-    KW("false", TokenKind::False)
-    KW("while", TokenKind::While)
-    KW("Int8", TokenKind::Int8)
-    KW("UInt", TokenKind::UInt)
-    break;
-
-  case 6:
-    KW("return", TokenKind::Return)
-    KW("Int32", TokenKind::Int32)
-    KW("Int64", TokenKind::Int64)
-    KW("UInt8", TokenKind::UInt8)
-    KW("break", TokenKind::Break)
-    break;
-
-  case 7:
-    KW("Float32", TokenKind::Float32)
-    KW("Float64", TokenKind::Float64)
-    KW("UInt32", TokenKind::UInt32)
-    KW("UInt64", TokenKind::UInt64)
-    break;
-
-  case 8:
-    KW("continue", TokenKind::Continue)
-    break;
+// A keyword is only recognised if the identifier scanner stops exactly at its
+// end; this used to silently break keywords containing digits.
+static constexpr bool keywordsLexAsOneIdentifier() {
+  for (const auto &K : Keywords) {
+    if (!scan::is(K.Spelling.front(), scan::CC_Ident))
+      return false;
+    for (char Chr : K.Spelling)
+      if (!scan::is(Chr, scan::CC_IdentBody))
+        return false;
   }
-
-  return TokenKind::Identifier;
+  return true;
 }
 
+static_assert(keywordsLexAsOneIdentifier(),
+              "every keyword must be lexable as a single identifier");
+
 Token Lexer::lexKeywordOrIdent() {
   auto Start = Pos;
-  while (Pos < Input.size() && ((std::isalpha(peek()) != 0) || peek() == '_'))
-    advance();
-  auto Ident = llvm::StringRef(Input.data() + Start, Pos - Start);
-  return {
-      .Span = Span(Start, Pos), .Kind = classifyIdent(Ident), .Value = Ident};
+  scanWhile(scan::skipIdent);
+  return makeToken(classifyIdent(Input.slice(Start, Pos)), Start);
 }
 
 Token Lexer::nextToken() {
@@ -160,16 +105,16 @@ Token Lexer::nextToken() {
   auto Start = Pos;
 
   if (Pos >= Input.size()) {
-    return {.Span = Span(Start, Start), .Kind = TokenKind::Eof};
+    return makeToken(TokenKind::Eof, Start);
   }
 
   auto Ch = peek();
 
-  if (std::isdigit(Ch) != 0) {
+  if (scan::is(Ch, scan::CC_Digit)) {
     return lexNum();
   }
 
-  if ((std::isalpha(Ch) != 0) || Ch == '_') {
+  if (scan::is(Ch, scan::CC_Ident)) {
     return lexKeywordOrIdent();
   }
 
@@ -177,112 +122,95 @@ Token Lexer::nextToken() {
 
   switch (Ch) {
   case '(':
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::LParen, .Value = "("};
+    return makeToken(TokenKind::LParen, Start);
 
   case ')':
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::RParen, .Value = ")"};
+    return makeToken(TokenKind::RParen, Start);
 
   case '{':
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::LBrace, .Value = "{"};
+    return makeToken(TokenKind::LBrace, Start);
 
   case '}':
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::RBrace, .Value = "}"};
+    return makeToken(TokenKind::RBrace, Start);
 
   case '[':
-    return {
-        .Span = Span(Start, Pos), .Kind = TokenKind::LBracket, .Value = "["};
+    return makeToken(TokenKind::LBracket, Start);
 
   case ']':
-    return {
-        .Span = Span(Start, Pos), .Kind = TokenKind::RBracket, .Value = "]"};
+    return makeToken(TokenKind::RBracket, Start);
 
   case '\n':
-    return {
-        .Span = Span(Start, Pos), .Kind = TokenKind::NewLine, .Value = "\n"};
+    return makeToken(TokenKind::NewLine, Start);
 
   case ',':
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Comma, .Value = ","};
+    return makeToken(TokenKind::Comma, Start);
 
   case ';':
-    return {
-        .Span = Span(Start, Pos), .Kind = TokenKind::Semicolon, .Value = ";"};
+    return makeToken(TokenKind::Semicolon, Start);
 
   case '.':
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Dot, .Value = "."};
+    return makeToken(TokenKind::Dot, Start);
 
   case '+':
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Plus, .Value = "+"};
+    return makeToken(TokenKind::Plus, Start);
 
   case '-':
     if (Pos < Input.size() && peek() == '>') {
       advance();
-      return {
-          .Span = Span(Start, Pos), .Kind = TokenKind::Arrow, .Value = "->"};
+      return makeToken(TokenKind::Arrow, Start);
     }
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Minus, .Value = "-"};
+    return makeToken(TokenKind::Minus, Start);
 
   case '*':
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Star, .Value = "*"};
+    return makeToken(TokenKind::Star, Start);
 
   case '/':
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Slash, .Value = "/"};
+    return makeToken(TokenKind::Slash, Start);
 
   case '%':
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Percent, .Value = "%"};
+    return makeToken(TokenKind::Percent, Start);
 
   case ':':
     if (Pos < Input.size() && peek() == '=') {
       advance();
-      return {.Span = Span(Start, Pos),
-              .Kind = TokenKind::ColonEqual,
-              .Value = ":="};
+      return makeToken(TokenKind::ColonEqual, Start);
     }
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Colon, .Value = ":"};
+    return makeToken(TokenKind::Colon, Start);
 
   case '=':
     if (Pos < Input.size() && peek() == '=') {
       advance();
-      return {.Span = Span(Start, Pos),
-              .Kind = TokenKind::EqualEqual,
-              .Value = "=="};
+      return makeToken(TokenKind::EqualEqual, Start);
     }
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Equal, .Value = "="};
+    return makeToken(TokenKind::Equal, Start);
 
   case '!':
     if (Pos < Input.size() && peek() == '=') {
       advance();
-      return {.Span = Span(Start, Pos),
-              .Kind = TokenKind::BangEqual,
-              .Value = "!="};
+      return makeToken(TokenKind::BangEqual, Start);
     }
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Bang, .Value = "!"};
+    return makeToken(TokenKind::Bang, Start);
 
   case '<':
     if (Pos < Input.size() && peek() == '=') {
       advance();
-      return {.Span = Span(Start, Pos),
-              .Kind = TokenKind::LessEqual,
-              .Value = "<="};
+      return makeToken(TokenKind::LessEqual, Start);
     }
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Less, .Value = "<"};
+    return makeToken(TokenKind::Less, Start);
 
   case '>':
     if (Pos < Input.size() && peek() == '=') {
       advance();
-      return {.Span = Span(Start, Pos),
-              .Kind = TokenKind::GreaterEqual,
-              .Value = ">="};
+      return makeToken(TokenKind::GreaterEqual, Start);
     }
-    return {.Span = Span(Start, Pos), .Kind = TokenKind::Greater, .Value = ">"};
+    return makeToken(TokenKind::Greater, Start);
 
   default:
     break;
   }
 
-  makeUnexpectedCharDiag(Ch, Span(Start, Pos));
-  return {.Span = Span(Start, Pos),
-          .Kind = TokenKind::Error,
-          .Value = llvm::StringRef(Input.data() + 1, 1)};
+  makeUnexpectedCharDiag(Ch, spanFrom(Start));
+  return makeToken(TokenKind::Error, Start);
 }
 
 } // namespace rheo
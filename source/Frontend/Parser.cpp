@@ -1,14 +1,22 @@
 #include "rheo/Frontend/Parser.h"
 #include "rheo/AST/AST.h"
+#include "rheo/AST/RecursiveASTVisitor.h"
 #include "rheo/Frontend/Token.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <format>
+#include <future>
 #include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/Support/ThreadPool.h>
+#include <memory>
 #include <optional>
 #include <string>
 #include <variant>
+#include <vector>
 
 namespace rheo {
 
@@ -110,27 +118,25 @@ static std::string describeToken(const Token &Tok) {
 }
 
 Expr *Parser::errorExpectedRParen(Span OpenParenSpan) {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expected ')'");
   Diag.setCode("E1001");
   Diag.addLabel(Label::primary(
-      Tok.Span, File,
-      std::format("found {} instead of ')'", describeToken(Tok))));
-  Diag.addLabel(Label::secondary(OpenParenSpan, File, "opening '(' here"));
+      Tok.Span, std::format("found {} instead of ')'", describeToken(Tok))));
+  Diag.addLabel(Label::secondary(OpenParenSpan, "opening '(' here"));
   Diag.setHelp("every '(' must be closed with ')'");
   Diags.emit(Diag);
   return nullptr;
 }
 
 Expr *Parser::errorExpectedExpr() {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setCode("E1002");
   auto Found = describeToken(Tok);
   Diag.setMessage(std::format("expected expression, found {}", Found));
-  Diag.addLabel(
-      Label::primary(Tok.Span, File, std::format("unexpected {}", Found)));
+  Diag.addLabel(Label::primary(Tok.Span, std::format("unexpected {}", Found)));
   Diag.setHelp(
       "expressions include literals, identifiers, or grouped expressions");
   Diags.emit(Diag);
@@ -139,45 +145,45 @@ Expr *Parser::errorExpectedExpr() {
 }
 
 Expr *Parser::errorExpectedCommaOrRParenInCall(Span OpenParenSpan) {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expected ',' or ')'");
   Diag.setCode("E1003");
   Diag.addLabel(Label::primary(
-      Tok.Span, File,
+      Tok.Span,
       std::format("found {} instead of ',' or ')'", describeToken(Tok))));
-  Diag.addLabel(Label::secondary(OpenParenSpan, File, "call started here"));
+  Diag.addLabel(Label::secondary(OpenParenSpan, "call started here"));
   Diag.setHelp("separate arguments with ',' and close with ')'");
   Diags.emit(Diag);
   return nullptr;
 }
 
 Stmt *Parser::errorExpectedStmtTerminator(Span StmtSpan) {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setCode("E1004");
   auto Found = describeToken(Tok);
   Diag.setMessage(
       std::format("expected ';' or newline after statement, found {}", Found));
-  Diag.addLabel(
-      Label::primary(Tok.Span, File, std::format("unexpected {}", Found)));
-  Diag.addLabel(Label::secondary(StmtSpan, File, "statement starts here"));
+  Diag.addLabel(Label::primary(Tok.Span, std::format("unexpected {}", Found)));
+  Diag.addLabel(Label::secondary(StmtSpan, "statement starts here"));
   Diag.setHelp("terminate statements with ';' or newline");
   Diags.emit(Diag);
   return nullptr;
 }
 
 Stmt *Parser::errorExpectedStmt() {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setCode("E1005");
   auto Found = describeToken(Tok);
   Diag.setMessage(std::format("expected statement, found {}", Found));
-  Diag.addLabel(
-      Label::primary(Tok.Span, File, std::format("unexpected {}", Found)));
+  Diag.addLabel(Label::primary(Tok.Span, std::format("unexpected {}", Found)));
   Diag.setHelp("expected function declaration, variable declaration, "
                "assignment, expression, or control flow");
   Diags.emit(Diag);
+  // Recovery stops at a ';', so a stray one must not stay put.
+  eatNextToken();
   return nullptr;
 }
 
@@ -186,7 +192,7 @@ Stmt *Parser::errorInvalidAssignmentTarget(Expr *LHS) {
   Diag.setCode("E1006");
   Diag.setMessage("invalid assignment target");
   Diag.addLabel(
-      Label::primary(LHS->Location, File, "cannot assign to this expression"));
+      Label::primary(LHS->Location, "cannot assign to this expression"));
   Diag.setHelp("only variables can be assigned");
   Diags.emit(Diag);
   return nullptr;
@@ -197,50 +203,47 @@ Stmt *Parser::errorInvalidDeclTarget(Expr *LHS) {
   Diag.setCode("E1007");
   Diag.setMessage("invalid declaration target");
   Diag.addLabel(
-      Label::primary(LHS->Location, File, "cannot declare this expression"));
+      Label::primary(LHS->Location, "cannot declare this expression"));
   Diag.setHelp("only identifiers can be declared");
   Diags.emit(Diag);
   return nullptr;
 }
 
-Type *Parser::errorUnexpectedType() {
-  Token Tok = NextToken;
+TypeLoc Parser::errorUnexpectedType() {
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setCode("E1008");
   auto Found = describeToken(Tok);
   Diag.setMessage(std::format("expected type, found {}", Found));
-  Diag.addLabel(
-      Label::primary(Tok.Span, File, std::format("unexpected {}", Found)));
+  Diag.addLabel(Label::primary(Tok.Span, std::format("unexpected {}", Found)));
   Diag.setHelp("types include builtins and identifiers");
   Diags.emit(Diag);
   eatNextToken();
-  return nullptr;
+  return {};
 }
 
-Type *Parser::errorExpectedRParenInType(Span OpenParenSpan) {
-  Token Tok = NextToken;
+TypeLoc Parser::errorExpectedRParenInType(Span OpenParenSpan) {
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expected ')'");
   Diag.setCode("E1009");
   Diag.addLabel(Label::primary(
-      Tok.Span, File,
-      std::format("found {} instead of ')'", describeToken(Tok))));
-  Diag.addLabel(
-      Label::secondary(OpenParenSpan, File, "opening '(' in type here"));
+      Tok.Span, std::format("found {} instead of ')'", describeToken(Tok))));
+  Diag.addLabel(Label::secondary(OpenParenSpan, "opening '(' in type here"));
   Diag.setHelp("type parentheses must be closed with ')'");
   Diags.emit(Diag);
   eatNextToken();
-  return nullptr;
+  return {};
 }
 
 Stmt *Parser::errorUnexpectedColonEqualAfterType(Span TypeSpan) {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("unexpected ':=' after type");
   Diag.setCode("E1010");
   Diag.addLabel(
-      Label::primary(Tok.Span, File, "':=' cannot follow a type annotation"));
-  Diag.addLabel(Label::secondary(TypeSpan, File, "type specified here"));
+      Label::primary(Tok.Span, "':=' cannot follow a type annotation"));
+  Diag.addLabel(Label::secondary(TypeSpan, "type specified here"));
   Diag.setHelp("use '=' to assign a value after a type annotation");
   Diags.emit(Diag);
   eatNextToken();
@@ -248,15 +251,15 @@ Stmt *Parser::errorUnexpectedColonEqualAfterType(Span TypeSpan) {
 }
 
 Stmt *Parser::errorExpectedIdentifierAfterMut(Span MutSpan) {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expected identifier after 'mut'");
   Diag.setCode("E1011");
   Diag.addLabel(Label::primary(
-      Tok.Span, File,
+      Tok.Span,
       std::format("found {} instead of identifier", describeToken(Tok))));
   Diag.addLabel(
-      Label::secondary(MutSpan, File, "'mut' starts a mutable binding here"));
+      Label::secondary(MutSpan, "'mut' starts a mutable binding here"));
   Diag.setHelp("write 'mut <name>' to declare a mutable variable");
   Diags.emit(Diag);
   eatNextToken();
@@ -264,25 +267,25 @@ Stmt *Parser::errorExpectedIdentifierAfterMut(Span MutSpan) {
 }
 
 Stmt *Parser::errorInvalidMutInitializer() {
-  auto Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expected ':=' after mutable binding");
   Diag.setCode("E1013");
-  Diag.addLabel(Label::primary(Tok.Span, File, "found '=' instead of ':='"));
+  Diag.addLabel(Label::primary(Tok.Span, "found '=' instead of ':='"));
   Diags.emit(Diag);
   eatNextToken();
   return nullptr;
 }
 
 Expr *Parser::errorExpectedThenBlock(Span IfSpan) {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expected newline after 'if' condition");
   Diag.setCode("E1014");
   Diag.addLabel(Label::primary(
-      Tok.Span, File,
+      Tok.Span,
       std::format("found {} instead of newline", describeToken(Tok))));
-  Diag.addLabel(Label::secondary(IfSpan, File, "'if' starts here"));
+  Diag.addLabel(Label::secondary(IfSpan, "'if' starts here"));
   Diag.setHelp("put the condition on the same line as 'if', then start the "
                "body on the next line");
   Diags.emit(Diag);
@@ -290,14 +293,14 @@ Expr *Parser::errorExpectedThenBlock(Span IfSpan) {
 }
 
 Expr *Parser::errorExpectedWhileBody(Span WhileSpan) {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expected newline after 'while' condition");
   Diag.setCode("E1015");
   Diag.addLabel(Label::primary(
-      Tok.Span, File,
+      Tok.Span,
       std::format("found {} instead of newline", describeToken(Tok))));
-  Diag.addLabel(Label::secondary(WhileSpan, File, "'while' starts here"));
+  Diag.addLabel(Label::secondary(WhileSpan, "'while' starts here"));
   Diag.setHelp("put the condition on the same line as 'while', then start the "
                "body on the next line");
   Diags.emit(Diag);
@@ -305,20 +308,20 @@ Expr *Parser::errorExpectedWhileBody(Span WhileSpan) {
 }
 
 void Parser::skipNewLines() {
-  while (NextToken.Kind == TokenKind::NewLine)
+  while (nextKind() == TokenKind::NewLine)
     eatNextToken();
 }
 
-Type *Parser::parseType() {
+TypeLoc Parser::parseType() {
   using TK = TokenKind;
 
-  auto MakeBuiltin = [&](BuiltinKind K) -> Type * {
-    auto Tok = NextToken;
+  auto MakeBuiltin = [&](BuiltinKind K) -> TypeLoc {
+    auto Loc = nextSpan();
     eatNextToken();
-    return Context.create<Type>(Tok.Span, BuiltinType{K});
+    return {Context.getBuiltinType(K), Loc};
   };
 
-  switch (NextToken.Kind) {
+  switch (nextKind()) {
   case TK::Bool:
     return MakeBuiltin(BuiltinKind::Bool);
   case TK::Int:
@@ -349,20 +352,21 @@ Type *Parser::parseType() {
     return MakeBuiltin(BuiltinKind::Never);
 
   case TK::LParen: {
-    auto LTok = NextToken;
+    auto LParenLoc = nextSpan();
     eatNextToken();
-    if (NextToken.Kind != TK::RParen)
-      return errorExpectedRParenInType(LTok.Span);
-    auto RTok = NextToken;
+    if (nextKind() != TK::RParen)
+      return errorExpectedRParenInType(LParenLoc);
+    auto RParenLoc = nextSpan();
     eatNextToken();
-    return Context.create<Type>(LTok.Span.merge(RTok.Span),
-                                BuiltinType{BuiltinKind::Unit});
+    return {Context.getBuiltinType(BuiltinKind::Unit),
+            LParenLoc.merge(RParenLoc)};
   }
 
   case TK::Identifier: {
-    auto Tok = NextToken;
+    auto Loc = nextSpan();
+    Atom Name = nextAtom();
     eatNextToken();
-    return Context.create<Type>(Tok.Span, NamedType{Context.save(Tok.Value)});
+    return {Context.getType(NamedType{Name}), Loc};
   }
 
   default:
@@ -371,54 +375,57 @@ Type *Parser::parseType() {
 }
 
 Expr *Parser::parsePrimaryExpr() {
-  switch (NextToken.Kind) {
+  switch (nextKind()) {
   case TokenKind::True: {
-    auto Tok = NextToken;
+    auto Loc = nextSpan();
     eatNextToken();
-    return Context.create<Expr>(Tok.Span, BoolLiteral{true});
+    return Context.create<Expr>(Loc, BoolLiteral{true});
   }
   case TokenKind::False: {
-    auto Tok = NextToken;
+    auto Loc = nextSpan();
     eatNextToken();
-    return Context.create<Expr>(Tok.Span, BoolLiteral{false});
+    return Context.create<Expr>(Loc, BoolLiteral{false});
   }
   case TokenKind::FloatLiteral: {
-    auto Tok = NextToken;
+    auto Loc = nextSpan();
+    auto Text = nextText();
     eatNextToken();
     float V = 0;
-    std::from_chars(Tok.Value.begin(), Tok.Value.end(), V);
-    return Context.create<Expr>(Tok.Span, FloatLiteral{V});
+    std::from_chars(Text.begin(), Text.end(), V);
+    return Context.create<Expr>(Loc, FloatLiteral{V});
   }
   case TokenKind::IntLiteral: {
-    auto Tok = NextToken;
+    auto Loc = nextSpan();
+    auto Text = nextText();
     eatNextToken();
     std::uint64_t V = 0;
-    std::from_chars(Tok.Value.begin(), Tok.Value.end(), V);
-    return Context.create<Expr>(Tok.Span, IntLiteral{V});
+    std::from_chars(Text.begin(), Text.end(), V);
+    return Context.create<Expr>(Loc, IntLiteral{V});
   }
   case TokenKind::Identifier: {
-    auto Tok = NextToken;
+    auto Loc = nextSpan();
+    Atom Name = nextAtom();
     eatNextToken();
-    return Context.create<Expr>(Tok.Span, VarRef{Context.save(Tok.Value)});
+    return Context.create<Expr>(Loc, VarRef{Name});
   }
   case TokenKind::Continue: {
-    auto Loc = NextToken.Span;
+    auto Loc = nextSpan();
     eatNextToken();
     return Context.create<Expr>(Loc, ContinueExpr{});
   }
   case TokenKind::LParen: {
-    auto LTok = NextToken;
+    auto LParenLoc = nextSpan();
     eatNextToken();
-    if (NextToken.Kind == TokenKind::RParen) {
-      auto RTok = NextToken;
+    if (nextKind() == TokenKind::RParen) {
+      auto RParenLoc = nextSpan();
       eatNextToken();
-      return Context.create<Expr>(LTok.Span.merge(RTok.Span), UnitLiteral{});
+      return Context.create<Expr>(LParenLoc.merge(RParenLoc), UnitLiteral{});
     }
     Expr *Inner = parseExpr();
     if (!Inner)
       return nullptr;
-    if (NextToken.Kind != TokenKind::RParen)
-      return errorExpectedRParen(LTok.Span);
+    if (nextKind() != TokenKind::RParen)
+      return errorExpectedRParen(LParenLoc);
     eatNextToken();
     return Inner;
   }
@@ -434,12 +441,12 @@ Expr *Parser::parsePrimaryExpr() {
 }
 
 Expr *Parser::parseBreakExpr() {
-  auto Loc = NextToken.Span;
+  auto Loc = nextSpan();
   eatNextToken();
   Expr *Value = nullptr;
-  if (NextToken.Kind != TokenKind::NewLine &&
-      NextToken.Kind != TokenKind::Semicolon &&
-      NextToken.Kind != TokenKind::Eof) {
+  if (nextKind() != TokenKind::NewLine &&
+      nextKind() != TokenKind::Semicolon &&
+      nextKind() != TokenKind::Eof) {
     Value = parseExpr();
     if (!Value)
       return nullptr;
@@ -468,14 +475,14 @@ Expr *Parser::parseCallExpr() {
     return nullptr;
 
   while (true) {
-    if (NextToken.Kind == TokenKind::LParen) {
-      Token LParen = NextToken;
+    if (nextKind() == TokenKind::LParen) {
+      auto LParenLoc = nextSpan();
       eatNextToken();
       skipNewLines();
 
       llvm::SmallVector<Expr *, 8> Args;
 
-      if (NextToken.Kind == TokenKind::RParen) {
+      if (nextKind() == TokenKind::RParen) {
         eatNextToken();
       } else {
         while (true) {
@@ -486,24 +493,24 @@ Expr *Parser::parseCallExpr() {
           Args.push_back(Arg);
           skipNewLines();
 
-          if (NextToken.Kind == TokenKind::Comma) {
+          if (nextKind() == TokenKind::Comma) {
             eatNextToken();
             skipNewLines();
             continue;
           }
-          if (NextToken.Kind == TokenKind::RParen) {
+          if (nextKind() == TokenKind::RParen) {
             eatNextToken();
             break;
           }
 
-          errorExpectedCommaOrRParenInCall(LParen.Span);
+          errorExpectedCommaOrRParenInCall(LParenLoc);
 
-          if (NextToken.Kind == TokenKind::Comma) {
+          if (nextKind() == TokenKind::Comma) {
             eatNextToken();
             skipNewLines();
             continue;
           }
-          if (NextToken.Kind == TokenKind::RParen)
+          if (nextKind() == TokenKind::RParen)
             eatNextToken();
           break;
         }
@@ -518,7 +525,7 @@ Expr *Parser::parseCallExpr() {
       continue;
     }
 
-    if (isAtomStart(NextToken.Kind)) {
+    if (isAtomStart(nextKind())) {
       Expr *Arg = parsePrimaryExpr();
       if (!Arg)
         break;
@@ -535,149 +542,160 @@ Expr *Parser::parseCallExpr() {
   return ExprNode;
 }
 
+namespace {
+
+// What a token means before an operand (prefix) and between two (binary).
+// Prec is the binary binding power, higher binding tighter; 0 means the token
+// does not continue an expression.
+struct OperatorInfo {
+  std::uint8_t Prec = 0;
+  BinaryOp Binary{};
+  bool IsPrefix = false;
+  UnaryOp Prefix{};
+};
+
+constexpr std::size_t NumTokenKinds =
+    static_cast<std::size_t>(TokenKind::Error) + 1;
+
+constexpr auto Operators = [] {
+  std::array<OperatorInfo, NumTokenKinds> Table{};
+  auto binary = [&](TokenKind K, std::uint8_t Prec, BinaryOp Op) {
+    Table[static_cast<std::size_t>(K)].Prec = Prec;
+    Table[static_cast<std::size_t>(K)].Binary = Op;
+  };
+  auto prefix = [&](TokenKind K, UnaryOp Op) {
+    Table[static_cast<std::size_t>(K)].IsPrefix = true;
+    Table[static_cast<std::size_t>(K)].Prefix = Op;
+  };
+  binary(TokenKind::Or, 1, BinaryOp::Or);
+  binary(TokenKind::And, 2, BinaryOp::And);
+  binary(TokenKind::EqualEqual, 3, BinaryOp::Eq);
+  binary(TokenKind::BangEqual, 3, BinaryOp::NotEq);
+  binary(TokenKind::Less, 4, BinaryOp::Lt);
+  binary(TokenKind::LessEqual, 4, BinaryOp::Le);
+  binary(TokenKind::Greater, 4, BinaryOp::Gt);
+  binary(TokenKind::GreaterEqual, 4, BinaryOp::Ge);
+  binary(TokenKind::Plus, 5, BinaryOp::Add);
+  binary(TokenKind::Minus, 5, BinaryOp::Sub);
+  binary(TokenKind::Star, 6, BinaryOp::Mul);
+  binary(TokenKind::Slash, 6, BinaryOp::Div);
+  binary(TokenKind::Percent, 6, BinaryOp::Mod);
+  prefix(TokenKind::Plus, UnaryOp::Plus);
+  prefix(TokenKind::Minus, UnaryOp::Neg);
+  prefix(TokenKind::Not, UnaryOp::Not);
+  return Table;
+}();
+
+static_assert(Operators[static_cast<std::size_t>(TokenKind::NewLine)].Prec ==
+                  0,
+              "a newline ends an expression");
+
+const OperatorInfo &operatorInfo(TokenKind K) {
+  return Operators[static_cast<std::size_t>(K)];
+}
+
+} // namespace
+
+// Prefix operators are collected and applied innermost first, so a long run
+// of them does not recurse.
 Expr *Parser::parseUnaryExpr() {
-  switch (NextToken.Kind) {
-  case TokenKind::Plus:
-  case TokenKind::Not:
-  case TokenKind::Minus: {
-    Token OpTok = NextToken;
-    eatNextToken();
-    Expr *Operand = parseUnaryExpr();
-    if (!Operand)
-      return nullptr;
-    UnaryOp Op;
-    if (OpTok.Kind == TokenKind::Not)
-      Op = UnaryOp::Not;
-    else if (OpTok.Kind == TokenKind::Minus)
-      Op = UnaryOp::Neg;
-    else
-      Op = UnaryOp::Plus;
-    return Context.create<Expr>(OpTok.Span.merge(Operand->Location),
-                                UnaryExpr{Op, Operand});
-  }
-  default:
+  if (!operatorInfo(nextKind()).IsPrefix)
     return parseCallExpr();
-  }
-}
 
-static std::optional<BinaryOp> toBinaryOp(TokenKind K) {
-  switch (K) {
-  case TokenKind::Plus:
-    return BinaryOp::Add;
-  case TokenKind::Minus:
-    return BinaryOp::Sub;
-  case TokenKind::Star:
-    return BinaryOp::Mul;
-  case TokenKind::Slash:
-    return BinaryOp::Div;
-  case TokenKind::Percent:
-    return BinaryOp::Mod;
-  case TokenKind::EqualEqual:
-    return BinaryOp::Eq;
-  case TokenKind::BangEqual:
-    return BinaryOp::NotEq;
-  case TokenKind::Less:
-    return BinaryOp::Lt;
-  case TokenKind::LessEqual:
-    return BinaryOp::Le;
-  case TokenKind::Greater:
-    return BinaryOp::Gt;
-  case TokenKind::GreaterEqual:
-    return BinaryOp::Ge;
-  case TokenKind::And:
-    return BinaryOp::And;
-  case TokenKind::Or:
-    return BinaryOp::Or;
-  default:
-    return std::nullopt;
+  llvm::SmallVector<std::pair<UnaryOp, Span>, 4> Prefixes;
+  while (operatorInfo(nextKind()).IsPrefix) {
+    Prefixes.emplace_back(operatorInfo(nextKind()).Prefix, nextSpan());
+    eatNextToken();
   }
-}
 
-static int getBinOpPrecedence(BinaryOp Op) {
-  switch (Op) {
-  case BinaryOp::Or:
-    return 1;
-  case BinaryOp::And:
-    return 2;
-  case BinaryOp::Eq:
-  case BinaryOp::NotEq:
-    return 3;
-  case BinaryOp::Lt:
-  case BinaryOp::Le:
-  case BinaryOp::Gt:
-  case BinaryOp::Ge:
-    return 4;
-  case BinaryOp::Add:
-  case BinaryOp::Sub:
-    return 5;
-  case BinaryOp::Mul:
-  case BinaryOp::Div:
-  case BinaryOp::Mod:
-    return 6;
-  }
-  return -1;
+  Expr *Operand = parseCallExpr();
+  if (!Operand)
+    return nullptr;
+  for (auto [Op, OpLoc] : llvm::reverse(Prefixes))
+    Operand = Context.create<Expr>(OpLoc.merge(Operand->Location),
+                                   UnaryExpr{Op, Operand});
+  return Operand;
 }
 
-Expr *Parser::parseBinaryExpr(int MinPrec) {
-  Expr *Left = parseUnaryExpr();
-  if (!Left)
+// Operator precedence by shunting: Pending[I] joins Operands[I] and
+// Operands[I + 1]. An operator first reduces every pending one that binds at
+// least as tightly, which keeps chains left-associative and the stacks no
+// deeper than the number of precedence levels, however long the chain.
+Expr *Parser::parseBinaryExpr() {
+  struct PendingOp {
+    BinaryOp Op;
+    std::uint8_t Prec;
+  };
+  llvm::SmallVector<Expr *, 8> Operands;
+  llvm::SmallVector<PendingOp, 8> Pending;
+  auto reduce = [&] {
+    Expr *Right = Operands.pop_back_val();
+    Expr *Left = Operands.back();
+    BinaryOp Op = Pending.pop_back_val().Op;
+    Operands.back() = Context.create<Expr>(
+        Left->Location.merge(Right->Location), BinaryExpr{Op, Left, Right});
+  };
+
+  Expr *First = parseUnaryExpr();
+  if (!First)
     return nullptr;
+  Operands.push_back(First);
 
   while (true) {
-    if (NextToken.Kind == TokenKind::NewLine)
-      break;
-
-    auto Op = toBinaryOp(NextToken.Kind);
-    if (!Op.has_value())
+    const OperatorInfo &Info = operatorInfo(nextKind());
+    if (Info.Prec == 0)
       break;
-
-    int Prec = getBinOpPrecedence(*Op);
-    if (Prec < MinPrec)
-      break;
-
-    Token OpTok = NextToken;
+    while (!Pending.empty() && Pending.back().Prec >= Info.Prec)
+      reduce();
     eatNextToken();
 
-    Expr *Right = parseBinaryExpr(Prec + 1);
-    if (!Right)
-      return Left;
-
-    Span S = Left->Location.merge(Right->Location);
-    Left = Context.create<Expr>(S, BinaryExpr{*Op, Left, Right});
+    Expr *Right = parseUnaryExpr();
+    if (!Right) {
+      // The operator is dropped along with its precedence level: what was
+      // pending below it is joined, and parsing carries on from there.
+      if (Pending.empty())
+        return Operands.back();
+      reduce();
+      continue;
+    }
+    Pending.push_back({Info.Binary, Info.Prec});
+    Operands.push_back(Right);
   }
 
-  return Left;
+  while (!Pending.empty())
+    reduce();
+  return Operands.back();
 }
 
 Expr *Parser::parseExpr() { return parseBinaryExpr(); }
 
 Expr *Parser::parseIf() {
-  auto IfTok = NextToken;
+  auto IfLoc = nextSpan();
   eatNextToken();
 
   auto *Cond = parseExpr();
   if (!Cond)
     return nullptr;
 
-  if (NextToken.Kind != TokenKind::NewLine &&
-      NextToken.Kind != TokenKind::Semicolon)
-    return errorExpectedThenBlock(IfTok.Span);
+  if (nextKind() != TokenKind::NewLine &&
+      nextKind() != TokenKind::Semicolon)
+    return errorExpectedThenBlock(IfLoc);
   eatNextToken();
 
   BlockExpr *Then =
       parseBlock({TokenKind::End, TokenKind::ElseIf, TokenKind::Else});
   BlockExpr *ElseBlock = nullptr;
 
-  if (NextToken.Kind == TokenKind::ElseIf) {
+  if (nextKind() == TokenKind::ElseIf) {
     auto *ElseIf = parseIf();
     if (!ElseIf)
       return nullptr;
     auto StmtsRef = Context.copyArray(llvm::ArrayRef<Stmt *>({}));
     ElseBlock = Context.create<BlockExpr>(StmtsRef, ElseIf);
-  } else if (NextToken.Kind == TokenKind::Else) {
+  } else if (nextKind() == TokenKind::Else) {
     eatNextToken();
-    if (NextToken.Kind == TokenKind::NewLine ||
-        NextToken.Kind == TokenKind::Semicolon)
+    if (nextKind() == TokenKind::NewLine ||
+        nextKind() == TokenKind::Semicolon)
       eatNextToken();
     ElseBlock = parseBlock({TokenKind::End});
     if (!ElseBlock)
@@ -687,34 +705,35 @@ Expr *Parser::parseIf() {
     eatNextToken();
   }
 
-  return Context.create<Expr>(IfTok.Span.merge(Cond->Location),
+  return Context.create<Expr>(IfLoc.merge(Cond->Location),
                               IfExpr{Cond, Then, ElseBlock});
 }
 
 Expr *Parser::parseWhile() {
-  auto WhileTok = NextToken;
+  auto WhileLoc = nextSpan();
   eatNextToken();
 
   auto *Cond = parseExpr();
   if (!Cond)
     return nullptr;
 
-  if (NextToken.Kind != TokenKind::NewLine &&
-      NextToken.Kind != TokenKind::Semicolon)
-    return errorExpectedWhileBody(WhileTok.Span);
+  if (nextKind() != TokenKind::NewLine &&
+      nextKind() != TokenKind::Semicolon)
+    return errorExpectedWhileBody(WhileLoc);
   eatNextToken();
 
   auto *Body = parseBlock({TokenKind::End});
-  return Context.create<Expr>(WhileTok.Span.merge(Cond->Location),
+  eatNextToken();
+  return Context.create<Expr>(WhileLoc.merge(Cond->Location),
                               WhileExpr{Cond, Body});
 }
 
 Stmt *Parser::parseReturnStmt() {
-  auto ReturnLoc = NextToken.Span;
+  auto ReturnLoc = nextSpan();
   eatNextToken();
 
-  if (NextToken.Kind == TokenKind::NewLine ||
-      NextToken.Kind == TokenKind::Semicolon) {
+  if (nextKind() == TokenKind::NewLine ||
+      nextKind() == TokenKind::Semicolon) {
     eatNextToken();
     return Context.create<Stmt>(ReturnLoc, ReturnStmt{nullptr});
   }
@@ -737,17 +756,17 @@ Stmt *Parser::parseExprStmt() {
 Stmt *Parser::parseExprOrAssignStmt() {
   bool IsMutable = false;
   std::optional<Span> MutSpan;
-  if (NextToken.Kind == TokenKind::Mut) {
-    MutSpan = NextToken.Span;
+  if (nextKind() == TokenKind::Mut) {
+    MutSpan = nextSpan();
     IsMutable = true;
     eatNextToken();
-    if (NextToken.Kind != TokenKind::Identifier)
+    if (nextKind() != TokenKind::Identifier)
       return errorExpectedIdentifierAfterMut(*MutSpan);
   }
   Expr *LHS = parseExpr();
   if (!LHS)
     return nullptr;
-  if (NextToken.Kind == TokenKind::Equal) {
+  if (nextKind() == TokenKind::Equal) {
     if (IsMutable)
       return errorInvalidMutInitializer();
     eatNextToken();
@@ -760,17 +779,16 @@ Stmt *Parser::parseExprOrAssignStmt() {
                                 AssignStmt{LHS, RHS});
   }
 
-  if (NextToken.Kind == TokenKind::ColonEqual ||
-      NextToken.Kind == TokenKind::Colon) {
-    Type *Ty = nullptr;
-    if (NextToken.Kind == TokenKind::Colon) {
+  if (nextKind() == TokenKind::ColonEqual ||
+      nextKind() == TokenKind::Colon) {
+    TypeLoc Ty;
+    if (nextKind() == TokenKind::Colon) {
       eatNextToken();
-      auto TypeTok = NextToken;
       Ty = parseType();
       if (!Ty)
         return nullptr;
-      if (NextToken.Kind != TokenKind::ColonEqual)
-        return errorUnexpectedColonEqualAfterType(TypeTok.Span);
+      if (nextKind() != TokenKind::ColonEqual)
+        return errorUnexpectedColonEqualAfterType(Ty.Location);
     }
     eatNextToken();
     auto *RHS = parseExpr();
@@ -780,7 +798,7 @@ Stmt *Parser::parseExprOrAssignStmt() {
       return errorInvalidDeclTarget(LHS);
     auto Name = std::get<VarRef>(LHS->Kind).Name;
     return Context.create<Stmt>(LHS->Location.merge(RHS->Location),
-                                VarDecl{Name, Ty, RHS, IsMutable});
+                                VarDecl{Name, IsMutable, Ty, RHS});
   }
 
   return Context.create<Stmt>(LHS->Location, ExprStmt{LHS});
@@ -789,17 +807,17 @@ Stmt *Parser::parseExprOrAssignStmt() {
 BlockExpr *Parser::parseBlock(llvm::ArrayRef<TokenKind> Terminators) {
   llvm::SmallVector<Stmt *, 8> Stmts;
 
-  while (NextToken.Kind != TokenKind::Eof) {
+  while (nextKind() != TokenKind::Eof) {
     skipNewLines();
-    if (llvm::is_contained(Terminators, NextToken.Kind))
+    if (llvm::is_contained(Terminators, nextKind()))
       break;
 
     auto *S = parseStmt();
     if (!S) {
-      while (NextToken.Kind != TokenKind::NewLine &&
-             NextToken.Kind != TokenKind::Semicolon &&
-             NextToken.Kind != TokenKind::Eof &&
-             !llvm::is_contained(Terminators, NextToken.Kind))
+      while (nextKind() != TokenKind::NewLine &&
+             nextKind() != TokenKind::Semicolon &&
+             nextKind() != TokenKind::Eof &&
+             !llvm::is_contained(Terminators, nextKind()))
         eatNextToken();
       continue;
     }
@@ -821,143 +839,174 @@ BlockExpr *Parser::parseBlock(llvm::ArrayRef<TokenKind> Terminators) {
 }
 
 void Parser::errorExpectedParamName() {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expected parameter name");
   Diag.setCode("E1020");
   Diag.addLabel(Label::primary(
-      Tok.Span, File,
+      Tok.Span,
       std::format("found {} instead of identifier", describeToken(Tok))));
   Diags.emit(Diag);
   eatNextToken();
 }
 
 std::optional<Param> Parser::parseParam() {
-  if (NextToken.Kind != TokenKind::Identifier) {
+  if (nextKind() != TokenKind::Identifier) {
     errorExpectedParamName();
     return std::nullopt;
   }
-  auto Name = Context.save(NextToken.Value);
-  auto Loc = NextToken.Span;
+  Atom Name = nextAtom();
+  auto Loc = nextSpan();
   eatNextToken();
-  Type *Ty = nullptr;
-  if (NextToken.Kind == TokenKind::Colon) {
+  TypeLoc Ty;
+  if (nextKind() == TokenKind::Colon) {
     eatNextToken();
     Ty = parseType();
     if (!Ty)
       return std::nullopt;
-    Loc = Loc.merge(Ty->Location);
+    Loc = Loc.merge(Ty.Location);
   }
   return Param{Name, Ty, Loc};
 }
 
 void Parser::errorExpectedCommaAfterParam(Span ParamSpan) {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
 
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expected ',' after parameter");
   Diag.setCode("E1021");
 
   Diag.addLabel(Label::primary(
-      Tok.Span, File,
-      std::format("found {} instead of ','", describeToken(Tok))));
+      Tok.Span, std::format("found {} instead of ','", describeToken(Tok))));
 
-  Diag.addLabel(Label::secondary(ParamSpan, File, "parameter declared here"));
+  Diag.addLabel(Label::secondary(ParamSpan, "parameter declared here"));
 
   Diags.emit(Diag);
 }
 
-llvm::ArrayRef<Param> Parser::parseParamList() {
+llvm::MutableArrayRef<Param> Parser::parseParamList() {
   eatNextToken();
   llvm::SmallVector<Param, 8> Params;
   auto SyncToParamBoundary = [&]() {
-    while (NextToken.Kind != TokenKind::Eof &&
-           NextToken.Kind != TokenKind::Comma &&
-           NextToken.Kind != TokenKind::RParen)
+    while (nextKind() != TokenKind::Eof &&
+           nextKind() != TokenKind::Comma &&
+           nextKind() != TokenKind::RParen)
       eatNextToken();
-    if (NextToken.Kind == TokenKind::Comma)
+    if (nextKind() == TokenKind::Comma)
       eatNextToken();
   };
-  while (NextToken.Kind != TokenKind::Eof &&
-         NextToken.Kind != TokenKind::RParen) {
+  while (nextKind() != TokenKind::Eof &&
+         nextKind() != TokenKind::RParen) {
     auto Param = parseParam();
     if (!Param.has_value()) {
       SyncToParamBoundary();
       continue;
     }
     Params.push_back(*Param);
-    if (NextToken.Kind == TokenKind::Comma) {
+    if (nextKind() == TokenKind::Comma) {
       eatNextToken();
       continue;
     }
-    if (NextToken.Kind != TokenKind::RParen) {
+    if (nextKind() != TokenKind::RParen) {
       errorExpectedCommaAfterParam(Param->Location);
       SyncToParamBoundary();
     }
   }
-  if (NextToken.Kind == TokenKind::RParen)
+  if (nextKind() == TokenKind::RParen)
     eatNextToken();
   return Context.copyArray(llvm::ArrayRef(Params));
 }
 
 void Parser::errorExpectedFunctionName(Span FnSpan) {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expected function name");
   Diag.setCode("E1022");
   Diag.addLabel(Label::primary(
-      Tok.Span, File,
+      Tok.Span,
       std::format("found {} instead of identifier", describeToken(Tok))));
-  Diag.addLabel(Label::secondary(FnSpan, File, "'fn' declared here"));
+  Diag.addLabel(Label::secondary(FnSpan, "'fn' declared here"));
   Diags.emit(Diag);
 }
 
 void Parser::errorExpectedFunctionBody(Span FnSpan) {
-  Token Tok = NextToken;
+  Token Tok = nextToken();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expected newline after function signature");
   Diag.setCode("E1023");
   Diag.addLabel(Label::primary(
-      Tok.Span, File,
+      Tok.Span,
       std::format("found {} instead of newline", describeToken(Tok))));
 
-  Diag.addLabel(Label::secondary(FnSpan, File, "'def' starts here"));
+  Diag.addLabel(Label::secondary(FnSpan, "'def' starts here"));
   Diag.setHelp("put the function signature on one line, "
                "then start the body on the next line");
   Diags.emit(Diag);
 }
 
+LazyBody *Parser::deferBody() {
+  std::size_t Begin = mark();
+  int Depth = 0;
+  for (; nextKind() != TokenKind::Eof; eatNextToken()) {
+    switch (nextKind()) {
+    case TokenKind::Def:
+    case TokenKind::If:
+    case TokenKind::While:
+      ++Depth;
+      break;
+    case TokenKind::End:
+      if (Depth-- == 0) {
+        auto *Lazy = Context.create<LazyBody>(
+            LazyBody{BodySource, static_cast<std::uint32_t>(TokenBase + Begin),
+                     static_cast<std::uint32_t>(TokenBase + Index)});
+        eatNextToken();
+        return Lazy;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  rewind(Begin);
+  return nullptr;
+}
+
 Stmt *Parser::parseFunc() {
-  auto FnSpan = NextToken.Span;
+  auto FnSpan = nextSpan();
   eatNextToken();
-  if (NextToken.Kind != TokenKind::Identifier) {
+  if (nextKind() != TokenKind::Identifier) {
     errorExpectedFunctionName(FnSpan);
     eatNextToken();
     return nullptr;
   }
-  auto Name = Context.save(NextToken.Value);
-  auto Loc = NextToken.Span;
+  Atom Name = nextAtom();
+  auto Loc = nextSpan();
   eatNextToken();
-  llvm::ArrayRef<Param> Params = {};
-  if (NextToken.Kind == TokenKind::LParen)
+  llvm::MutableArrayRef<Param> Params = {};
+  if (nextKind() == TokenKind::LParen)
     Params = parseParamList();
-  Type *ReturnType = nullptr;
-  if (NextToken.Kind == TokenKind::Arrow) {
+  TypeLoc ReturnType;
+  if (nextKind() == TokenKind::Arrow) {
     eatNextToken();
     ReturnType = parseType();
     if (!ReturnType)
       return nullptr;
   }
   BlockExpr *Body = nullptr;
-  if (NextToken.Kind == TokenKind::NewLine ||
-      NextToken.Kind == TokenKind::Semicolon) {
+  if (nextKind() == TokenKind::NewLine ||
+      nextKind() == TokenKind::Semicolon) {
     eatNextToken();
+    if (BodySource)
+      if (auto *Lazy = deferBody()) {
+        auto *Decl =
+            Context.create<FunctionDecl>(Name, Params, ReturnType, Lazy);
+        return Context.create<Stmt>(Loc, Decl);
+      }
     Body = parseBlock({TokenKind::End});
     eatNextToken();
   } else {
-    BlockExpr *Body = nullptr;
     auto EmptyStmts = Context.copyArray(llvm::ArrayRef<Stmt *>({}));
-    if (NextToken.Kind == TokenKind::End) {
+    if (nextKind() == TokenKind::End) {
       Body = Context.create<BlockExpr>(EmptyStmts, /*Tail=*/nullptr);
       eatNextToken();
     } else {
@@ -965,7 +1014,7 @@ Stmt *Parser::parseFunc() {
       if (!E)
         return nullptr;
       Body = Context.create<BlockExpr>(EmptyStmts, E);
-      if (NextToken.Kind == TokenKind::End)
+      if (nextKind() == TokenKind::End)
         eatNextToken();
       else {
         errorExpectedFunctionBody(FnSpan);
@@ -978,10 +1027,10 @@ Stmt *Parser::parseFunc() {
 }
 
 Stmt *Parser::parseStmt() {
-  auto Start = NextToken.Span;
+  auto Start = nextSpan();
   Stmt *S = nullptr;
 
-  switch (NextToken.Kind) {
+  switch (nextKind()) {
   case TokenKind::Return:
     S = parseReturnStmt();
     break;
@@ -1004,7 +1053,7 @@ Stmt *Parser::parseStmt() {
     S = parseExprOrAssignStmt();
     break;
   case TokenKind::Def: {
-    auto Loc = NextToken.Span;
+    auto Loc = nextSpan();
     S = parseFunc();
     break;
   }
@@ -1015,10 +1064,10 @@ Stmt *Parser::parseStmt() {
   if (!S)
     return nullptr;
 
-  if (NextToken.Kind == TokenKind::NewLine ||
-      NextToken.Kind == TokenKind::Semicolon ||
-      NextToken.Kind == TokenKind::Eof) {
-    if (NextToken.Kind != TokenKind::Eof)
+  if (nextKind() == TokenKind::NewLine ||
+      nextKind() == TokenKind::Semicolon ||
+      nextKind() == TokenKind::Eof) {
+    if (nextKind() != TokenKind::Eof)
       eatNextToken();
     return S;
   }
@@ -1026,23 +1075,273 @@ Stmt *Parser::parseStmt() {
   return errorExpectedStmtTerminator(Start);
 }
 
-Module Parser::parseModule(llvm::StringRef Name) {
-  llvm::SmallVector<Stmt *, 8> Stmts;
-  while (NextToken.Kind != TokenKind::Eof) {
+void Parser::parseTopLevel(llvm::SmallVectorImpl<Stmt *> &Stmts) {
+  while (nextKind() != TokenKind::Eof) {
     skipNewLines();
-    if (NextToken.Kind == TokenKind::Eof)
+    if (nextKind() == TokenKind::Eof)
       break;
     Stmt *S = parseStmt();
     if (!S) {
-      while (NextToken.Kind != TokenKind::NewLine &&
-             NextToken.Kind != TokenKind::Semicolon &&
-             NextToken.Kind != TokenKind::Eof)
+      while (nextKind() != TokenKind::NewLine &&
+             nextKind() != TokenKind::Semicolon &&
+             nextKind() != TokenKind::Eof)
         eatNextToken();
       continue;
     }
     Stmts.push_back(S);
   }
+}
+
+// Parses deferred bodies out of the whole buffer, into the context and engine
+// of the parser that deferred them.
+class DeferredBodies final : public LazyBodySource {
+  ASTContext &Context;
+  const TokenBuffer &Tokens;
+  DiagnosticEngine &Diags;
+
+public:
+  DeferredBodies(ASTContext &Context, const TokenBuffer &Tokens,
+                 DiagnosticEngine &Diags)
+      : Context(Context), Tokens(Tokens), Diags(Diags) {}
+
+  BlockExpr *parseBody(const LazyBody &Body) override {
+    Parser P(Context, Tokens, Diags);
+    P.BodySource = this;
+    P.Index = Body.Begin;
+    return P.parseBlock({TokenKind::End});
+  }
+
+  BlockExpr *parseBodyInto(const LazyBody &Body, ASTContext &Arena,
+                           DiagnosticEngine *Into) override {
+    assert(&Arena.identifiers() == &Context.identifiers() &&
+           "arena is not a child of the parsing context");
+    Parser P(Arena, Tokens, Into ? *Into : Diags);
+    P.Index = Body.Begin;
+    return P.parseBlock({TokenKind::End});
+  }
+};
+
+void Parser::deferFunctionBodies() {
+  assert(Tokens != &OwnedTokens && "deferred bodies would outlive the tokens");
+  if (!BodySource)
+    BodySource = Context.create<DeferredBodies>(Context, *Tokens, Diags);
+}
+
+Module Parser::parseModule(llvm::StringRef Name) {
+  llvm::SmallVector<Stmt *, 8> Stmts;
+  parseTopLevel(Stmts);
   return Module{Context.save(Name), Context.copyArray(llvm::ArrayRef(Stmts))};
 }
 
+// Token indices where top-level statements may be cut, from From to the Eof:
+// just after a newline or ';' with every def/if/while closed by its end and
+// every parenthesis closed, at least ChunkTokens apart. Nothing if the
+// nesting does not balance, since then the serial parser's recovery could
+// run across any cut.
+static std::optional<std::vector<std::size_t>>
+findTopLevelCuts(const TokenBuffer &Tokens, std::size_t From,
+                 std::size_t ChunkTokens) {
+  std::size_t Eof = Tokens.size() - 1;
+  std::vector<std::size_t> Cuts{From};
+  int Blocks = 0;
+  int Parens = 0;
+  auto Kinds = Tokens.kinds();
+  for (std::size_t I = From; I < Eof; ++I) {
+    switch (Kinds[I]) {
+    case TokenKind::Def:
+    case TokenKind::If:
+    case TokenKind::While:
+      ++Blocks;
+      break;
+    case TokenKind::End:
+      if (--Blocks < 0)
+        return std::nullopt;
+      break;
+    case TokenKind::LParen:
+      ++Parens;
+      break;
+    case TokenKind::RParen:
+      if (--Parens < 0)
+        return std::nullopt;
+      break;
+    case TokenKind::NewLine:
+    case TokenKind::Semicolon:
+      if (Blocks == 0 && Parens == 0 && I + 1 < Eof &&
+          I + 1 - Cuts.back() >= ChunkTokens)
+        Cuts.push_back(I + 1);
+      break;
+    default:
+      break;
+    }
+  }
+  if (Blocks != 0 || Parens != 0)
+    return std::nullopt;
+  Cuts.push_back(Eof);
+  return Cuts;
+}
+
+Module Parser::parseModuleParallel(llvm::StringRef Name,
+                                   llvm::ThreadPoolInterface &Pool,
+                                   std::size_t ChunkTokens) {
+  auto Cuts =
+      findTopLevelCuts(*Tokens, Index, std::max<std::size_t>(ChunkTokens, 1));
+  if (!Cuts || Cuts->size() <= 2)
+    return parseModule(Name);
+
+  // Workers only read the token buffer and the identifier table (every
+  // atom was interned while lexing); each builds nodes in its own context
+  // and reports into its own engine. Bodies they defer are parsed later from
+  // the whole buffer, into this parser's context.
+  struct Chunk {
+    std::unique_ptr<ASTContext> Context;
+    DiagnosticEngine Diags;
+    llvm::SmallVector<Stmt *, 0> Stmts;
+  };
+  std::size_t NumChunks = Cuts->size() - 1;
+  std::vector<Chunk> Chunks(NumChunks);
+  std::vector<std::shared_future<void>> Pending;
+  Pending.reserve(NumChunks);
+  for (std::size_t I = 0; I < NumChunks; ++I) {
+    Chunks[I].Context = std::make_unique<ASTContext>(Context);
+    Pending.push_back(Pool.async([&, I] {
+      TokenBuffer Part = Tokens->slice((*Cuts)[I], (*Cuts)[I + 1]);
+      Parser Worker(*Chunks[I].Context, Part, Chunks[I].Diags);
+      Worker.BodySource = BodySource;
+      Worker.TokenBase = (*Cuts)[I];
+      Worker.parseTopLevel(Chunks[I].Stmts);
+    }));
+  }
+  for (auto &Task : Pending)
+    Task.wait();
+
+  // Chunks before the first error parsed exactly as the serial parser would
+  // have; from that one on, parse serially and drop the rest.
+  llvm::SmallVector<Stmt *, 8> Stmts;
+  std::size_t I = 0;
+  for (; I < NumChunks && !Chunks[I].Diags.hasError(); ++I) {
+    Stmts.append(Chunks[I].Stmts.begin(), Chunks[I].Stmts.end());
+    Context.adopt(std::move(Chunks[I].Context));
+  }
+  Index = (*Cuts)[I];
+  if (I < NumChunks)
+    parseTopLevel(Stmts);
+  return Module{Context.save(Name), Context.copyArray(llvm::ArrayRef(Stmts))};
+}
+
+namespace {
+
+// Moves every position in a reused statement by Delta bytes, and its
+// deferred bodies by TokenDelta tokens.
+class LocationShifter : public RecursiveASTVisitor<LocationShifter> {
+  std::int64_t Delta;
+  std::int64_t TokenDelta;
+
+  void shift(Span &S) const {
+    S = Span(static_cast<BytePos>(S.getStart() + Delta),
+             static_cast<BytePos>(S.getEnd() + Delta));
+  }
+
+public:
+  LocationShifter(std::int64_t Delta, std::int64_t TokenDelta)
+      : Delta(Delta), TokenDelta(TokenDelta) {}
+
+  bool shouldTraverseDeferredBodies() const { return false; }
+
+  bool visitStmt(Stmt &S) {
+    shift(S.Location);
+    return true;
+  }
+  bool visitExpr(Expr &E) {
+    shift(E.Location);
+    return true;
+  }
+  bool visitParam(Param &P) {
+    shift(P.Location);
+    return true;
+  }
+  bool visitTypeLoc(TypeLoc &T) {
+    shift(T.Location);
+    return true;
+  }
+  bool visitFunction(FunctionDecl &F) {
+    if (auto *Lazy = F.getDeferredBody()) {
+      Lazy->Begin = static_cast<std::uint32_t>(Lazy->Begin + TokenDelta);
+      Lazy->End = static_cast<std::uint32_t>(Lazy->End + TokenDelta);
+    }
+    return true;
+  }
+};
+
+} // namespace
+
+Module Parser::reparseModule(const Module &Old, const TextEdit &Edit,
+                             const TokenBuffer::RelexResult &Changed) {
+  // Every cut is a statement start, or a blank line to skip.
+  auto Starts = findTopLevelCuts(*Tokens, 0, /*ChunkTokens=*/1);
+  if (!Starts)
+    return parseModule(Old.Name);
+  llvm::erase_if(*Starts, [&](std::size_t I) {
+    return Tokens->kind(I) == TokenKind::NewLine;
+  });
+  auto StmtStarts = llvm::ArrayRef(*Starts).drop_back();
+  std::size_t NumStmts = StmtStarts.size();
+  // How many statements start at or before token Tok.
+  auto StartedBy = [&](std::size_t Tok) {
+    return static_cast<std::size_t>(llvm::upper_bound(StmtStarts, Tok) -
+                                    StmtStarts.begin());
+  };
+
+  // Statements [First, Last) overlap the relexed tokens or the token just
+  // before them, since deleting a separator joins two statements.
+  std::size_t FirstTok = std::max<std::size_t>(Changed.First, 1) - 1;
+  std::size_t First = std::max<std::size_t>(StartedBy(FirstTok), 1) - 1;
+  std::size_t Last =
+      std::max(StartedBy(Changed.First + Changed.Inserted), First);
+  BytePos Begin = Tokens->start((*Starts)[First]);
+  BytePos End = Tokens->start((*Starts)[Last]);
+
+  // Old must have one statement per start, the ones before the edit where
+  // they were and the ones after it Edit.delta() bytes earlier.
+  std::int64_t Delta = Edit.delta();
+  auto OldStmts = Old.Stmts;
+  auto Before = static_cast<std::size_t>(
+      llvm::partition_point(OldStmts,
+                            [&](const Stmt *S) {
+                              return S->Location.getStart() < Begin;
+                            }) -
+      OldStmts.begin());
+  auto After = static_cast<std::size_t>(
+      OldStmts.end() - llvm::partition_point(OldStmts, [&](const Stmt *S) {
+        return S->Location.getStart() + Delta < End;
+      }));
+  if (Before != First || After != NumStmts - Last)
+    return parseModule(Old.Name);
+
+  llvm::SmallVector<Stmt *, 8> Stmts(OldStmts.begin(),
+                                     OldStmts.begin() + Before);
+  if (First < Last) {
+    DiagnosticEngine Scratch;
+    TokenBuffer Part = Tokens->slice((*Starts)[First], (*Starts)[Last]);
+    Parser Region(Context, Part, Scratch);
+    Region.BodySource = BodySource;
+    Region.TokenBase = TokenBase + (*Starts)[First];
+    Region.parseTopLevel(Stmts);
+    if (Scratch.hasError()) {
+      Stmts.truncate(Before);
+      Index = (*Starts)[First];
+      parseTopLevel(Stmts);
+      return Module{Old.Name, Context.copyArray(llvm::ArrayRef(Stmts))};
+    }
+  }
+
+  LocationShifter Shift(Delta, std::int64_t(Changed.Inserted) -
+                                   std::int64_t(Changed.Removed));
+  for (auto *S : OldStmts.take_back(After)) {
+    if (Delta != 0 || Changed.Inserted != Changed.Removed)
+      Shift.traverseStmt(*S);
+    Stmts.push_back(S);
+  }
+  return Module{Old.Name, Context.copyArray(llvm::ArrayRef(Stmts))};
+}
+
 } // namespace rheo
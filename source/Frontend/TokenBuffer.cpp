@@ -0,0 +1,181 @@
+#include "rheo/Frontend/TokenBuffer.h"
+#include "rheo/Diagnostics/DiagnosticEngine.h"
+#include "rheo/Diagnostics/SourceManager.h"
+#include "rheo/Frontend/Lexer.h"
+#include "rheo/Frontend/Token.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <iterator>
+#include <llvm/Support/ThreadPool.h>
+#include <vector>
+
+namespace rheo {
+
+void TokenBuffer::reserve(std::size_t Count) {
+  Kinds.reserve(Count);
+  Starts.reserve(Count);
+  Lengths.reserve(Count);
+  Atoms.reserve(Count);
+}
+
+TokenBuffer TokenBuffer::slice(std::size_t Begin, std::size_t End) const {
+  assert(Begin <= End && End < size() && "slice out of range");
+  TokenBuffer Part(Source, Base);
+  Part.reserve(End - Begin + 1);
+  auto From = static_cast<std::ptrdiff_t>(Begin);
+  auto To = static_cast<std::ptrdiff_t>(End);
+  Part.Kinds.assign(Kinds.begin() + From, Kinds.begin() + To);
+  Part.Starts.assign(Starts.begin() + From, Starts.begin() + To);
+  Part.Lengths.assign(Lengths.begin() + From, Lengths.begin() + To);
+  Part.Atoms.assign(Atoms.begin() + From, Atoms.begin() + To);
+  Part.append(TokenKind::Eof, Starts[End], 0);
+  return Part;
+}
+
+TokenBuffer TokenBuffer::lex(Lexer &Lex, IdentifierTable &Idents) {
+  TokenBuffer Tokens(Lex.getInput(), Lex.getBase());
+  // Real sources run five to eight bytes per token; reserving a little too
+  // much is cheaper than regrowing four arrays.
+  Tokens.reserve((Lex.getInput().size() - Lex.getOffset()) / 4 + 1);
+  while (true) {
+    Token Tok = Lex.nextToken();
+    Tokens.append(Tok, Idents);
+    if (Tok.Kind == TokenKind::Eof)
+      return Tokens;
+  }
+}
+
+TokenBuffer::RelexResult TokenBuffer::relex(const TextEdit &Edit,
+                                            const SourceFile &File,
+                                            IdentifierTable &Idents,
+                                            DiagnosticEngine &Diags) {
+  assert(!empty() && "relexing a buffer that was never lexed");
+  llvm::StringRef NewSource = File.getSource();
+  std::int64_t Delta = Edit.delta();
+  std::int64_t EditEnd = std::int64_t(Edit.Offset) +
+                         static_cast<std::int64_t>(Edit.Inserted.size());
+
+  // The lexer keeps no state across lines, so tokens that end before the
+  // edited line starts cannot change.
+  auto LineBegin = NewSource.substr(0, Edit.Offset).rfind('\n');
+  LineBegin = LineBegin == llvm::StringRef::npos ? 0 : LineBegin + 1;
+  auto LineStart = static_cast<std::uint32_t>(LineBegin);
+  auto First = static_cast<std::size_t>(
+      std::ranges::lower_bound(Starts, LineStart) - Starts.begin());
+
+  // The file may have moved; every comparison below is file-relative.
+  Lexer Lex(File.getBase(), NewSource, Diags, LineBegin, NewSource.size());
+  TokenBuffer Fresh(NewSource, File.getBase());
+  std::size_t Resume = First;
+  while (true) {
+    Token Tok = Lex.nextToken();
+    std::int64_t Start = Tok.Span.getStart() - File.getBase();
+    if (Start >= EditEnd) {
+      while (Resume < size() && std::int64_t(Starts[Resume]) + Delta < Start)
+        ++Resume;
+      if (Resume < size() && std::int64_t(Starts[Resume]) + Delta == Start)
+        break;
+    }
+    Fresh.append(Tok, Idents);
+    if (Tok.Kind == TokenKind::Eof) {
+      // Only reachable if the old buffer did not end in Eof either.
+      Resume = size();
+      break;
+    }
+  }
+
+  for (std::size_t I = Resume; I < size(); ++I)
+    Starts[I] = static_cast<std::uint32_t>(Starts[I] + Delta);
+  auto Splice = [&](auto &Column, const auto &Replacement) {
+    auto Begin = Column.begin() + static_cast<std::ptrdiff_t>(First);
+    auto End = Column.begin() + static_cast<std::ptrdiff_t>(Resume);
+    Column.insert(Column.erase(Begin, End), Replacement.begin(),
+                  Replacement.end());
+  };
+  Splice(Kinds, Fresh.Kinds);
+  Splice(Starts, Fresh.Starts);
+  Splice(Lengths, Fresh.Lengths);
+  Splice(Atoms, Fresh.Atoms);
+  Source = NewSource;
+  Base = File.getBase();
+  return {.First = First,
+          .Removed = Resume - First,
+          .Inserted = Fresh.size()};
+}
+
+TokenBuffer TokenBuffer::lexParallel(const SourceManager &SM, FileId File,
+                                     IdentifierTable &Idents,
+                                     DiagnosticEngine &Diags,
+                                     llvm::ThreadPoolInterface &Pool,
+                                     std::size_t ChunkBytes) {
+  const SourceFile &Src = *SM.getFile(File);
+  llvm::StringRef Source = Src.getSource();
+
+  std::vector<std::size_t> Bounds{0};
+  while (Bounds.back() < Source.size()) {
+    std::size_t Target = Bounds.back() + std::max<std::size_t>(ChunkBytes, 1);
+    std::size_t NewLine =
+        Target >= Source.size() ? llvm::StringRef::npos
+                                : Source.find('\n', Target);
+    Bounds.push_back(NewLine == llvm::StringRef::npos ? Source.size()
+                                                      : NewLine + 1);
+  }
+  std::size_t NumChunks = Bounds.size() - 1;
+  if (NumChunks <= 1) {
+    Lexer Lex(Src, Diags);
+    return lex(Lex, Idents);
+  }
+
+  struct Chunk {
+    TokenBuffer Tokens;
+    IdentifierTable Idents;
+    DiagnosticEngine Diags;
+  };
+  std::vector<Chunk> Chunks(NumChunks);
+  std::vector<std::shared_future<void>> Pending;
+  Pending.reserve(NumChunks);
+  for (std::size_t I = 0; I < NumChunks; ++I) {
+    Pending.push_back(Pool.async([&, I] {
+      Lexer Lex(Src.getBase(), Source, Chunks[I].Diags, Bounds[I],
+                Bounds[I + 1]);
+      Chunks[I].Tokens = lex(Lex, Chunks[I].Idents);
+    }));
+  }
+  for (auto &Task : Pending)
+    Task.wait();
+
+  // Every chunk ends in its own Eof; only the last one is kept. Idents is
+  // not shared with the workers: each chunk interned into a table of its own,
+  // and only that table's distinct spellings are interned here.
+  std::size_t Total = 1;
+  for (const auto &C : Chunks)
+    Total += C.Tokens.size() - 1;
+  TokenBuffer Tokens(Source, Src.getBase());
+  Tokens.reserve(Total);
+  for (std::size_t I = 0; I < NumChunks; ++I) {
+    const TokenBuffer &Part = Chunks[I].Tokens;
+    auto Count = static_cast<std::ptrdiff_t>(
+        I + 1 == NumChunks ? Part.size() : Part.size() - 1);
+    Tokens.Kinds.insert(Tokens.Kinds.end(), Part.Kinds.begin(),
+                        Part.Kinds.begin() + Count);
+    Tokens.Starts.insert(Tokens.Starts.end(), Part.Starts.begin(),
+                         Part.Starts.begin() + Count);
+    Tokens.Lengths.insert(Tokens.Lengths.end(), Part.Lengths.begin(),
+                          Part.Lengths.begin() + Count);
+    const IdentifierTable &Local = Chunks[I].Idents;
+    std::vector<Atom> Remap(Local.size(), NoAtom);
+    for (Atom Id = NoAtom + 1; Id < Local.size(); ++Id)
+      Remap[Id] = Idents.intern(Local.spelling(Id));
+    std::ranges::transform(Part.Atoms.begin(), Part.Atoms.begin() + Count,
+                           std::back_inserter(Tokens.Atoms),
+                           [&](Atom Id) { return Remap[Id]; });
+    for (const auto &Diag : Chunks[I].Diags.diagnostics())
+      Diags.emit(Diag);
+  }
+  return Tokens;
+}
+
+} // namespace rheo
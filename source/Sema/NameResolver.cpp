@@ -1,131 +1,143 @@
 #include "rheo/Sema/NameResolver.h"
 #include "rheo/AST/AST.h"
 #include "rheo/Common.h"
+#include <algorithm>
 #include <format>
+#include <future>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/ThreadPool.h>
+#include <memory>
+#include <string>
 #include <variant>
 
 namespace rheo {
 
-void NameResolver::declare(llvm::StringRef Name, Symbol S) {
-  Scopes.back().insert_or_assign(Name, S);
+void SymbolTable::popScope() {
+  auto Start = Scopes.pop_back_val();
+  while (Bindings.size() > Start.Bindings) {
+    auto &B = Bindings.back();
+    Innermost[B.Name] = B.Shadowed;
+    Bindings.pop_back();
+  }
+  Frames.back().NextSlot = Start.NextSlot;
 }
 
-const Symbol *NameResolver::lookup(llvm::StringRef Name) const {
-  for (auto It = Scopes.rbegin(); It != Scopes.rend(); ++It) {
-    auto Found = It->find(Name);
-    if (Found != It->end())
-      return &Found->second;
-  }
-  return nullptr;
+void SymbolTable::declare(Atom Name, Symbol S) {
+  if (Name >= Innermost.size())
+    Innermost.resize(Name + 1, None);
+  Bindings.push_back({S, Name, Innermost[Name],
+                      static_cast<std::uint32_t>(Frames.size() - 1)});
+  Innermost[Name] = static_cast<std::uint32_t>(Bindings.size() - 1);
 }
 
-void NameResolver::errorSymbolRedeclared(llvm::StringRef Name, Span NewSpan,
-                                         Span OldSpan) {
+void NameResolver::errorSymbolRedeclared(Atom Id, Span NewSpan, Span OldSpan) {
+  std::string Name = Ctx.spelling(Id).str();
   Diagnostic Diag(Severity::Error);
-  Diag.setMessage(std::format("symbol '{}' redeclared", Name.str()));
+  Diag.setMessage(std::format("symbol '{}' redeclared", Name));
   Diag.setCode("E2001");
 
-  Diag.addLabel(Label::primary(NewSpan, File, "redeclaration occurs here"));
+  Diag.addLabel(Label::primary(NewSpan, "redeclaration occurs here"));
 
-  Diag.addLabel(
-      Label::secondary(OldSpan, File, "previous declaration is here"));
+  Diag.addLabel(Label::secondary(OldSpan, "previous declaration is here"));
 
   Diag.setHelp("rename the symbol or remove the previous declaration");
 
-  Diags.emit(Diag);
+  Sink->emit(Diag);
 }
 
-void NameResolver::errorCalleeUndefined(llvm::StringRef Name, Span CallSpan) {
+void NameResolver::errorCalleeUndefined(Atom Id, Span CallSpan) {
+  std::string Name = Ctx.spelling(Id).str();
   Diagnostic Diag(Severity::Error);
-  Diag.setMessage(std::format("undefined function '{}'", Name.str()));
+  Diag.setMessage(std::format("undefined function '{}'", Name));
   Diag.setCode("E2002");
-  Diag.addLabel(Label::primary(CallSpan, File, "not found in this scope"));
+  Diag.addLabel(Label::primary(CallSpan, "not found in this scope"));
   Diag.setHelp("ensure the function is declared before this call");
-  Diags.emit(Diag);
+  Sink->emit(Diag);
 }
 
-void NameResolver::errorCalleeNotCallable(llvm::StringRef Name, Span CallSpan,
+void NameResolver::errorCalleeNotCallable(Atom Id, Span CallSpan,
                                           Span DeclSpan) {
+  std::string Name = Ctx.spelling(Id).str();
   Diagnostic Diag(Severity::Error);
-  Diag.setMessage(std::format("'{}' is not a function", Name.str()));
+  Diag.setMessage(std::format("'{}' is not a function", Name));
   Diag.setCode("E2003");
-  Diag.addLabel(Label::primary(CallSpan, File, "called here"));
-  Diag.addLabel(
-      Label::secondary(DeclSpan, File, "declared as non-function here"));
+  Diag.addLabel(Label::primary(CallSpan, "called here"));
+  Diag.addLabel(Label::secondary(DeclSpan, "declared as non-function here"));
   Diag.setHelp("only functions and closures can be called");
-  Diags.emit(Diag);
+  Sink->emit(Diag);
 }
 
-void NameResolver::errorCalleeArityMismatch(llvm::StringRef Name, Span CallSpan,
+void NameResolver::errorCalleeArityMismatch(Atom Id, Span CallSpan,
                                             Span DeclSpan, size_t Expected,
                                             size_t Got) {
+  std::string Name = Ctx.spelling(Id).str();
   Diagnostic Diag(Severity::Error);
-  Diag.setMessage(std::format("'{}' expects {} argument{}, got {}", Name.str(),
+  Diag.setMessage(std::format("'{}' expects {} argument{}, got {}", Name,
                               Expected, Expected == 1 ? "" : "s", Got));
   Diag.setCode("E2004");
   Diag.addLabel(Label::primary(
-      CallSpan, File,
+      CallSpan,
       std::format("{} argument{} provided", Got, Got == 1 ? "" : "s")));
-  Diag.addLabel(
-      Label::secondary(DeclSpan, File,
-                       std::format("defined with {} parameter{}", Expected,
-                                   Expected == 1 ? "" : "s")));
+  Diag.addLabel(Label::secondary(
+      DeclSpan, std::format("defined with {} parameter{}", Expected,
+                            Expected == 1 ? "" : "s")));
   Diag.setHelp("check the function signature and adjust the call");
-  Diags.emit(Diag);
+  Sink->emit(Diag);
 }
 
 void NameResolver::errorCalleeExprNotCallable(Span CallSpan) {
   Diagnostic Diag(Severity::Error);
   Diag.setMessage("expression is not callable");
   Diag.setCode("E2005");
-  Diag.addLabel(
-      Label::primary(CallSpan, File, "this expression cannot be called"));
+  Diag.addLabel(Label::primary(CallSpan, "this expression cannot be called"));
   Diag.setHelp("only functions and closures can be called with '()'");
-  Diags.emit(Diag);
+  Sink->emit(Diag);
 }
 
-void NameResolver::errorUndefinedDecl(llvm::StringRef Name, Span UseSpan) {
+void NameResolver::errorUndefinedDecl(Atom Id, Span UseSpan) {
+  std::string Name = Ctx.spelling(Id).str();
   Diagnostic Diag(Severity::Error);
-  Diag.setMessage(std::format("undefined symbol '{}'", Name.str()));
+  Diag.setMessage(std::format("undefined symbol '{}'", Name));
   Diag.setCode("E2006");
-  Diag.addLabel(Label::primary(UseSpan, File, "not found in this scope"));
+  Diag.addLabel(Label::primary(UseSpan, "not found in this scope"));
   Diag.setHelp(std::format("ensure '{}' is declared before use", Name));
-  Diags.emit(Diag);
+  Sink->emit(Diag);
 }
 
-void NameResolver::errorVarRefNotAVariable(llvm::StringRef Name, Span UseSpan,
+void NameResolver::errorVarRefNotAVariable(Atom Id, Span UseSpan,
                                            Span DeclSpan) {
+  std::string Name = Ctx.spelling(Id).str();
   Diagnostic Diag(Severity::Error);
-  Diag.setMessage(std::format("'{}' is not a variable", Name.str()));
+  Diag.setMessage(std::format("'{}' is not a variable", Name));
   Diag.setCode("E2007");
-  Diag.addLabel(Label::primary(UseSpan, File, "used as a variable here"));
-  Diag.addLabel(
-      Label::secondary(DeclSpan, File, "declared as non-variable here"));
+  Diag.addLabel(Label::primary(UseSpan, "used as a variable here"));
+  Diag.addLabel(Label::secondary(DeclSpan, "declared as non-variable here"));
   Diag.setHelp(
       std::format("'{}' refers to a function or type, not a variable", Name));
-  Diags.emit(Diag);
+  Sink->emit(Diag);
 }
 
-void NameResolver::errorAssignToImmutable(llvm::StringRef Name, Span AssignSpan,
+void NameResolver::errorAssignToImmutable(Atom Id, Span AssignSpan,
                                           Span DeclSpan) {
+  std::string Name = Ctx.spelling(Id).str();
   Diagnostic Diag(Severity::Error);
   Diag.setMessage(
-      std::format("cannot assign to immutable variable '{}'", Name.str()));
+      std::format("cannot assign to immutable variable '{}'", Name));
   Diag.setCode("E2008");
-  Diag.addLabel(Label::primary(AssignSpan, File, "assignment here"));
-  Diag.addLabel(Label::secondary(DeclSpan, File, "declared without '~' here"));
+  Diag.addLabel(Label::primary(AssignSpan, "assignment here"));
+  Diag.addLabel(Label::secondary(DeclSpan, "declared without '~' here"));
   Diag.setHelp(
       std::format("declare '{}' as mutable with '~{} := ...'", Name, Name));
-  Diags.emit(Diag);
+  Sink->emit(Diag);
 }
 
 void NameResolver::analyzeBlock(BlockExpr &B) {
-  ScopeGuard BSCope(&Scopes);
+  ScopeGuard BSCope(&Symbols);
   for (auto *S : B.Stmts) {
     if (!std::holds_alternative<FunctionDecl *>(S->Kind))
       continue;
     auto *Fn = std::get<FunctionDecl *>(S->Kind);
-    declare(Fn->Name, Symbol(S->Location, Fn));
+    Symbols.declare(Fn->Name, Symbol(S->Location, Fn));
   }
   for (auto *S : B.Stmts) {
     analyzeStmt(*S);
@@ -147,7 +159,7 @@ void NameResolver::analyzeExpr(Expr &E) {
                    if (!std::holds_alternative<VarRef>(Node.Callee->Kind))
                      return errorCalleeExprNotCallable(Node.Callee->Location);
                    auto VRef = std::get<VarRef>(Node.Callee->Kind);
-                   auto *Sym = lookup(VRef.Name);
+                   auto *Sym = Symbols.lookup(VRef.Name);
                    if (!Sym)
                      return errorCalleeUndefined(VRef.Name,
                                                  Node.Callee->Location);
@@ -165,13 +177,15 @@ void NameResolver::analyzeExpr(Expr &E) {
                  },
 
                  [&](VarRef &Node) {
-                   auto *Sym = lookup(Node.Name);
+                   auto *Sym = Symbols.lookup(Node.Name);
                    if (!Sym)
                      return errorUndefinedDecl(Node.Name, E.Location);
                    if (!Sym->is<VarDecl *>())
                      return errorVarRefNotAVariable(Node.Name, E.Location,
                                                     Sym->Location);
                    Node.Resolved = Sym->get<VarDecl *>();
+                   Node.Depth = Symbols.depthOf(Node.Name);
+                   Node.Slot = Node.Resolved->Slot;
                  },
 
                  [&](IfExpr &Node) {
@@ -210,7 +224,8 @@ void NameResolver::analyzeStmt(Stmt &S) {
           [&](VarDecl &Node) {
             if (Node.Init)
               analyzeExpr(*Node.Init);
-            declare(Node.Name, Symbol(S.Location, &Node));
+            Node.setSlot(Symbols.allocateSlot());
+            Symbols.declare(Node.Name, Symbol(S.Location, &Node));
           },
 
           [&](AssignStmt &Node) {
@@ -220,7 +235,7 @@ void NameResolver::analyzeStmt(Stmt &S) {
             }
 
             auto &VRef = std::get<VarRef>(Node.Target->Kind);
-            auto *Sym = lookup(VRef.Name);
+            auto *Sym = Symbols.lookup(VRef.Name);
             if (!Sym)
               return errorUndefinedDecl(VRef.Name, Node.Target->Location);
             if (!Sym->is<VarDecl *>())
@@ -236,32 +251,167 @@ void NameResolver::analyzeStmt(Stmt &S) {
               errorAssignToImmutable(VRef.Name, Node.Target->Location,
                                      Sym->Location);
             VRef.Resolved = Decl;
+            VRef.Depth = Symbols.depthOf(VRef.Name);
+            VRef.Slot = Decl->Slot;
             analyzeExpr(*Node.Value);
           },
 
-          [&](FunctionDecl *Node) {
-            ScopeGuard FnScope(&Scopes);
-            for (auto &P : Node->Params)
-              declare(P.Name,
-                      Symbol(P.Location, Ctx.create<VarDecl>(VarDecl{
-                                             P.Name, P.Ty, nullptr, false})));
-          }},
+          [&](FunctionDecl *Node) { analyzeFunction(*Node); }},
       S.Kind);
 }
 
-void NameResolver::analyze(Module &M) {
-  ScopeGuard Global(&Scopes);
+void NameResolver::analyzeFunction(FunctionDecl &Fn) {
+  ScopeGuard FnScope(&Symbols, /*OpensFrame=*/true);
+  for (auto &P : Fn.Params) {
+    auto *Decl =
+        Nodes->create<VarDecl>(VarDecl{P.Name, false, P.Ty, nullptr});
+    Decl->setSlot(Symbols.allocateSlot());
+    Symbols.declare(P.Name, Symbol(P.Location, Decl));
+  }
+  auto *Body = OnWorker && Fn.hasDeferredBody() ? Fn.loadBody(*Nodes, *Sink)
+                                                : Fn.getBody();
+  if (Body)
+    analyzeBlock(*Body);
+  Fn.NumLocals = Symbols.frameSize();
+}
+
+// Functions can be called before their definition, so all of them are
+// declared up front.
+void NameResolver::declareFunctions(Module &M) {
   for (auto *S : M.Stmts) {
     if (!std::holds_alternative<FunctionDecl *>(S->Kind))
       continue;
     auto *Fn = std::get<FunctionDecl *>(S->Kind);
-    if (auto *Existing = lookup(Fn->Name))
+    if (auto *Existing = Symbols.lookup(Fn->Name))
       errorSymbolRedeclared(Fn->Name, S->Location, Existing->Location);
     else
-      declare(Fn->Name, Symbol(S->Location, Fn));
+      Symbols.declare(Fn->Name, Symbol(S->Location, Fn));
   }
+}
+
+void NameResolver::analyze(Module &M) {
+  ScopeGuard Global(&Symbols, /*OpensFrame=*/true);
+  declareFunctions(M);
   for (auto *S : M.Stmts)
     analyzeStmt(*S);
+  M.NumGlobals = Symbols.frameSize();
+}
+
+void NameResolver::analyzeStreaming(Module &M, ASTContext &Arena,
+                                    llvm::function_ref<void(Stmt &)> Consume) {
+  ScopeGuard Global(&Symbols, /*OpensFrame=*/true);
+  declareFunctions(M);
+  for (auto *S : M.Stmts) {
+    auto *Fn = std::get_if<FunctionDecl *>(&S->Kind);
+    if (!Fn || !(*Fn)->hasDeferredBody()) {
+      analyzeStmt(*S);
+      Consume(*S);
+      continue;
+    }
+    (*Fn)->borrowBody(Arena);
+    Nodes = &Arena;
+    analyzeStmt(*S);
+    Consume(*S);
+    Nodes = &Ctx;
+    (*Fn)->releaseBody();
+    Arena.reset();
+  }
+  M.NumGlobals = Symbols.frameSize();
+}
+
+void NameResolver::analyzeParallel(Module &M, llvm::ThreadPoolInterface &Pool,
+                                   std::size_t ChunkFunctions) {
+  ChunkFunctions = std::max<std::size_t>(ChunkFunctions, 1);
+  std::size_t NumDefs = llvm::count_if(M.Stmts, [](const Stmt *S) {
+    return std::holds_alternative<FunctionDecl *>(S->Kind);
+  });
+  if (NumDefs <= ChunkFunctions)
+    return analyze(M);
+
+  // The other top-level statements are resolved here first, into one
+  // buffer. Each def notes how far the global bindings and that buffer had
+  // got when it came up, which is all a task needs to resolve it as if in
+  // order: global bindings are only ever added, and the tasks only read
+  // them.
+  struct Def {
+    FunctionDecl *Fn;
+    std::uint32_t Mark;
+    std::size_t DiagsBefore;
+    DiagnosticEngine Diags;
+  };
+  std::vector<Def> Defs;
+  Defs.reserve(NumDefs);
+  DiagnosticEngine TopLevel;
+  {
+    ScopeGuard Global(&Symbols, /*OpensFrame=*/true);
+    declareFunctions(M);
+    Sink = &TopLevel;
+    for (auto *S : M.Stmts) {
+      if (auto *Fn = std::get_if<FunctionDecl *>(&S->Kind))
+        Defs.push_back(
+            {*Fn, Symbols.mark(), TopLevel.diagnostics().size(), {}});
+      else
+        analyzeStmt(*S);
+    }
+    Sink = &Diags;
+    M.NumGlobals = Symbols.frameSize();
+
+    std::size_t NumTasks = (Defs.size() + ChunkFunctions - 1) / ChunkFunctions;
+    std::vector<std::unique_ptr<ASTContext>> Arenas(NumTasks);
+    std::vector<std::shared_future<void>> Pending;
+    Pending.reserve(NumTasks);
+    for (std::size_t T = 0; T < NumTasks; ++T) {
+      Arenas[T] = std::make_unique<ASTContext>(Ctx);
+      Pending.push_back(Pool.async([&, T] {
+        NameResolver Worker(Diags, *Arenas[T]);
+        Worker.OnWorker = true;
+        std::size_t End = std::min(Defs.size(), (T + 1) * ChunkFunctions);
+        for (std::size_t I = T * ChunkFunctions; I < End; ++I) {
+          Worker.Sink = &Defs[I].Diags;
+          Worker.analyzeFunctionAt(*Defs[I].Fn, *this, Defs[I].Mark);
+        }
+      }));
+    }
+    for (auto &Task : Pending)
+      Task.wait();
+    for (auto &Arena : Arenas)
+      Ctx.adopt(std::move(Arena));
+  }
+
+  auto Earlier = TopLevel.diagnostics();
+  std::size_t Next = 0;
+  for (const auto &D : Defs) {
+    for (; Next < D.DiagsBefore; ++Next)
+      Diags.emit(Earlier[Next]);
+    for (const auto &Diag : D.Diags.diagnostics())
+      Diags.emit(Diag);
+  }
+  for (; Next < Earlier.size(); ++Next)
+    Diags.emit(Earlier[Next]);
+}
+
+void NameResolver::analyzeTopLevel(
+    Module &M,
+    llvm::function_ref<void(FunctionDecl &, std::uint32_t)> OnDef) {
+  // No ScopeGuard: the global scope lives as long as the resolver.
+  Symbols.pushFrame();
+  Symbols.pushScope();
+  declareFunctions(M);
+  for (auto *S : M.Stmts) {
+    if (auto *Fn = std::get_if<FunctionDecl *>(&S->Kind))
+      OnDef(**Fn, Symbols.mark());
+    else
+      analyzeStmt(*S);
+  }
+  M.NumGlobals = Symbols.frameSize();
+}
+
+void NameResolver::analyzeFunctionAt(FunctionDecl &Fn,
+                                     const NameResolver &Globals,
+                                     std::uint32_t Mark) {
+  Symbols.setOuter(Globals.Symbols, Mark);
+  ScopeGuard Global(&Symbols, /*OpensFrame=*/true);
+  analyzeFunction(Fn);
 }
 
 } // namespace rheo
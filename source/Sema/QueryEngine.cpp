@@ -0,0 +1,464 @@
+#include "rheo/Sema/QueryEngine.h"
+#include "rheo/AST/RecursiveASTVisitor.h"
+#include "rheo/Common.h"
+#include "rheo/Frontend/Lexer.h"
+#include "rheo/Frontend/Parser.h"
+#include "rheo/Sema/TypeChecker.h"
+#include <algorithm>
+#include <cassert>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/Support/Path.h>
+#include <utility>
+
+namespace rheo {
+
+namespace {
+
+// Whether New is Old over again. A parse always counts as new: even where it
+// kept Old's nodes, it moved them.
+bool unchanged(const auto &Old, const auto &New) {
+  return Old.index() == New.index() &&
+         std::visit(Overloaded{[](const std::monostate &) { return true; },
+                               [&](const auto &V) {
+                                 using T = std::decay_t<decltype(V)>;
+                                 if constexpr (requires { V == V; })
+                                   return V == std::get<T>(New);
+                                 else
+                                   return false;
+                               }},
+                    Old);
+}
+
+// Clears the links NameResolver sets. It leaves a link as it was where it
+// reports an error, so nodes are unlinked before they are resolved again.
+struct Unlinker : RecursiveASTVisitor<Unlinker> {
+  bool visitExpr(Expr &E) {
+    if (auto *Call = std::get_if<CallExpr>(&E.Kind))
+      Call->Resolved = nullptr;
+    else if (auto *Ref = std::get_if<VarRef>(&E.Kind))
+      *Ref = VarRef{Ref->Name};
+    return true;
+  }
+};
+
+} // namespace
+
+bool QueryEngine::ranBefore(QueryKind Kind, std::uint32_t Id) {
+  return !std::holds_alternative<std::monostate>(memo(key(Kind, Id)).Val);
+}
+
+QueryEngine::Memo &QueryEngine::memo(QueryKey Key) {
+  auto [It, Inserted] = MemoOf.try_emplace(Key, nullptr);
+  if (Inserted)
+    It->second = &Memos.emplace_back();
+  return *It->second;
+}
+
+QueryEngine::Revision QueryEngine::update(QueryKey Key) {
+  Memo &M = memo(Key);
+  assert(!M.Running && "query depends on itself");
+  if (M.VerifiedAt == Current)
+    return M.ChangedAt;
+  bool Stale = M.VerifiedAt == 0;
+  if (static_cast<QueryKind>(Key >> 32) != QueryKind::Text)
+    for (std::size_t I = 0; !Stale && I < M.Deps.size(); ++I)
+      Stale = update(M.Deps[I]) > M.VerifiedAt;
+  if (Stale)
+    run(Key, M);
+  M.VerifiedAt = Current;
+  return M.ChangedAt;
+}
+
+void QueryEngine::run(QueryKey Key, Memo &M) {
+  auto Kind = static_cast<QueryKind>(Key >> 32);
+  M.Running = true;
+  M.Deps.clear();
+  Active.push_back(&M);
+  Value New = compute(Kind, static_cast<std::uint32_t>(Key));
+  Active.pop_back();
+  M.Running = false;
+  ++Runs[static_cast<std::size_t>(Kind)];
+  if (M.ChangedAt == 0 || !unchanged(M.Val, New))
+    M.ChangedAt = Current;
+  M.Val = std::move(New);
+}
+
+template <typename T> T &QueryEngine::fetch(QueryKind Kind, std::uint32_t Id) {
+  QueryKey Key = key(Kind, Id);
+  update(Key);
+  if (!Active.empty())
+    Active.back()->Deps.push_back(Key);
+  return std::get<T>(memo(Key).Val);
+}
+
+QueryEngine::Value QueryEngine::compute(QueryKind Kind, std::uint32_t Id) {
+  switch (Kind) {
+  case QueryKind::Text:
+    break;
+  case QueryKind::Parse:
+    return computeParse(Id);
+  case QueryKind::Definition:
+    return computeDefinition(Id);
+  case QueryKind::Signature:
+    return computeSignature(Id);
+  case QueryKind::Globals:
+    return computeGlobals(Id);
+  case QueryKind::Resolve:
+    return computeResolve(Id);
+  case QueryKind::Uses:
+    return computeUses(Id);
+  case QueryKind::Groups:
+    return computeGroups(Id);
+  case QueryKind::Group:
+    return computeGroup(Id);
+  case QueryKind::Infer:
+    return computeInfer(Id);
+  case QueryKind::Types:
+    return computeTypes(Id);
+  }
+  return std::monostate();
+}
+
+FileId QueryEngine::addFile(llvm::StringRef Name, llvm::StringRef Text) {
+  FileId File = SM.addFile(Name, Text);
+  Files.emplace_back().ModuleName = Ctx.save(llvm::sys::path::stem(Name));
+  Memo &M = memo(key(QueryKind::Text, File));
+  M.ChangedAt = M.VerifiedAt = Current;
+  return File;
+}
+
+void QueryEngine::applyEdit(FileId File, const TextEdit &Edit) {
+  auto &FS = Files[File];
+  bool Relex = FS.CanReparse && !FS.Edit;
+  const auto &Source = SM.applyEdit(File, Edit);
+  FS.CanReparse = Relex;
+  FS.Edit.reset();
+  if (Relex) {
+    DiagnosticEngine Diags;
+    auto Changed = FS.Tokens.relex(Edit, Source, Ctx.identifiers(), Diags);
+    FS.Edit = PendingEdit{Edit.Offset, Edit.RemovedLen, Edit.Inserted.str(),
+                          Changed, Diags.diagnostics()};
+  }
+  Memo &M = memo(key(QueryKind::Text, File));
+  M.ChangedAt = M.VerifiedAt = ++Current;
+}
+
+QueryEngine::ParsedFile QueryEngine::computeParse(FileId File) {
+  fetch<std::monostate>(QueryKind::Text, File);
+  auto &FS = Files[File];
+  const auto *Old =
+      std::get_if<ParsedFile>(&memo(key(QueryKind::Parse, File)).Val);
+  DiagnosticEngine Diags;
+  ParsedFile New;
+  if (FS.Edit && Old) {
+    for (const auto &Diag : FS.Edit->Diags)
+      Diags.emit(Diag);
+    TextEdit Edit{FS.Edit->Offset, FS.Edit->RemovedLen, FS.Edit->Inserted};
+    New.M = Parser(Ctx, FS.Tokens, Diags)
+                .reparseModule(Old->M, Edit, FS.Edit->Changed);
+  } else {
+    Lexer Lex(*SM.getFile(File), Diags);
+    FS.Tokens = TokenBuffer::lex(Lex, Ctx.identifiers());
+    New.M = Parser(Ctx, FS.Tokens, Diags).parseModule(FS.ModuleName);
+  }
+  FS.Edit.reset();
+  FS.CanReparse = !Diags.hasError();
+  New.Diags = Diags.diagnostics();
+  keepIdentities(File, Old, New);
+  return New;
+}
+
+// A statement the parse made anew takes the node of the item it replaces,
+// unless the parse kept that node too.
+void QueryEngine::keepIdentities(FileId File, const ParsedFile *Old,
+                                 ParsedFile &New) {
+  llvm::DenseMap<const Stmt *, Revision> WasOld;
+  if (Old)
+    for (std::size_t I = 0; I < Old->M.Stmts.size(); ++I)
+      WasOld[Old->M.Stmts[I]] = Old->Stmts[I].ParsedAt;
+  llvm::DenseSet<const Stmt *> InNew(New.M.Stmts.begin(), New.M.Stmts.end());
+
+  auto &FS = Files[File];
+  llvm::DenseMap<std::uint64_t, Stmt *> Items;
+  llvm::DenseMap<std::uint64_t, std::uint32_t> Ordinals;
+  llvm::SmallVector<Stmt *, 0> Stmts(New.M.Stmts.begin(), New.M.Stmts.end());
+  for (auto *&S : Stmts) {
+    auto *Fn = std::get_if<FunctionDecl *>(&S->Kind);
+    auto *Var = std::get_if<VarDecl>(&S->Kind);
+    auto Was = WasOld.find(S);
+    bool Kept = Was != WasOld.end();
+    Revision ParsedAt = Kept ? Was->second : Current;
+    if (!Fn && !Var) {
+      New.Stmts.push_back({NoItem, ParsedAt});
+      continue;
+    }
+    Atom Name = Fn ? (*Fn)->Name : Var->Name;
+    std::uint64_t Kind = std::uint64_t(Name) << 1 | (Fn != nullptr);
+    std::uint64_t ItemKey = std::uint64_t(Ordinals[Kind]++) << 33 | Kind;
+    auto It = FS.Items.find(ItemKey);
+    if (!Kept && It != FS.Items.end() && !InNew.contains(It->second)) {
+      Stmt &Into = *It->second;
+      if (Fn) {
+        *std::get<FunctionDecl *>(Into.Kind) = **Fn;
+        Into.Location = S->Location;
+      } else {
+        Into = *S;
+      }
+      S = &Into;
+    }
+    Items[ItemKey] = S;
+    auto NextId = static_cast<ItemId>(ItemFiles.size());
+    if (!Fn) {
+      auto [Id, Inserted] = VarIds.try_emplace(&std::get<VarDecl>(S->Kind),
+                                               NextId);
+      if (Inserted)
+        ItemFiles.push_back(File);
+      New.Stmts.push_back({Id->second, ParsedAt});
+      continue;
+    }
+    auto *Decl = std::get<FunctionDecl *>(S->Kind);
+    auto [Id, Inserted] = DefIds.try_emplace(Decl, NextId);
+    if (Inserted)
+      ItemFiles.push_back(File);
+    New.DefIndex[Id->second] = static_cast<std::uint32_t>(New.Defs.size());
+    New.Defs.push_back({Id->second, Decl, ParsedAt});
+    New.Stmts.push_back({Id->second, ParsedAt});
+  }
+  FS.Items = std::move(Items);
+  New.M.Stmts = Ctx.copyArray(llvm::ArrayRef(Stmts));
+}
+
+QueryEngine::DefId QueryEngine::defIdOf(const FunctionDecl &Fn) const {
+  auto It = DefIds.find(&Fn);
+  assert(It != DefIds.end() && "not a top-level def of an engine file");
+  return It->second;
+}
+
+QueryEngine::Definition QueryEngine::computeDefinition(DefId Def) {
+  auto &P = fetch<ParsedFile>(QueryKind::Parse, ItemFiles[Def]);
+  auto It = P.DefIndex.find(Def);
+  if (It == P.DefIndex.end())
+    return {nullptr, 0};
+  const auto &D = P.Defs[It->second];
+  return {D.Fn, D.ParsedAt};
+}
+
+QueryEngine::Signature QueryEngine::computeSignature(DefId Def) {
+  auto *Fn = fetch<Definition>(QueryKind::Definition, Def).Fn;
+  if (!Fn)
+    return {NoAtom, {}, nullptr};
+  Signature Sig{Fn->Name, {}, Fn->ReturnType.Ty};
+  for (const auto &P : Fn->Params)
+    Sig.Params.push_back(P.Ty.Ty);
+  return Sig;
+}
+
+QueryEngine::GlobalScope QueryEngine::computeGlobals(FileId File) {
+  auto &P = fetch<ParsedFile>(QueryKind::Parse, File);
+  GlobalScope G;
+  G.Diags = std::make_unique<DiagnosticEngine>();
+  G.Resolver = std::make_unique<NameResolver>(*G.Diags, Ctx);
+  if (ranBefore(QueryKind::Globals, File))
+    for (auto *S : P.M.Stmts)
+      if (!std::holds_alternative<FunctionDecl *>(S->Kind))
+        Unlinker().traverseStmt(*S);
+  G.Resolver->analyzeTopLevel(P.M, [&](FunctionDecl &Fn, std::uint32_t Mark) {
+    DefId Def = defIdOf(Fn);
+    G.Scopes[Def] = {Mark, G.Diags->diagnostics().size()};
+    auto Arity = fetch<Signature>(QueryKind::Signature, Def).Params.size();
+    G.Bindings.push_back(
+        {&Fn, Fn.Name, static_cast<std::uint32_t>(Arity), Mark});
+  });
+  for (auto *S : P.M.Stmts)
+    if (auto *Var = std::get_if<VarDecl>(&S->Kind))
+      G.Bindings.push_back({Var, Var->Name,
+                            std::uint32_t(Var->Slot) << 1 | Var->IsMut, 0});
+  return G;
+}
+
+QueryEngine::Reported QueryEngine::computeResolve(DefId Def) {
+  auto *Fn = fetch<Definition>(QueryKind::Definition, Def).Fn;
+  auto &G = fetch<GlobalScope>(QueryKind::Globals, ItemFiles[Def]);
+  if (!Fn)
+    return {};
+  if (ranBefore(QueryKind::Resolve, Def))
+    Unlinker().traverseFunction(*Fn);
+  DiagnosticEngine Diags;
+  NameResolver(Diags, Ctx)
+      .analyzeFunctionAt(*Fn, *G.Resolver, G.Scopes.lookup(Def).Mark);
+  if (Diags.hasError())
+    fetch<ParsedFile>(QueryKind::Parse, ItemFiles[Def]);
+  return {Diags.diagnostics()};
+}
+
+QueryEngine::Used QueryEngine::computeUses(DefId Def) {
+  auto *Fn = fetch<Definition>(QueryKind::Definition, Def).Fn;
+  fetch<Reported>(QueryKind::Resolve, Def);
+  Used U;
+  if (Fn)
+    TypeChecker::uses(*Fn, U.Decls);
+  return U;
+}
+
+// Other statements than defs are resolved with the global scope, so their
+// uses are collected here.
+QueryEngine::Grouping QueryEngine::computeGroups(FileId File) {
+  auto &P = fetch<ParsedFile>(QueryKind::Parse, File);
+  fetch<GlobalScope>(QueryKind::Globals, File);
+  llvm::SmallVector<const void *, 0> All;
+  std::vector<std::uint32_t> Begin;
+  Begin.reserve(P.M.Stmts.size() + 1);
+  for (std::size_t I = 0; I < P.M.Stmts.size(); ++I) {
+    Begin.push_back(static_cast<std::uint32_t>(All.size()));
+    if (std::holds_alternative<FunctionDecl *>(P.M.Stmts[I]->Kind)) {
+      const auto &U = fetch<Used>(QueryKind::Uses, P.Stmts[I].Id);
+      All.append(U.Decls.begin(), U.Decls.end());
+    } else {
+      TypeChecker::uses(*P.M.Stmts[I], All);
+    }
+  }
+  Begin.push_back(static_cast<std::uint32_t>(All.size()));
+
+  Grouping G;
+  G.Groups = TypeChecker::groups(P.M.Stmts, [&](std::uint32_t I) {
+    return llvm::ArrayRef(All).slice(Begin[I], Begin[I + 1] - Begin[I]);
+  });
+  G.LeaderOf.assign(P.M.Stmts.size(), NoItem);
+  for (std::uint32_t Id = 0; Id < G.Groups.size(); ++Id) {
+    ItemId Leader = P.Stmts[G.Groups[Id].Stmts.front()].Id;
+    if (Leader == NoItem)
+      continue;
+    G.ByLeader[Leader] = Id;
+    for (auto I : G.Groups[Id].Stmts)
+      G.LeaderOf[I] = Leader;
+  }
+  return G;
+}
+
+QueryEngine::GroupItems QueryEngine::computeGroup(ItemId Leader) {
+  auto &P = fetch<ParsedFile>(QueryKind::Parse, ItemFiles[Leader]);
+  auto &G = fetch<Grouping>(QueryKind::Groups, ItemFiles[Leader]);
+  GroupItems Out;
+  auto It = G.ByLeader.find(Leader);
+  if (It == G.ByLeader.end())
+    return Out;
+  const auto &Group = G.Groups[It->second];
+  for (auto I : Group.Stmts)
+    Out.Items.push_back({P.M.Stmts[I], P.Stmts[I].ParsedAt});
+  for (auto I : Group.Uses)
+    Out.Uses.push_back({P.M.Stmts[I], G.LeaderOf[I]});
+  return Out;
+}
+
+void QueryEngine::assumptions(llvm::ArrayRef<std::pair<Stmt *, ItemId>> Uses,
+                              std::vector<TypeChecker::Assumption> &Out) {
+  for (auto [S, Leader] : Uses) {
+    const auto &Used = fetch<Inferred>(QueryKind::Infer, Leader);
+    for (const auto &[Item, Scheme] : Used.Schemes)
+      if (Item == S)
+        Out.push_back({S, &Scheme});
+  }
+}
+
+QueryEngine::Inferred QueryEngine::computeInfer(ItemId Leader) {
+  auto &G = fetch<GroupItems>(QueryKind::Group, Leader);
+  Inferred Out;
+  if (G.Items.empty())
+    return Out;
+  llvm::SmallVector<Stmt *, 1> Stmts;
+  for (auto [S, ParsedAt] : G.Items) {
+    Stmts.push_back(S);
+    if (auto **Fn = std::get_if<FunctionDecl *>(&S->Kind))
+      fetch<Reported>(QueryKind::Resolve, defIdOf(**Fn));
+  }
+  std::vector<TypeChecker::Assumption> Uses;
+  assumptions(G.Uses, Uses);
+  DiagnosticEngine Diags;
+  auto Schemes = TypeChecker(Diags, Ctx).analyzeGroup(Stmts, Uses);
+  for (std::size_t I = 0; I < Stmts.size(); ++I)
+    Out.Schemes.push_back({Stmts[I], std::move(Schemes[I])});
+  if (Diags.hasError())
+    fetch<ParsedFile>(QueryKind::Parse, ItemFiles[Leader]);
+  Out.Diags = Diags.diagnostics();
+  return Out;
+}
+
+// Groups are brought up to date in the order they are checked, so what a
+// group uses is already. Loose statements are checked here, every time.
+QueryEngine::Reported QueryEngine::computeTypes(FileId File) {
+  auto &P = fetch<ParsedFile>(QueryKind::Parse, File);
+  auto &G = fetch<Grouping>(QueryKind::Groups, File);
+  std::vector<std::vector<Diagnostic>> Reports(G.Groups.size());
+  std::vector<std::pair<Stmt *, ItemId>> Used;
+  std::vector<TypeChecker::Assumption> Uses;
+  for (std::size_t Id = 0; Id < G.Groups.size(); ++Id) {
+    const auto &Group = G.Groups[Id];
+    ItemId Leader = G.LeaderOf[Group.Stmts.front()];
+    if (Leader != NoItem) {
+      Reports[Id] = fetch<Inferred>(QueryKind::Infer, Leader).Diags;
+      continue;
+    }
+    Used.clear();
+    for (auto I : Group.Uses)
+      Used.push_back({P.M.Stmts[I], G.LeaderOf[I]});
+    Uses.clear();
+    assumptions(Used, Uses);
+    DiagnosticEngine Diags;
+    TypeChecker(Diags, Ctx).analyzeGroup(P.M.Stmts[Group.Stmts.front()],
+                                         Uses);
+    Reports[Id] = Diags.diagnostics();
+  }
+
+  std::vector<std::uint32_t> ByStart(G.Groups.size());
+  for (std::uint32_t Id = 0; Id < ByStart.size(); ++Id)
+    ByStart[Id] = Id;
+  std::sort(ByStart.begin(), ByStart.end(), [&](auto A, auto B) {
+    return G.Groups[A].Stmts.front() < G.Groups[B].Stmts.front();
+  });
+  Reported Out;
+  for (auto Id : ByStart)
+    Out.Diags.insert(Out.Diags.end(), Reports[Id].begin(), Reports[Id].end());
+  return Out;
+}
+
+const Module &QueryEngine::parse(FileId File) {
+  return fetch<ParsedFile>(QueryKind::Parse, File).M;
+}
+
+const QueryEngine::Signature &
+QueryEngine::signature(const FunctionDecl &Fn) {
+  return fetch<Signature>(QueryKind::Signature, defIdOf(Fn));
+}
+
+llvm::ArrayRef<Diagnostic> QueryEngine::resolve(const FunctionDecl &Fn) {
+  return fetch<Reported>(QueryKind::Resolve, defIdOf(Fn)).Diags;
+}
+
+const Type *QueryEngine::typeOf(const Expr &E) {
+  auto Loc = SM.decompose(E.Location.getStart());
+  assert(Loc && "expression from no engine file");
+  fetch<Reported>(QueryKind::Types, Loc->File);
+  return E.Ty;
+}
+
+std::vector<Diagnostic> QueryEngine::diagnostics(FileId File) {
+  auto &P = fetch<ParsedFile>(QueryKind::Parse, File);
+  auto &G = fetch<GlobalScope>(QueryKind::Globals, File);
+  std::vector<Diagnostic> Out = P.Diags;
+  auto Earlier = G.Diags->diagnostics();
+  std::size_t Next = 0;
+  for (const auto &D : P.Defs) {
+    for (; Next < G.Scopes.lookup(D.Id).DiagsBefore; ++Next)
+      Out.push_back(Earlier[Next]);
+    const auto &R = fetch<Reported>(QueryKind::Resolve, D.Id);
+    Out.insert(Out.end(), R.Diags.begin(), R.Diags.end());
+  }
+  Out.insert(Out.end(), Earlier.begin() + Next, Earlier.end());
+  return Out;
+}
+
+llvm::ArrayRef<Diagnostic> QueryEngine::typeDiagnostics(FileId File) {
+  return fetch<Reported>(QueryKind::Types, File).Diags;
+}
+
+} // namespace rheo
@@ -0,0 +1,731 @@
+#include "rheo/Sema/TypeChecker.h"
+#include "rheo/AST/AST.h"
+#include "rheo/AST/Print.h"
+#include "rheo/AST/RecursiveASTVisitor.h"
+#include "rheo/Common.h"
+#include <algorithm>
+#include <format>
+#include <llvm/ADT/DenseMap.h>
+#include <string>
+#include <variant>
+
+namespace rheo {
+
+namespace {
+
+constexpr const Type *NeverType =
+    &BuiltinTypes[static_cast<std::size_t>(BuiltinKind::Never)];
+
+bool isNumeric(const Type *T) {
+  auto *B = std::get_if<BuiltinType>(&T->Kind);
+  return B && B->Kind <= BuiltinKind::F64;
+}
+
+// Collects the calls and the reads of top-level variables under a
+// statement. A variable is top-level when it is in the module's frame, as
+// many frames out as there are defs around the read.
+struct UseCollector : RecursiveASTVisitor<UseCollector> {
+  llvm::SmallVectorImpl<const void *> &Decls;
+  std::uint32_t Depth = 0;
+
+  explicit UseCollector(llvm::SmallVectorImpl<const void *> &Decls)
+      : Decls(Decls) {}
+
+  bool visitFunction(FunctionDecl &) {
+    ++Depth;
+    return true;
+  }
+  bool postVisitFunction(FunctionDecl &) {
+    --Depth;
+    return true;
+  }
+  bool visitExpr(Expr &E) {
+    if (auto *Call = std::get_if<CallExpr>(&E.Kind)) {
+      if (Call->Resolved)
+        Decls.push_back(Call->Resolved);
+    } else if (auto *Ref = std::get_if<VarRef>(&E.Kind)) {
+      if (Ref->Resolved && Ref->Depth == Depth)
+        Decls.push_back(Ref->Resolved);
+    }
+    return true;
+  }
+};
+
+} // namespace
+
+TypeChecker::TypeChecker(DiagnosticEngine &Diags, ASTContext &Ctx)
+    : Diags(Diags), Ctx(Ctx) {
+  reset();
+}
+
+void TypeChecker::reset() {
+  Nodes.clear();
+  Level = 0;
+  NumNames = 0;
+  for (unsigned K = 0; K < NumBuiltinKinds; ++K) {
+    Builtins[K] = fresh();
+    Nodes[Builtins[K]].Con = &BuiltinTypes[K];
+  }
+  Sigs.clear();
+  SigOf.clear();
+  Frames.clear();
+  Locals.clear();
+  Globals.clear();
+  Loops.clear();
+  Typed.clear();
+}
+
+TypeChecker::TyId TypeChecker::fresh() {
+  auto Id = static_cast<TyId>(Nodes.size());
+  Nodes.push_back({Id, Level});
+  return Id;
+}
+
+TypeChecker::TyId TypeChecker::typeOf(TypeLoc Written) {
+  if (!Written)
+    return fresh();
+  if (auto *B = std::get_if<BuiltinType>(&Written->Kind))
+    return builtin(B->Kind);
+  auto Id = fresh();
+  Nodes[Id].Con = Written.Ty;
+  return Id;
+}
+
+TypeChecker::TyId TypeChecker::find(TyId T) {
+  while (Nodes[T].Parent != T) {
+    Nodes[T].Parent = Nodes[Nodes[T].Parent].Parent;
+    T = Nodes[T].Parent;
+  }
+  return T;
+}
+
+bool TypeChecker::is(TyId T, BuiltinKind K) {
+  return Nodes[find(T)].Con == &BuiltinTypes[static_cast<unsigned>(K)];
+}
+
+bool TypeChecker::unify(TyId A, TyId B) {
+  A = find(A);
+  B = find(B);
+  if (A == B)
+    return true;
+  const Type *ConA = Nodes[A].Con;
+  const Type *ConB = Nodes[B].Con;
+  if (ConA == NeverType || ConB == NeverType)
+    return true;
+  if (ConA && ConB)
+    return ConA == ConB;
+  const Type *Con = ConA ? ConA : ConB;
+  bool Numeric = Nodes[A].Numeric || Nodes[B].Numeric;
+  if (Con && Numeric && !isNumeric(Con))
+    return false;
+
+  if (Nodes[A].Rank < Nodes[B].Rank)
+    std::swap(A, B);
+  else if (Nodes[A].Rank == Nodes[B].Rank)
+    ++Nodes[A].Rank;
+  Nodes[B].Parent = A;
+  if (Nodes[A].Name == NoName)
+    Nodes[A].Name = Nodes[B].Name;
+  Nodes[A].Con = Con;
+  Nodes[A].Numeric = Numeric;
+  Nodes[A].Level = std::min(Nodes[A].Level, Nodes[B].Level);
+  return true;
+}
+
+bool TypeChecker::requireNumeric(TyId T) {
+  auto &Root = Nodes[find(T)];
+  if (Root.Con)
+    return isNumeric(Root.Con) || Root.Con == NeverType;
+  Root.Numeric = true;
+  return true;
+}
+
+// Numbers Fn at the current level, without making its types.
+void TypeChecker::declare(FunctionDecl &Fn) {
+  SigOf[&Fn] = static_cast<std::uint32_t>(Sigs.size());
+  Sigs.emplace_back().DeclLevel = Level;
+}
+
+// The signature of Fn, its types made if they are not yet: at AtLevel, or at
+// the level the def is declared at. A def that was not declared, as in a
+// tree that was never resolved, counts as global.
+std::uint32_t TypeChecker::signature(FunctionDecl &Fn,
+                                     std::optional<std::uint32_t> AtLevel) {
+  auto [It, Inserted] =
+      SigOf.try_emplace(&Fn, static_cast<std::uint32_t>(Sigs.size()));
+  std::uint32_t Index = It->second;
+  if (Inserted)
+    Sigs.emplace_back();
+  if (Sigs[Index].Ret != NoTy)
+    return Index;
+  auto Saved =
+      std::exchange(Level, AtLevel.value_or(Sigs[Index].DeclLevel));
+  llvm::SmallVector<TyId, 4> Params;
+  for (const auto &P : Fn.Params)
+    Params.push_back(typeOf(P.Ty));
+  TyId Ret = typeOf(Fn.ReturnType);
+  Level = Saved;
+  Sigs[Index].Params = std::move(Params);
+  Sigs[Index].Ret = Ret;
+  return Index;
+}
+
+// The parameter types then the return type of a use of Sig, with fresh
+// variables for the generalized ones.
+void TypeChecker::instantiate(const Signature &Sig,
+                              llvm::SmallVectorImpl<TyId> &Out) {
+  llvm::SmallVector<std::pair<TyId, TyId>, 4> Copies;
+  auto Copy = [&](TyId T) {
+    T = find(T);
+    if (Nodes[T].Level != Generic)
+      return T;
+    for (auto [From, To] : Copies)
+      if (From == T)
+        return To;
+    auto To = fresh();
+    Nodes[To].Numeric = Nodes[T].Numeric;
+    Copies.push_back({T, To});
+    return To;
+  };
+  for (TyId P : Sig.Params)
+    Out.push_back(Copy(P));
+  Out.push_back(Copy(Sig.Ret));
+}
+
+// Called with Level back at the def's own: what is deeper belongs to the
+// def alone.
+void TypeChecker::generalize(Signature &Sig) {
+  auto Mark = [&](TyId T) {
+    auto &Root = Nodes[find(T)];
+    if (!Root.Con && Root.Level > Level)
+      Root.Level = Generic;
+  };
+  for (TyId P : Sig.Params)
+    Mark(P);
+  Mark(Sig.Ret);
+  Sig.Generalized = true;
+}
+
+void TypeChecker::pushFrame(const FunctionDecl *Fn, std::uint32_t Sig,
+                            std::uint32_t Size) {
+  auto Base = static_cast<std::uint32_t>(Locals.size());
+  Frames.push_back({Fn, Sig, Base, Size});
+  Locals.resize(Base + Size);
+}
+
+void TypeChecker::popFrame() {
+  Locals.resize(Frames.pop_back_val().Base);
+}
+
+// Null past the frame's size, as in a tree that was never resolved. The
+// module's frame has no size: its slots are made as they are asked for, and
+// stay valid until the next is.
+TypeChecker::Local *TypeChecker::slot(Frame &F, std::uint32_t Slot) {
+  if (!F.Fn)
+    return &Globals[Slot];
+  if (Slot >= F.Size)
+    return nullptr;
+  return &Locals[F.Base + Slot];
+}
+
+// A parameter's VarDecl is the resolver's own, so it is found by its frame
+// slot, which for parameters is their position. Slots of sibling blocks
+// overlap, so a slot counts only while it holds the variable asked for.
+TypeChecker::TyId TypeChecker::variable(const VarRef &Ref) {
+  if (!Ref.Resolved || Ref.Depth >= Frames.size())
+    return fresh();
+  auto &F = Frames[Frames.size() - 1 - Ref.Depth];
+  if (F.Fn && Ref.Slot < F.Fn->Params.size())
+    return Sigs[F.Sig].Params[Ref.Slot];
+  Local *L = slot(F, Ref.Slot);
+  if (!L)
+    return fresh();
+  if (L->Decl != Ref.Resolved)
+    *L = {Ref.Resolved, fresh()};
+  return copyIfGeneric(L->Ty);
+}
+
+// A variable of an earlier group may hold a generalized type; each read gets
+// its own.
+TypeChecker::TyId TypeChecker::copyIfGeneric(TyId T) {
+  T = find(T);
+  if (Nodes[T].Level != Generic)
+    return T;
+  auto Copy = fresh();
+  Nodes[Copy].Numeric = Nodes[T].Numeric;
+  return Copy;
+}
+
+// Makes Item, a def or variable of an earlier group, known by its scheme.
+void TypeChecker::assume(Stmt &Item, const Scheme &S) {
+  llvm::SmallVector<TyId, 4> Vars;
+  auto Import = [&](const Type *T) {
+    if (auto *V = std::get_if<TypeVar>(&T->Kind)) {
+      while (Vars.size() <= V->Id) {
+        Vars.push_back(fresh());
+        Nodes[Vars.back()].Level = Generic;
+      }
+      return Vars[V->Id];
+    }
+    if (auto *B = std::get_if<BuiltinType>(&T->Kind))
+      return builtin(B->Kind);
+    auto Id = fresh();
+    Nodes[Id].Con = T;
+    return Id;
+  };
+  if (auto **Fn = std::get_if<FunctionDecl *>(&Item.Kind)) {
+    declare(**Fn);
+    auto &Sig = Sigs.back();
+    for (const auto *P : S.Params)
+      Sig.Params.push_back(Import(P));
+    Sig.Ret = Import(S.Ret);
+    Sig.Generalized = true;
+  } else if (auto *Var = std::get_if<VarDecl>(&Item.Kind)) {
+    if (Local *L = slot(Frames.front(), Var->Slot))
+      *L = {Var, Import(S.Ret)};
+  }
+  for (auto N : S.Numeric)
+    if (N < Vars.size())
+      Nodes[Vars[N]].Numeric = true;
+}
+
+// Generalizes what Item, a def or variable of the group just inferred, left
+// open and returns its scheme.
+TypeChecker::Scheme TypeChecker::close(const Stmt &Item) {
+  Scheme S;
+  llvm::SmallVector<TyId, 4> Vars;
+  auto Export = [&](TyId T) -> const Type * {
+    auto &Root = Nodes[T = find(T)];
+    if (Root.Con)
+      return Root.Con;
+    Root.Level = Generic;
+    auto It = llvm::find(Vars, T);
+    auto Id = static_cast<std::uint32_t>(It - Vars.begin());
+    if (It == Vars.end()) {
+      Vars.push_back(T);
+      if (Root.Numeric)
+        S.Numeric.push_back(Id);
+    }
+    return Ctx.getType(TypeVar{Id});
+  };
+  if (auto *const *Fn = std::get_if<FunctionDecl *>(&Item.Kind)) {
+    const auto &Sig = Sigs[signature(**Fn)];
+    for (TyId P : Sig.Params)
+      S.Params.push_back(Export(P));
+    S.Ret = Export(Sig.Ret);
+  } else if (auto *Var = std::get_if<VarDecl>(&Item.Kind)) {
+    Local *L = slot(Frames.front(), Var->Slot);
+    S.Ret = Export(L && L->Decl == Var ? L->Ty : fresh());
+  }
+  return S;
+}
+
+std::uint32_t TypeChecker::name(TyId Root) {
+  if (Nodes[Root].Name == NoName)
+    Nodes[Root].Name = NumNames++;
+  return Nodes[Root].Name;
+}
+
+std::string TypeChecker::spell(TyId T) {
+  T = find(T);
+  const Type *Con = Nodes[T].Con;
+  if (!Con)
+    return std::format("?T{}", name(T));
+  if (auto *B = std::get_if<BuiltinType>(&Con->Kind))
+    return ASTPrinter::builtinKindStr(B->Kind).str();
+  if (auto *N = std::get_if<NamedType>(&Con->Kind))
+    return Ctx.spelling(N->Name).str();
+  return std::format("?T{}", std::get<TypeVar>(Con->Kind).Id);
+}
+
+void TypeChecker::errorMismatch(Span Use, TyId Expected, TyId Found,
+                                TypeLoc Annotation) {
+  Diagnostic Diag(Severity::Error);
+  Diag.setMessage("mismatched types");
+  Diag.setCode("E3001");
+  Diag.addLabel(Label::primary(
+      Use, std::format("expected '{}', found '{}'", spell(Expected),
+                       spell(Found))));
+  if (Annotation) {
+    Diag.addLabel(Label::secondary(Annotation.Location,
+                                   "expected because of this annotation"));
+    Diag.setHelp("change the expression or the annotation so they agree");
+  }
+  Sink->emit(Diag);
+}
+
+void TypeChecker::errorNotNumeric(Span Use, llvm::StringRef Op, TyId Found) {
+  Diagnostic Diag(Severity::Error);
+  Diag.setMessage(std::format("cannot apply '{}' to '{}'", Op.str(),
+                              spell(Found)));
+  Diag.setCode("E3002");
+  Diag.addLabel(Label::primary(Use, "operand is not a number"));
+  Diag.setHelp("arithmetic, ordering and negation need numeric operands");
+  Sink->emit(Diag);
+}
+
+// Defs can be called before their definition; note the level they are
+// declared at, where a signature made for such a call belongs.
+void TypeChecker::declareFunctions(llvm::ArrayRef<Stmt *> Stmts) {
+  for (auto *S : Stmts)
+    if (auto **Fn = std::get_if<FunctionDecl *>(&S->Kind))
+      declare(**Fn);
+}
+
+void TypeChecker::inferFunction(FunctionDecl &Fn, Span Location) {
+  auto Sig = signature(Fn, Level + 1);
+  ++Level;
+  pushFrame(&Fn, Sig, Fn.NumLocals);
+  // A break in the body cannot leave a loop around the def.
+  auto Outer = std::exchange(Loops, {});
+  if (auto *Body = Fn.getBody()) {
+    TyId BodyTy = inferBlock(*Body);
+    TyId Ret = Sigs[Sig].Ret;
+    if (!unify(BodyTy, Ret))
+      errorMismatch(Body->Tail ? Body->Tail->Location : Location, Ret,
+                    BodyTy, Fn.ReturnType);
+  }
+  Loops = std::move(Outer);
+  popFrame();
+  --Level;
+  generalize(Sigs[Sig]);
+}
+
+TypeChecker::TyId TypeChecker::inferBlock(BlockExpr &B) {
+  declareFunctions(B.Stmts);
+  bool Diverges = false;
+  for (auto *S : B.Stmts)
+    Diverges = inferStmt(*S);
+  if (B.Tail)
+    return inferExpr(*B.Tail);
+  return builtin(Diverges ? BuiltinKind::Never : BuiltinKind::Unit);
+}
+
+TypeChecker::TyId TypeChecker::inferExpr(Expr &E) {
+  TyId T = inferExprKind(E);
+  Typed.push_back({&E, T});
+  return T;
+}
+
+TypeChecker::TyId TypeChecker::inferExprKind(Expr &E) {
+  auto Expect = [&](Expr &Sub, BuiltinKind K) {
+    TyId T = inferExpr(Sub);
+    if (!unify(T, builtin(K)))
+      errorMismatch(Sub.Location, builtin(K), T);
+  };
+  return std::visit(
+      Overloaded{
+          [&](IntLiteral &) { return builtin(BuiltinKind::Int); },
+          [&](FloatLiteral &) { return builtin(BuiltinKind::F64); },
+          [&](BoolLiteral &) { return builtin(BuiltinKind::Bool); },
+          [&](UnitLiteral &) { return builtin(BuiltinKind::Unit); },
+
+          [&](UnaryExpr &X) {
+            if (X.Op == Not) {
+              Expect(*X.Operand, BuiltinKind::Bool);
+              return builtin(BuiltinKind::Bool);
+            }
+            TyId T = inferExpr(*X.Operand);
+            if (!requireNumeric(T))
+              errorNotNumeric(X.Operand->Location,
+                              ASTPrinter::unaryOpStr(X.Op), T);
+            return T;
+          },
+
+          [&](BinaryExpr &X) {
+            if (X.Op == And || X.Op == Or) {
+              Expect(*X.Lhs, BuiltinKind::Bool);
+              Expect(*X.Rhs, BuiltinKind::Bool);
+              return builtin(BuiltinKind::Bool);
+            }
+            TyId L = inferExpr(*X.Lhs);
+            TyId R = inferExpr(*X.Rhs);
+            bool Same = unify(R, L);
+            if (!Same)
+              errorMismatch(X.Rhs->Location, L, R);
+            if (X.Op == Eq || X.Op == NotEq)
+              return builtin(BuiltinKind::Bool);
+            if (Same && !requireNumeric(L))
+              errorNotNumeric(X.Lhs->Location,
+                              ASTPrinter::binaryOpStr(X.Op), L);
+            return X.Op <= Mod ? L : builtin(BuiltinKind::Bool);
+          },
+
+          [&](CallExpr &X) {
+            if (!X.Resolved) {
+              for (auto *Arg : X.Args)
+                inferExpr(*Arg);
+              return fresh();
+            }
+            auto &Fn = *X.Resolved;
+            auto Sig = signature(Fn);
+            llvm::SmallVector<TyId, 8> Types;
+            if (Sigs[Sig].Generalized) {
+              instantiate(Sigs[Sig], Types);
+            } else {
+              Types.append(Sigs[Sig].Params.begin(), Sigs[Sig].Params.end());
+              Types.push_back(Sigs[Sig].Ret);
+            }
+            for (std::size_t I = 0; I < X.Args.size(); ++I) {
+              TyId A = inferExpr(*X.Args[I]);
+              if (I < Fn.Params.size() && !unify(A, Types[I]))
+                errorMismatch(X.Args[I]->Location, Types[I], A,
+                              Fn.Params[I].Ty);
+            }
+            return Types.back();
+          },
+
+          [&](VarRef &X) { return variable(X); },
+
+          [&](BlockExpr *X) { return inferBlock(*X); },
+
+          [&](IfExpr &X) {
+            Expect(*X.Condition, BuiltinKind::Bool);
+            TyId Then = inferBlock(*X.ThenBlock);
+            if (!X.ElseBranch)
+              return builtin(BuiltinKind::Unit);
+            TyId Else = inferBlock(*X.ElseBranch);
+            if (is(Then, BuiltinKind::Never))
+              return Else;
+            if (!unify(Else, Then))
+              errorMismatch(X.ElseBranch->Tail
+                                ? X.ElseBranch->Tail->Location
+                                : E.Location,
+                            Then, Else);
+            return Then;
+          },
+
+          [&](WhileExpr &X) {
+            Expect(*X.Condition, BuiltinKind::Bool);
+            Loops.push_back({fresh()});
+            inferBlock(*X.Body);
+            auto L = Loops.pop_back_val();
+            if (!L.HasBreak)
+              unify(L.Ty, builtin(BuiltinKind::Unit));
+            return L.Ty;
+          },
+
+          [&](BreakExpr &X) {
+            TyId V = X.Value ? inferExpr(*X.Value)
+                                : builtin(BuiltinKind::Unit);
+            if (!Loops.empty()) {
+              Loops.back().HasBreak = true;
+              if (!unify(V, Loops.back().Ty))
+                errorMismatch(X.Value ? X.Value->Location : E.Location,
+                              Loops.back().Ty, V);
+            }
+            return builtin(BuiltinKind::Never);
+          },
+
+          [&](ContinueExpr &) { return builtin(BuiltinKind::Never); }},
+      E.Kind);
+}
+
+bool TypeChecker::inferStmt(Stmt &S) {
+  return std::visit(
+      Overloaded{
+          [&](ExprStmt &X) {
+            return is(inferExpr(*X.Expr), BuiltinKind::Never);
+          },
+
+          [&](ReturnStmt &X) {
+            TyId V = X.Value ? inferExpr(*X.Value)
+                                : builtin(BuiltinKind::Unit);
+            const auto &F = Frames.back();
+            if (F.Fn && !unify(V, Sigs[F.Sig].Ret))
+              errorMismatch(X.Value ? X.Value->Location : S.Location,
+                            Sigs[F.Sig].Ret, V, F.Fn->ReturnType);
+            return true;
+          },
+
+          [&](VarDecl &X) {
+            TyId T = X.Init ? inferExpr(*X.Init) : fresh();
+            if (X.Ty) {
+              TyId Declared = typeOf(X.Ty);
+              if (!unify(T, Declared))
+                errorMismatch(X.Init->Location, Declared, T, X.Ty);
+              T = Declared;
+            }
+            if (Local *L = slot(Frames.back(), X.Slot))
+              *L = {&X, T};
+            return false;
+          },
+
+          [&](AssignStmt &X) {
+            TyId Target = inferExpr(*X.Target);
+            TyId V = inferExpr(*X.Value);
+            if (!unify(V, Target))
+              errorMismatch(X.Value->Location, Target, V);
+            return false;
+          },
+
+          [&](FunctionDecl *X) {
+            inferFunction(*X, S.Location);
+            return false;
+          }},
+      S.Kind);
+}
+
+void TypeChecker::uses(Stmt &S, llvm::SmallVectorImpl<const void *> &Decls) {
+  UseCollector(Decls).traverseStmt(S);
+}
+
+void TypeChecker::uses(FunctionDecl &Fn,
+                       llvm::SmallVectorImpl<const void *> &Decls) {
+  UseCollector(Decls).traverseFunction(Fn);
+}
+
+// Tarjan's algorithm, without recursion, since a chain of variables may be
+// as long as the module. It finishes a group only after every group it
+// reaches, which is the order they are checked in.
+std::vector<TypeChecker::Group> TypeChecker::groups(
+    llvm::ArrayRef<Stmt *> Stmts,
+    llvm::function_ref<llvm::ArrayRef<const void *>(std::uint32_t)> UsesOf) {
+  auto N = static_cast<std::uint32_t>(Stmts.size());
+  llvm::DenseMap<const void *, std::uint32_t> Items;
+  for (std::uint32_t I = 0; I < N; ++I) {
+    if (auto **Fn = std::get_if<FunctionDecl *>(&Stmts[I]->Kind))
+      Items[*Fn] = I;
+    else if (auto *Var = std::get_if<VarDecl>(&Stmts[I]->Kind))
+      Items[Var] = I;
+  }
+  // The uses of statement I are Edges[Begin[I]] up to Edges[Begin[I + 1]].
+  std::vector<std::uint32_t> Begin, Edges;
+  Begin.reserve(N + 1);
+  for (std::uint32_t I = 0; I < N; ++I) {
+    Begin.push_back(static_cast<std::uint32_t>(Edges.size()));
+    for (const void *D : UsesOf(I))
+      if (auto It = Items.find(D); It != Items.end())
+        Edges.push_back(It->second);
+  }
+  Begin.push_back(static_cast<std::uint32_t>(Edges.size()));
+
+  constexpr std::uint32_t Unseen = ~std::uint32_t(0);
+  constexpr std::uint32_t Done = Unseen - 1;
+  std::vector<std::uint32_t> Order(N, Unseen), Low(N), GroupOf(N);
+  std::vector<std::uint32_t> Open;
+  // The statements being visited, and the next of their uses to follow.
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> Walk;
+  std::vector<Group> Out;
+  std::uint32_t Seen = 0;
+  for (std::uint32_t Root = 0; Root < N; ++Root) {
+    if (Order[Root] != Unseen)
+      continue;
+    Walk.push_back({Root, Begin[Root]});
+    Order[Root] = Low[Root] = Seen++;
+    Open.push_back(Root);
+    while (!Walk.empty()) {
+      auto &[I, Next] = Walk.back();
+      if (Next < Begin[I + 1]) {
+        std::uint32_t J = Edges[Next++];
+        if (Order[J] == Unseen) {
+          Order[J] = Low[J] = Seen++;
+          Open.push_back(J);
+          Walk.push_back({J, Begin[J]});
+        } else if (Order[J] != Done) {
+          Low[I] = std::min(Low[I], Order[J]);
+        }
+        continue;
+      }
+      std::uint32_t Finished = I;
+      Walk.pop_back();
+      if (!Walk.empty())
+        Low[Walk.back().first] =
+            std::min(Low[Walk.back().first], Low[Finished]);
+      if (Low[Finished] != Order[Finished])
+        continue;
+      auto &G = Out.emplace_back();
+      auto Id = static_cast<std::uint32_t>(Out.size() - 1);
+      std::uint32_t J;
+      do {
+        J = Open.back();
+        Open.pop_back();
+        Order[J] = Done;
+        GroupOf[J] = Id;
+        G.Stmts.push_back(J);
+      } while (J != Finished);
+      std::sort(G.Stmts.begin(), G.Stmts.end());
+    }
+  }
+
+  for (std::uint32_t Id = 0; Id < Out.size(); ++Id) {
+    auto &G = Out[Id];
+    for (std::uint32_t I : G.Stmts)
+      for (std::uint32_t E = Begin[I]; E < Begin[I + 1]; ++E)
+        if (GroupOf[Edges[E]] != Id)
+          G.Uses.push_back(Edges[E]);
+    std::sort(G.Uses.begin(), G.Uses.end());
+    G.Uses.erase(std::unique(G.Uses.begin(), G.Uses.end()), G.Uses.end());
+  }
+  return Out;
+}
+
+std::vector<TypeChecker::Scheme>
+TypeChecker::analyzeGroup(llvm::ArrayRef<Stmt *> Stmts,
+                          llvm::ArrayRef<Assumption> Uses) {
+  reset();
+  pushFrame(nullptr, 0, 0);
+  for (auto [Item, S] : Uses)
+    assume(*Item, *S);
+  declareFunctions(Stmts);
+  for (auto *S : Stmts)
+    inferStmt(*S);
+  std::vector<Scheme> Out;
+  Out.reserve(Stmts.size());
+  for (auto *S : Stmts)
+    Out.push_back(close(*S));
+  popFrame();
+
+  for (auto [E, T] : Typed) {
+    T = find(T);
+    E->Ty = Nodes[T].Con ? Nodes[T].Con : Ctx.getType(TypeVar{name(T)});
+  }
+  Typed.clear();
+  return Out;
+}
+
+void TypeChecker::analyze(Module &M) {
+  llvm::SmallVector<const void *, 0> All;
+  std::vector<std::uint32_t> Begin;
+  Begin.reserve(M.Stmts.size() + 1);
+  for (auto *S : M.Stmts) {
+    Begin.push_back(static_cast<std::uint32_t>(All.size()));
+    uses(*S, All);
+  }
+  Begin.push_back(static_cast<std::uint32_t>(All.size()));
+  auto Groups = groups(M.Stmts, [&](std::uint32_t I) {
+    return llvm::ArrayRef(All).slice(Begin[I], Begin[I + 1] - Begin[I]);
+  });
+
+  // Each group reports to its own buffer, emitted in the order of the
+  // groups' first statements.
+  std::vector<Scheme> Schemes(M.Stmts.size());
+  std::vector<DiagnosticEngine> Reports(Groups.size());
+  llvm::SmallVector<Stmt *, 1> Stmts;
+  std::vector<Assumption> Uses;
+  for (std::size_t G = 0; G < Groups.size(); ++G) {
+    Stmts.clear();
+    for (auto I : Groups[G].Stmts)
+      Stmts.push_back(M.Stmts[I]);
+    Uses.clear();
+    for (auto I : Groups[G].Uses)
+      Uses.push_back({M.Stmts[I], &Schemes[I]});
+    Sink = &Reports[G];
+    auto Out = analyzeGroup(Stmts, Uses);
+    for (std::size_t K = 0; K < Out.size(); ++K)
+      Schemes[Groups[G].Stmts[K]] = std::move(Out[K]);
+  }
+  Sink = &Diags;
+
+  std::vector<std::uint32_t> ByStart(Groups.size());
+  for (std::uint32_t G = 0; G < ByStart.size(); ++G)
+    ByStart[G] = G;
+  std::sort(ByStart.begin(), ByStart.end(), [&](auto A, auto B) {
+    return Groups[A].Stmts.front() < Groups[B].Stmts.front();
+  });
+  for (auto G : ByStart)
+    for (const auto &Diag : Reports[G].diagnostics())
+      Diags.emit(Diag);
+}
+
+} // namespace rheo
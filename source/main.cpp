@@ -4,31 +4,101 @@
 #include "rheo/Diagnostics/SourceManager.h"
 #include "rheo/Frontend/Lexer.h"
 #include "rheo/Frontend/Parser.h"
+#include "rheo/Frontend/TokenBuffer.h"
 #include "rheo/Sema/NameResolver.h"
+#include "rheo/Sema/TypeChecker.h"
 #include <llvm/ADT/ArrayRef.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <cstdint>
+#include <string>
 
-int main() {
-  const auto *Src = R"(
+static llvm::cl::opt<std::string>
+    InputFilename(llvm::cl::Positional, llvm::cl::desc("[input file]"),
+                  llvm::cl::init(""));
+
+static llvm::cl::opt<bool> StreamFunctions(
+    "stream-functions",
+    llvm::cl::desc("Parse each def body into a short-lived arena, freed once "
+                   "the def is resolved and printed"));
+
+static llvm::cl::opt<bool>
+    InferTypes("infer-types",
+               llvm::cl::desc("Infer and check types once names resolve, "
+                              "and print them on each expression"));
+
+static llvm::cl::opt<bool>
+    PrintASTStats("print-ast-stats",
+                  llvm::cl::desc("Print AST memory statistics to stderr"));
+
+int main(int Argc, char **Argv) {
+  llvm::cl::ParseCommandLineOptions(Argc, Argv, "rheo compiler\n");
+
+  const auto *Sample = R"(
     x := 10
     x := 13
     def sum(x, y) x + y end
     sum(10, 20)
   )";
   rheo::SourceManager Manager;
-  auto FileId = Manager.addFile("main.rheo", Src);
+  rheo::FileId FileId = 0;
+  llvm::StringRef ModuleName = "main";
+  if (InputFilename.empty()) {
+    FileId = Manager.addFile("main.rheo", Sample);
+  } else {
+    auto Opened = Manager.openFile(InputFilename);
+    if (!Opened) {
+      llvm::errs() << "rheo: cannot open '" << InputFilename
+                   << "': " << Opened.getError().message() << "\n";
+      return 1;
+    }
+    FileId = *Opened;
+    ModuleName = llvm::sys::path::stem(InputFilename);
+  }
+
   rheo::DiagnosticEngine Engine;
-  rheo::Lexer Lexer(FileId, Src, Engine);
+  rheo::Lexer Lexer(*Manager.getFile(FileId), Engine);
   rheo::ASTContext Ctx;
-  rheo::Parser Parser(Ctx, Lexer, Engine, FileId);
-  auto E = Parser.parseModule("main");
-  rheo::NameResolver Resolver(Engine, FileId, Ctx);
+  auto Tokens = rheo::TokenBuffer::lex(Lexer, Ctx.identifiers());
+  rheo::Parser Parser(Ctx, Tokens, Engine);
+  if (StreamFunctions)
+    Parser.deferFunctionBodies();
+  auto E = Parser.parseModule(ModuleName);
+  rheo::NameResolver Resolver(Engine, Ctx);
+  rheo::ASTPrinter Printer(Ctx);
+  auto PrintDiagnostics = [&] {
+    for (const auto &Diag : Engine.diagnostics())
+      Diag.print(llvm::outs(), Manager);
+  };
+
+  if (StreamFunctions) {
+    // Output goes out as each statement is resolved, so diagnostics come
+    // after it.
+    rheo::ASTContext Arena(Ctx);
+    std::uint64_t LargestArena = 0;
+    Printer.printModuleHeader(E);
+    Resolver.analyzeStreaming(E, Arena, [&](rheo::Stmt &S) {
+      LargestArena = std::max(LargestArena, Arena.getStats().BytesReserved);
+      Printer.printTopLevel(S);
+    });
+    if (PrintASTStats) {
+      Ctx.getStats().print(llvm::errs());
+      llvm::errs() << "  largest function arena: " << LargestArena
+                   << " bytes reserved\n";
+    }
+    PrintDiagnostics();
+    return Engine.hasError() ? 1 : 0;
+  }
+
   Resolver.analyze(E);
-  rheo::ASTPrinter Printer;
+  if (InferTypes && !Engine.hasError())
+    rheo::TypeChecker(Engine, Ctx).analyze(E);
+  if (PrintASTStats)
+    Ctx.getStats().print(llvm::errs());
   if (Engine.hasError()) {
-    auto &Out = llvm::outs();
-    for (const auto &Diag : Engine.diagnostics()) {
-      Diag.print(Out, Manager);
-    }
+    PrintDiagnostics();
     return 1;
   }
   Printer.print(E);
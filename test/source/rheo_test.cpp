@@ -1,8 +1,1266 @@
-#include "lib.hpp"
+#include "rheo/AST/AST.h"
+#include "rheo/AST/FlatAST.h"
+#include "rheo/AST/ModuleFile.h"
+#include "rheo/AST/Print.h"
+#include "rheo/AST/RecursiveASTVisitor.h"
+#include "rheo/Diagnostics/DiagnosticEngine.h"
+#include "rheo/Diagnostics/SourceManager.h"
+#include "rheo/Frontend/CharScan.h"
+#include "rheo/Frontend/Lexer.h"
+#include "rheo/Frontend/Parser.h"
+#include "rheo/Frontend/Token.h"
+#include "rheo/Frontend/TokenBuffer.h"
+#include "rheo/Sema/NameResolver.h"
+#include "rheo/Sema/QueryEngine.h"
+#include "rheo/Sema/TypeChecker.h"
+#include <format>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/raw_ostream.h>
+#include <string>
+#include <vector>
 
-auto main() -> int
-{
-  auto const lib = library {};
+namespace {
 
-  return lib.name == "rheo" ? 0 : 1;
+int Failures = 0;
+
+void check(bool Cond, llvm::StringRef What) {
+  if (Cond)
+    return;
+  ++Failures;
+  llvm::errs() << "FAIL: " << What << "\n";
+}
+
+std::vector<rheo::Token> lex(llvm::StringRef Src) {
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0, Src, Diags);
+  std::vector<rheo::Token> Toks;
+  do
+    Toks.push_back(Lex.nextToken());
+  while (Toks.back().Kind != rheo::TokenKind::Eof);
+  return Toks;
+}
+
+bool sameTokens(llvm::ArrayRef<rheo::Token> A, llvm::ArrayRef<rheo::Token> B) {
+  if (A.size() != B.size())
+    return false;
+  for (std::size_t I = 0; I < A.size(); ++I)
+    if (A[I].Kind != B[I].Kind || A[I].Value != B[I].Value ||
+        A[I].Span.getStart() != B[I].Span.getStart() ||
+        A[I].Span.getEnd() != B[I].Span.getEnd())
+      return false;
+  return true;
+}
+
+// Every vector kernel must agree with the scalar tables, including runs that
+// straddle 16/32-byte blocks and stop at the end of the buffer.
+void testScanKernelsAgree() {
+  using rheo::scan::ISA;
+  std::string Src = "def f(x_long_identifier_name, y) -> Int\n";
+  Src += std::string(37, ' ') + "\t\v\f\r" + "x := 12345678901234567890.5\n";
+  Src += std::string(70, 'a') + " @ " + std::string(33, '9') + "..1\n";
+  Src += "while not done\n  x = x + 1\nend\n" + std::string(40, '_');
+
+  auto Default = rheo::scan::activeISA();
+  rheo::scan::forceISA(ISA::Scalar);
+  auto Expected = lex(Src);
+  for (auto Target : {ISA::SSE42, ISA::AVX2}) {
+    if (!rheo::scan::forceISA(Target))
+      continue;
+    for (std::size_t Len = 0; Len <= Src.size(); ++Len) {
+      rheo::scan::forceISA(ISA::Scalar);
+      auto Want = lex(llvm::StringRef(Src).take_front(Len));
+      rheo::scan::forceISA(Target);
+      check(sameTokens(Want, lex(llvm::StringRef(Src).take_front(Len))),
+            "scan kernels disagree on a prefix");
+    }
+    check(sameTokens(Expected, lex(Src)), "scan kernels disagree");
+  }
+  rheo::scan::forceISA(Default);
+}
+
+// Tokens, including punctuation and error tokens, are views into the one
+// buffer the SourceManager owns.
+void testTokensViewSourceBuffer() {
+  rheo::SourceManager SM;
+  auto File = SM.addFile("view.rheo", "def f(x) -> Int\n  x @ 1.5 != 2\nend");
+  llvm::StringRef Src = SM.getFile(File)->getSource();
+  for (const auto &Tok : lex(Src)) {
+    check(Tok.Value.begin() >= Src.begin() && Tok.Value.end() <= Src.end(),
+          "token value does not point into the source buffer");
+    check(Tok.Value == Src.slice(Tok.Span.getStart(), Tok.Span.getEnd()),
+          "token value does not match its span");
+  }
+}
+
+// The lazily built line table agrees with a naive count for every kernel, in
+// whatever order positions are looked up.
+void testLineTable() {
+  using rheo::scan::ISA;
+  std::string Src;
+  for (int Line = 0; Line < 90; ++Line)
+    Src += std::string(static_cast<std::size_t>(Line % 37), 'x') + "\n";
+  Src += "tail";
+
+  auto Default = rheo::scan::activeISA();
+  for (auto Target : {ISA::Scalar, ISA::SSE42, ISA::AVX2}) {
+    if (!rheo::scan::forceISA(Target))
+      continue;
+    rheo::SourceManager SM;
+    const auto *File = SM.getFile(SM.addFile("lines.rheo", Src));
+    auto Expect = [&](rheo::BytePos Pos) {
+      rheo::LineColumn LC{1, 1};
+      for (rheo::BytePos I = 0; I < Pos; ++I) {
+        if (Src[I] == '\n')
+          LC = {LC.Line + 1, 1};
+        else
+          ++LC.Col;
+      }
+      return LC;
+    };
+    for (rheo::BytePos Pos = 0; Pos <= Src.size(); Pos += 7) {
+      for (auto P : {Pos, static_cast<rheo::BytePos>(Src.size()) - Pos}) {
+        auto Got = File->getLineCol(P);
+        auto Want = Expect(P);
+        check(Got.Line == Want.Line && Got.Col == Want.Col,
+              "wrong line/column");
+      }
+    }
+  }
+  rheo::scan::forceISA(Default);
+}
+
+void testKeywords() {
+  for (const auto &K : rheo::Keywords) {
+    auto Toks = lex(K.Spelling);
+    check(Toks.size() == 2 && Toks[0].Kind == K.Kind &&
+              Toks[0].Value == llvm::StringRef(K.Spelling),
+          "keyword does not lex as itself");
+  }
+  auto Toks = lex("x1 Int8x elseif_ _9");
+  check(Toks.size() == 5, "identifiers with digits split into tokens");
+  for (std::size_t I = 0; I + 1 < Toks.size(); ++I)
+    check(Toks[I].Kind == rheo::TokenKind::Identifier,
+          "keyword prefix lexed as keyword");
+}
+
+void testTokenBuffer() {
+  llvm::StringRef Src = "def f(a) a + 1 end\nf(2)\n";
+  auto Toks = lex(Src);
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0, Src, Diags);
+  rheo::IdentifierTable Idents;
+  auto Buffer = rheo::TokenBuffer::lex(Lex, Idents);
+  check(Buffer.size() == Toks.size(), "token buffer size differs from lexer");
+  for (std::size_t I = 0; I < Buffer.size() && I < Toks.size(); ++I)
+    check(Buffer.token(I).Kind == Toks[I].Kind &&
+              Buffer.start(I) == Toks[I].Span.getStart() &&
+              Buffer.token(I).Value == Toks[I].Value,
+          "token buffer entry differs from lexer");
+  check(!Buffer.empty() &&
+            Buffer.kind(Buffer.size() - 1) == rheo::TokenKind::Eof,
+        "token buffer does not end in Eof");
+
+  // Tokens 1, 3, 5 and 10 are f, a, a, f.
+  check(Buffer.atom(1) != rheo::NoAtom && Buffer.atom(1) == Buffer.atom(10) &&
+            Buffer.atom(3) == Buffer.atom(5) &&
+            Buffer.atom(1) != Buffer.atom(3),
+        "identifiers interned to the wrong atoms");
+  check(Idents.spelling(Buffer.atom(3)) == "a" &&
+            Buffer.atom(0) == rheo::NoAtom,
+        "atom spelling or keyword atom wrong");
+}
+
+// Small chunks force boundaries everywhere, including inside a long line and
+// right before the errors, which must still come out in order.
+void testParallelLex() {
+  std::string Src;
+  for (int I = 0; I < 200; ++I)
+    Src += "x := y + 12 * z\n  @\n" + std::string(I % 7, ' ') + "1.2.3\n";
+  rheo::SourceManager SM;
+  auto File = SM.addFile("par.rheo", Src);
+
+  rheo::DiagnosticEngine SerialDiags;
+  rheo::IdentifierTable SerialIdents;
+  rheo::Lexer Lex(*SM.getFile(File), SerialDiags);
+  auto Serial = rheo::TokenBuffer::lex(Lex, SerialIdents);
+
+  // Chunks are merged in order, so atoms come out in the same first-seen
+  // order as with a serial lex.
+  llvm::DefaultThreadPool Pool;
+  rheo::DiagnosticEngine ParallelDiags;
+  rheo::IdentifierTable ParallelIdents;
+  auto Parallel = rheo::TokenBuffer::lexParallel(
+      SM, File, ParallelIdents, ParallelDiags, Pool, /*ChunkBytes=*/64);
+  check(Serial.kinds() == Parallel.kinds() &&
+            Serial.starts() == Parallel.starts() &&
+            Serial.lengths() == Parallel.lengths() &&
+            Serial.atoms() == Parallel.atoms(),
+        "parallel lexing differs from serial lexing");
+  auto Expected = SerialDiags.diagnostics();
+  auto Got = ParallelDiags.diagnostics();
+  check(Expected.size() == Got.size(), "parallel lexing lost diagnostics");
+  for (std::size_t I = 0; I < Expected.size() && I < Got.size(); ++I)
+    check(Expected[I].Labels[0].Location.getStart() ==
+              Got[I].Labels[0].Location.getStart(),
+          "parallel lexing reordered diagnostics");
+}
+
+void testRelex() {
+  rheo::SourceManager SM;
+  auto File = SM.addFile("edit.rheo", "x := 1\ny := x + 2\nz := y\n");
+  rheo::DiagnosticEngine Diags;
+  rheo::IdentifierTable Idents;
+  rheo::Lexer Lex(*SM.getFile(File), Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Idents);
+  // Builds the line table, so that the edit has one to patch.
+  auto Before = SM.getFile(File)->getLineCol(14);
+  check(Before.Line == 2 && Before.Col == 8, "line table wrong before edit");
+
+  // "x + 2" -> "xy + 2": only the edited line is relexed.
+  rheo::TextEdit Edit{.Offset = 13, .RemovedLen = 0, .Inserted = "y"};
+  const auto &Edited = SM.applyEdit(File, Edit);
+  auto Changed = Tokens.relex(Edit, Edited, Idents, Diags);
+  check(Changed.First == 4 && Changed.Removed <= 6,
+        "relex touched tokens before the edited line");
+
+  rheo::Lexer Fresh(Edited, Diags);
+  auto Expected = rheo::TokenBuffer::lex(Fresh, Idents);
+  check(Tokens.kinds() == Expected.kinds() &&
+            Tokens.starts() == Expected.starts() &&
+            Tokens.lengths() == Expected.lengths() &&
+            Tokens.atoms() == Expected.atoms(),
+        "relexed tokens differ from a full relex");
+  check(Tokens.text(6) == "xy", "relexed identifier has the wrong text");
+  auto Pos = SM.getFile(File)->getLineCol(19);
+  check(Pos.Line == 3 && Pos.Col == 1, "line table not patched after edit");
+}
+
+void testResolveByAtom() {
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0, "value := 1\nvalue + 2\n", Diags);
+  rheo::Parser P(Ctx, Lex, Diags);
+  auto M = P.parseModule("atoms");
+  rheo::NameResolver(Diags, Ctx).analyze(M);
+  check(!Diags.hasError() && M.Stmts.size() == 2, "atom test did not parse");
+  if (Diags.hasError() || M.Stmts.size() != 2)
+    return;
+  auto &Decl = std::get<rheo::VarDecl>(M.Stmts[0]->Kind);
+  auto *Use = std::get<rheo::ExprStmt>(M.Stmts[1]->Kind).Expr;
+  auto &Sum = std::get<rheo::BinaryExpr>(Use->Kind);
+  auto &Ref = std::get<rheo::VarRef>(Sum.Lhs->Kind);
+  check(Ref.Name == Decl.Name && Ctx.spelling(Ref.Name) == "value" &&
+            Ref.Resolved == &Decl,
+        "variable reference not resolved by atom");
+}
+
+// An inner declaration shadows the outer one until its block closes.
+void testShadowing() {
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0, "x := 1\nwhile x < 2\n    x := 2\n    x\nend\nx\n",
+                  Diags);
+  rheo::Parser P(Ctx, Lex, Diags);
+  auto M = P.parseModule("shadow");
+  rheo::NameResolver(Diags, Ctx).analyze(M);
+  check(!Diags.hasError() && M.Stmts.size() == 3, "shadowing did not parse");
+  if (Diags.hasError() || M.Stmts.size() != 3)
+    return;
+  auto &Outer = std::get<rheo::VarDecl>(M.Stmts[0]->Kind);
+  auto *Loop = std::get<rheo::ExprStmt>(M.Stmts[1]->Kind).Expr;
+  auto *Body = std::get<rheo::WhileExpr>(Loop->Kind).Body;
+  auto &Inner = std::get<rheo::VarDecl>(Body->Stmts[0]->Kind);
+  auto &InnerUse = std::get<rheo::VarRef>(Body->Tail->Kind);
+  auto *After = std::get<rheo::ExprStmt>(M.Stmts[2]->Kind).Expr;
+  check(InnerUse.Resolved == &Inner, "inner use not bound to the shadow");
+  check(std::get<rheo::VarRef>(After->Kind).Resolved == &Outer,
+        "shadow outlived its block");
+}
+
+// Parameters take the first slots, a closed block's slots are reused and
+// globals are one frame out from a function body.
+void testLexicalAddresses() {
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0,
+                  "g := 1\ndef f(a, b)\n    while a < b\n"
+                  "        c := a + g\n        c\n    end\n"
+                  "    d := b\n    d\nend\n",
+                  Diags);
+  rheo::Parser P(Ctx, Lex, Diags);
+  auto M = P.parseModule("slots");
+  rheo::NameResolver(Diags, Ctx).analyze(M);
+  check(!Diags.hasError() && M.Stmts.size() == 2, "slots did not parse");
+  if (Diags.hasError() || M.Stmts.size() != 2)
+    return;
+  auto *F = std::get<rheo::FunctionDecl *>(M.Stmts[1]->Kind);
+  check(M.NumGlobals == 1 && F->NumLocals == 3, "wrong frame sizes");
+  auto *Body = F->getBody();
+  auto *Loop = std::get<rheo::ExprStmt>(Body->Stmts[0]->Kind).Expr;
+  auto &While = std::get<rheo::WhileExpr>(Loop->Kind);
+  auto &Cond = std::get<rheo::BinaryExpr>(While.Condition->Kind);
+  auto &B = std::get<rheo::VarRef>(Cond.Rhs->Kind);
+  check(B.Depth == 0 && B.Slot == 1, "parameter not in its slot");
+  auto &C = std::get<rheo::VarDecl>(While.Body->Stmts[0]->Kind);
+  auto &Sum = std::get<rheo::BinaryExpr>(C.Init->Kind);
+  auto &G = std::get<rheo::VarRef>(Sum.Rhs->Kind);
+  check(C.Slot == 2 && G.Depth == 1 && G.Slot == 0,
+        "global not addressed through the module frame");
+  auto &D = std::get<rheo::VarDecl>(Body->Stmts[1]->Kind);
+  auto &Use = std::get<rheo::VarRef>(Body->Tail->Kind);
+  check(D.Slot == 2 && Use.Depth == 0 && Use.Slot == 2,
+        "slot of a closed block not reused");
+}
+
+// while consumes its `end`, inline bodies are kept and bodies are resolved.
+void testFunctionBodies() {
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0,
+                  "def inc(x) x + 1 end\n"
+                  "def loop(n)\n    mut i := 0\n"
+                  "    while i < n\n        i = inc(i)\n    end\n    i\nend\n",
+                  Diags);
+  rheo::Parser P(Ctx, Lex, Diags);
+  auto M = P.parseModule("bodies");
+  rheo::NameResolver(Diags, Ctx).analyze(M);
+  check(!Diags.hasError() && M.Stmts.size() == 2, "functions did not parse");
+  if (Diags.hasError() || M.Stmts.size() != 2)
+    return;
+  auto *Inc = std::get<rheo::FunctionDecl *>(M.Stmts[0]->Kind);
+  auto *Body = Inc->getBody();
+  check(Body && Body->Tail, "inline function body dropped");
+  if (!Body || !Body->Tail)
+    return;
+  auto &Sum = std::get<rheo::BinaryExpr>(Body->Tail->Kind);
+  check(std::get<rheo::VarRef>(Sum.Lhs->Kind).Resolved != nullptr,
+        "function body not resolved");
+}
+
+// Records the order nodes are entered and left in.
+class OrderRecorder : public rheo::RecursiveASTVisitor<OrderRecorder> {
+public:
+  std::string Trace;
+
+  bool visitStmt(rheo::Stmt &) {
+    Trace += 'S';
+    return true;
+  }
+  bool postVisitStmt(rheo::Stmt &) {
+    Trace += 's';
+    return true;
+  }
+  bool visitExpr(rheo::Expr &) {
+    Trace += 'E';
+    return true;
+  }
+  bool postVisitExpr(rheo::Expr &) {
+    Trace += 'e';
+    return true;
+  }
+  bool visitBlock(rheo::BlockExpr &) {
+    Trace += 'B';
+    return true;
+  }
+  bool visitParam(rheo::Param &) {
+    Trace += 'P';
+    return true;
+  }
+  bool visitTypeLoc(rheo::TypeLoc &) {
+    Trace += 'T';
+    return true;
+  }
+};
+
+// Stops the walk at the first call.
+class FindCall : public rheo::RecursiveASTVisitor<FindCall> {
+public:
+  rheo::Expr *Found = nullptr;
+
+  bool visitExpr(rheo::Expr &E) {
+    if (!std::holds_alternative<rheo::CallExpr>(E.Kind))
+      return true;
+    Found = &E;
+    return false;
+  }
+};
+
+void testVisitor() {
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0, "def f(a: Int) a end\nx := -f(1)\ny := 2\n", Diags);
+  rheo::Parser P(Ctx, Lex, Diags);
+  auto M = P.parseModule("visit");
+
+  OrderRecorder Alone;
+  Alone.traverseModule(M);
+  check(Alone.Trace == "SPTBEesSEEEeEeeesSEes", "wrong visiting order");
+
+  OrderRecorder First, Second;
+  FindCall Finder;
+  check(!rheo::FusedVisitor(First, Finder, Second).traverseModule(M),
+        "stopped walk reported as finished");
+  check(Finder.Found && First.Trace == "SPTBEesSEE" &&
+            Second.Trace == "SPTBEesSE",
+        "fused passes saw the wrong nodes");
+}
+
+// The printed tree plus each diagnostic's code and position.
+std::string parseAndDump(llvm::StringRef Src, llvm::ThreadPoolInterface *Pool,
+                         bool Lazy = false) {
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0, Src, Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Ctx.identifiers());
+  rheo::Parser P(Ctx, Tokens, Diags);
+  if (Lazy)
+    P.deferFunctionBodies();
+  auto M = Pool ? P.parseModuleParallel("m", *Pool, /*ChunkTokens=*/16)
+                : P.parseModule("m");
+  std::string Out;
+  llvm::raw_string_ostream OS(Out);
+  rheo::printAST(Ctx, M, OS);
+  for (const auto &D : Diags.diagnostics())
+    OS << D.Code.value_or("") << "@" << D.Labels[0].Location.getStart()
+       << "\n";
+  return OS.str();
+}
+
+// Binary chains associate to the left, tightest operators first; prefix
+// operators nest. Neither may use stack in proportion to the input.
+void testExpressions() {
+  auto Dump = parseAndDump("x := 1 - 2 * 3 < 4 or not - 5\n", nullptr);
+  check(Dump == "Module(m)\n"
+                "  VarDecl(x) [0:29]\n"
+                "    BinaryExpr(or) [5:29]\n"
+                "      BinaryExpr(<) [5:18]\n"
+                "        BinaryExpr(-) [5:14]\n"
+                "          IntLiteral(1) [5:6]\n"
+                "          BinaryExpr(*) [9:14]\n"
+                "            IntLiteral(2) [9:10]\n"
+                "            IntLiteral(3) [13:14]\n"
+                "        IntLiteral(4) [17:18]\n"
+                "      UnaryExpr(not) [22:29]\n"
+                "        UnaryExpr(-) [26:29]\n"
+                "          IntLiteral(5) [28:29]\n",
+        "wrong precedence or associativity");
+
+  std::string Long = "x := 1";
+  for (int I = 0; I < 200000; ++I)
+    Long += I % 2 ? " * 2" : " - 1";
+  Long += "\ny := ";
+  for (int I = 0; I < 200000; ++I)
+    Long += "- ";
+  Long += "1\n";
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0, Long, Diags);
+  rheo::Parser P(Ctx, Lex, Diags);
+  auto M = P.parseModule("long");
+  check(!Diags.hasError() && M.Stmts.size() == 2,
+        "long expressions did not parse");
+}
+
+void testParallelParse() {
+  std::string Src;
+  for (int I = 0; I < 40; ++I)
+    Src += std::format("def f{}(a, b)\n    if a > b\n        a\n    else\n"
+                       "        while b < (a + 1)\n            b = b + 1\n"
+                       "        end\n    end\nend\n"
+                       "x{} := f{}(1, 2); y{} := 3\n",
+                       I, I, I, I);
+  llvm::DefaultThreadPool Pool;
+  auto Expected = parseAndDump(Src, nullptr);
+  check(Expected.find('@') == std::string::npos &&
+            Expected == parseAndDump(Src, &Pool),
+        "parallel parse differs from serial parse");
+  check(Expected == parseAndDump(Src, nullptr, /*Lazy=*/true) &&
+            Expected == parseAndDump(Src, &Pool, /*Lazy=*/true),
+        "deferred bodies parse differently");
+
+  // A missing name leaves the rest of that def to top-level recovery; an
+  // unclosed parameter list makes the serial parser skip into the next def.
+  // The parallel parse must recover the same way from both.
+  for (llvm::StringRef Edit : {"def 20(a, b)", "def f20((a, b)"}) {
+    auto Broken = Src;
+    Broken.replace(Broken.find("def f20(a, b)"), 13, Edit.str());
+    auto Serial = parseAndDump(Broken, nullptr);
+    check(Serial.find('@') != std::string::npos &&
+              Serial == parseAndDump(Broken, &Pool),
+          "parallel parse recovers differently from serial parse");
+  }
+}
+
+void testReparse() {
+  std::string Src;
+  for (int I = 0; I < 6; ++I)
+    Src += std::format("def f{}(a)\n    if a > {}\n        a = a - 1\n"
+                       "    end\n    a\nend\nx{} := f{}({})\n",
+                       I, I, I, I, I);
+  // Body edit, a new statement, two statements joined, and a syntax error.
+  struct Case {
+    llvm::StringRef Find;
+    std::uint32_t RemovedLen;
+    llvm::StringRef Inserted;
+  };
+  for (auto [Find, RemovedLen, Inserted] :
+       {Case{"a > 2", 5, "a >= 20"}, Case{"x3", 0, "y := 1\n"},
+        Case{"\nx4", 1, "; "}, Case{"a > 4", 0, "> "}}) {
+    rheo::SourceManager SM;
+    auto File = SM.addFile("reparse.rheo", Src);
+    rheo::ASTContext Ctx;
+    rheo::DiagnosticEngine Diags;
+    rheo::Lexer Lex(*SM.getFile(File), Diags);
+    auto Tokens = rheo::TokenBuffer::lex(Lex, Ctx.identifiers());
+    auto Old = rheo::Parser(Ctx, Tokens, Diags).parseModule("m");
+
+    rheo::TextEdit Edit{.Offset = static_cast<std::uint32_t>(Src.find(Find)),
+                        .RemovedLen = RemovedLen,
+                        .Inserted = Inserted};
+    const auto &Edited = SM.applyEdit(File, Edit);
+    auto Changed = Tokens.relex(Edit, Edited, Ctx.identifiers(), Diags);
+    auto New = rheo::Parser(Ctx, Tokens, Diags).reparseModule(Old, Edit,
+                                                               Changed);
+    std::string Got;
+    llvm::raw_string_ostream OS(Got);
+    rheo::printAST(Ctx, New, OS);
+    for (const auto &D : Diags.diagnostics())
+      OS << D.Code.value_or("") << "@" << D.Labels[0].Location.getStart()
+         << "\n";
+    check(Got == parseAndDump(Edited.getSource(), nullptr),
+          "reparse differs from a full parse");
+    // After an error the rest of the module is parsed again.
+    check(New.Stmts.front() == Old.Stmts.front() &&
+              (Diags.hasError() || New.Stmts.back() == Old.Stmts.back()),
+          "reparse did not reuse untouched statements");
+  }
+}
+
+void testDeferredBodies() {
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0,
+                  "def f(a, b) -> Int\n    if a\n        return a +\n"
+                  "    end\nend\ny := 1\n",
+                  Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Ctx.identifiers());
+  rheo::Parser P(Ctx, Tokens, Diags);
+  P.deferFunctionBodies();
+  auto M = P.parseModule("lazy");
+  check(!Diags.hasError() && M.Stmts.size() == 2,
+        "deferred body was parsed with the signature");
+  if (M.Stmts.size() != 2)
+    return;
+  auto *F = std::get<rheo::FunctionDecl *>(M.Stmts[0]->Kind);
+  check(F->hasDeferredBody() && F->Params.size() == 2 && F->ReturnType,
+        "signature not parsed");
+  F->getBody();
+  check(!F->hasDeferredBody() && Diags.hasError(),
+        "deferred body not parsed on first use");
+}
+
+// Equal types are one object, also when made by child contexts on a pool;
+// each mention keeps its own location.
+void testUniquedTypes() {
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  std::string Src;
+  for (int I = 0; I < 8; ++I)
+    Src += std::format("def f{}(a: Point, b: Int) -> Int\n    a\nend\n", I);
+  rheo::Lexer Lex(0, Src, Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Ctx.identifiers());
+  rheo::Parser P(Ctx, Tokens, Diags);
+  llvm::DefaultThreadPool Pool;
+  auto M = P.parseModuleParallel("types", Pool, /*ChunkTokens=*/16);
+  check(!Diags.hasError() && M.Stmts.size() == 8, "typed functions");
+  if (M.Stmts.size() != 8)
+    return;
+  auto *Point = Ctx.getType(rheo::NamedType{Ctx.intern("Point")});
+  auto *Int = Ctx.getBuiltinType(rheo::BuiltinKind::Int);
+  for (auto *S : M.Stmts) {
+    auto *F = std::get<rheo::FunctionDecl *>(S->Kind);
+    check(F->Params[0].Ty.Ty == Point && F->Params[1].Ty.Ty == Int &&
+              F->ReturnType.Ty == Int,
+          "equal types are distinct objects");
+    check(F->Params[1].Ty.Location.getStart() !=
+              F->ReturnType.Location.getStart(),
+          "type mentions share a location");
+  }
+  check(Ctx.getType(rheo::BuiltinType{rheo::BuiltinKind::Int}) == Int &&
+            Ctx.getType(rheo::TypeVar{1}) == Ctx.getType(rheo::TypeVar{1}) &&
+            Ctx.getType(rheo::TypeVar{1}) != Ctx.getType(rheo::TypeVar{2}),
+        "types not uniqued by kind");
+}
+
+// Every arena byte is accounted to some kind, children's included.
+void testASTStats() {
+  std::string Src;
+  for (int I = 0; I < 20; ++I)
+    Src += std::format("def f{}(a: Int)\n    mut b := a\n    b = b + 1\n"
+                       "    b\nend\nx{} := f{}(1)\n",
+                       I, I, I);
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0, Src, Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Ctx.identifiers());
+  rheo::Parser P(Ctx, Tokens, Diags);
+  llvm::DefaultThreadPool Pool;
+  auto M = P.parseModuleParallel("stats", Pool, /*ChunkTokens=*/16);
+  auto Stats = Ctx.getStats();
+
+  std::uint64_t Bytes = 0, Exprs = 0, Stmts = 0;
+  for (const auto &C : Stats.Allocs)
+    Bytes += C.Bytes;
+  for (auto N : Stats.ExprKinds)
+    Exprs += N;
+  for (auto N : Stats.StmtKinds)
+    Stmts += N;
+  auto Count = [&](rheo::AllocKind K) {
+    return Stats.Allocs[static_cast<std::size_t>(K)].Count;
+  };
+  check(!Diags.hasError() && M.Stmts.size() == 40, "stats module");
+  check(Bytes == Stats.BytesAllocated &&
+            Stats.BytesAllocated == Ctx.getBytesAllocated() &&
+            Stats.BytesAllocated <= Stats.BytesReserved && Stats.Slabs > 0,
+        "arena bytes not all accounted for");
+  check(Exprs == Count(rheo::AllocKind::Expr) &&
+            Stmts == Count(rheo::AllocKind::Stmt) &&
+            Count(rheo::AllocKind::Function) == 20 &&
+            Stats.StmtKinds[2] == 40, // VarDecl
+        "wrong node counts");
+}
+
+// Each multi-line body lives in the arena only while its def is consumed,
+// and the printed statements match a whole-module resolve.
+void testStreaming() {
+  llvm::StringRef Src = "def add(a, b)\n    a + b\nend\n"
+                        "def twice(x)\n    mut y := add(x, x)\n    y\nend\n"
+                        "z := twice(3)\n";
+  std::string Expected;
+  {
+    rheo::ASTContext Ctx;
+    rheo::DiagnosticEngine Diags;
+    rheo::Lexer Lex(0, Src, Diags);
+    rheo::Parser P(Ctx, Lex, Diags);
+    auto M = P.parseModule("m");
+    rheo::NameResolver(Diags, Ctx).analyze(M);
+    llvm::raw_string_ostream OS(Expected);
+    rheo::printAST(Ctx, M, OS);
+  }
+
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0, Src, Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Ctx.identifiers());
+  rheo::Parser P(Ctx, Tokens, Diags);
+  P.deferFunctionBodies();
+  auto M = P.parseModule("m");
+  auto Before = Ctx.getBytesAllocated();
+
+  std::string Out;
+  llvm::raw_string_ostream OS(Out);
+  rheo::ASTPrinter Printer(Ctx, OS);
+  Printer.printModuleHeader(M);
+  rheo::ASTContext Arena(Ctx);
+  bool InArena = true;
+  rheo::NameResolver(Diags, Ctx).analyzeStreaming(M, Arena, [&](rheo::Stmt &S) {
+    if (std::holds_alternative<rheo::FunctionDecl *>(S.Kind))
+      InArena &= Arena.getBytesAllocated() != 0;
+    Printer.printTopLevel(S);
+  });
+
+  check(!Diags.hasError() && InArena, "bodies not parsed into the arena");
+  check(OS.str() == Expected, "streamed output differs from a full resolve");
+  check(Ctx.getBytesAllocated() == Before && Arena.getBytesAllocated() == 0,
+        "streamed bodies outlived their def");
+  for (auto *S : M.Stmts)
+    if (auto **F = std::get_if<rheo::FunctionDecl *>(&S->Kind))
+      check((*F)->hasDeferredBody(), "streamed body not deferred again");
+}
+
+// Defs resolved on a pool see the globals declared before them, and report
+// what the serial resolver does, in the same order.
+void testParallelResolve() {
+  std::string Src = "x := 1\n";
+  for (int I = 0; I < 24; ++I) {
+    Src += std::format("def f{}(a)\n    y := a + x\n    g(y)\n"
+                       "    f{}(y)\nend\n",
+                       I, (I + 1) % 24);
+    if (I % 5 == 0)
+      Src += std::format("x := {}\nh(x)\n", I);
+  }
+  Src += "def broken(a)\n    q := )\n    a\nend\n";
+  llvm::DefaultThreadPool Pool;
+  auto Resolve = [&](bool Parallel, bool Lazy) {
+    rheo::ASTContext Ctx;
+    rheo::DiagnosticEngine Diags;
+    rheo::Lexer Lex(0, Src, Diags);
+    auto Tokens = rheo::TokenBuffer::lex(Lex, Ctx.identifiers());
+    rheo::Parser P(Ctx, Tokens, Diags);
+    if (Lazy)
+      P.deferFunctionBodies();
+    auto M = P.parseModule("m");
+    rheo::NameResolver R(Diags, Ctx);
+    if (Parallel)
+      R.analyzeParallel(M, Pool, /*ChunkFunctions=*/4);
+    else
+      R.analyze(M);
+    std::string Out;
+    llvm::raw_string_ostream OS(Out);
+    rheo::printAST(Ctx, M, OS);
+    for (const auto &D : Diags.diagnostics())
+      OS << D.Code.value_or("") << "@" << D.Labels[0].Location.getStart()
+         << "\n";
+    // f0 reads the first x, f1 the one declared after f0.
+    auto *F0 = std::get<rheo::FunctionDecl *>(M.Stmts[1]->Kind);
+    auto &Y = std::get<rheo::VarDecl>(F0->getBody()->Stmts[0]->Kind);
+    auto &Sum = std::get<rheo::BinaryExpr>(Y.Init->Kind);
+    auto &X = std::get<rheo::VarRef>(Sum.Rhs->Kind);
+    OS << (X.Resolved == &std::get<rheo::VarDecl>(M.Stmts[0]->Kind)) << " "
+       << X.Depth << ":" << X.Slot << " " << F0->NumLocals << " "
+       << M.NumGlobals << "\n";
+    return OS.str();
+  };
+  auto Expected = Resolve(false, false);
+  check(Expected.find("E2002@") != std::string::npos &&
+            Expected.ends_with("1 1:0 2 6\n"),
+        "serial resolve of the parallel test went wrong");
+  check(Resolve(true, false) == Expected,
+        "parallel resolve differs from serial resolve");
+  check(Resolve(true, true) == Resolve(false, true),
+        "parallel resolve of deferred bodies differs");
+}
+
+// Every expression gets a type; defs are polymorphic, a while has the type
+// of its breaks, and annotations are checked.
+void testTypeInference() {
+  // Callees name a def and are left alone: functions are not values.
+  struct Untyped : rheo::RecursiveASTVisitor<Untyped> {
+    unsigned Count = 0;
+    const rheo::Expr *Callee = nullptr;
+    bool visitExpr(rheo::Expr &E) {
+      Count += E.Ty == nullptr && &E != Callee;
+      if (auto *Call = std::get_if<rheo::CallExpr>(&E.Kind))
+        Callee = Call->Callee;
+      return true;
+    }
+  };
+  auto Infer = [](llvm::StringRef Src, rheo::ASTContext &Ctx,
+                  rheo::DiagnosticEngine &Diags) {
+    rheo::Lexer Lex(0, Src, Diags);
+    rheo::Parser P(Ctx, Lex, Diags);
+    auto M = P.parseModule("types");
+    rheo::NameResolver(Diags, Ctx).analyze(M);
+    rheo::TypeChecker(Diags, Ctx).analyze(M);
+    return M;
+  };
+
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  auto M = Infer("def id(x) x end\n"
+                 "def pick(c, a: Int) -> Int\n"
+                 "    if c\n        a\n    else\n        id(a)\n    end\n"
+                 "end\n"
+                 "flag := id(true)\nn := pick(flag, 2)\nmut i := 0\n"
+                 "found := while i < 10\n"
+                 "    if i == n\n        break i\n    end\n"
+                 "    i = i + 1\nend\n",
+                 Ctx, Diags);
+  check(!Diags.hasError() && M.Stmts.size() == 6, "inference test failed");
+  if (Diags.hasError() || M.Stmts.size() != 6)
+    return;
+  auto InitTy = [&](std::size_t I) {
+    return std::get<rheo::VarDecl>(M.Stmts[I]->Kind).Init->Ty;
+  };
+  auto *Int = Ctx.getBuiltinType(rheo::BuiltinKind::Int);
+  auto *Bool = Ctx.getBuiltinType(rheo::BuiltinKind::Bool);
+  check(InitTy(2) == Bool && InitTy(3) == Int && InitTy(5) == Int,
+        "wrong inferred types");
+  auto *Id = std::get<rheo::FunctionDecl *>(M.Stmts[0]->Kind);
+  check(std::holds_alternative<rheo::TypeVar>(Id->getBody()->Tail->Ty->Kind),
+        "identity not generalized");
+  Untyped Walk;
+  Walk.traverseModule(M);
+  check(Walk.Count == 0, "expression left without a type");
+
+  rheo::ASTContext BadCtx;
+  rheo::DiagnosticEngine Bad;
+  Infer("def f(a: Int) -> Bool\n    a + 1\nend\n"
+        "b := f(true)\nc := not 3\nd := true + 1\ne := true < false\n",
+        BadCtx, Bad);
+  std::string Codes;
+  for (const auto &D : Bad.diagnostics())
+    Codes += D.Code.value_or("") + " ";
+  check(Codes == "E3001 E3001 E3001 E3001 E3002 ",
+        "wrong type errors: " + Codes);
+
+  // A def checked before its callers is polymorphic in them, wherever it is.
+  rheo::ASTContext FwdCtx;
+  rheo::DiagnosticEngine Fwd;
+  Infer("a := first(1)\nb := first(true)\ndef first(x) x end\n", FwdCtx,
+        Fwd);
+  check(!Fwd.hasError(), "a def called before it is defined is monomorphic");
+}
+
+// After each edit the engine agrees with a parse and resolve from scratch,
+// having resolved again only the defs the edit touched.
+void testQueryEngine() {
+  std::string Src = "x := 1\n"
+                    "def f(a) a + x end\n"
+                    "def g(a)\n    y := a * 2\n    f(y)\nend\n"
+                    "def h(a)\n    g(a) + 1\nend\n"
+                    "n := h(2)\n";
+  rheo::QueryEngine Engine;
+  auto File = Engine.addFile("m.rheo", Src);
+  auto Print = [](rheo::ASTContext &Ctx, const rheo::Module &M,
+                  llvm::ArrayRef<rheo::Diagnostic> Diags) {
+    std::string Out;
+    llvm::raw_string_ostream OS(Out);
+    rheo::printAST(Ctx, M, OS);
+    for (const auto &D : Diags)
+      OS << D.Code.value_or("") << "@" << D.Labels[0].Location.getStart()
+         << "\n";
+    return OS.str();
+  };
+  auto Fresh = [&] {
+    rheo::ASTContext Ctx;
+    rheo::DiagnosticEngine Diags;
+    rheo::Lexer Lex(0, Src, Diags);
+    rheo::Parser P(Ctx, Lex, Diags);
+    auto M = P.parseModule("m");
+    rheo::NameResolver(Diags, Ctx).analyze(M);
+    rheo::TypeChecker(Diags, Ctx).analyze(M);
+    return Print(Ctx, M, Diags.diagnostics());
+  };
+  auto Current = [&] {
+    auto Diags = Engine.diagnostics(File);
+    auto Types = Engine.typeDiagnostics(File);
+    Diags.insert(Diags.end(), Types.begin(), Types.end());
+    return Print(Engine.context(), Engine.parse(File), Diags);
+  };
+  auto Edit = [&](llvm::StringRef Old, llvm::StringRef New) {
+    auto Offset = static_cast<std::uint32_t>(Src.find(Old.str()));
+    Engine.applyEdit(File, {Offset, static_cast<std::uint32_t>(Old.size()),
+                            New});
+    Src.replace(Offset, Old.size(), New.str());
+  };
+  auto Resolved = [&] { return Engine.runs(rheo::QueryKind::Resolve); };
+
+  check(Current() == Fresh(), "query engine differs from a fresh analysis");
+  check(Resolved() == 3, "not every def was resolved");
+  auto Def = [&](std::size_t I) {
+    return std::get<rheo::FunctionDecl *>(Engine.parse(File).Stmts[I]->Kind);
+  };
+  const auto *G = Def(2);
+  Current();
+  check(Resolved() == 3 && Engine.runs(rheo::QueryKind::Parse) == 1,
+        "queries ran again without an edit");
+
+  Edit("a * 2", "a * 3");
+  check(Current() == Fresh(), "query engine differs after a body edit");
+  check(Resolved() == 4, "a body edit resolved more than its def");
+  auto &Sum = std::get<rheo::BinaryExpr>(Def(3)->getBody()->Tail->Kind);
+  check(Def(2) == G && std::get<rheo::CallExpr>(Sum.Lhs->Kind).Resolved == G,
+        "a reparsed def did not keep its node");
+  auto *N = &std::get<rheo::VarDecl>(Engine.parse(File).Stmts.back()->Kind);
+  auto Int = static_cast<std::size_t>(rheo::BuiltinKind::Int);
+  check(Engine.typeOf(*N->Init) == &rheo::BuiltinTypes[Int],
+        "typeOf went wrong");
+
+  Edit("g(a) + 1", "g(b) + 1");
+  check(Current() == Fresh(), "query engine differs after an error");
+  Edit("x := 1", "x := 100");
+  check(Current() == Fresh(), "diagnostics did not move with the edit");
+  check(Resolved() == 6, "only the def with errors should run again");
+
+  Edit("def f(a)", "def f(a, b)");
+  check(Current() == Fresh(), "query engine differs after an arity change");
+  check(Resolved() == 9, "an arity change must resolve every def");
+}
+
+// Types are inferred again for the groups an edit touched, and the groups
+// that use them only if what they see changed. Edits back and forth leave
+// the type table as it was and use the same memory each time round.
+void testIncrementalTypes() {
+  std::string Src = "def id(v) v end\n"
+                    "def twice(a) id(a) + id(a) end\n"
+                    "def spin(a) spin(a) end\n"
+                    "n := twice(2)\n"
+                    "z := spin(true)\n"
+                    "def g(a)\n    y := a * 2\n    twice(y)\nend\n"
+                    "twice(z)\n";
+  rheo::QueryEngine Engine;
+  auto File = Engine.addFile("m.rheo", Src);
+  // The AST, then the type of each expression and the diagnostics.
+  auto Print = [](rheo::ASTContext &Ctx, const rheo::Module &M,
+                  llvm::ArrayRef<rheo::Diagnostic> Diags) {
+    struct Types : rheo::RecursiveASTVisitor<Types> {
+      rheo::ASTContext &Ctx;
+      llvm::raw_ostream &OS;
+      Types(rheo::ASTContext &Ctx, llvm::raw_ostream &OS) : Ctx(Ctx), OS(OS) {}
+      bool visitExpr(rheo::Expr &E) {
+        if (!E.Ty)
+          OS << "- ";
+        else if (auto *B = std::get_if<rheo::BuiltinType>(&E.Ty->Kind))
+          OS << rheo::ASTPrinter::builtinKindStr(B->Kind) << " ";
+        else if (auto *V = std::get_if<rheo::TypeVar>(&E.Ty->Kind))
+          OS << "?T" << V->Id << " ";
+        else
+          OS << Ctx.spelling(std::get<rheo::NamedType>(E.Ty->Kind).Name)
+             << " ";
+        return true;
+      }
+    };
+    std::string Out;
+    llvm::raw_string_ostream OS(Out);
+    rheo::printAST(Ctx, M, OS);
+    Types(Ctx, OS).traverseModule(M);
+    for (const auto &D : Diags)
+      OS << "\n"
+         << D.Code.value_or("") << "@" << D.Labels[0].Location.getStart();
+    return OS.str();
+  };
+  auto Fresh = [&] {
+    rheo::ASTContext Ctx;
+    rheo::DiagnosticEngine Diags;
+    rheo::Lexer Lex(0, Src, Diags);
+    rheo::Parser P(Ctx, Lex, Diags);
+    auto M = P.parseModule("m");
+    rheo::NameResolver(Diags, Ctx).analyze(M);
+    rheo::TypeChecker(Diags, Ctx).analyze(M);
+    return Print(Ctx, M, Diags.diagnostics());
+  };
+  auto Current = [&] {
+    auto Diags = Engine.diagnostics(File);
+    auto Types = Engine.typeDiagnostics(File);
+    Diags.insert(Diags.end(), Types.begin(), Types.end());
+    return Print(Engine.context(), Engine.parse(File), Diags);
+  };
+  auto Edit = [&](llvm::StringRef Old, llvm::StringRef New) {
+    auto Offset = static_cast<std::uint32_t>(Src.find(Old.str()));
+    Engine.applyEdit(File, {Offset, static_cast<std::uint32_t>(Old.size()),
+                            New});
+    Src.replace(Offset, Old.size(), New.str());
+  };
+  auto Inferred = [&] { return Engine.runs(rheo::QueryKind::Infer); };
+
+  check(Current() == Fresh(), "types differ from a fresh analysis");
+  check(Inferred() == 6, "not every group was inferred");
+
+  Edit("a * 2", "a * 3");
+  check(Current() == Fresh(), "types differ after a body edit");
+  check(Inferred() == 7, "a body edit inferred more than its def");
+  Edit("y := a", "y :=  a");
+  check(Current() == Fresh(), "types differ after a whitespace edit");
+  check(Inferred() == 8, "a whitespace edit inferred more than its def");
+
+  // twice's scheme changes from numeric to Int, so n and g see it.
+  Edit("def id(v) v end", "def id(v) v + 1 end");
+  check(Current() == Fresh(), "types differ after a scheme changed");
+  check(Inferred() == 12, "a new scheme must reach the groups using it");
+
+  auto &Ctx = Engine.context();
+  auto Cycle = [&] {
+    Edit("a * 3", "a * 4");
+    Current();
+    Edit("a * 4", "a * 3");
+    Current();
+  };
+  Cycle();
+  auto Types = Ctx.getStats().Types;
+  auto Before = Ctx.getBytesAllocated();
+  Cycle();
+  auto Growth = Ctx.getBytesAllocated() - Before;
+  for (int I = 0; I < 8; ++I)
+    Cycle();
+  check(Ctx.getStats().Types == Types, "edits keep adding types");
+  check(Ctx.getBytesAllocated() - Before == 9 * Growth,
+        "edits use more memory as they go on");
+  check(Current() == Fresh(), "types differ after repeated edits");
+}
+
+void testFlatAST() {
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  rheo::Lexer Lex(0,
+                  "def add(a: Int, b: Int) -> Int\n    return a + b\nend\n"
+                  "mut total := 1.5\nflag := not true\n"
+                  "def loop(n)\n    mut i := 0\n    while i < n\n"
+                  "        if i == 3\n            break i\n        else\n"
+                  "            continue\n        end\n"
+                  "        i = add(i, 1)\n    end\n    i\nend\n"
+                  "loop 5\n",
+                  Diags);
+  rheo::Parser P(Ctx, Lex, Diags);
+  auto M = P.parseModule("flat");
+  rheo::NameResolver(Diags, Ctx).analyze(M);
+  check(!Diags.hasError(), "flat AST input did not resolve");
+
+  auto Flat = rheo::FlatAST::build(M);
+  std::string Pointer;
+  std::string Arrays;
+  llvm::raw_string_ostream PointerOS(Pointer);
+  llvm::raw_string_ostream ArraysOS(Arrays);
+  rheo::printAST(Ctx, M, PointerOS);
+  rheo::printFlatAST(Flat, Ctx.identifiers(), ArraysOS);
+  check(PointerOS.str() == ArraysOS.str(),
+        "flat AST prints differently from the pointer AST");
+
+  // Parent before children, and a parameter reference links to the Param.
+  for (rheo::NodeId N = 1; N < Flat.size(); ++N) {
+    if (Flat.kind(N) == rheo::NodeKind::Binary)
+      check(Flat.data(N).A > N && Flat.data(N).B > N,
+            "flat AST not in pre-order");
+    if (Flat.kind(N) == rheo::NodeKind::VarRef &&
+        Ctx.spelling(Flat.data(N).A) == "a")
+      check(Flat.kind(Flat.data(N).B) == rheo::NodeKind::Param,
+            "parameter reference not linked to its Param node");
+  }
+
+  // Typed, the tree grows by one node per distinct expression type.
+  rheo::TypeChecker(Diags, Ctx).analyze(M);
+  check(!Diags.hasError(), "flat AST input did not type-check");
+  auto Typed = rheo::FlatAST::build(M);
+  std::string TypedPointer;
+  std::string TypedArrays;
+  llvm::raw_string_ostream TypedPointerOS(TypedPointer);
+  llvm::raw_string_ostream TypedArraysOS(TypedArrays);
+  rheo::printAST(Ctx, M, TypedPointerOS);
+  rheo::printFlatAST(Typed, Ctx.identifiers(), TypedArraysOS);
+  check(TypedPointerOS.str() == TypedArraysOS.str(),
+        "typed flat AST prints differently from the pointer AST");
+  std::vector<bool> IsTypeNode(Typed.size());
+  std::size_t TypeNodes = 0;
+  for (rheo::NodeId N = 1; N < Typed.size(); ++N)
+    if (rheo::NodeId T = Typed.exprType(N); T && !IsTypeNode[T]) {
+      IsTypeNode[T] = true;
+      ++TypeNodes;
+    }
+  check(TypeNodes > 1 && Typed.size() == Flat.size() + TypeNodes,
+        "expression types not shared");
+  check(Typed.verify(), "typed flat AST does not verify");
+}
+
+void testModuleFile() {
+  rheo::ASTContext Ctx;
+  rheo::DiagnosticEngine Diags;
+  llvm::StringRef Source =
+      "def twice(x: Int) -> Int\n    return add(x, x)\nend\n"
+      "def add(a, b) a + b end\nmut y := twice(2.5)\ny = -y\n";
+  rheo::Lexer Lex(0, Source, Diags);
+  rheo::Parser P(Ctx, Lex, Diags);
+  auto M = P.parseModule("cached");
+  rheo::NameResolver(Diags, Ctx).analyze(M);
+  std::string Bytes;
+  llvm::raw_string_ostream BytesOS(Bytes);
+  rheo::writeModuleFile(rheo::FlatAST::build(M), Ctx.identifiers(), 0,
+                        BytesOS);
+  BytesOS.flush();
+  auto Dump = [](const rheo::ASTContext &C, const rheo::Module &Mod) {
+    std::string Out;
+    llvm::raw_string_ostream OS(Out);
+    rheo::printAST(C, Mod, OS);
+    return OS.str();
+  };
+
+  // A fresh table numbers atoms as the file does; one with an extra name
+  // makes the reader renumber them.
+  for (bool Renumber : {false, true}) {
+    rheo::ASTContext Loaded;
+    if (Renumber)
+      Loaded.intern("unrelated");
+    auto Tree = rheo::readModuleFile(
+        llvm::MemoryBuffer::getMemBuffer(Bytes, "cached", false),
+        Loaded.identifiers(), 0);
+    check(bool(Tree), "module file did not load");
+    if (!Tree)
+      return;
+    check(Dump(Loaded, Tree->toModule(Loaded)) == Dump(Ctx, M),
+          "module file round trip lost part of the tree");
+  }
+
+  // Spans are written relative to the source file and moved to where the
+  // loader puts it.
+  rheo::ASTContext ShiftedCtx;
+  rheo::Lexer ShiftedLex(100, Source, Diags);
+  rheo::Parser ShiftedP(ShiftedCtx, ShiftedLex, Diags);
+  auto Shifted = ShiftedP.parseModule("cached");
+  rheo::NameResolver(Diags, ShiftedCtx).analyze(Shifted);
+  std::string ShiftedBytes;
+  llvm::raw_string_ostream ShiftedOS(ShiftedBytes);
+  auto ShiftedFlat = rheo::FlatAST::build(Shifted);
+  rheo::writeModuleFile(ShiftedFlat, ShiftedCtx.identifiers(), 100, ShiftedOS);
+  ShiftedOS.flush();
+  check(ShiftedBytes == Bytes, "module file depends on the source's position");
+  rheo::ASTContext Rebased;
+  auto RebasedTree = rheo::readModuleFile(
+      llvm::MemoryBuffer::getMemBuffer(Bytes, "cached", false),
+      Rebased.identifiers(), 100);
+  auto SameSpan = [](rheo::Span A, rheo::Span B) {
+    return A.getStart() == B.getStart() && A.getEnd() == B.getEnd();
+  };
+  check(RebasedTree && std::ranges::equal(RebasedTree->spans(),
+                                          ShiftedFlat.spans(), SameSpan),
+        "module file spans not moved to the loader's base");
+
+  // A loaded module keeps its frame slots, so it type-checks as it is: in
+  // pick, 'a' must get its own type and not that of the first parameter.
+  auto Check = [&](rheo::ASTContext &C, rheo::Module &Mod) {
+    rheo::DiagnosticEngine TypeDiags;
+    rheo::TypeChecker(TypeDiags, C).analyze(Mod);
+    auto &Pick = *std::get<rheo::FunctionDecl *>(Mod.Stmts[0]->Kind);
+    auto &Then = *std::get<rheo::IfExpr>(Pick.getBody()->Tail->Kind).ThenBlock;
+    auto &A = std::get<rheo::VarRef>(Then.Tail->Kind);
+    return std::format("{} {}:{} {} {}\n", TypeDiags.diagnostics().size(),
+                       A.Depth, A.Slot, Pick.NumLocals, Mod.NumGlobals) +
+           Dump(C, Mod);
+  };
+  rheo::ASTContext TypedCtx;
+  rheo::DiagnosticEngine TypedDiags;
+  rheo::Lexer TypedLex(0,
+                       "def pick(c, a: Int) -> Int\n"
+                       "    b := a\n    if c\n        a\n    else\n"
+                       "        b\n    end\nend\n"
+                       "n := pick(true, 2)\n",
+                       TypedDiags);
+  rheo::Parser TypedP(TypedCtx, TypedLex, TypedDiags);
+  auto Typed = TypedP.parseModule("typed");
+  rheo::NameResolver(TypedDiags, TypedCtx).analyze(Typed);
+  std::string TypedBytes;
+  llvm::raw_string_ostream TypedOS(TypedBytes);
+  rheo::writeModuleFile(rheo::FlatAST::build(Typed), TypedCtx.identifiers(),
+                        0, TypedOS);
+  TypedOS.flush();
+  rheo::ASTContext TypedLoaded;
+  auto TypedTree = rheo::readModuleFile(
+      llvm::MemoryBuffer::getMemBuffer(TypedBytes, "typed", false),
+      TypedLoaded.identifiers(), 0);
+  check(bool(TypedTree), "resolved module file did not load");
+  if (TypedTree) {
+    auto Reloaded = TypedTree->toModule(TypedLoaded);
+    auto Expected = Check(TypedCtx, Typed);
+    check(Expected.starts_with("0 0:1 3 1\n") &&
+              Check(TypedLoaded, Reloaded) == Expected,
+          "loaded module does not type-check like the original");
+  }
+
+  auto Truncated = rheo::readModuleFile(
+      llvm::MemoryBuffer::getMemBuffer(llvm::StringRef(Bytes).drop_back(8),
+                                       "truncated", false),
+      Ctx.identifiers(), 0);
+  check(!Truncated, "truncated module file accepted");
+
+  // Well framed but corrupt: a child id past the last node, a node kind
+  // outside the enum, a declaration left out of the tree while references
+  // still link to it, and a child with two parents.
+  auto Buffer = llvm::MemoryBuffer::getMemBufferCopy(Bytes, "cached");
+  const char *Start = Buffer->getBufferStart();
+  rheo::ASTContext Loaded;
+  auto Tree = rheo::readModuleFile(std::move(Buffer), Loaded.identifiers(), 0);
+  if (!Tree)
+    return;
+  auto Corrupted = [&](const void *At, llvm::StringRef With) {
+    std::string Bad = Bytes;
+    Bad.replace(static_cast<const char *>(At) - Start, With.size(), With.str());
+    rheo::ASTContext Fresh;
+    auto Names = Fresh.identifiers().size();
+    return !rheo::readModuleFile(
+               llvm::MemoryBuffer::getMemBufferCopy(Bad, "corrupt"),
+               Fresh.identifiers(), 0) &&
+           Fresh.identifiers().size() == Names;
+  };
+  auto BadId = static_cast<rheo::NodeId>(Tree->size());
+  check(Corrupted(&Tree->extra()[Tree->topLevelIndex() + 1],
+                  llvm::StringRef(reinterpret_cast<const char *>(&BadId),
+                                  sizeof(BadId))),
+        "module file with an out-of-range node id accepted");
+  check(Corrupted(&Tree->kinds()[1], "\xff"),
+        "module file with an unknown node kind accepted");
+  auto Ids = [](llvm::ArrayRef<std::uint32_t> Words) {
+    return llvm::StringRef(reinterpret_cast<const char *>(Words.data()),
+                           Words.size() * sizeof(std::uint32_t));
+  };
+  // Drops 'mut y := ...' from the top-level list; 'y = -y' still links to it.
+  auto Top = Tree->topLevel();
+  check(Top.size() == 4 &&
+            Corrupted(&Tree->extra()[Tree->topLevelIndex()],
+                      Ids({3, Top[0], Top[1], Top[3]})),
+        "module file with an unreachable declaration accepted");
+  // 'a + b' becomes 'a + a' through the same node.
+  auto Sum = static_cast<std::size_t>(
+      llvm::find(Tree->kinds(), rheo::NodeKind::Binary) -
+      Tree->kinds().begin());
+  check(Sum < Tree->size() &&
+            Corrupted(&Tree->data()[Sum].B, Ids({Tree->data()[Sum].A})),
+        "module file with a shared child accepted");
+}
+
+void testGlobalLocations() {
+  rheo::SourceManager SM;
+  auto A = SM.addFile("a.rheo", "x := 1\n");
+  auto B = SM.addFile("b.rheo", "y := 2\nz @\n");
+  const auto *FileB = SM.getFile(B);
+  check(FileB->getBase() > SM.getFile(A)->getBase() + 7,
+        "file ranges overlap");
+
+  // A lexer error in B carries only a global position.
+  rheo::DiagnosticEngine Diags;
+  rheo::IdentifierTable Idents;
+  rheo::Lexer Lex(*FileB, Diags);
+  auto Tokens = rheo::TokenBuffer::lex(Lex, Idents);
+  check(Diags.diagnostics().size() == 1, "expected one lexer error");
+  if (Diags.diagnostics().size() != 1)
+    return;
+  auto At = Diags.diagnostics()[0].Labels[0].Location.getStart();
+  auto Loc = SM.decompose(At);
+  check(Loc && Loc->File == B && Loc->Offset == 9,
+        "global position did not map back to its file");
+  auto Pos = SM.getLineCol(At);
+  check(Pos.Line == 2 && Pos.Col == 3, "wrong line/column for global position");
+  check(Tokens.start(0) == FileB->getBase() && Tokens.text(0) == "y",
+        "token buffer positions are not global");
+  auto End = Tokens.span(Tokens.size() - 1).getStart();
+  check(SM.decompose(End) && SM.decompose(End)->File == B,
+        "Eof position falls outside its file");
+
+  // Growing A, which is not the last file, moves it past B.
+  const auto &Edited = SM.applyEdit(A, {.Offset = 0, .RemovedLen = 0,
+                                        .Inserted = "w := 0\n"});
+  check(Edited.getBase() > FileB->getBase() &&
+            SM.decompose(Edited.getBase() + 3)->File == A &&
+            SM.decompose(FileB->getBase())->File == B,
+        "grown file was not moved to a fresh range");
+}
+
+} // namespace
+
+int main() {
+  testScanKernelsAgree();
+  testTokensViewSourceBuffer();
+  testLineTable();
+  testKeywords();
+  testTokenBuffer();
+  testParallelLex();
+  testRelex();
+  testResolveByAtom();
+  testShadowing();
+  testLexicalAddresses();
+  testFunctionBodies();
+  testVisitor();
+  testExpressions();
+  testParallelParse();
+  testDeferredBodies();
+  testReparse();
+  testUniquedTypes();
+  testASTStats();
+  testStreaming();
+  testParallelResolve();
+  testTypeInference();
+  testQueryEngine();
+  testIncrementalTypes();
+  testFlatAST();
+  testModuleFile();
+  testGlobalLocations();
+  return Failures == 0 ? 0 : 1;
 }